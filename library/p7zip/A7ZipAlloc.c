@@ -0,0 +1,130 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// A replacement of p7zip/C/Alloc.c.
+// MidAlloc and BigAlloc are macros of MyAlloc on unix,
+// so every dictionary window and model goes through here.
+
+#include "A7ZipAlloc.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include <Alloc.h>
+
+static A7ZipAllocFunc g_AllocFunc = NULL;
+static A7ZipFreeFunc g_FreeFunc = NULL;
+
+void A7Zip_SetAllocFuncs(A7ZipAllocFunc alloc_func, A7ZipFreeFunc free_func) {
+  g_AllocFunc = alloc_func;
+  g_FreeFunc = free_func;
+}
+
+void *MyAlloc(size_t size) {
+  if (size == 0) {
+    return NULL;
+  }
+  return g_AllocFunc != NULL ? g_AllocFunc(size) : malloc(size);
+}
+
+void MyFree(void *address) {
+  if (address == NULL) {
+    return;
+  }
+  if (g_FreeFunc != NULL) {
+    g_FreeFunc(address);
+  } else {
+    free(address);
+  }
+}
+
+static void *SzAlloc(void *p, size_t size) {
+  (void) p;
+  return MyAlloc(size);
+}
+
+static void SzFree(void *p, void *address) {
+  (void) p;
+  MyFree(address);
+}
+
+ISzAlloc g_Alloc = { SzAlloc, SzFree };
+ISzAlloc g_BigAlloc = { SzAlloc, SzFree };
+
+static A7ZipThreadCaptureFunc g_ThreadCaptureFunc = NULL;
+static A7ZipThreadEnterFunc g_ThreadEnterFunc = NULL;
+static A7ZipThreadReleaseFunc g_ThreadReleaseFunc = NULL;
+
+void A7Zip_SetThreadFuncs(
+    A7ZipThreadCaptureFunc capture_func,
+    A7ZipThreadEnterFunc enter_func,
+    A7ZipThreadReleaseFunc release_func
+) {
+  g_ThreadCaptureFunc = capture_func;
+  g_ThreadEnterFunc = enter_func;
+  g_ThreadReleaseFunc = release_func;
+}
+
+typedef struct {
+  void *(*start_routine)(void *);
+  void *arg;
+  void *state;
+} ThreadStart;
+
+static void ExitThread(void *state) {
+  g_ThreadEnterFunc(NULL);
+  g_ThreadReleaseFunc(state);
+}
+
+static void *RunThread(void *p) {
+  ThreadStart start = *(ThreadStart *) p;
+  void *result;
+  free(p);
+
+  g_ThreadEnterFunc(start.state);
+  pthread_cleanup_push(ExitThread, start.state);
+  result = start.start_routine(start.arg);
+  pthread_cleanup_pop(1);
+  return result;
+}
+
+int __real_pthread_create(pthread_t *thread, const pthread_attr_t *attr, void *(*start_routine)(void *), void *arg);
+
+// The threads of the multithreaded coders are created here
+int __wrap_pthread_create(pthread_t *thread, const pthread_attr_t *attr, void *(*start_routine)(void *), void *arg) {
+  void *state = g_ThreadCaptureFunc != NULL ? g_ThreadCaptureFunc() : NULL;
+  ThreadStart *start;
+  int result;
+  if (state == NULL) {
+    return __real_pthread_create(thread, attr, start_routine, arg);
+  }
+
+  start = (ThreadStart *) malloc(sizeof(ThreadStart));
+  if (start == NULL) {
+    g_ThreadReleaseFunc(state);
+    return EAGAIN;
+  }
+  start->start_routine = start_routine;
+  start->arg = arg;
+  start->state = state;
+  result = __real_pthread_create(thread, attr, RunThread, start);
+  if (result != 0) {
+    free(start);
+    g_ThreadReleaseFunc(state);
+  }
+  return result;
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __A7ZIP_ALLOC_H__
+#define __A7ZIP_ALLOC_H__
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void* (*A7ZipAllocFunc)(size_t size);
+typedef void (*A7ZipFreeFunc)(void* address);
+// Returns the state of the creating thread for the new thread, null for nothing
+typedef void* (*A7ZipThreadCaptureFunc)(void);
+// Called on the new thread with the state before it runs, and with null after it
+typedef void (*A7ZipThreadEnterFunc)(void* state);
+typedef void (*A7ZipThreadReleaseFunc)(void* state);
+
+// Routes MyAlloc, MyFree, g_Alloc and g_BigAlloc to the functions.
+// It must be called before p7zip allocates anything, and only once.
+void A7Zip_SetAllocFuncs(A7ZipAllocFunc alloc_func, A7ZipFreeFunc free_func);
+
+// Passes a state from the thread calling pthread_create in p7zip to the new thread,
+// p7zip is linked with --wrap=pthread_create. Call it before p7zip starts any thread.
+void A7Zip_SetThreadFuncs(
+    A7ZipThreadCaptureFunc capture_func,
+    A7ZipThreadEnterFunc enter_func,
+    A7ZipThreadReleaseFunc release_func
+);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__A7ZIP_ALLOC_H__
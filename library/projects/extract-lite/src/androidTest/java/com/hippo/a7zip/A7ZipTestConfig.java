@@ -18,6 +18,7 @@ package com.hippo.a7zip;
 
 class A7ZipTestConfig {
 
-  static String[] SUPPORTED_FORMATS = { "7z", "Rar", "Rar5", "zip" };
-  static String[] GET_STREAM_SUPPORTED_FORMATS = { };
+  static String[] SUPPORTED_FORMATS = { "7z", "Rar", "Rar5", "zip", "xz" };
+  static String[] GET_STREAM_SUPPORTED_FORMATS = { "zip" };
+  static String[] CREATE_SUPPORTED_FORMATS = { };
 }
@@ -18,6 +18,7 @@ package com.hippo.a7zip;
 
 class A7ZipTestConfig {
 
-  static String[] SUPPORTED_FORMATS = { "7z", "Rar", "Rar5", "zip", "tar", "wim", "Cpio" };
-  static String[] GET_STREAM_SUPPORTED_FORMATS = { "tar", "Cpio" };
+  static String[] SUPPORTED_FORMATS = { "7z", "Rar", "Rar5", "zip", "tar", "wim", "Cpio", "xz", "CramFS", "gzip" };
+  static String[] GET_STREAM_SUPPORTED_FORMATS = { "zip", "tar", "Cpio" };
+  static String[] CREATE_SUPPORTED_FORMATS = { };
 }
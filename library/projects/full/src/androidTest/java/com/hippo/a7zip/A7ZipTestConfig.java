@@ -0,0 +1,24 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package com.hippo.a7zip;
+
+class A7ZipTestConfig {
+
+  static String[] SUPPORTED_FORMATS = { "7z", "Rar", "Rar5", "zip", "tar", "wim", "Cpio", "xz", "CramFS", "gzip" };
+  static String[] GET_STREAM_SUPPORTED_FORMATS = { "zip", "tar", "Cpio" };
+  static String[] CREATE_SUPPORTED_FORMATS = { "7z", "zip" };
+}
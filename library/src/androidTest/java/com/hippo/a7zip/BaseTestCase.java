@@ -52,6 +52,19 @@ public class BaseTestCase {
     return of;
   }
 
+  protected static File createTempDir() throws IOException {
+    File dir = File.createTempFile("tempDir", "");
+    if (!dir.delete() || !dir.mkdir()) {
+      throw new IOException("Can't create the directory: " + dir.getPath());
+    }
+
+    synchronized (tempCopies) {
+      tempCopies.add(dir);
+    }
+
+    return dir;
+  }
+
   @AfterClass
   public static void clearTempCopies() {
     synchronized (tempCopies) {
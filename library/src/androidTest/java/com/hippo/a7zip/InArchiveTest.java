@@ -23,12 +23,26 @@ import static org.junit.Assert.fail;
 
 import android.support.annotation.NonNull;
 import java.io.ByteArrayOutputStream;
+import java.io.File;
+import java.io.FileInputStream;
+import java.io.FileOutputStream;
 import java.io.IOException;
 import java.io.InputStream;
 import java.io.UnsupportedEncodingException;
 import java.nio.charset.Charset;
+import java.security.MessageDigest;
+import java.security.NoSuchAlgorithmException;
 import java.util.Arrays;
 import java.util.List;
+import java.util.Locale;
+import java.util.Random;
+import java.util.concurrent.ArrayBlockingQueue;
+import java.util.concurrent.BlockingQueue;
+import java.util.concurrent.TimeUnit;
+import java.util.zip.CRC32;
+import java.util.zip.GZIPOutputStream;
+import java.util.zip.ZipEntry;
+import java.util.zip.ZipOutputStream;
 import org.apache.commons.io.IOUtils;
 import org.junit.Rule;
 import org.junit.Test;
@@ -397,6 +411,1044 @@ public class InArchiveTest extends BaseTestCase {
     testArchive("multi-volume.7z.001", "7z");
   }
 
+  @Test
+  public void testMaxOpenVolumesZip() throws IOException, ArchiveException {
+    checkFormat("zip");
+
+    byte[] expected;
+    try (InArchive archive = openInArchiveFromAsset("archive.zip")) {
+      ByteArrayOutputStream os = new ByteArrayOutputStream();
+      archive.extractEntry(indexOfEntry(archive, "folder/dump.txt"), os);
+      expected = os.toByteArray();
+    }
+
+    // Volumes are closed and reopened while extracting
+    InArchive.OpenOptions options = new InArchive.OpenOptions()
+        .setMaxOpenVolumes(2)
+        .setVolumePrefetchEnabled(true);
+    String name = "multi-volume.zip.001";
+    try (InArchive archive = InArchive.open(new FileSeekableInputStream(getAsset(name)),
+        null, null, name, new OpenVolumeInAssetCallback(), options)) {
+      for (int i = 0; i < 2; i++) {
+        ByteArrayOutputStream os = new ByteArrayOutputStream();
+        archive.extractEntry(indexOfEntry(archive, "folder/dump.txt"), os);
+        assertArrayEquals(expected, os.toByteArray());
+      }
+    }
+  }
+
+  @Test
+  public void testExtractTo7z() throws IOException, ArchiveException {
+    checkFormat("7z");
+    try (InArchive archive = openInArchiveFromAsset("archive.7z")) {
+      File dir = createTempDir();
+      archive.extractTo(dir, new InArchive.EntryFilter() {
+        @Override
+        public boolean accept(int index, @NonNull String path) {
+          return path.startsWith("folder");
+        }
+      });
+
+      ByteArrayOutputStream os = new ByteArrayOutputStream();
+      archive.extractEntry(indexOfEntry(archive, "folder/dump.txt"), os);
+      try (InputStream is = new FileInputStream(new File(dir, "folder/dump.txt"))) {
+        assertArrayEquals(os.toByteArray(), IOUtils.toByteArray(is));
+      }
+      assertEquals(0, new File(dir, "folder/empty.txt").length());
+      assertTrue(new File(dir, "folder/empty.txt").isFile());
+      assertTrue(!new File(dir, "dump.txt").exists());
+    }
+  }
+
+  @Test
+  public void testEntries7z() throws IOException, ArchiveException {
+    checkFormat("7z");
+    try (InArchive archive = openInArchiveFromAsset("archive.7z")) {
+      int skipped = indexOfEntry(archive, "dump.txt");
+      int read = indexOfEntry(archive, "folder/dump.txt");
+      ByteArrayOutputStream os = new ByteArrayOutputStream();
+      archive.extractEntry(read, os);
+      boolean found = false;
+
+      try (EntryIterator iterator = archive.entries()) {
+        EntryIterator.Entry entry;
+        while ((entry = iterator.next()) != null) {
+          if (entry.getIndex() == skipped) {
+            // Read a little and skip the rest
+            entry.getInputStream().read();
+          } else if (entry.getIndex() == read) {
+            assertArrayEquals(os.toByteArray(), IOUtils.toByteArray(entry.getInputStream()));
+            found = true;
+          }
+        }
+      }
+
+      assertTrue(found);
+    }
+  }
+
+  @Test
+  public void testIteratorRejectsSyncExtraction7z() throws IOException, ArchiveException {
+    checkFormat("7z");
+    try (InArchive archive = openInArchiveFromAsset("archive.7z")) {
+      int index = indexOfEntry(archive, "dump.txt");
+
+      try (EntryIterator iterator = archive.entries()) {
+        assertTrue(iterator.next() != null);
+
+        // The producer holds the archive, waiting for it here would never end
+        try {
+          archive.extractEntry(index, new ByteArrayOutputStream());
+          fail("Expected an ArchiveException to be thrown");
+        } catch (ArchiveException e) {
+          assertEquals("An entry iterator is running", e.getMessage());
+        }
+        try {
+          archive.getEntryStream(index);
+          fail("Expected an ArchiveException to be thrown");
+        } catch (ArchiveException e) {
+          assertEquals("An entry iterator is running", e.getMessage());
+        }
+        try {
+          archive.hashEntries(null, EntryDigest.CRC32);
+          fail("Expected an ArchiveException to be thrown");
+        } catch (ArchiveException e) {
+          assertEquals("An entry iterator is running", e.getMessage());
+        }
+        try {
+          archive.entries().close();
+          fail("Expected an ArchiveException to be thrown");
+        } catch (ArchiveException e) {
+          assertEquals("An entry iterator is running", e.getMessage());
+        }
+      }
+
+      // Closing the iterator releases the archive
+      assertEquals("dump", getContentByExtractingEntry(archive, index));
+    }
+  }
+
+  @Test
+  public void testExtractForward7z()throws IOException, ArchiveException {
+    checkFormat("7z");
+    try (InArchive archive = openInArchiveFromAsset("archive.7z")) {
+      int size = archive.getNumberOfEntries();
+      byte[][] contents = new byte[size][];
+      try (EntryIterator iterator = archive.entries()) {
+        EntryIterator.Entry entry;
+        while ((entry = iterator.next()) != null) {
+          contents[entry.getIndex()] = IOUtils.toByteArray(entry.getInputStream());
+        }
+      }
+
+      // Forward paging resumes the decoder, backward paging restarts it
+      for (int i = 0; i < size; i++) {
+        assertExtractedContent(archive, i, contents[i]);
+      }
+      for (int i = size - 1; i >= 0; i--) {
+        assertExtractedContent(archive, i, contents[i]);
+      }
+    }
+  }
+
+  private static void assertExtractedContent(InArchive archive, int index, byte[] expected) throws ArchiveException {
+    if (expected == null) {
+      // Directory
+      return;
+    }
+    ByteArrayOutputStream os = new ByteArrayOutputStream();
+    archive.extractEntry(index, os);
+    assertArrayEquals(expected, os.toByteArray());
+  }
+
+  @Test
+  public void testStoredEntryStreamZip() throws IOException, ArchiveException {
+    checkFormat("zip");
+
+    try (InArchive archive = openInArchiveFromAsset("archive.zip")) {
+      int index = indexOfEntry(archive, "folder/dump.txt");
+      try (InputStream stream = archive.getEntryStream(index)) {
+        assertTrue(stream instanceof SeekableInputStream);
+        SeekableInputStream seekable = (SeekableInputStream) stream;
+        assertEquals(4, seekable.size());
+        seekable.seek(2);
+        assertEquals("mp", IOUtils.toString(seekable, "UTF-8"));
+        seekable.seek(0);
+        assertEquals("dump", IOUtils.toString(seekable, "UTF-8"));
+      }
+    }
+  }
+
+  @Test
+  public void testZipDirectory() throws IOException, ArchiveException {
+    checkFormat("zip");
+
+    try (InArchive archive = openInArchiveFromAsset("archive.zip");
+         ZipDirectory directory = ZipDirectory.open(new FileSeekableInputStream(getAsset("archive.zip")), null)) {
+      int size = archive.getNumberOfEntries();
+      assertEquals(size, directory.getNumberOfEntries());
+
+      for (int i = 0; i < size; i++) {
+        String path = directory.getEntryPath(i);
+        int index = indexOfEntry(archive, path.endsWith("/") ? path.substring(0, path.length() - 1) : path);
+        assertEquals(archive.getEntryLongProperty(index, PropID.SIZE), directory.getEntrySize(i));
+        if (directory.isEntryDirectory(i)) {
+          continue;
+        }
+
+        ByteArrayOutputStream os = new ByteArrayOutputStream();
+        archive.extractEntry(index, os);
+        try (InArchive entry = directory.openEntry(i)) {
+          assertEquals(1, entry.getNumberOfEntries());
+          assertExtractedContent(entry, 0, os.toByteArray());
+        }
+      }
+    }
+  }
+
+  @Test
+  public void testEntryCache7z() throws IOException, ArchiveException {
+    checkFormat("7z");
+    File dir = createTempDir();
+    EntryCache.configure(1 << 20, dir, 1 << 20);
+    try (InArchive archive = openInArchiveFromAsset("archive.7z")) {
+      archive.setCacheKey("testEntryCache7z");
+      int index = indexOfEntry(archive, "folder/dump.txt");
+
+      ByteArrayOutputStream os = new ByteArrayOutputStream();
+      archive.extractEntry(index, os);
+      EntryCache.Stats before = EntryCache.getStats();
+
+      ByteArrayOutputStream cached = new ByteArrayOutputStream();
+      archive.extractEntry(index, cached);
+      assertArrayEquals(os.toByteArray(), cached.toByteArray());
+      assertArrayEquals(os.toByteArray(), IOUtils.toByteArray(archive.getEntryStream(index)));
+      assertEquals(before.memoryHits + 2, EntryCache.getStats().memoryHits);
+
+      // Served from the disk tier after the memory tier is dropped
+      EntryCache.configure(1, dir, 1 << 20);
+      EntryCache.configure(1 << 20, dir, 1 << 20);
+      cached = new ByteArrayOutputStream();
+      archive.extractEntry(index, cached);
+      assertArrayEquals(os.toByteArray(), cached.toByteArray());
+      assertEquals(before.diskHits + 1, EntryCache.getStats().diskHits);
+    } finally {
+      EntryCache.clear();
+      EntryCache.configure(0, null, 0);
+    }
+  }
+
+  @Test
+  public void testDigest7z() throws IOException, ArchiveException, NoSuchAlgorithmException {
+    checkFormat("7z");
+    try (InArchive archive = openInArchiveFromAsset("archive.7z")) {
+      int index = indexOfEntry(archive, "dump.txt");
+
+      ByteArrayOutputStream os = new ByteArrayOutputStream();
+      EntryDigest digest = archive.extractEntry(index, null, os, EntryDigest.CRC32 | EntryDigest.SHA256);
+      byte[] content = os.toByteArray();
+      byte[] sha256 = MessageDigest.getInstance("SHA-256").digest(content);
+      CRC32 crc32 = new CRC32();
+      crc32.update(content);
+
+      assertEquals(content.length, digest.getSize());
+      assertEquals((int) crc32.getValue(), digest.getCrc32());
+      assertArrayEquals(sha256, digest.getSha256());
+      assertEquals(null, digest.getSha1());
+
+      // Hash only
+      digest = archive.extractEntry(index, null, null, EntryDigest.SHA256);
+      assertArrayEquals(sha256, digest.getSha256());
+
+      EntryDigest[] digests = archive.hashEntries(null, EntryDigest.SHA256);
+      boolean found = false;
+      for (EntryDigest d : digests) {
+        if (d.getIndex() == index) {
+          assertArrayEquals(sha256, d.getSha256());
+          found = true;
+        }
+      }
+      assertTrue(found);
+    }
+  }
+
+  @Test
+  public void testHashEntriesSkipDirectories() throws IOException, ArchiveException {
+    checkFormat("7z");
+    try (InArchive archive = openInArchiveFromAsset("archive.7z")) {
+      int folder = indexOfEntry(archive, "folder");
+      assertTrue(archive.getEntryBooleanProperty(folder, PropID.IS_DIR));
+
+      EntryDigest[] digests = archive.hashEntries(null, EntryDigest.CRC32);
+      assertEquals(archive.getNumberOfEntries() - 1, digests.length);
+      for (EntryDigest digest : digests) {
+        assertTrue(digest.getIndex() != folder);
+      }
+
+      // Only the directory
+      digests = archive.hashEntries(new InArchive.EntryFilter() {
+        @Override
+        public boolean accept(int index, @NonNull String path) {
+          return "folder".equals(path);
+        }
+      }, EntryDigest.CRC32);
+      assertEquals(0, digests.length);
+    }
+  }
+
+  @Test
+  public void testEntryLayouts7z()throws IOException, ArchiveException {
+    checkFormat("7z");
+    try (InArchive archive = openInArchiveFromAsset("archive.7z")) {
+      EntryLayout[] layouts = archive.getEntryLayouts();
+      assertEquals(archive.getNumberOfEntries(), layouts.length);
+
+      EntryLayout layout1 = layouts[indexOfEntry(archive, "dump.txt")];
+      EntryLayout layout2 = layouts[indexOfEntry(archive, "folder/dump.txt")];
+      assertTrue(layout1.getBlock() >= 0);
+      assertEquals(layout1.getBlock(), layout2.getBlock());
+      assertTrue(layout1.getPosition() != layout2.getPosition());
+
+      int[] indices = new int[layouts.length];
+      for (int i = indices.length - 1; i >= 0; i--) {
+        indices[indices.length - 1 - i] = i;
+      }
+      int[] sorted = archive.sortByDecodeOrder(indices);
+      assertEquals(indices.length, sorted.length);
+      for (int i = 1; i < sorted.length; i++) {
+        EntryLayout previous = layouts[sorted[i - 1]];
+        EntryLayout current = layouts[sorted[i]];
+        if (previous.getBlock() >= 0 && previous.getBlock() == current.getBlock()) {
+          assertTrue(previous.getPosition() < current.getPosition());
+          assertTrue(previous.getBytesBefore() <= current.getBytesBefore());
+        }
+      }
+    }
+  }
+
+  @Test
+  public void testMemoryBudget7z() throws IOException, ArchiveException {
+    checkFormat("7z");
+    try (InArchive archive = openInArchiveFromAsset("archive.7z")) {
+      int index = indexOfEntry(archive, "dump.txt");
+
+      archive.setMemoryBudget(1);
+      try {
+        archive.extractEntry(index, new ByteArrayOutputStream());
+        fail("Expected an ArchiveException to be thrown");
+      } catch (ArchiveException e) {
+        assertEquals("Memory budget exceeded", e.getMessage());
+      }
+
+      archive.setMemoryBudget(0);
+      assertContent("dump.txt", getContentByExtractingEntry(archive, index));
+      assertTrue(archive.getPeakMemoryUsage() > 0);
+    }
+  }
+
+  @Test
+  public void testExtractLimits7z() throws IOException, ArchiveException {
+    checkFormat("7z");
+    try (InArchive archive = openInArchiveFromAsset("archive.7z")) {
+      int index = indexOfEntry(archive, "dump.txt");
+
+      archive.setExtractLimits(new ExtractLimits().setMaxMemory(1));
+      try {
+        archive.extractEntry(index, new ByteArrayOutputStream());
+        fail("Expected an ArchiveException to be thrown");
+      } catch (ArchiveException e) {
+        assertEquals("Memory limit exceeded", e.getMessage());
+      }
+
+      archive.setExtractLimits(new ExtractLimits()
+          .setMaxMemory(1024 * 1024 * 1024)
+          .setMaxOutputBytes(1024 * 1024 * 1024)
+          .setMaxRatio(1000)
+          .setMaxWallTime(60 * 1000)
+          .setMaxCpuTime(60 * 1000));
+      assertContent("dump.txt", getContentByExtractingEntry(archive, index));
+
+      archive.setExtractLimits(null);
+      assertContent("dump.txt", getContentByExtractingEntry(archive, index));
+    }
+  }
+
+  @Test
+  public void testWritePipeline7z() throws IOException, ArchiveException, NoSuchAlgorithmException {
+    checkFormat("7z");
+    try (InArchive archive = openInArchiveFromAsset("archive.7z")) {
+      int index = indexOfEntry(archive, "dump.txt");
+
+      // The smallest buffers, 4 KiB
+      archive.setWritePipeline(2, 1);
+      assertContent("dump.txt", getContentByExtractingEntry(archive, index));
+
+      ByteArrayOutputStream os = new ByteArrayOutputStream();
+      EntryDigest digest = archive.extractEntry(index, null, os, EntryDigest.SHA256);
+      byte[] content = os.toByteArray();
+      assertArrayEquals(MessageDigest.getInstance("SHA-256").digest(content), digest.getSha256());
+
+      archive.setWritePipeline(0, 0);
+      assertEquals(new String(content, "UTF-8"), getContentByExtractingEntry(archive, index));
+    }
+  }
+
+  @Test
+  public void testDecodeThreadsZip() throws IOException, ArchiveException {
+    checkFormat("zip");
+
+    byte[] content = getWordsContent(16 * 1024 * 1024);
+    File file = new File(createTempDir(), "big.zip");
+    try (ZipOutputStream zos = new ZipOutputStream(new FileOutputStream(file))) {
+      zos.putNextEntry(new ZipEntry("big.txt"));
+      zos.write(content);
+      zos.closeEntry();
+    }
+
+    assertDecodeThreadsInflate(file, content);
+  }
+
+  @Test
+  public void testDecodeThreadsGzip() throws IOException, ArchiveException {
+    checkFormat("gzip");
+
+    byte[] content = getWordsContent(16 * 1024 * 1024);
+    File file = new File(createTempDir(), "big.txt.gz");
+    try (GZIPOutputStream gos = new GZIPOutputStream(new FileOutputStream(file))) {
+      gos.write(content);
+    }
+
+    assertDecodeThreadsInflate(file, content);
+  }
+
+  // Words compress to about a third, big enough for threads
+  private static byte[] getWordsContent(int size) throws UnsupportedEncodingException {
+    Random random = new Random(0);
+    String[] words = new String[1000];
+    for (int i = 0; i < words.length; i++) {
+      char[] word = new char[2 + random.nextInt(8)];
+      for (int j = 0; j < word.length; j++) {
+        word[j] = (char) ('a' + random.nextInt(10));
+      }
+      words[i] = new String(word);
+    }
+    StringBuilder sb = new StringBuilder();
+    while (sb.length() < size) {
+      sb.append(words[random.nextInt(words.length)]).append(' ');
+    }
+    return sb.toString().getBytes("UTF-8");
+  }
+
+  private static void assertDecodeThreadsInflate(File file, byte[] content) throws ArchiveException {
+    try (InArchive archive = InArchive.open(file)) {
+      archive.setDecodeThreads(4);
+      ByteArrayOutputStream os = new ByteArrayOutputStream();
+      archive.extractEntry(0, os);
+      assertArrayEquals(content, os.toByteArray());
+      // About 5 MiB of deflate data in chunks of 1 MiB, the first one is decoded serially
+      long count = archive.getParallelChunkCount();
+      assertTrue(count >= 2);
+
+      archive.setDecodeThreads(0);
+      os.reset();
+      archive.extractEntry(0, os);
+      assertArrayEquals(content, os.toByteArray());
+      assertEquals(count, archive.getParallelChunkCount());
+    }
+  }
+
+  @Test
+  public void testDecodeThreadsXz() throws IOException, ArchiveException {
+    checkFormat("xz");
+
+    // Nine blocks, the last one is short
+    byte[] content = new byte[8 * 1024 * 1024 + 12345];
+    new Random(0).nextBytes(content);
+    File file = createXz(content, 1024 * 1024);
+
+    try (InArchive archive = InArchive.open(file)) {
+      archive.setDecodeThreads(0);
+      ByteArrayOutputStream os = new ByteArrayOutputStream();
+      archive.extractEntry(0, os);
+      byte[] single = os.toByteArray();
+      assertArrayEquals(content, single);
+      assertEquals(0, archive.getParallelChunkCount());
+
+      archive.setDecodeThreads(4);
+      os.reset();
+      archive.extractEntry(0, os);
+      assertArrayEquals(single, os.toByteArray());
+      assertEquals(9, archive.getParallelChunkCount());
+    }
+  }
+
+  @Test
+  public void testDecodeThreadsCorruptBlockXz() throws IOException, ArchiveException {
+    checkFormat("xz");
+
+    byte[] content = new byte[8 * 1024 * 1024];
+    new Random(0).nextBytes(content);
+    byte[] xz = createXzBytes(content, 1024 * 1024);
+    // A byte in the third block, its check fails
+    int offset = indexOf(xz, Arrays.copyOfRange(content, 2 * 1024 * 1024 + 5000, 2 * 1024 * 1024 + 5064));
+    xz[offset] ^= 1;
+    File file = writeTempFile("corrupt-block.xz", xz);
+
+    try (InArchive archive = InArchive.open(file)) {
+      archive.setDecodeThreads(4);
+      try {
+        archive.extractEntry(0, new ByteArrayOutputStream());
+        fail();
+      } catch (ArchiveException e) {
+        // Ignore
+      }
+      assertEquals(0, archive.getParallelChunkCount());
+
+      archive.setDecodeThreads(0);
+      try {
+        archive.extractEntry(0, new ByteArrayOutputStream());
+        fail();
+      } catch (ArchiveException e) {
+        // Ignore
+      }
+    }
+  }
+
+  @Test
+  public void testDecodeThreadsCorruptIndexXz() throws IOException, ArchiveException {
+    checkFormat("xz");
+
+    byte[] content = new byte[8 * 1024 * 1024];
+    new Random(0).nextBytes(content);
+    byte[] xz = createXzBytes(content, 1024 * 1024);
+    // The CRC32 of the index, before the stream footer
+    xz[xz.length - 12 - 4] ^= 1;
+    File file = writeTempFile("corrupt-index.xz", xz);
+
+    InArchive archive;
+    try {
+      archive = InArchive.open(file);
+    } catch (ArchiveException e) {
+      // The handler may refuse the broken index
+      return;
+    }
+    try {
+      // The broken index is never used for the threads, the handler finds it broken
+      archive.setDecodeThreads(4);
+      try {
+        archive.extractEntry(0, new ByteArrayOutputStream());
+        fail();
+      } catch (ArchiveException e) {
+        // Ignore
+      }
+      assertEquals(0, archive.getParallelChunkCount());
+    } finally {
+      archive.close();
+    }
+  }
+
+  @Test
+  public void testEntryStreamXz() throws IOException, ArchiveException {
+    checkFormat("xz");
+
+    int blockSize = 1024 * 1024;
+    byte[] content = new byte[8 * blockSize + 12345];
+    new Random(0).nextBytes(content);
+    File file = createXz(content, blockSize);
+
+    try (InArchive archive = InArchive.open(file);
+         InputStream stream = archive.getEntryStream(0)) {
+      assertTrue(stream instanceof SeekableInputStream);
+      SeekableInputStream seekable = (SeekableInputStream) stream;
+      assertEquals(content.length, seekable.size());
+
+      // Across a block boundary, and across whole blocks
+      assertSeekableRead(seekable, content, blockSize - 100, 200);
+      assertSeekableRead(seekable, content, 3 * blockSize - 10, 2 * blockSize + 20);
+
+      // Backward, into a block decoded before and into a new one
+      assertSeekableRead(seekable, content, 5 * blockSize + 7, 1000);
+      assertSeekableRead(seekable, content, 3 * blockSize, 1000);
+      assertSeekableRead(seekable, content, 1000, 1000);
+
+      // The short last block, and the end
+      assertSeekableRead(seekable, content, content.length - 10, 10);
+      assertEquals(-1, seekable.read());
+      seekable.seek(content.length - 10);
+      byte[] buffer = new byte[100];
+      assertEquals(10, IOUtils.read(seekable, buffer));
+      assertEquals(-1, seekable.read());
+      seekable.seek(content.length);
+      assertEquals(content.length, seekable.tell());
+      assertEquals(-1, seekable.read());
+
+      // All of it from the start
+      seekable.seek(0);
+      assertArrayEquals(content, IOUtils.toByteArray(seekable));
+    }
+  }
+
+  @Test
+  public void testDecodeThreadsCramfs() throws IOException, ArchiveException {
+    checkFormat("CramFS");
+
+    byte[] content = getCramfsBigContent();
+    try (InArchive archive = openInArchiveFromAsset("archive.cramfs")) {
+      int index = indexOfEntry(archive, "folder/big.bin");
+
+      archive.setDecodeThreads(0);
+      ByteArrayOutputStream os = new ByteArrayOutputStream();
+      archive.extractEntry(index, os);
+      assertArrayEquals(content, os.toByteArray());
+      assertEquals(0, archive.getParallelChunkCount());
+
+      // A page of 4 KiB each
+      archive.setDecodeThreads(4);
+      os.reset();
+      archive.extractEntry(index, os);
+      assertArrayEquals(content, os.toByteArray());
+      assertEquals((content.length + 4095) / 4096, archive.getParallelChunkCount());
+
+      assertContent("dump.txt", getContentByExtractingEntry(archive, indexOfEntry(archive, "dump.txt")));
+    }
+  }
+
+  @Test
+  public void testEntryStreamCramfs() throws IOException, ArchiveException {
+    checkFormat("CramFS");
+
+    byte[] content = getCramfsBigContent();
+    try (InArchive archive = openInArchiveFromAsset("archive.cramfs")) {
+      try (InputStream stream = archive.getEntryStream(indexOfEntry(archive, "folder/big.bin"))) {
+        assertTrue(stream instanceof SeekableInputStream);
+        SeekableInputStream seekable = (SeekableInputStream) stream;
+        assertEquals(content.length, seekable.size());
+
+        // Across a page boundary, into the holes and out of them
+        assertSeekableRead(seekable, content, 4096 - 10, 20);
+        assertSeekableRead(seekable, content, 299 * 4096 + 100, 3 * 4096);
+        assertSeekableRead(seekable, content, 315 * 4096 + 100, 2 * 4096);
+
+        // Backward, and the short last page
+        assertSeekableRead(seekable, content, 10, 100);
+        assertSeekableRead(seekable, content, content.length - 4, 4);
+        assertEquals(-1, seekable.read());
+      }
+
+      assertContent("dump.txt", getContentByGettingEntryStream(archive, indexOfEntry(archive, "dump.txt")));
+    }
+  }
+
+  @Test
+  public void testPageSizeCramfs() throws IOException, ArchiveException {
+    checkFormat("CramFS");
+
+    // The files of archive.cramfs, made by mkfs.cramfs -z -b 16384
+    byte[] content = getCramfsBigContent();
+    try (InArchive archive = openInArchiveFromAsset("archive-16k.cramfs")) {
+      int index = indexOfEntry(archive, "folder/big.bin");
+
+      // A page of 16 KiB each
+      archive.setDecodeThreads(4);
+      ByteArrayOutputStream os = new ByteArrayOutputStream();
+      archive.extractEntry(index, os);
+      assertArrayEquals(content, os.toByteArray());
+      assertEquals((content.length + 16383) / 16384, archive.getParallelChunkCount());
+
+      try (InputStream stream = archive.getEntryStream(index)) {
+        SeekableInputStream seekable = (SeekableInputStream) stream;
+        assertEquals(content.length, seekable.size());
+
+        // Across a page boundary, into the holes and the short last page
+        assertSeekableRead(seekable, content, 16384 - 10, 20);
+        assertSeekableRead(seekable, content, 299 * 4096 + 100, 3 * 4096);
+        assertSeekableRead(seekable, content, content.length - 4, 4);
+      }
+
+      assertContent("dump.txt", getContentByExtractingEntry(archive, indexOfEntry(archive, "dump.txt")));
+    }
+  }
+
+  @Test
+  public void testBufferPool7z() throws IOException, ArchiveException {
+    checkFormat("7z");
+    try (InArchive archive = openInArchiveFromAsset("archive.7z")) {
+      int index = indexOfEntry(archive, "dump.txt");
+
+      assertContent("dump.txt", getContentByExtractingEntry(archive, index));
+      assertTrue(archive.getBufferPoolRetainedBytes() > 0);
+      long hits = archive.getBufferPoolHits();
+
+      assertContent("dump.txt", getContentByExtractingEntry(archive, index));
+      assertTrue(archive.getBufferPoolHits() > hits);
+
+      archive.setBufferPoolCapacity(0);
+      assertEquals(0, archive.getBufferPoolRetainedBytes());
+    }
+  }
+
+  @Test
+  public void testBufferPoolBudget7z() throws IOException, ArchiveException {
+    checkFormat("7z");
+    try (InArchive archive = openInArchiveFromAsset("archive.7z")) {
+      int index = indexOfEntry(archive, "dump.txt");
+
+      assertContent("dump.txt", getContentByExtractingEntry(archive, index));
+      assertTrue(archive.getBufferPoolRetainedBytes() > 0);
+
+      // Pooled blocks are freed down to the new budget, and can't be reused over it
+      archive.setMemoryBudget(1);
+      assertEquals(0, archive.getBufferPoolRetainedBytes());
+      try {
+        archive.extractEntry(index, new ByteArrayOutputStream());
+        fail("Expected an ArchiveException to be thrown");
+      } catch (ArchiveException e) {
+        assertEquals("Memory budget exceeded", e.getMessage());
+      }
+
+      archive.setMemoryBudget(0);
+      assertContent("dump.txt", getContentByExtractingEntry(archive, index));
+    }
+  }
+
+  @Test
+  public void testTrace7z() throws IOException, ArchiveException {
+    checkFormat("7z");
+
+    Trace.reset();
+    Trace.setRecording(true);
+    try (InArchive archive = openInArchiveFromAsset("archive.7z")) {
+      assertContent("dump.txt", getContentByExtractingEntry(archive, indexOfEntry(archive, "dump.txt")));
+    } finally {
+      Trace.setRecording(false);
+    }
+
+    Trace.Counter[] counters = Trace.snapshot();
+    assertEquals(Trace.Stage.values().length, counters.length);
+    File file = new File(createTempDir(), "trace.json");
+
+    if (!Trace.isEnabled()) {
+      for (Trace.Counter counter : counters) {
+        assertEquals(0, counter.calls);
+      }
+      try {
+        Trace.exportChromeTrace(file);
+        fail("Expected an IllegalStateException to be thrown");
+      } catch (IllegalStateException e) {
+        // Ignore
+      }
+      return;
+    }
+
+    assertTrue(counters[Trace.Stage.OPEN_ARCHIVE.ordinal()].calls >= 1);
+    assertTrue(counters[Trace.Stage.IN_ARCHIVE_OPEN.ordinal()].calls >= 1);
+    assertTrue(counters[Trace.Stage.EXTRACT_ENTRY.ordinal()].calls >= 1);
+    assertTrue(counters[Trace.Stage.STREAM_READ.ordinal()].bytes > 0);
+
+    Trace.exportChromeTrace(file);
+    try (InputStream is = new FileInputStream(file)) {
+      String json = IOUtils.toString(is, "UTF-8");
+      assertTrue(json.startsWith("{"));
+      assertTrue(json.contains("\"traceEvents\""));
+    }
+
+    Trace.reset();
+    assertEquals(0, Trace.snapshot()[Trace.Stage.OPEN_ARCHIVE.ordinal()].calls);
+  }
+
+  @Test
+  public void testConcurrentOpen() throws InterruptedException {
+    // The formats and codecs are loaded by whichever open comes first
+    final String[] names = { "archive.7z", "archive.zip", "archive.rar", "archive.tar" };
+    final String[] formats = { "7z", "zip", "Rar", "tar" };
+    final BlockingQueue<Object> results = new ArrayBlockingQueue<>(names.length * 4);
+    Thread[] threads = new Thread[names.length * 4];
+    for (int i = 0; i < threads.length; i++) {
+      final int n = i % names.length;
+      threads[i] = new Thread() {
+        @Override
+        public void run() {
+          if (!supportedFormats.contains(formats[n])) {
+            results.add(formats[n]);
+            return;
+          }
+          try (InArchive archive = openInArchiveFromAsset(names[n])) {
+            assertTrue(archive.getNumberOfEntries() > 0);
+            results.add(archive.getFormatName());
+          } catch (Throwable e) {
+            results.add(e);
+          }
+        }
+      };
+    }
+    for (Thread thread : threads) {
+      thread.start();
+    }
+    for (int i = 0; i < threads.length; i++) {
+      Object result = results.poll(10, TimeUnit.SECONDS);
+      assertTrue(String.valueOf(result), Arrays.asList(formats).contains(result));
+    }
+    for (Thread thread : threads) {
+      thread.join();
+    }
+  }
+
+  @Test
+  public void testExtraModuleTar() throws IOException, ArchiveException {
+    checkFormat("tar");
+
+    // Core formats alone never offer the formats of the module, so tar can't open
+    InArchive.OpenOptions options = new InArchive.OpenOptions()
+        .setAllowedFormats("zip", "7z", "Rar", "Rar5")
+        .setFallbackEnabled(false);
+    try {
+      InArchive.open(new FileSeekableInputStream(getAsset("archive.tar")), null, null, null, null, options);
+      fail("Expected an ArchiveException to be thrown");
+    } catch (ArchiveException e) {
+      assertEquals("Unknown archive format", e.getMessage());
+    }
+
+    // No core format opens it, the formats of the module are tried
+    try (InArchive archive = openInArchiveFromAsset("archive.tar")) {
+      assertEquals("tar", archive.getFormatName());
+      assertContent("dump.txt", getContentByExtractingEntry(archive, indexOfEntry(archive, "dump.txt")));
+    }
+
+    // A preferred format of the module
+    options = new InArchive.OpenOptions().setPreferredFormat("tar");
+    try (InArchive archive = InArchive.open(new FileSeekableInputStream(getAsset("archive.tar")),
+        null, null, null, null, options)) {
+      assertEquals("tar", archive.getFormatName());
+    }
+
+    // Core formats still open after it
+    if (supportedFormats.contains("zip")) {
+      try (InArchive archive = openInArchiveFromAsset("archive.zip")) {
+        assertEquals("zip", archive.getFormatName());
+      }
+    }
+  }
+
+  @Test
+  public void testOpenOptionsZip() throws IOException, ArchiveException {
+    checkFormat("zip");
+
+    InArchive.OpenOptions options = new InArchive.OpenOptions()
+        .setPreferredFormat("ZIP")
+        .setAllowedFormats("zip")
+        .setFallbackEnabled(false);
+    try (InArchive archive = InArchive.open(new FileSeekableInputStream(getAsset("archive.zip")),
+        null, null, null, null, options)) {
+      assertEquals("zip", archive.getFormatName());
+    }
+
+    options = new InArchive.OpenOptions()
+        .setAllowedFormats("7z")
+        .setFallbackEnabled(false);
+    try {
+      InArchive.open(new FileSeekableInputStream(getAsset("archive.zip")), null, null, null, null, options);
+      fail("Expected an ArchiveException to be thrown");
+    } catch (ArchiveException e) {
+      assertEquals("Unknown archive format", e.getMessage());
+    }
+  }
+
+  @Test
+  public void testAsync7z() throws IOException, ArchiveException, InterruptedException {
+    checkFormat("7z");
+
+    BlockingQueue<Object> results = new ArrayBlockingQueue<>(1);
+    InArchive.openAsync(new FileSeekableInputStream(getAsset("archive.7z")),
+        null, null, null, null, null, ArchiveJob.PRIORITY_HIGH, new QueueCallback<InArchive>(results));
+    Object result = results.poll(10, TimeUnit.SECONDS);
+    assertTrue(String.valueOf(result), result instanceof InArchive);
+
+    try (InArchive archive = (InArchive) result) {
+      archive.listEntriesAsync(ArchiveJob.PRIORITY_NORMAL, new QueueCallback<String[]>(results));
+      result = results.poll(10, TimeUnit.SECONDS);
+      assertTrue(String.valueOf(result), result instanceof String[]);
+      assertTrue(Arrays.asList((String[]) result).contains("dump.txt"));
+
+      ByteArrayOutputStream os = new ByteArrayOutputStream();
+      archive.extractEntryAsync(indexOfEntry(archive, "dump.txt"), null, os,
+          ArchiveJob.PRIORITY_NORMAL, new QueueCallback<Void>(results));
+      assertEquals(QueueCallback.SUCCESS, results.poll(10, TimeUnit.SECONDS));
+      assertContent("dump.txt", os.toString("UTF-8"));
+
+      archive.testAsync(ArchiveJob.PRIORITY_LOW, new QueueCallback<Void>(results));
+      assertEquals(QueueCallback.SUCCESS, results.poll(10, TimeUnit.SECONDS));
+    }
+  }
+
+  private static class QueueCallback<T> implements ArchiveJob.Callback<T> {
+
+    static final Object SUCCESS = new Object();
+
+    private final BlockingQueue<Object> queue;
+
+    QueueCallback(BlockingQueue<Object> queue) {
+      this.queue = queue;
+    }
+
+    @Override
+    public void onSuccess(T result) {
+      queue.add(result != null ? result : SUCCESS);
+    }
+
+    @Override
+    public void onFailure(ArchiveException e) {
+      queue.add(e);
+    }
+  }
+
+  private static int indexOfEntry(InArchive archive, String path) {
+    int size = archive.getNumberOfEntries();
+    for (int i = 0; i < size; i++) {
+      if (path.equals(archive.getEntryPath(i))) {
+        return i;
+      }
+    }
+    fail("Can't find the entry: " + path);
+    return -1;
+  }
+
+  // folder/big.bin of archive.cramfs, made by mkfs.cramfs -z: pages of a line with
+  // the page number, 16 pages of zeros stored as holes, and a short tail
+  private static byte[] getCramfsBigContent() throws UnsupportedEncodingException {
+    int pageSize = 4096;
+    ByteArrayOutputStream os = new ByteArrayOutputStream();
+    for (int i = 0; i < 1100; i++) {
+      byte[] page = new byte[pageSize];
+      if (i < 300 || i >= 316) {
+        byte[] line = String.format(Locale.US, "page %06d ", i).getBytes("UTF-8");
+        for (int j = 0; j < pageSize; j++) {
+          page[j] = line[j % line.length];
+        }
+      }
+      os.write(page, 0, pageSize);
+    }
+    byte[] tail = "tail".getBytes("UTF-8");
+    os.write(tail, 0, tail.length);
+    return os.toByteArray();
+  }
+
+  private static void assertSeekableRead(SeekableInputStream stream, byte[] content, int position, int length)
+      throws IOException {
+    stream.seek(position);
+    assertEquals(position, stream.tell());
+    byte[] buffer = new byte[length];
+    IOUtils.readFully(stream, buffer);
+    assertArrayEquals(Arrays.copyOfRange(content, position, position + length), buffer);
+    assertEquals(position + length, stream.tell());
+  }
+
+  private static int indexOf(byte[] array, byte[] target) {
+    outer:
+    for (int i = 0; i <= array.length - target.length; i++) {
+      for (int j = 0; j < target.length; j++) {
+        if (array[i + j] != target[j]) {
+          continue outer;
+        }
+      }
+      return i;
+    }
+    fail("Can't find the bytes");
+    return -1;
+  }
+
+  private static File writeTempFile(String name, byte[] bytes) throws IOException {
+    File file = new File(createTempDir(), name);
+    try (FileOutputStream os = new FileOutputStream(file)) {
+      os.write(bytes);
+    }
+    return file;
+  }
+
+  private static File createXz(byte[] content, int blockSize) throws IOException {
+    return writeTempFile("blocks.xz", createXzBytes(content, blockSize));
+  }
+
+  // An xz stream of blocks of the block size with CRC32 checks, like xz -T0 writes.
+  // The LZMA2 chunks are stored uncompressed, so any content fits the same layout.
+  private static byte[] createXzBytes(byte[] content, int blockSize) throws IOException {
+    ByteArrayOutputStream os = new ByteArrayOutputStream();
+    byte[] flags = { 0x00, 0x01 };
+    os.write(new byte[] { (byte) 0xFD, '7', 'z', 'X', 'Z', 0x00 });
+    os.write(flags);
+    writeUInt32(os, crc32(flags, 0, flags.length));
+
+    ByteArrayOutputStream records = new ByteArrayOutputStream();
+    int blockCount = 0;
+    for (int offset = 0; offset < content.length; offset += blockSize) {
+      int size = Math.min(blockSize, content.length - offset);
+      // The header size, no sizes, LZMA2 of a 1 MiB dictionary and the padding
+      byte[] header = { 0x02, 0x00, 0x21, 0x01, 0x10, 0x00, 0x00, 0x00 };
+      os.write(header);
+      writeUInt32(os, crc32(header, 0, header.length));
+
+      int packedSize = 0;
+      for (int chunk = 0; chunk < size; chunk += 0x10000) {
+        int chunkSize = Math.min(0x10000, size - chunk);
+        // An uncompressed chunk, the first one resets the dictionary
+        os.write(chunk == 0 ? 0x01 : 0x02);
+        os.write((chunkSize - 1) >> 8);
+        os.write((chunkSize - 1) & 0xFF);
+        os.write(content, offset + chunk, chunkSize);
+        packedSize += 3 + chunkSize;
+      }
+      os.write(0x00);
+      packedSize += 1;
+      for (int i = packedSize; i % 4 != 0; i++) {
+        os.write(0x00);
+      }
+      writeUInt32(os, crc32(content, offset, size));
+
+      writeVarInt(records, header.length + 4 + packedSize + 4);
+      writeVarInt(records, size);
+      blockCount++;
+    }
+
+    ByteArrayOutputStream index = new ByteArrayOutputStream();
+    index.write(0x00);
+    writeVarInt(index, blockCount);
+    records.writeTo(index);
+    while (index.size() % 4 != 0) {
+      index.write(0x00);
+    }
+    byte[] indexBytes = index.toByteArray();
+    os.write(indexBytes);
+    writeUInt32(os, crc32(indexBytes, 0, indexBytes.length));
+
+    ByteArrayOutputStream footer = new ByteArrayOutputStream();
+    writeUInt32(footer, (indexBytes.length + 4) / 4 - 1);
+    footer.write(flags);
+    byte[] footerBytes = footer.toByteArray();
+    writeUInt32(os, crc32(footerBytes, 0, footerBytes.length));
+    os.write(footerBytes);
+    os.write(new byte[] { 'Y', 'Z' });
+    return os.toByteArray();
+  }
+
+  private static int crc32(byte[] bytes, int offset, int length) {
+    CRC32 crc = new CRC32();
+    crc.update(bytes, offset, length);
+    return (int) crc.getValue();
+  }
+
+  private static void writeUInt32(ByteArrayOutputStream os, int value) {
+    for (int i = 0; i < 4; i++) {
+      os.write(value >>> (i * 8));
+    }
+  }
+
+  private static void writeVarInt(ByteArrayOutputStream os, long value) {
+    while (value >= 0x80) {
+      os.write((int) (value & 0x7F) | 0x80);
+      value >>>= 7;
+    }
+    os.write((int) value);
+  }
+
   private InArchive openInArchiveFromAsset(String name) throws IOException, ArchiveException {
     return openInArchiveFromAsset(name, null, null);
   }
@@ -0,0 +1,199 @@
+/*
+ * Copyright 2018 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package com.hippo.a7zip;
+
+import static org.junit.Assert.assertArrayEquals;
+import static org.junit.Assert.assertEquals;
+import static org.junit.Assert.assertTrue;
+
+import java.io.ByteArrayInputStream;
+import java.io.ByteArrayOutputStream;
+import java.io.File;
+import java.io.IOException;
+import java.util.Arrays;
+import java.util.List;
+import java.util.Random;
+import org.junit.Rule;
+import org.junit.Test;
+import org.junit.rules.ExpectedException;
+
+public class OutArchiveTest extends BaseTestCase {
+
+  @Rule
+  public ExpectedException thrown = ExpectedException.none();
+
+  private List<String> createSupportedFormats = Arrays.asList(A7ZipTestConfig.CREATE_SUPPORTED_FORMATS);
+
+  private void checkCreateFormat(String format) {
+    if (!createSupportedFormats.contains(format)) {
+      thrown.expect(ArchiveException.class);
+      thrown.expectMessage("Not implemented");
+    }
+  }
+
+  @Test
+  public void testCreate7z() throws IOException, ArchiveException {
+    checkCreateFormat("7z");
+    testCreate("7z", null);
+  }
+
+  @Test
+  public void testCreateZip() throws IOException, ArchiveException {
+    checkCreateFormat("zip");
+    testCreate("zip", null);
+  }
+
+  @Test
+  public void testCreatePassword7z() throws IOException, ArchiveException {
+    checkCreateFormat("7z");
+    testCreate("7z", "password");
+  }
+
+  @Test
+  public void testCreatePasswordZip() throws IOException, ArchiveException {
+    checkCreateFormat("zip");
+    testCreate("zip", "password");
+  }
+
+  private void testCreate(String format, String password) throws IOException, ArchiveException {
+    // Compressible, and large enough to be split for the threads
+    byte[] large = new byte[4 * 1024 * 1024];
+    Random random = new Random(0);
+    for (int i = 0; i < large.length; i++) {
+      large[i] = (byte) ('a' + random.nextInt(4));
+    }
+    byte[] small = "dump".getBytes("UTF-8");
+    File dump = new File(createTempDir(), "dump.txt");
+    try (FileSeekableOutputStream os = new FileSeekableOutputStream(dump)) {
+      os.write(small);
+    }
+
+    File file = new File(createTempDir(), "archive." + format);
+    try (OutArchive archive = OutArchive.create(format)) {
+      archive.addFile("dump.txt", dump)
+          .addDirectory("folder", 0)
+          .addStream("folder/large.bin", new ByteArrayInputStream(large), large.length, 0);
+      archive.write(file, new OutArchive.Options().setLevel(1).setThreadCount(4), password);
+    }
+    assertTrue(file.length() < large.length);
+
+    try (InArchive archive = InArchive.open(new FileSeekableInputStream(file), null, password, null, null)) {
+      assertEquals(3, archive.getNumberOfEntries());
+      for (int i = 0; i < archive.getNumberOfEntries(); i++) {
+        String path = archive.getEntryPath(i);
+        if ("folder".equals(path) || "folder/".equals(path)) {
+          assertTrue(archive.getEntryBooleanProperty(i, PropID.IS_DIR));
+          continue;
+        }
+        ByteArrayOutputStream os = new ByteArrayOutputStream();
+        archive.extractEntry(i, os);
+        assertArrayEquals("dump.txt".equals(path) ? small : large, os.toByteArray());
+      }
+    }
+  }
+
+  @Test
+  public void testDecodeThreads7z() throws IOException, ArchiveException {
+    checkCreateFormat("7z");
+
+    // The LZMA2 encoder resets the dictionary every block of its threads
+    byte[] large = new byte[16 * 1024 * 1024];
+    Random random = new Random(0);
+    for (int i = 0; i < large.length; i++) {
+      large[i] = (byte) ('a' + random.nextInt(4));
+    }
+
+    byte[] small = "small".getBytes("UTF-8");
+
+    File file = new File(createTempDir(), "archive.7z");
+    try (OutArchive archive = OutArchive.create("7z")) {
+      archive.addStream("small.txt", new ByteArrayInputStream(small), small.length, 0)
+          .addStream("large.bin", new ByteArrayInputStream(large), large.length, 0);
+      archive.write(file, new OutArchive.Options().setLevel(1).setThreadCount(4).setMethod("LZMA2"), null);
+    }
+
+    try (InArchive archive = InArchive.open(file)) {
+      int smallIndex = "small.txt".equals(archive.getEntryPath(0)) ? 0 : 1;
+      int largeIndex = 1 - smallIndex;
+      archive.setDecodeThreads(4);
+
+      // The decoder is suspended after the small entry, the threads read beside it
+      ByteArrayOutputStream os = new ByteArrayOutputStream();
+      archive.extractEntry(smallIndex, os);
+      assertArrayEquals(small, os.toByteArray());
+      assertEquals(0, archive.getParallelChunkCount());
+
+      os.reset();
+      archive.extractEntry(largeIndex, os);
+      assertArrayEquals(large, os.toByteArray());
+      long count = archive.getParallelChunkCount();
+      assertTrue(count >= 2);
+
+      // The same bytes from the handler
+      archive.setDecodeThreads(0);
+      os.reset();
+      archive.extractEntry(largeIndex, os);
+      assertArrayEquals(large, os.toByteArray());
+      assertEquals(count, archive.getParallelChunkCount());
+    }
+  }
+
+  @Test
+  public void testUpdate7z() throws IOException, ArchiveException {
+    checkCreateFormat("7z");
+    testUpdate("7z");
+  }
+
+  @Test
+  public void testUpdateZip() throws IOException, ArchiveException {
+    checkCreateFormat("zip");
+    testUpdate("zip");
+  }
+
+  private void testUpdate(String format) throws IOException, ArchiveException {
+    byte[] kept = "kept".getBytes("UTF-8");
+    byte[] removed = "removed".getBytes("UTF-8");
+    byte[] added = "added".getBytes("UTF-8");
+
+    File source = new File(createTempDir(), "source." + format);
+    try (OutArchive archive = OutArchive.create(format)) {
+      archive.addStream("kept.txt", new ByteArrayInputStream(kept), kept.length, 0)
+          .addStream("removed.txt", new ByteArrayInputStream(removed), removed.length, 0);
+      archive.write(source, null, null);
+    }
+
+    File file = new File(createTempDir(), "archive." + format);
+    try (InArchive sourceArchive = InArchive.open(source);
+         OutArchive archive = OutArchive.update(sourceArchive)) {
+      int removedIndex = "removed.txt".equals(sourceArchive.getEntryPath(0)) ? 0 : 1;
+      assertTrue(archive.removeEntry(removedIndex));
+      archive.addStream("added.txt", new ByteArrayInputStream(added), added.length, 0);
+      archive.write(file, null, null);
+    }
+
+    try (InArchive archive = InArchive.open(file)) {
+      assertEquals(2, archive.getNumberOfEntries());
+      for (int i = 0; i < archive.getNumberOfEntries(); i++) {
+        String path = archive.getEntryPath(i);
+        assertTrue("kept.txt".equals(path) || "added.txt".equals(path));
+        ByteArrayOutputStream os = new ByteArrayOutputStream();
+        archive.extractEntry(i, os);
+        assertArrayEquals("kept.txt".equals(path) ? kept : added, os.toByteArray());
+      }
+    }
+  }
+}
@@ -0,0 +1,388 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Allocator.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <A7ZipAlloc.h>
+#include <Common/MyCom.h>
+
+#include "Log.h"
+#include "Utils.h"
+
+#ifdef LOG_TAG
+#  undef LOG_TAG
+#endif //LOG_TAG
+#define LOG_TAG "Allocator"
+
+// Blocks not smaller than it are mapped at huge page boundary
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+// Blocks not smaller than it are pooled, malloc is fast enough for smaller ones
+#define POOL_MIN_BLOCK_SIZE (64 * 1024)
+#define DEFAULT_POOL_CAPACITY (64 * 1024 * 1024)
+
+using namespace a7zip;
+
+struct BlockHeader {
+  Allocator* allocator;
+  size_t size;
+  // Not null if the block is mapped
+  void* map_address;
+  size_t map_size;
+};
+
+// Keep the block aligned as malloc does
+static const size_t BLOCK_HEADER_SIZE = (sizeof(BlockHeader) + 15) & ~static_cast<size_t>(15);
+
+namespace a7zip {
+
+struct Allocator::ScopeState {
+  CMyComPtr<Allocator> allocator;
+  std::atomic<UInt32> refused_count;
+  std::atomic<ULONG> ref_count;
+};
+
+}
+
+static thread_local Allocator::ScopeState* current_state = nullptr;
+
+static Allocator::ScopeState* AcquireState(Allocator::ScopeState* state) {
+  state->ref_count++;
+  return state;
+}
+
+static void ReleaseState(Allocator::ScopeState* state) {
+  if (--state->ref_count == 0) {
+    delete state;
+  }
+}
+
+static BlockHeader* AllocBlock(size_t size, bool huge_pages) {
+  if (size > SIZE_MAX - BLOCK_HEADER_SIZE - HUGE_PAGE_SIZE) {
+    return nullptr;
+  }
+
+#ifdef MADV_HUGEPAGE
+  if (huge_pages && size >= HUGE_PAGE_SIZE) {
+    // Map one more huge page to put the data at huge page boundary,
+    // the header lives in the normal page before it
+    size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t map_size = (size + BLOCK_HEADER_SIZE + HUGE_PAGE_SIZE + page_size - 1) & ~(page_size - 1);
+    void* map_address = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map_address != MAP_FAILED) {
+      uintptr_t data = (reinterpret_cast<uintptr_t>(map_address) + BLOCK_HEADER_SIZE + HUGE_PAGE_SIZE - 1) &
+          ~static_cast<uintptr_t>(HUGE_PAGE_SIZE - 1);
+      if (madvise(reinterpret_cast<void*>(data), size, MADV_HUGEPAGE) != 0) {
+        LOGD("Can't enable huge pages for %zu bytes", size);
+      }
+      BlockHeader* header = reinterpret_cast<BlockHeader*>(data - BLOCK_HEADER_SIZE);
+      header->map_address = map_address;
+      header->map_size = map_size;
+      return header;
+    }
+    // Fallback to malloc
+  }
+#endif
+
+  BlockHeader* header = static_cast<BlockHeader*>(malloc(BLOCK_HEADER_SIZE + size));
+  if (header != nullptr) {
+    header->map_address = nullptr;
+    header->map_size = 0;
+  }
+  return header;
+}
+
+static void FreeBlock(BlockHeader* header) {
+  if (header->map_address != nullptr) {
+    munmap(header->map_address, header->map_size);
+  } else {
+    free(header);
+  }
+}
+
+static inline void* BlockToData(BlockHeader* header) {
+  return reinterpret_cast<Byte*>(header) + BLOCK_HEADER_SIZE;
+}
+
+static inline BlockHeader* DataToBlock(void* data) {
+  return reinterpret_cast<BlockHeader*>(static_cast<Byte*>(data) - BLOCK_HEADER_SIZE);
+}
+
+Allocator::Allocator() :
+    ref_count(0),
+    budget(0),
+    huge_pages_enabled(true),
+    current_bytes(0),
+    peak_bytes(0),
+    pool_capacity(DEFAULT_POOL_CAPACITY),
+    pool_retained_bytes(0),
+    pool_hits(0),
+    pool_misses(0) { }
+
+Allocator::~Allocator() {
+  for (void* address : pool) {
+    FreeBlock(DataToBlock(address));
+  }
+  pool.clear();
+}
+
+ULONG Allocator::AddRef() {
+  return ++ref_count;
+}
+
+ULONG Allocator::Release() {
+  ULONG count = --ref_count;
+  if (count == 0) {
+    delete this;
+  }
+  return count;
+}
+
+void Allocator::SetBudget(UInt64 budget) {
+  this->budget = budget;
+  if (budget != 0) {
+    UInt64 used = current_bytes;
+    TrimPool(budget > used ? budget - used : 0);
+  }
+}
+
+void Allocator::SetHugePagesEnabled(bool enabled) {
+  this->huge_pages_enabled = enabled;
+}
+
+void Allocator::SetPoolCapacity(UInt64 capacity) {
+  {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    pool_capacity = capacity;
+  }
+  TrimPool(capacity);
+}
+
+UInt64 Allocator::GetCurrentBytes() {
+  return current_bytes;
+}
+
+UInt64 Allocator::GetPeakBytes() {
+  return peak_bytes;
+}
+
+UInt64 Allocator::GetPoolHits() {
+  return pool_hits;
+}
+
+UInt64 Allocator::GetPoolMisses() {
+  return pool_misses;
+}
+
+UInt64 Allocator::GetPoolRetainedBytes() {
+  return pool_retained_bytes;
+}
+
+void* Allocator::TakeFromPool(size_t size) {
+  std::lock_guard<std::mutex> lock(pool_mutex);
+
+  if (pool_capacity == 0) {
+    return nullptr;
+  }
+
+  // The newest block is the most likely to be warm
+  for (size_t i = pool.size(); i > 0; i--) {
+    void* address = pool[i - 1];
+    if (DataToBlock(address)->size == size) {
+      pool.erase(pool.begin() + (i - 1));
+      pool_retained_bytes -= size;
+      pool_hits++;
+      return address;
+    }
+  }
+
+  pool_misses++;
+  return nullptr;
+}
+
+bool Allocator::PutToPool(void* address) {
+  size_t size = DataToBlock(address)->size;
+  UInt64 capacity;
+
+  {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+
+    capacity = pool_capacity;
+    if (size > capacity) {
+      return false;
+    }
+
+    // Pooled blocks count in the budget too
+    UInt64 limit = budget;
+    if (limit != 0 && current_bytes + pool_retained_bytes > limit) {
+      return false;
+    }
+
+    pool.push_back(address);
+    pool_retained_bytes += size;
+  }
+
+  TrimPool(capacity);
+  return true;
+}
+
+void Allocator::TrimPool(UInt64 limit) {
+  std::lock_guard<std::mutex> lock(pool_mutex);
+
+  while (!pool.empty() && pool_retained_bytes > limit) {
+    BlockHeader* header = DataToBlock(pool.front());
+    pool.erase(pool.begin());
+    pool_retained_bytes -= header->size;
+    FreeBlock(header);
+  }
+}
+
+void* Allocator::Alloc(size_t size, std::atomic<UInt32>& refused_count) {
+  // Reserve the bytes before the allocation, so the budget is never overrun.
+  // Reused blocks are charged too, the budget may be lowered after they are pooled.
+  UInt64 limit = budget;
+  UInt64 current = current_bytes.load();
+  UInt64 next;
+  do {
+    next = current + size;
+    if (limit != 0 && next > limit) {
+      refused_count++;
+      LOGW("Refuse to allocate %zu bytes, %llu of %llu bytes are in use",
+           size, static_cast<unsigned long long>(current), static_cast<unsigned long long>(limit));
+      return nullptr;
+    }
+  } while (!current_bytes.compare_exchange_weak(current, next));
+
+  UInt64 peak = peak_bytes.load();
+  while (peak < next && !peak_bytes.compare_exchange_weak(peak, next)) { }
+
+  if (size >= POOL_MIN_BLOCK_SIZE) {
+    void* address = TakeFromPool(size);
+    if (address != nullptr) {
+      AddRef();
+      return address;
+    }
+  }
+
+  if (limit != 0 && current_bytes + pool_retained_bytes > limit) {
+    // Give pooled blocks back to the system for the new block
+    UInt64 used = current_bytes;
+    TrimPool(limit > used ? limit - used : 0);
+  }
+
+  BlockHeader* header = AllocBlock(size, huge_pages_enabled);
+  if (header == nullptr) {
+    current_bytes -= size;
+    return nullptr;
+  }
+
+  header->allocator = this;
+  header->size = size;
+  // Each block keeps the allocator alive
+  AddRef();
+  return BlockToData(header);
+}
+
+void Allocator::Free(void* address) {
+  BlockHeader* header = DataToBlock(address);
+  size_t size = header->size;
+  if (size < POOL_MIN_BLOCK_SIZE || !PutToPool(address)) {
+    FreeBlock(header);
+  }
+  current_bytes -= size;
+  // Pooled blocks don't keep the allocator alive,
+  // the destructor frees them
+  Release();
+}
+
+void* Allocator::AllocFunc(size_t size) {
+  ScopeState* state = current_state;
+  if (state != nullptr) {
+    return state->allocator->Alloc(size, state->refused_count);
+  }
+
+  BlockHeader* header = AllocBlock(size, false);
+  if (header == nullptr) {
+    return nullptr;
+  }
+  header->allocator = nullptr;
+  header->size = size;
+  return BlockToData(header);
+}
+
+void Allocator::FreeFunc(void* address) {
+  BlockHeader* header = DataToBlock(address);
+  if (header->allocator != nullptr) {
+    header->allocator->Free(address);
+  } else {
+    FreeBlock(header);
+  }
+}
+
+void Allocator::Initialize() {
+  static bool initialized = false;
+  if (initialized) {
+    return;
+  }
+
+  A7Zip_SetAllocFuncs(AllocFunc, FreeFunc);
+  A7Zip_SetThreadFuncs(CaptureThreadScope, EnterThreadScope, ReleaseThreadScope);
+
+  initialized = true;
+}
+
+void* Allocator::CaptureThreadScope() {
+  ScopeState* state = current_state;
+  return state != nullptr ? AcquireState(state) : nullptr;
+}
+
+void Allocator::EnterThreadScope(void* state) {
+  current_state = static_cast<ScopeState*>(state);
+}
+
+void Allocator::ReleaseThreadScope(void* state) {
+  ReleaseState(static_cast<ScopeState*>(state));
+}
+
+Allocator::Scope::Scope(Allocator* allocator) :
+    state(nullptr),
+    previous(current_state) {
+  if (allocator != nullptr) {
+    state = new ScopeState();
+    state->allocator = allocator;
+    state->refused_count = 0;
+    state->ref_count = 1;
+    current_state = state;
+  }
+}
+
+Allocator::Scope::~Scope() {
+  current_state = previous;
+  if (state != nullptr) {
+    ReleaseState(state);
+  }
+}
+
+HRESULT Allocator::Scope::GetBetterResult(HRESULT result) {
+  if (result != S_OK && state != nullptr && state->refused_count != 0) {
+    return E_MEMORY_BUDGET_EXCEEDED;
+  }
+  return result;
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __A7ZIP_ALLOCATOR_H__
+#define __A7ZIP_ALLOCATOR_H__
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+#include <Common/MyWindows.h>
+
+namespace a7zip {
+
+// Accounts the memory which p7zip allocates through MyAlloc, MidAlloc, BigAlloc,
+// g_Alloc and g_BigAlloc while an Allocator::Scope of it is alive on the thread.
+// Blocks remember their allocator, so they can be freed anywhere.
+// Freed big blocks are kept in a pool and handed out again for the same size,
+// so the dictionaries of the decoders aren't mapped and faulted in for every entry.
+// The threads p7zip starts in a scope, like the ones of the multithreaded coders,
+// run in the scope too. Other threads without a scope aren't accounted.
+class Allocator {
+ public:
+  Allocator();
+  ~Allocator();
+
+ public:
+  ULONG AddRef();
+  ULONG Release();
+
+  // 0 means unlimited, pooled blocks over the budget are freed
+  void SetBudget(UInt64 budget);
+  void SetHugePagesEnabled(bool enabled);
+  // 0 disables the pool
+  void SetPoolCapacity(UInt64 capacity);
+
+  UInt64 GetCurrentBytes();
+  UInt64 GetPeakBytes();
+
+  UInt64 GetPoolHits();
+  UInt64 GetPoolMisses();
+  UInt64 GetPoolRetainedBytes();
+
+ private:
+  // Counts a refusal to refused_count
+  void* Alloc(size_t size, std::atomic<UInt32>& refused_count);
+  void Free(void* address);
+
+  void* TakeFromPool(size_t size);
+  bool PutToPool(void* address);
+  // Frees pooled blocks, the oldest first, until the retained bytes are not bigger than the limit
+  void TrimPool(UInt64 limit);
+
+ private:
+  std::atomic<ULONG> ref_count;
+  std::atomic<UInt64> budget;
+  std::atomic<bool> huge_pages_enabled;
+  std::atomic<UInt64> current_bytes;
+  std::atomic<UInt64> peak_bytes;
+
+  std::mutex pool_mutex;
+  // The oldest is the first
+  std::vector<void*> pool;
+  UInt64 pool_capacity;
+  std::atomic<UInt64> pool_retained_bytes;
+  std::atomic<UInt64> pool_hits;
+  std::atomic<UInt64> pool_misses;
+
+ public:
+  // Installs the allocation functions into p7zip
+  static void Initialize();
+
+ private:
+  static void* AllocFunc(size_t size);
+  static void FreeFunc(void* address);
+  static void* CaptureThreadScope();
+  static void EnterThreadScope(void* state);
+  static void ReleaseThreadScope(void* state);
+
+ public:
+  // Shared by a scope and the p7zip threads started in it
+  struct ScopeState;
+
+  class Scope {
+   public:
+    Scope(Allocator* allocator);
+    ~Scope();
+
+   public:
+    // Returns E_MEMORY_BUDGET_EXCEEDED if the operation failed after an allocation
+    // of this scope is refused
+    HRESULT GetBetterResult(HRESULT result);
+
+   private:
+    ScopeState* state;
+    ScopeState* previous;
+  };
+};
+
+}
+
+#endif //__A7ZIP_ALLOCATOR_H__
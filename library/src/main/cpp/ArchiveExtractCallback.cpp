@@ -0,0 +1,203 @@
+/*
+ * Copyright 2018 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ArchiveExtractCallback.h"
+
+#include <ctime>
+
+#include "BlackHole.h"
+#include "Utils.h"
+
+// Small entries compress well, the ratio is meaningless for them
+#define RATIO_MIN_UNPACKED_BYTES (1024 * 1024)
+
+using namespace a7zip;
+
+static UInt64 GetThreadCpuTimeMs() {
+  struct timespec ts;
+  if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+    return 0;
+  }
+  return static_cast<UInt64>(ts.tv_sec) * 1000 + static_cast<UInt64>(ts.tv_nsec) / 1000000;
+}
+
+ArchiveExtractCallback::ArchiveExtractCallback(
+    UInt32 index,
+    BSTR password,
+    const CMyComPtr<ISequentialOutStream>& out_stream,
+    const std::atomic<bool>* cancelled
+) :
+    index(index),
+    password(::SysAllocString(password)),
+    out_stream(out_stream),
+    cancelled(cancelled),
+    has_asked_password(false),
+    start_cpu_time_ms(0),
+    limit_result(S_OK) {}
+
+ArchiveExtractCallback::~ArchiveExtractCallback() {
+  ::SysFreeString(password);
+}
+
+HRESULT ArchiveExtractCallback::SetTotal(UInt64 total) {
+  // Ignored
+  return S_OK;
+}
+
+HRESULT ArchiveExtractCallback::SetCompleted(const UInt64 *completeValue) {
+  // Handlers call it between blocks, it's the chance to stop
+  if (IsCancelled()) {
+    return E_ABORT;
+  }
+  return CheckTimeLimits();
+}
+
+HRESULT ArchiveExtractCallback::GetStream(
+    UInt32 index,
+    ISequentialOutStream** outStream,
+    Int32 askExtractMode
+) {
+  if (IsCancelled()) {
+    return E_ABORT;
+  }
+
+  // If it's not extract mode or the index is different, return a black hole to skip data
+  if (askExtractMode != NArchive::NExtract::NAskMode::kExtract || this->index != index) {
+    CMyComPtr<ISequentialOutStream> black_hole(new BlackHole());
+    *outStream = black_hole.Detach();
+    return S_OK;
+  }
+
+  if (out_stream == nullptr) {
+    return E_NO_OUT_STREAM;
+  }
+
+  CMyComPtr<ISequentialOutStream> steam_copy(out_stream);
+  *outStream = steam_copy.Detach();
+
+  return S_OK;
+}
+
+HRESULT ArchiveExtractCallback::PrepareOperation(Int32 askExtractMode) {
+  // Always return S_OK
+  return S_OK;
+}
+
+HRESULT ArchiveExtractCallback::SetOperationResult(Int32 opRes) {
+  // Stop extracting action if operation result is not OK
+  switch (opRes) {
+    case NArchive::NExtract::NOperationResult::kOK:
+      return S_OK;
+    case NArchive::NExtract::NOperationResult::kUnsupportedMethod:
+      return E_UNSUPPORTED_METHOD;
+    case NArchive::NExtract::NOperationResult::kDataError:
+      return E_DATA_ERROR;
+    case NArchive::NExtract::NOperationResult::kCRCError:
+      return E_CRC_ERROR;
+    case NArchive::NExtract::NOperationResult::kUnavailable:
+      return E_UNAVAILABLE;
+    case NArchive::NExtract::NOperationResult::kUnexpectedEnd:
+      return E_UNEXPECTED_END;
+    case NArchive::NExtract::NOperationResult::kDataAfterEnd:
+      return E_DATA_AFTER_END;
+    case NArchive::NExtract::NOperationResult::kIsNotArc:
+      return E_IS_NOT_ARC;
+    case NArchive::NExtract::NOperationResult::kHeadersError:
+      return E_HEADERS_ERROR;
+    case NArchive::NExtract::NOperationResult::kWrongPassword:
+      return E_WRONG_PASSWORD;
+    default:
+      return E_UNKNOWN_ERROR;
+  }
+}
+
+HRESULT ArchiveExtractCallback::CryptoGetTextPassword(BSTR* password) {
+  has_asked_password = true;
+  *password = ::SysAllocString(this->password);
+  return this->password != nullptr ? S_OK : E_NO_PASSWORD;
+}
+
+HRESULT ArchiveExtractCallback::SetRatioInfo(const UInt64* inSize, const UInt64* outSize) {
+  if (IsCancelled()) {
+    return E_ABORT;
+  }
+  // 0 packed bytes skips the ratio
+  return CheckLimits(inSize != nullptr ? *inSize : 0, outSize != nullptr ? *outSize : 0);
+}
+
+void ArchiveExtractCallback::SetLimits(const ExtractLimits& limits) {
+  this->limits = limits;
+  start_time = std::chrono::steady_clock::now();
+  cpu_thread = std::this_thread::get_id();
+  start_cpu_time_ms = GetThreadCpuTimeMs();
+  limit_result = S_OK;
+}
+
+HRESULT ArchiveExtractCallback::CheckLimits(UInt64 packed_bytes, UInt64 unpacked_bytes) {
+  if (limit_result != S_OK) {
+    return limit_result;
+  }
+
+  if (limits.max_output_bytes != 0 && unpacked_bytes > limits.max_output_bytes) {
+    limit_result = E_OUTPUT_LIMIT_EXCEEDED;
+  } else if (limits.max_ratio != 0 && packed_bytes != 0 && unpacked_bytes >= RATIO_MIN_UNPACKED_BYTES &&
+      unpacked_bytes / packed_bytes > limits.max_ratio) {
+    limit_result = E_RATIO_LIMIT_EXCEEDED;
+  } else {
+    return CheckTimeLimits();
+  }
+  return limit_result;
+}
+
+HRESULT ArchiveExtractCallback::CheckTimeLimits() {
+  if (limit_result != S_OK) {
+    return limit_result;
+  }
+
+  if (limits.max_wall_time_ms != 0) {
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start_time).count();
+    if (static_cast<UInt64>(elapsed) > limits.max_wall_time_ms) {
+      limit_result = E_TIME_LIMIT_EXCEEDED;
+      return limit_result;
+    }
+  }
+
+  // Only the thread which started the clock can read it
+  if (limits.max_cpu_time_ms != 0 && std::this_thread::get_id() == cpu_thread &&
+      GetThreadCpuTimeMs() - start_cpu_time_ms > limits.max_cpu_time_ms) {
+    limit_result = E_TIME_LIMIT_EXCEEDED;
+  }
+  return limit_result;
+}
+
+HRESULT ArchiveExtractCallback::GetBetterResult(HRESULT result) {
+  if (result == S_OK) {
+    return S_OK;
+  } else if (limit_result != S_OK) {
+    return limit_result;
+  } else if (IsCancelled()) {
+    return E_ABORT;
+  } else if (has_asked_password) {
+    if (password != nullptr) {
+      return E_WRONG_PASSWORD;
+    } else {
+      return E_NO_PASSWORD;
+    }
+  } else {
+    return result;
+  }
+}
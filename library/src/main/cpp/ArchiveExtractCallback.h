@@ -0,0 +1,119 @@
+/*
+ * Copyright 2018 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __A7ZIP_ARCHIVE_EXTRACT_CALLBACK_H__
+#define __A7ZIP_ARCHIVE_EXTRACT_CALLBACK_H__
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <include_windows/windows.h>
+#include <Common/MyCom.h>
+#include <7zip/Archive/IArchive.h>
+#include <7zip/ICoder.h>
+#include <7zip/IPassword.h>
+
+namespace a7zip {
+
+// The limits of one extraction, 0 means unlimited
+struct ExtractLimits {
+  // The bytes decoded, including the skipped ones
+  UInt64 max_output_bytes;
+  // Unpacked bytes per packed byte, checked after the first MiB
+  UInt32 max_ratio;
+  // Checked against the dictionaries in the methods of the entries before decoding
+  UInt64 max_memory;
+  UInt64 max_wall_time_ms;
+  // The CPU time of the thread which decodes
+  UInt64 max_cpu_time_ms;
+
+  ExtractLimits():
+      max_output_bytes(0),
+      max_ratio(0),
+      max_memory(0),
+      max_wall_time_ms(0),
+      max_cpu_time_ms(0) { }
+
+  bool IsEmpty() const {
+    return max_output_bytes == 0 && max_ratio == 0 && max_memory == 0 &&
+        max_wall_time_ms == 0 && max_cpu_time_ms == 0;
+  }
+};
+
+// Extracts the entry of the index to the out stream, other entries go to a black hole
+class ArchiveExtractCallback :
+    public IArchiveExtractCallback,
+    public ICryptoGetTextPassword,
+    public ICompressProgressInfo,
+    public CMyUnknownImp
+{
+ public:
+  ArchiveExtractCallback(
+      UInt32 index,
+      BSTR password,
+      const CMyComPtr<ISequentialOutStream>& out_stream,
+      const std::atomic<bool>* cancelled
+  );
+  virtual ~ArchiveExtractCallback();
+
+ public:
+  MY_UNKNOWN_IMP3(IArchiveExtractCallback, ICryptoGetTextPassword, ICompressProgressInfo)
+
+  STDMETHOD(SetTotal)(UInt64 total);
+  STDMETHOD(SetCompleted)(const UInt64 *completeValue);
+
+  STDMETHOD(GetStream)(UInt32 index, ISequentialOutStream** outStream, Int32 askExtractMode);
+  STDMETHOD(PrepareOperation)(Int32 askExtractMode);
+  STDMETHOD(SetOperationResult)(Int32 opRes);
+
+  STDMETHOD(CryptoGetTextPassword)(BSTR *password);
+
+  // Decoders report the packed and unpacked bytes of the extraction with it
+  STDMETHOD(SetRatioInfo)(const UInt64* inSize, const UInt64* outSize);
+
+  // The clocks start here, the CPU time is of the calling thread
+  void SetLimits(const ExtractLimits& limits);
+
+  HRESULT GetBetterResult(HRESULT result);
+
+ protected:
+  bool IsCancelled() { return cancelled != nullptr && cancelled->load(); }
+  const ExtractLimits& GetLimits() { return limits; }
+
+ private:
+  // Returns the error code of the exceeded limit
+  HRESULT CheckLimits(UInt64 packed_bytes, UInt64 unpacked_bytes);
+  HRESULT CheckTimeLimits();
+
+ private:
+  UInt32 index;
+  BSTR password;
+  CMyComPtr<ISequentialOutStream> out_stream;
+  const std::atomic<bool>* cancelled;
+  bool has_asked_password;
+
+  ExtractLimits limits;
+  std::chrono::steady_clock::time_point start_time;
+  std::thread::id cpu_thread;
+  UInt64 start_cpu_time_ms;
+  // Kept, the handler may turn it into a data error
+  HRESULT limit_result;
+};
+
+}
+
+#endif //__A7ZIP_ARCHIVE_EXTRACT_CALLBACK_H__
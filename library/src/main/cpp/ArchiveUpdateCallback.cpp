@@ -0,0 +1,276 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ArchiveUpdateCallback.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <Windows/PropVariant.h>
+
+#include "Log.h"
+#include "Utils.h"
+
+#ifdef LOG_TAG
+#  undef LOG_TAG
+#endif //LOG_TAG
+#define LOG_TAG "ArchiveUpdateCallback"
+
+#define ATTRIBUTE_DIRECTORY 0x10
+#define ATTRIBUTE_ARCHIVE 0x20
+
+using namespace a7zip;
+
+static const UInt64 FILE_TIME_OFFSET = (369 * 365 + 89) * 86400ULL * 10000000ULL;
+static const UInt64 FILE_TIME_MULTIPLE = 10000;
+
+namespace a7zip {
+
+// Reads the fd with pread, so a shared fd keeps its offset
+class FileInStream :
+    public IInStream,
+    public IStreamGetSize,
+    public CMyUnknownImp
+{
+ public:
+  FileInStream(int fd, bool owned) : fd(fd), owned(owned), position(0) { }
+  virtual ~FileInStream() {
+    if (owned) {
+      close(fd);
+    }
+  }
+
+ public:
+  MY_UNKNOWN_IMP2(IInStream, IStreamGetSize)
+
+  STDMETHOD(Read)(void* data, UInt32 size, UInt32* processedSize) {
+    if (processedSize != nullptr) {
+      *processedSize = 0;
+    }
+
+    ssize_t n;
+    do {
+      n = pread(fd, data, size, static_cast<off_t>(position));
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+      LOGE("Failed to read: %s", strerror(errno));
+      return E_IO_ERROR;
+    }
+
+    position += static_cast<UInt64>(n);
+    if (processedSize != nullptr) {
+      *processedSize = static_cast<UInt32>(n);
+    }
+    return S_OK;
+  }
+
+  STDMETHOD(Seek)(Int64 offset, UInt32 seekOrigin, UInt64* newPosition) {
+    Int64 new_position;
+    switch (seekOrigin) {
+      case STREAM_SEEK_SET:
+        new_position = offset;
+        break;
+      case STREAM_SEEK_CUR:
+        new_position = static_cast<Int64>(position) + offset;
+        break;
+      case STREAM_SEEK_END: {
+        UInt64 size;
+        RETURN_SAME_IF_NOT_ZERO(GetSize(&size));
+        new_position = static_cast<Int64>(size) + offset;
+        break;
+      }
+      default:
+        return E_INVALIDARG;
+    }
+    if (new_position < 0) {
+      return STG_E_INVALIDFUNCTION;
+    }
+
+    position = static_cast<UInt64>(new_position);
+    if (newPosition != nullptr) {
+      *newPosition = position;
+    }
+    return S_OK;
+  }
+
+  STDMETHOD(GetSize)(UInt64* size) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      LOGE("Failed to stat: %s", strerror(errno));
+      return E_IO_ERROR;
+    }
+    *size = static_cast<UInt64>(st.st_size);
+    return S_OK;
+  }
+
+ private:
+  int fd;
+  bool owned;
+  UInt64 position;
+};
+
+}
+
+ArchiveUpdateCallback::ArchiveUpdateCallback(
+    std::vector<OutEntry>& entries,
+    BSTR password,
+    const std::atomic<bool>* cancelled
+) :
+    entries(entries),
+    password(::SysAllocString(password)),
+    cancelled(cancelled),
+    stream_result(S_OK) { }
+
+ArchiveUpdateCallback::~ArchiveUpdateCallback() {
+  ::SysFreeString(password);
+}
+
+HRESULT ArchiveUpdateCallback::SetTotal(UInt64 total) {
+  // Ignored
+  return S_OK;
+}
+
+HRESULT ArchiveUpdateCallback::SetCompleted(const UInt64* completeValue) {
+  // Encoders call it between blocks, it's the chance to stop
+  return IsCancelled() ? E_ABORT : S_OK;
+}
+
+HRESULT ArchiveUpdateCallback::GetUpdateItemInfo(
+    UInt32 index,
+    Int32* newData,
+    Int32* newProps,
+    UInt32* indexInArchive
+) {
+  if (index >= entries.size()) {
+    return E_INVALIDARG;
+  }
+
+  // Kept entries are copied from the source as they are
+  bool is_new = entries[index].index_in_archive < 0;
+  if (newData != nullptr) *newData = is_new ? 1 : 0;
+  if (newProps != nullptr) *newProps = is_new ? 1 : 0;
+  if (indexInArchive != nullptr) *indexInArchive = static_cast<UInt32>(entries[index].index_in_archive);
+  return S_OK;
+}
+
+HRESULT ArchiveUpdateCallback::GetProperty(UInt32 index, PROPID propID, PROPVARIANT* value) {
+  if (index >= entries.size()) {
+    return E_INVALIDARG;
+  }
+  const OutEntry& entry = entries[index];
+
+  NWindows::NCOM::CPropVariant prop;
+  switch (propID) {
+    case kpidPath:
+      prop = entry.path.Ptr();
+      break;
+    case kpidIsDir:
+      prop = entry.is_dir;
+      break;
+    case kpidIsAnti:
+      prop = false;
+      break;
+    case kpidSize:
+      prop = entry.is_dir ? static_cast<UInt64>(0) : entry.size;
+      break;
+    case kpidAttrib:
+      prop = static_cast<UInt32>(entry.is_dir ? ATTRIBUTE_DIRECTORY : ATTRIBUTE_ARCHIVE);
+      break;
+    case kpidMTime:
+      if (entry.modified_time >= 0) {
+        UInt64 time = static_cast<UInt64>(entry.modified_time) * FILE_TIME_MULTIPLE + FILE_TIME_OFFSET;
+        FILETIME file_time;
+        file_time.dwLowDateTime = static_cast<DWORD>(time);
+        file_time.dwHighDateTime = static_cast<DWORD>(time >> 32);
+        prop = file_time;
+      }
+      break;
+    default:
+      break;
+  }
+  return prop.Detach(value);
+}
+
+HRESULT ArchiveUpdateCallback::GetStream(UInt32 index, ISequentialInStream** inStream) {
+  *inStream = nullptr;
+
+  if (IsCancelled()) {
+    return E_ABORT;
+  }
+  if (index >= entries.size()) {
+    return E_INVALIDARG;
+  }
+
+  OutEntry& entry = entries[index];
+  if (entry.is_dir) {
+    return S_OK;
+  }
+
+  if (!entry.file_path.IsEmpty()) {
+    int fd = open(entry.file_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      LOGE("Failed to open %s: %s", entry.file_path.Ptr(), strerror(errno));
+      stream_result = E_IO_ERROR;
+      return stream_result;
+    }
+    CMyComPtr<ISequentialInStream> stream(new FileInStream(fd, true));
+    *inStream = stream.Detach();
+  } else if (entry.fd >= 0) {
+    CMyComPtr<ISequentialInStream> stream(new FileInStream(entry.fd, false));
+    *inStream = stream.Detach();
+  } else if (entry.stream != nullptr) {
+    // The stream is read once, drop it so it's closed once the handler is done with it
+    *inStream = entry.stream.Detach();
+  } else {
+    stream_result = E_NO_IN_STREAM;
+    return stream_result;
+  }
+
+  return S_OK;
+}
+
+HRESULT ArchiveUpdateCallback::SetOperationResult(Int32 operationResult) {
+  return operationResult == NArchive::NUpdate::NOperationResult::kOK ? S_OK : E_FAIL;
+}
+
+HRESULT ArchiveUpdateCallback::CryptoGetTextPassword(BSTR* password) {
+  if (this->password == nullptr) {
+    return E_NO_PASSWORD;
+  }
+  *password = ::SysAllocString(this->password);
+  return S_OK;
+}
+
+HRESULT ArchiveUpdateCallback::CryptoGetTextPassword2(Int32* passwordIsDefined, BSTR* password) {
+  *passwordIsDefined = this->password != nullptr ? 1 : 0;
+  *password = ::SysAllocString(this->password);
+  return S_OK;
+}
+
+HRESULT ArchiveUpdateCallback::GetBetterResult(HRESULT result) {
+  if (result == S_OK) {
+    return S_OK;
+  } else if (IsCancelled()) {
+    return E_ABORT;
+  } else if (stream_result != S_OK) {
+    return stream_result;
+  } else {
+    return result;
+  }
+}
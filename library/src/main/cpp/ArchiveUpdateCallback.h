@@ -0,0 +1,78 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __A7ZIP_ARCHIVE_UPDATE_CALLBACK_H__
+#define __A7ZIP_ARCHIVE_UPDATE_CALLBACK_H__
+
+#include <atomic>
+#include <vector>
+
+#include <include_windows/windows.h>
+#include <Common/MyCom.h>
+#include <7zip/Archive/IArchive.h>
+#include <7zip/IPassword.h>
+
+#include "OutArchive.h"
+
+namespace a7zip {
+
+// Feeds the entries to IOutArchive::UpdateItems.
+// The entries of the source archive are copied by the handler.
+class ArchiveUpdateCallback :
+    public IArchiveUpdateCallback,
+    public ICryptoGetTextPassword,
+    public ICryptoGetTextPassword2,
+    public CMyUnknownImp
+{
+ public:
+  ArchiveUpdateCallback(
+      std::vector<OutEntry>& entries,
+      BSTR password,
+      const std::atomic<bool>* cancelled
+  );
+  virtual ~ArchiveUpdateCallback();
+
+ public:
+  MY_UNKNOWN_IMP3(IArchiveUpdateCallback, ICryptoGetTextPassword, ICryptoGetTextPassword2)
+
+  STDMETHOD(SetTotal)(UInt64 total);
+  STDMETHOD(SetCompleted)(const UInt64 *completeValue);
+
+  STDMETHOD(GetUpdateItemInfo)(UInt32 index, Int32* newData, Int32* newProps, UInt32* indexInArchive);
+  STDMETHOD(GetProperty)(UInt32 index, PROPID propID, PROPVARIANT* value);
+  STDMETHOD(GetStream)(UInt32 index, ISequentialInStream** inStream);
+  STDMETHOD(SetOperationResult)(Int32 operationResult);
+
+  // 7z asks it to decode the solid blocks which lose some entries
+  STDMETHOD(CryptoGetTextPassword)(BSTR* password);
+  STDMETHOD(CryptoGetTextPassword2)(Int32* passwordIsDefined, BSTR* password);
+
+  // The error of opening an entry is more useful than the one from the handler
+  HRESULT GetBetterResult(HRESULT result);
+
+ private:
+  bool IsCancelled() { return cancelled != nullptr && cancelled->load(); }
+
+ private:
+  std::vector<OutEntry>& entries;
+  BSTR password;
+  const std::atomic<bool>* cancelled;
+  HRESULT stream_result;
+};
+
+}
+
+#endif //__A7ZIP_ARCHIVE_UPDATE_CALLBACK_H__
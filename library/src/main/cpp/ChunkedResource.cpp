@@ -0,0 +1,222 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ChunkedResource.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "Utils.h"
+
+using namespace a7zip;
+
+namespace a7zip {
+
+// Keeps the chunk being read, it may be evicted from the cache of the resource
+class ChunkedInStream :
+    public IInStream,
+    public CMyUnknownImp
+{
+ public:
+  explicit ChunkedInStream(ChunkedResource* resource) :
+      resource(resource),
+      size(resource->GetSize()),
+      position(0),
+      current_index(0) { }
+
+ public:
+  MY_UNKNOWN_IMP2(ISequentialInStream, IInStream)
+
+  STDMETHOD(Read)(void* data, UInt32 size, UInt32* processedSize) {
+    if (processedSize != nullptr) {
+      *processedSize = 0;
+    }
+    if (size == 0 || position >= this->size) {
+      return S_OK;
+    }
+
+    size_t index = resource->FindChunk(position);
+    if (current == nullptr || current_index != index) {
+      current = nullptr;
+      RETURN_SAME_IF_NOT_ZERO(resource->GetChunk(index, current));
+      current_index = index;
+    }
+
+    // Only the rest of the chunk, the next read takes the next chunk
+    const IndependentChunk& chunk = resource->GetChunks()[index];
+    UInt64 chunk_position = position - chunk.offset;
+    UInt32 processed = static_cast<UInt32>(MIN(static_cast<UInt64>(size), chunk.size - chunk_position));
+    memcpy(data, current->Buf + static_cast<size_t>(chunk_position), processed);
+    position += processed;
+    if (processedSize != nullptr) {
+      *processedSize = processed;
+    }
+    return S_OK;
+  }
+
+  STDMETHOD(Seek)(Int64 offset, UInt32 seekOrigin, UInt64* newPosition) {
+    Int64 new_position;
+    switch (seekOrigin) {
+      case STREAM_SEEK_SET:
+        new_position = offset;
+        break;
+      case STREAM_SEEK_CUR:
+        new_position = static_cast<Int64>(position) + offset;
+        break;
+      case STREAM_SEEK_END:
+        new_position = static_cast<Int64>(size) + offset;
+        break;
+      default:
+        return E_INVALIDARG;
+    }
+    if (new_position < 0) {
+      return STG_E_INVALIDFUNCTION;
+    }
+
+    position = static_cast<UInt64>(new_position);
+    if (newPosition != nullptr) {
+      *newPosition = position;
+    }
+    return S_OK;
+  }
+
+ private:
+  CMyComPtr<ChunkedResource> resource;
+  UInt64 size;
+  UInt64 position;
+  CMyComPtr<CReferenceBuf> current;
+  size_t current_index;
+};
+
+}
+
+ChunkedResource::ChunkedResource(SharedInStream* stream, UInt64 cache_size) :
+    stream(stream->Clone()),
+    chunk_size(0),
+    cache_size(cache_size),
+    cached_bytes(0) { }
+
+void ChunkedResource::SetChunksLoaded() {
+  chunk_size = chunks.empty() ? 0 : chunks[0].size;
+  for (size_t i = 0; i < chunks.size() && chunk_size != 0; i++) {
+    if (chunks[i].offset != i * chunk_size || (chunks[i].size != chunk_size && i != chunks.size() - 1)) {
+      chunk_size = 0;
+    }
+  }
+}
+
+UInt64 ChunkedResource::GetSize() {
+  return chunks.empty() ? 0 : chunks.back().offset + chunks.back().size;
+}
+
+UInt64 ChunkedResource::GetMaxChunkSize() {
+  UInt64 max_size = 0;
+  for (const IndependentChunk& chunk : chunks) {
+    max_size = MAX(max_size, chunk.size);
+  }
+  return max_size;
+}
+
+HRESULT ChunkedResource::Extract(
+    UInt64 begin,
+    UInt64 end,
+    ISequentialOutStream* out_stream,
+    UInt32 thread_count,
+    Allocator* allocator,
+    const std::atomic<bool>* cancelled,
+    UInt32* crc
+) {
+  // The threads of the extraction move the position of their clone
+  CMyComPtr<IInStream> extract_stream(stream->Clone());
+  return ParallelChunks::Decode(
+      extract_stream, chunks, this, begin, end, out_stream, thread_count, allocator, cancelled, crc);
+}
+
+HRESULT ChunkedResource::OpenStream(IInStream** stream) {
+  CMyComPtr<IInStream> chunked_stream(new ChunkedInStream(this));
+  *stream = chunked_stream.Detach();
+  return S_OK;
+}
+
+size_t ChunkedResource::FindChunk(UInt64 position) {
+  if (chunk_size != 0) {
+    return static_cast<size_t>(position / chunk_size);
+  }
+  // The first chunk after the position, the chunk before it has the position
+  auto it = std::upper_bound(chunks.begin(), chunks.end(), position,
+      [](UInt64 value, const IndependentChunk& chunk) { return value < chunk.offset; });
+  return static_cast<size_t>(it - chunks.begin()) - 1;
+}
+
+HRESULT ChunkedResource::ReadPacked(const IndependentChunk& chunk, Byte* data) {
+  UInt64 offset = chunk.packed_offset;
+  size_t size = static_cast<size_t>(chunk.packed_size);
+  while (size != 0) {
+    UInt32 processed = 0;
+    RETURN_SAME_IF_NOT_ZERO(stream->ReadAt(offset, data, static_cast<UInt32>(MIN(size, static_cast<size_t>(UINT32_MAX))), &processed));
+    if (processed == 0) {
+      return E_UNEXPECTED_END;
+    }
+    offset += processed;
+    data += processed;
+    size -= processed;
+  }
+  return S_OK;
+}
+
+HRESULT ChunkedResource::GetChunk(size_t index, CMyComPtr<CReferenceBuf>& buffer) {
+  {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    auto it = cache_index.find(index);
+    if (it != cache_index.end()) {
+      cache.splice(cache.begin(), cache, it->second);
+      buffer = it->second->buffer;
+      return S_OK;
+    }
+  }
+
+  // Decoded without the lock, two streams may decode the same chunk at once
+  const IndependentChunk& chunk = chunks[index];
+  CByteBuffer packed(static_cast<size_t>(chunk.packed_size));
+  RETURN_SAME_IF_NOT_ZERO(ReadPacked(chunk, packed));
+  CMyComPtr<CReferenceBuf> decoded(new CReferenceBuf());
+  decoded->Buf.Alloc(static_cast<size_t>(MAX(chunk.size, static_cast<UInt64>(1))));
+  RETURN_SAME_IF_NOT_ZERO(DecodeChunk(index, chunk, packed, decoded->Buf));
+
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  auto it = cache_index.find(index);
+  if (it != cache_index.end()) {
+    // The other stream cached it first, share its buffer
+    cache.splice(cache.begin(), cache, it->second);
+    buffer = it->second->buffer;
+    return S_OK;
+  }
+  if (chunk.size <= cache_size) {
+    CachedChunk cached;
+    cached.index = index;
+    cached.buffer = decoded;
+    cache.push_front(cached);
+    cache_index[index] = cache.begin();
+    cached_bytes += chunk.size;
+    while (cached_bytes > cache_size) {
+      cached_bytes -= chunks[cache.back().index].size;
+      cache_index.erase(cache.back().index);
+      cache.pop_back();
+    }
+  }
+  buffer = decoded;
+  return S_OK;
+}
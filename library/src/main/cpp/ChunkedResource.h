@@ -0,0 +1,112 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __A7ZIP_CHUNKED_RESOURCE_H__
+#define __A7ZIP_CHUNKED_RESOURCE_H__
+
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <include_windows/windows.h>
+#include <Common/MyCom.h>
+#include <7zip/IStream.h>
+#include <7zip/Common/StreamObjects.h>
+
+#include "Allocator.h"
+#include "ParallelChunks.h"
+#include "SharedInStream.h"
+
+namespace a7zip {
+
+// Data stored as independently compressed chunks with a table of them, like
+// the blocks of xz files, WIM resources, DMG partitions, and the files of SquashFS
+// and CramFS. A format fills the chunks and decodes one chunk, the resource
+// extracts the chunks with threads and serves seekable streams of the data.
+//
+// A read of the streams decodes only the chunk it falls in. The chunk is found
+// by a division if the chunks have the same size, or a binary search.
+// The decoded chunks are kept for all streams of the resource, the most recent
+// ones up to the cache size.
+class ChunkedResource :
+    public IUnknown,
+    public CMyUnknownImp,
+    public ChunkCodec
+{
+ public:
+  MY_UNKNOWN_IMP
+
+  const std::vector<IndependentChunk>& GetChunks() { return chunks; }
+  // The unpacked size
+  UInt64 GetSize();
+  UInt64 GetMaxChunkSize();
+
+  // Writes the unpacked bytes [begin, end) with the threads, see ParallelChunks::Decode
+  HRESULT Extract(
+      UInt64 begin,
+      UInt64 end,
+      ISequentialOutStream* out_stream,
+      UInt32 thread_count,
+      Allocator* allocator,
+      const std::atomic<bool>* cancelled,
+      UInt32* crc
+  );
+  // A seekable stream of the unpacked data
+  HRESULT OpenStream(IInStream** stream);
+
+  // Returns the chunk the position falls in, the position must be less than the size
+  size_t FindChunk(UInt64 position);
+  // Returns the decoded chunk from the cache, or decodes it and caches it. Thread-safe.
+  HRESULT GetChunk(size_t index, CMyComPtr<CReferenceBuf>& buffer);
+
+ protected:
+  ChunkedResource(SharedInStream* stream, UInt64 cache_size);
+
+  // Call it after the chunks are filled
+  void SetChunksLoaded();
+
+ protected:
+  // A clone for the resource
+  CMyComPtr<SharedInStream> stream;
+  // The chunks in order, covering the unpacked data
+  std::vector<IndependentChunk> chunks;
+
+ private:
+  HRESULT ReadPacked(const IndependentChunk& chunk, Byte* data);
+
+ private:
+  struct CachedChunk {
+    size_t index;
+    CMyComPtr<CReferenceBuf> buffer;
+  };
+
+  // 0 if the chunks don't have the same size
+  UInt64 chunk_size;
+
+  std::mutex cache_mutex;
+  UInt64 cache_size;
+  UInt64 cached_bytes;
+  // The most recent first
+  std::list<CachedChunk> cache;
+  // The chunks in the cache by index
+  std::unordered_map<size_t, std::list<CachedChunk>::iterator> cache_index;
+};
+
+}
+
+#endif //__A7ZIP_CHUNKED_RESOURCE_H__
@@ -0,0 +1,382 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "CramfsImage.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include <7zip/Common/StreamObjects.h>
+#include <7zip/Compress/DeflateDecoder.h>
+
+#include "Log.h"
+#include "Utils.h"
+
+#ifdef LOG_TAG
+#  undef LOG_TAG
+#endif //LOG_TAG
+#define LOG_TAG "CramfsImage"
+
+#define CRAMFS_MAGIC 0x28CD3D45
+// The superblock follows the boot code of padded images
+#define PADDED_SUPER_OFFSET 512
+#define SUPER_SIZE 76
+#define ROOT_INODE_OFFSET 64
+#define INODE_SIZE 12
+#define SIGNATURE_OFFSET 16
+
+#define FLAG_FSID_VERSION_2 0x00000001
+#define FLAG_SORTED_DIRS 0x00000002
+#define FLAG_HOLES 0x00000100
+#define FLAG_WRONG_SIGNATURE 0x00000200
+#define FLAG_SHIFTED_ROOT_OFFSET 0x00000400
+#define SUPPORTED_FLAGS (FLAG_FSID_VERSION_2 | FLAG_SORTED_DIRS | FLAG_HOLES | \
+    FLAG_WRONG_SIGNATURE | FLAG_SHIFTED_ROOT_OFFSET)
+
+#define MODE_TYPE_MASK 0170000
+#define MODE_DIRECTORY 0040000
+#define MODE_REGULAR 0100000
+#define MODE_SYMLINK 0120000
+
+// A page compressed by zlib is a little bigger at most
+#define MAX_PACKED_PAGE_SIZE(page_size) (2 * static_cast<UInt64>(page_size))
+// The data of a file starts at 4 bytes
+#define DATA_ALIGNMENT 4
+#define ZLIB_HEADER_SIZE 2
+#define ZLIB_FOOTER_SIZE 4
+// Deeper directories are likely broken
+#define MAX_DEPTH 128
+// The decoded pages kept for the streams of a file
+#define FILE_CACHE_SIZE (4 << 20)
+
+using namespace a7zip;
+
+// The page sizes of Linux, the first one is the most common
+static const UInt32 PAGE_SIZES[] = { 4096, 8192, 16384, 32768, 65536 };
+
+static const char SIGNATURE[16] = { 'C', 'o', 'm', 'p', 'r', 'e', 's', 's', 'e', 'd', ' ', 'R', 'O', 'M', 'F', 'S' };
+
+static UInt32 GetUInt32(const Byte* p) {
+  return static_cast<UInt32>(p[0]) | (static_cast<UInt32>(p[1]) << 8) |
+      (static_cast<UInt32>(p[2]) << 16) | (static_cast<UInt32>(p[3]) << 24);
+}
+
+static UInt32 GetBeUInt32(const Byte* p) {
+  return (static_cast<UInt32>(p[0]) << 24) | (static_cast<UInt32>(p[1]) << 16) |
+      (static_cast<UInt32>(p[2]) << 8) | static_cast<UInt32>(p[3]);
+}
+
+static UInt32 Adler32(const Byte* data, size_t size) {
+  UInt32 a = 1;
+  UInt32 b = 0;
+  while (size != 0) {
+    // The sums can't overflow in 5552 bytes
+    size_t n = MIN(size, static_cast<size_t>(5552));
+    size -= n;
+    for (; n != 0; n--) {
+      a += *data++;
+      b += a;
+    }
+    a %= 65521;
+    b %= 65521;
+  }
+  return (b << 16) | a;
+}
+
+static HRESULT ReadFully(SharedInStream* stream, UInt64 offset, Byte* data, size_t size) {
+  while (size != 0) {
+    UInt32 processed = 0;
+    RETURN_SAME_IF_NOT_ZERO(stream->ReadAt(offset, data, static_cast<UInt32>(MIN(size, static_cast<size_t>(UINT32_MAX))), &processed));
+    if (processed == 0) {
+      return E_UNEXPECTED_END;
+    }
+    offset += processed;
+    data += processed;
+    size -= processed;
+  }
+  return S_OK;
+}
+
+namespace a7zip {
+
+// A regular file, the chunks are its pages
+class CramfsFile : public ChunkedResource {
+ public:
+  CramfsFile(SharedInStream* stream, std::vector<IndependentChunk>& pages) :
+      ChunkedResource(stream, FILE_CACHE_SIZE) {
+    chunks.swap(pages);
+    SetChunksLoaded();
+  }
+
+  HRESULT DecodeChunk(size_t, const IndependentChunk& chunk, const Byte* packed, Byte* data) {
+    size_t size = static_cast<size_t>(chunk.size);
+    size_t packed_size = static_cast<size_t>(chunk.packed_size);
+    if (packed_size == 0) {
+      // A hole
+      memset(data, 0, size);
+      return S_OK;
+    }
+
+    // The zlib header, the deflate stream and the Adler-32 of the page
+    if (packed_size < ZLIB_HEADER_SIZE + ZLIB_FOOTER_SIZE || (packed[0] & 0x0F) != 8 ||
+        (packed[1] & 0x20) != 0 || ((packed[0] << 8) | packed[1]) % 31 != 0) {
+      return E_DATA_ERROR;
+    }
+
+    CBufInStream* in_stream_spec = new CBufInStream();
+    CMyComPtr<ISequentialInStream> in_stream(in_stream_spec);
+    in_stream_spec->Init(packed + ZLIB_HEADER_SIZE, packed_size - ZLIB_HEADER_SIZE - ZLIB_FOOTER_SIZE);
+    CBufPtrSeqOutStream* out_stream_spec = new CBufPtrSeqOutStream();
+    CMyComPtr<ISequentialOutStream> out_stream(out_stream_spec);
+    out_stream_spec->Init(data, size);
+
+    CMyComPtr<ICompressCoder> decoder(new NCompress::NDeflate::NDecoder::CCOMCoder());
+    UInt64 out_size = chunk.size;
+    HRESULT result = decoder->Code(in_stream, out_stream, nullptr, &out_size, nullptr);
+    if (result == S_FALSE) {
+      return E_DATA_ERROR;
+    }
+    RETURN_SAME_IF_NOT_ZERO(result);
+
+    if (out_stream_spec->GetPos() != size ||
+        Adler32(data, size) != GetBeUInt32(packed + packed_size - ZLIB_FOOTER_SIZE)) {
+      return E_DATA_ERROR;
+    }
+    return S_OK;
+  }
+};
+
+}
+
+CramfsImage::CramfsImage(SharedInStream* stream) :
+    stream(stream->Clone()),
+    image_size(0),
+    directory_bytes(0),
+    page_size(0) { }
+
+HRESULT CramfsImage::ReadDirectory(const std::string& prefix, UInt32 offset, UInt32 size, int depth) {
+  // A directory is listed once in an image, more bytes than the image mean loops
+  directory_bytes += size;
+  if (depth > MAX_DEPTH || directory_bytes > image_size || static_cast<UInt64>(offset) + size > image_size) {
+    return S_FALSE;
+  }
+
+  std::vector<Byte> entries(size);
+  RETURN_SAME_IF_NOT_ZERO(ReadFully(stream, offset, entries.data(), entries.size()));
+
+  size_t position = 0;
+  while (position < entries.size()) {
+    if (entries.size() - position < INODE_SIZE) {
+      return S_FALSE;
+    }
+    const Byte* inode = entries.data() + position;
+    UInt32 mode = GetUInt32(inode) & 0xFFFF;
+    UInt32 entry_size = GetUInt32(inode + 4) & 0xFFFFFF;
+    UInt32 name_size = (GetUInt32(inode + 8) & 0x3F) * 4;
+    UInt32 entry_offset = (GetUInt32(inode + 8) >> 6) * 4;
+    position += INODE_SIZE;
+    if (name_size == 0 || entries.size() - position < name_size) {
+      return S_FALSE;
+    }
+
+    // The name is padded with zeros
+    const char* name = reinterpret_cast<const char*>(entries.data() + position);
+    size_t name_length = strnlen(name, name_size);
+    position += name_size;
+    if (name_length == 0 || memchr(name, '/', name_length) != nullptr ||
+        (name_length == 1 && name[0] == '.') || (name_length == 2 && name[0] == '.' && name[1] == '.')) {
+      return S_FALSE;
+    }
+    std::string path = prefix + std::string(name, name_length);
+
+    if ((mode & MODE_TYPE_MASK) == MODE_DIRECTORY) {
+      if (entry_size != 0) {
+        data_starts.push_back(entry_offset);
+        RETURN_SAME_IF_NOT_ZERO(ReadDirectory(path + '/', entry_offset, entry_size, depth + 1));
+      }
+    } else if ((mode & MODE_TYPE_MASK) == MODE_REGULAR) {
+      File file;
+      file.offset = entry_offset;
+      file.size = entry_size;
+      files[path] = file;
+      if (entry_size != 0) {
+        data_starts.push_back(entry_offset);
+      }
+    } else if ((mode & MODE_TYPE_MASK) == MODE_SYMLINK) {
+      // The target is stored like the data of a file
+      if (entry_size != 0) {
+        data_starts.push_back(entry_offset);
+      }
+    }
+  }
+  return S_OK;
+}
+
+HRESULT CramfsImage::Load() {
+  UInt64 stream_size;
+  RETURN_SAME_IF_NOT_ZERO(stream->Seek(0, STREAM_SEEK_END, &stream_size));
+
+  Byte super[SUPER_SIZE];
+  UInt64 super_offset = 0;
+  if (stream_size < SUPER_SIZE) {
+    return S_FALSE;
+  }
+  RETURN_SAME_IF_NOT_ZERO(ReadFully(stream, 0, super, sizeof(super)));
+  if (GetUInt32(super) != CRAMFS_MAGIC) {
+    super_offset = PADDED_SUPER_OFFSET;
+    if (stream_size < super_offset + SUPER_SIZE) {
+      return S_FALSE;
+    }
+    RETURN_SAME_IF_NOT_ZERO(ReadFully(stream, super_offset, super, sizeof(super)));
+    if (GetUInt32(super) != CRAMFS_MAGIC) {
+      return S_FALSE;
+    }
+  }
+
+  UInt32 flags = GetUInt32(super + 8);
+  if ((flags & ~SUPPORTED_FLAGS) != 0) {
+    LOGD("Unsupported flags: 0x%08x", flags);
+    return S_FALSE;
+  }
+  if ((flags & FLAG_WRONG_SIGNATURE) == 0 && memcmp(super + SIGNATURE_OFFSET, SIGNATURE, sizeof(SIGNATURE)) != 0) {
+    return S_FALSE;
+  }
+
+  image_size = stream_size;
+  if ((flags & FLAG_FSID_VERSION_2) != 0) {
+    UInt32 size = GetUInt32(super + 4);
+    if (size < super_offset + SUPER_SIZE || size > stream_size) {
+      return S_FALSE;
+    }
+    image_size = size;
+  }
+
+  const Byte* root = super + ROOT_INODE_OFFSET;
+  UInt32 root_size = GetUInt32(root + 4) & 0xFFFFFF;
+  UInt32 root_offset = (GetUInt32(root + 8) >> 6) * 4;
+  if ((GetUInt32(root) & MODE_TYPE_MASK) != MODE_DIRECTORY || root_offset == 0) {
+    return S_FALSE;
+  }
+  RETURN_SAME_IF_NOT_ZERO(ReadDirectory("", root_offset, root_size, 0));
+  if (files.empty()) {
+    return S_FALSE;
+  }
+  std::sort(data_starts.begin(), data_starts.end());
+  return DetectPageSize();
+}
+
+HRESULT CramfsImage::ReadPages(UInt32 offset, UInt64 size, UInt32 page_size, std::vector<IndependentChunk>& pages) {
+  // The end offsets of the pages follow each other, the first page follows them
+  size_t page_count = static_cast<size_t>((size + page_size - 1) / page_size);
+  UInt64 start = static_cast<UInt64>(offset) + page_count * 4;
+  if (start > image_size) {
+    return S_FALSE;
+  }
+  std::vector<Byte> ends(page_count * 4);
+  RETURN_SAME_IF_NOT_ZERO(ReadFully(stream, offset, ends.data(), ends.size()));
+
+  pages.resize(page_count);
+  for (size_t i = 0; i < page_count; i++) {
+    UInt64 end = GetUInt32(ends.data() + i * 4);
+    if (end < start || end > image_size || end - start > MAX_PACKED_PAGE_SIZE(page_size)) {
+      return S_FALSE;
+    }
+    IndependentChunk& page = pages[i];
+    page.packed_offset = start;
+    page.packed_size = end - start;
+    page.offset = static_cast<UInt64>(i) * page_size;
+    page.size = MIN(static_cast<UInt64>(page_size), size - page.offset);
+    start = end;
+  }
+
+  // Of another page size, the table ends before or after the next data
+  auto next = std::upper_bound(data_starts.begin(), data_starts.end(), offset);
+  if (next != data_starts.end() && (start + DATA_ALIGNMENT - 1) / DATA_ALIGNMENT * DATA_ALIGNMENT != *next) {
+    return S_FALSE;
+  }
+  return S_OK;
+}
+
+HRESULT CramfsImage::DetectPageSize() {
+  // The tables of a file tell the page sizes up to its size apart, the larger ones
+  // all make a page of it. The table of the last data in the image has no next data
+  // to end at, so it's only checked too if it's the largest file.
+  const File* largest = nullptr;
+  const File* last = nullptr;
+  for (auto& it : files) {
+    const File& file = it.second;
+    if (std::upper_bound(data_starts.begin(), data_starts.end(), file.offset) != data_starts.end()) {
+      if (largest == nullptr || file.size > largest->size) {
+        largest = &file;
+      }
+    } else if (file.size != 0) {
+      last = &file;
+    }
+  }
+  if (last != nullptr && largest != nullptr && last->size <= largest->size) {
+    last = nullptr;
+  }
+
+  std::vector<IndependentChunk> pages;
+  for (UInt32 size : PAGE_SIZES) {
+    HRESULT result = largest != nullptr ? ReadPages(largest->offset, largest->size, size, pages) : S_OK;
+    if (result == S_OK && last != nullptr) {
+      result = ReadPages(last->offset, last->size, size, pages);
+    }
+    if (result == S_OK) {
+      page_size = size;
+      return S_OK;
+    }
+    if (result != S_FALSE) {
+      return result;
+    }
+  }
+  LOGD("Unknown page size");
+  return S_FALSE;
+}
+
+HRESULT CramfsImage::OpenFile(const AString& path, UInt64 size, CMyComPtr<ChunkedResource>& file) {
+  auto it = files.find(std::string(path.Ptr(), path.Len()));
+  if (it == files.end() || it->second.size != size || size == 0) {
+    return S_FALSE;
+  }
+
+  std::vector<IndependentChunk> pages;
+  RETURN_SAME_IF_NOT_ZERO(ReadPages(it->second.offset, size, page_size, pages));
+  CMyComPtr<ChunkedResource> cramfs_file(new CramfsFile(stream, pages));
+
+  // A page size the tables can't tell fails the first page, the handler takes over.
+  // The page stays in the cache for the extraction.
+  CMyComPtr<CReferenceBuf> first_page;
+  HRESULT result = cramfs_file->GetChunk(0, first_page);
+  if (result == E_DATA_ERROR) {
+    return S_FALSE;
+  }
+  RETURN_SAME_IF_NOT_ZERO(result);
+
+  file = cramfs_file;
+  return S_OK;
+}
+
+HRESULT CramfsImage::Open(SharedInStream* stream, CMyComPtr<CramfsImage>& image) {
+  CMyComPtr<CramfsImage> cramfs_image(new CramfsImage(stream));
+  HRESULT result = cramfs_image->Load();
+  if (result == S_OK) {
+    image = cramfs_image;
+  }
+  return result;
+}
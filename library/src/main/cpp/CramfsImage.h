@@ -0,0 +1,84 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __A7ZIP_CRAMFS_IMAGE_H__
+#define __A7ZIP_CRAMFS_IMAGE_H__
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <include_windows/windows.h>
+#include <Common/MyCom.h>
+#include <Common/MyString.h>
+#include <7zip/IStream.h>
+
+#include "ChunkedResource.h"
+#include "SharedInStream.h"
+
+namespace a7zip {
+
+// The regular files of a little-endian CramFS image, read from its directories.
+// A file is stored as a zlib stream for each page with a table of their end
+// offsets, so each page decodes alone. An empty page is a hole of zeros.
+// The page size isn't stored in the image, it's the one of 4 KiB to 64 KiB
+// whose page tables end where the next data starts.
+// Images with the extended block pointers of Linux 4.15 are left to the handler.
+class CramfsImage : public IUnknown, public CMyUnknownImp {
+ public:
+  MY_UNKNOWN_IMP
+
+  // The pages of the file at the path, "folder/file". Returns S_FALSE if there is
+  // no regular file of the path and the size, its page table is broken, or its
+  // first page can't be decoded.
+  HRESULT OpenFile(const AString& path, UInt64 size, CMyComPtr<ChunkedResource>& file);
+
+ private:
+  explicit CramfsImage(SharedInStream* stream);
+
+  HRESULT Load();
+  // Adds the files of the directory to files, returns S_FALSE if it's broken
+  HRESULT ReadDirectory(const std::string& prefix, UInt32 offset, UInt32 size, int depth);
+  // Fills the pages of the file of the page size, returns S_FALSE if they don't fit
+  HRESULT ReadPages(UInt32 offset, UInt64 size, UInt32 page_size, std::vector<IndependentChunk>& pages);
+  // Sets the page size by the page tables, returns S_FALSE if none fits
+  HRESULT DetectPageSize();
+
+ private:
+  struct File {
+    // Of the page table in the image
+    UInt32 offset;
+    UInt32 size;
+  };
+
+  // A clone for the image
+  CMyComPtr<SharedInStream> stream;
+  UInt64 image_size;
+  // Of the directories read so far
+  UInt64 directory_bytes;
+  std::unordered_map<std::string, File> files;
+  // Where the directories and the data of the files start, sorted
+  std::vector<UInt32> data_starts;
+  UInt32 page_size;
+
+ public:
+  // Returns S_FALSE if it isn't a CramFS image this can read
+  static HRESULT Open(SharedInStream* stream, CMyComPtr<CramfsImage>& image);
+};
+
+}
+
+#endif //__A7ZIP_CRAMFS_IMAGE_H__
@@ -0,0 +1,390 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "DirectoryExtractCallback.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+#include <Common/UTFConvert.h>
+#include <Windows/PropVariant.h>
+
+#include "Log.h"
+#include "Utils.h"
+
+#ifdef LOG_TAG
+#  undef LOG_TAG
+#endif //LOG_TAG
+#define LOG_TAG "DirectoryExtractCallback"
+
+// Unix mode is in the high 16 bits if the flag is set
+#define FILE_ATTRIBUTE_UNIX_EXTENSION 0x8000
+#define MODE_MASK 0777
+
+using namespace a7zip;
+
+static const UInt64 FILE_TIME_OFFSET = (369 * 365 + 89) * 86400ULL * 10000000ULL;
+
+static HRESULT ErrnoToResult(int error, const char* operation) {
+  LOGE("Failed to %s: %s", operation, strerror(error));
+  switch (error) {
+    case ELOOP:
+    case ENOTDIR:
+      // A symbolic link or a file is in the path
+      return E_UNSAFE_PATH;
+    default:
+      return E_IO_ERROR;
+  }
+}
+
+// Removes empty and "." components, fails for ".." components
+static HRESULT SanitizePath(const wchar_t* path, std::string& result) {
+  AString utf8;
+  ConvertUnicodeToUTF8(UString(path), utf8);
+
+  result.clear();
+  const char* start = utf8;
+  while (*start != '\0') {
+    const char* end = strchr(start, '/');
+    if (end == nullptr) {
+      end = start + strlen(start);
+    }
+
+    size_t length = static_cast<size_t>(end - start);
+    if (length == 2 && start[0] == '.' && start[1] == '.') {
+      return E_UNSAFE_PATH;
+    }
+    if (length != 0 && !(length == 1 && start[0] == '.')) {
+      if (!result.empty()) {
+        result += '/';
+      }
+      result.append(start, length);
+    }
+
+    start = *end != '\0' ? end + 1 : end;
+  }
+
+  return S_OK;
+}
+
+namespace a7zip {
+
+// Writes to the fd, doesn't own it
+class FileOutStream :
+    public ISequentialOutStream,
+    public CMyUnknownImp
+{
+ public:
+  explicit FileOutStream(int fd) : fd(fd) { }
+
+ public:
+  MY_UNKNOWN_IMP
+
+  STDMETHOD(Write)(const void* data, UInt32 size, UInt32* processedSize) {
+    if (processedSize != nullptr) {
+      *processedSize = 0;
+    }
+
+    const char* bytes = static_cast<const char*>(data);
+    UInt32 written = 0;
+    while (written < size) {
+      ssize_t n = write(fd, bytes + written, size - written);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        return ErrnoToResult(errno, "write");
+      }
+      written += static_cast<UInt32>(n);
+    }
+
+    if (processedSize != nullptr) {
+      *processedSize = written;
+    }
+    return S_OK;
+  }
+
+ private:
+  int fd;
+};
+
+}
+
+DirectoryExtractCallback::DirectoryExtractCallback(
+    IInArchive* in_archive,
+    int dir_fd,
+    BSTR password,
+    UInt32 hash_algorithms,
+    std::vector<EntryDigest>* digests,
+    const std::atomic<bool>* cancelled
+) :
+    ArchiveExtractCallback(static_cast<UInt32>(-1), password, CMyComPtr<ISequentialOutStream>(), cancelled),
+    in_archive(in_archive),
+    dir_fd(dir_fd),
+    parent_fd(-1),
+    file_fd(-1),
+    hash_algorithms(hash_algorithms),
+    digests(digests),
+    file_index(0) { }
+
+DirectoryExtractCallback::~DirectoryExtractCallback() {
+  CloseFile(false);
+  if (parent_fd >= 0 && parent_fd != dir_fd) {
+    close(parent_fd);
+  }
+}
+
+HRESULT DirectoryExtractCallback::GetAttributes(UInt32 index, Attributes& attributes) {
+  attributes.has_mtime = false;
+  attributes.has_mode = false;
+
+  NWindows::NCOM::CPropVariant prop;
+  RETURN_SAME_IF_NOT_ZERO(in_archive->GetProperty(index, kpidMTime, &prop));
+  if (prop.vt == VT_FILETIME) {
+    UInt64 time = (static_cast<UInt64>(prop.filetime.dwHighDateTime) << 32) | prop.filetime.dwLowDateTime;
+    if (time >= FILE_TIME_OFFSET) {
+      time -= FILE_TIME_OFFSET;
+      attributes.has_mtime = true;
+      attributes.mtime.tv_sec = static_cast<time_t>(time / 10000000ULL);
+      attributes.mtime.tv_nsec = static_cast<long>(time % 10000000ULL * 100);
+    }
+  }
+
+  // Special bits are dropped, only permissions are restored
+  prop.Clear();
+  RETURN_SAME_IF_NOT_ZERO(in_archive->GetProperty(index, kpidPosixAttrib, &prop));
+  if (prop.vt == VT_UI4) {
+    attributes.has_mode = true;
+    attributes.mode = static_cast<mode_t>(prop.ulVal & MODE_MASK);
+    return S_OK;
+  }
+
+  prop.Clear();
+  RETURN_SAME_IF_NOT_ZERO(in_archive->GetProperty(index, kpidAttrib, &prop));
+  if (prop.vt == VT_UI4 && (prop.ulVal & FILE_ATTRIBUTE_UNIX_EXTENSION) != 0) {
+    attributes.has_mode = true;
+    attributes.mode = static_cast<mode_t>((prop.ulVal >> 16) & MODE_MASK);
+  }
+
+  return S_OK;
+}
+
+HRESULT DirectoryExtractCallback::OpenDirectory(const std::string& path, bool create, int& fd) {
+  int current = dir_fd;
+  size_t start = 0;
+
+  while (start < path.size()) {
+    size_t end = path.find('/', start);
+    if (end == std::string::npos) {
+      end = path.size();
+    }
+    std::string name = path.substr(start, end - start);
+
+    int next = openat(current, name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (next < 0 && errno == ENOENT && create) {
+      if (mkdirat(current, name.c_str(), 0777) == 0 || errno == EEXIST) {
+        next = openat(current, name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+      }
+    }
+    int error = errno;
+
+    if (current != dir_fd) {
+      close(current);
+    }
+    if (next < 0) {
+      return ErrnoToResult(error, "open directory");
+    }
+
+    current = next;
+    start = end + 1;
+  }
+
+  fd = current;
+  return S_OK;
+}
+
+HRESULT DirectoryExtractCallback::OpenParent(const std::string& path, int& fd) {
+  size_t slash = path.rfind('/');
+  std::string parent = slash != std::string::npos ? path.substr(0, slash) : std::string();
+
+  // Entries are usually grouped by directory
+  if (parent_fd < 0 || parent != parent_path) {
+    if (parent_fd >= 0 && parent_fd != dir_fd) {
+      close(parent_fd);
+    }
+    parent_fd = -1;
+    RETURN_SAME_IF_NOT_ZERO(OpenDirectory(parent, true, parent_fd));
+    parent_path = parent;
+  }
+
+  fd = parent_fd;
+  return S_OK;
+}
+
+bool DirectoryExtractCallback::IsPlausibleSize(int fd, UInt64 size) {
+  // The size is from the archive, a crafted one must not take the disk.
+  // An entry over the output limit or the free space is refused later anyway.
+  if (size == 0 || size > static_cast<UInt64>(INT64_MAX)) {
+    return false;
+  }
+  UInt64 max_output_bytes = GetLimits().max_output_bytes;
+  if (max_output_bytes != 0 && size > max_output_bytes) {
+    return false;
+  }
+  struct statvfs fs;
+  return fstatvfs(fd, &fs) == 0 && size <= static_cast<UInt64>(fs.f_bavail) * fs.f_frsize;
+}
+
+void DirectoryExtractCallback::CloseFile(bool succeeded) {
+  if (file_fd < 0) {
+    return;
+  }
+
+  if (succeeded && hash_stream != nullptr) {
+    digests->emplace_back();
+    hash_stream->GetDigest(file_index, digests->back());
+  }
+  hash_stream = nullptr;
+
+  if (succeeded) {
+    // Drop the preallocated tail if the entry is shorter than its size property
+    off_t end = lseek(file_fd, 0, SEEK_CUR);
+    if (end >= 0) {
+      ftruncate(file_fd, end);
+    }
+    if (file_attributes.has_mode) {
+      fchmod(file_fd, file_attributes.mode);
+    }
+    if (file_attributes.has_mtime) {
+      struct timespec times[2] = { { 0, UTIME_OMIT }, file_attributes.mtime };
+      futimens(file_fd, times);
+    }
+  }
+
+  close(file_fd);
+  file_fd = -1;
+
+  if (!succeeded) {
+    // Don't leave a broken file
+    unlinkat(parent_fd, file_name.c_str(), 0);
+  }
+}
+
+HRESULT DirectoryExtractCallback::GetStream(
+    UInt32 index,
+    ISequentialOutStream** outStream,
+    Int32 askExtractMode
+) {
+  if (askExtractMode != NArchive::NExtract::NAskMode::kExtract) {
+    return ArchiveExtractCallback::GetStream(index, outStream, askExtractMode);
+  }
+
+  if (IsCancelled()) {
+    return E_ABORT;
+  }
+
+  // Null stream for directories
+  *outStream = nullptr;
+  CloseFile(false);
+
+  NWindows::NCOM::CPropVariant prop;
+  RETURN_SAME_IF_NOT_ZERO(in_archive->GetProperty(index, kpidPath, &prop));
+  if (prop.vt != VT_BSTR) {
+    return E_EMPTY_PROP;
+  }
+  std::string path;
+  RETURN_SAME_IF_NOT_ZERO(SanitizePath(prop.bstrVal, path));
+
+  prop.Clear();
+  RETURN_SAME_IF_NOT_ZERO(in_archive->GetProperty(index, kpidIsDir, &prop));
+  bool is_dir = prop.vt == VT_BOOL && prop.boolVal != 0;
+
+  Attributes attributes;
+  RETURN_SAME_IF_NOT_ZERO(GetAttributes(index, attributes));
+
+  if (is_dir) {
+    if (!path.empty()) {
+      int fd;
+      RETURN_SAME_IF_NOT_ZERO(OpenDirectory(path, true, fd));
+      close(fd);
+      directories.push_back({ path, attributes });
+    }
+    return S_OK;
+  }
+
+  if (path.empty()) {
+    return E_UNSAFE_PATH;
+  }
+
+  int parent;
+  RETURN_SAME_IF_NOT_ZERO(OpenParent(path, parent));
+
+  size_t slash = path.rfind('/');
+  file_name = slash != std::string::npos ? path.substr(slash + 1) : path;
+
+  int fd = openat(parent, file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0666);
+  if (fd < 0) {
+    return ErrnoToResult(errno, "open file");
+  }
+  file_fd = fd;
+  file_attributes = attributes;
+  file_index = index;
+
+  // Reserve the blocks at once, it keeps the file contiguous.
+  // The disk may fill up since the free space is checked.
+  prop.Clear();
+  RETURN_SAME_IF_NOT_ZERO(in_archive->GetProperty(index, kpidSize, &prop));
+  if (prop.vt == VT_UI8 && IsPlausibleSize(fd, prop.uhVal.QuadPart)) {
+    if (fallocate(fd, 0, 0, static_cast<off_t>(prop.uhVal.QuadPart)) != 0 && errno == ENOSPC) {
+      CloseFile(false);
+      return ErrnoToResult(ENOSPC, "allocate");
+    }
+  }
+
+  CMyComPtr<ISequentialOutStream> stream(new FileOutStream(fd));
+  if (hash_algorithms != 0 && digests != nullptr) {
+    hash_stream = new HashOutStream(hash_algorithms, stream);
+    stream = hash_stream;
+  }
+  *outStream = stream.Detach();
+  return S_OK;
+}
+
+HRESULT DirectoryExtractCallback::SetOperationResult(Int32 opRes) {
+  CloseFile(opRes == NArchive::NExtract::NOperationResult::kOK);
+  return ArchiveExtractCallback::SetOperationResult(opRes);
+}
+
+void DirectoryExtractCallback::Finish() {
+  // Children first, a parent may lose the write permission
+  for (auto it = directories.rbegin(); it != directories.rend(); ++it) {
+    int fd;
+    if (OpenDirectory(it->path, false, fd) != S_OK) {
+      continue;
+    }
+    if (it->attributes.has_mode) {
+      fchmod(fd, it->attributes.mode);
+    }
+    if (it->attributes.has_mtime) {
+      struct timespec times[2] = { { 0, UTIME_OMIT }, it->attributes.mtime };
+      futimens(fd, times);
+    }
+    if (fd != dir_fd) {
+      close(fd);
+    }
+  }
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __A7ZIP_DIRECTORY_EXTRACT_CALLBACK_H__
+#define __A7ZIP_DIRECTORY_EXTRACT_CALLBACK_H__
+
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+#include "ArchiveExtractCallback.h"
+#include "HashOutStream.h"
+
+namespace a7zip {
+
+// Writes the entries into files under a directory, all paths are relative to
+// the directory fd and symbolic links are never followed, so no entry can
+// escape from the directory.
+class DirectoryExtractCallback : public ArchiveExtractCallback {
+ public:
+  DirectoryExtractCallback(
+      IInArchive* in_archive,
+      int dir_fd,
+      BSTR password,
+      UInt32 hash_algorithms,
+      std::vector<EntryDigest>* digests,
+      const std::atomic<bool>* cancelled
+  );
+  ~DirectoryExtractCallback();
+
+ public:
+  STDMETHOD(GetStream)(UInt32 index, ISequentialOutStream** outStream, Int32 askExtractMode);
+  STDMETHOD(SetOperationResult)(Int32 opRes);
+
+  // Restores the times and the modes of the directories,
+  // creating files in them changes the times.
+  void Finish();
+
+ private:
+  struct Attributes {
+    bool has_mtime;
+    struct timespec mtime;
+    bool has_mode;
+    mode_t mode;
+  };
+
+  struct Directory {
+    std::string path;
+    Attributes attributes;
+  };
+
+  HRESULT GetAttributes(UInt32 index, Attributes& attributes);
+  // Opens the directory relative to dir_fd, creates the missing parts if create is true
+  HRESULT OpenDirectory(const std::string& path, bool create, int& fd);
+  // Returns the fd of the parent directory of the file, it's cached for the next file
+  HRESULT OpenParent(const std::string& path, int& fd);
+  // Returns false if the size of the entry shouldn't be reserved
+  bool IsPlausibleSize(int fd, UInt64 size);
+  void CloseFile(bool succeeded);
+
+ private:
+  IInArchive* in_archive;
+  int dir_fd;
+
+  std::string parent_path;
+  int parent_fd;
+
+  int file_fd;
+  std::string file_name;
+  Attributes file_attributes;
+
+  // The files are hashed while writing if hash_algorithms isn't 0
+  UInt32 hash_algorithms;
+  std::vector<EntryDigest>* digests;
+  CMyComPtr<HashOutStream> hash_stream;
+  UInt32 file_index;
+
+  std::vector<Directory> directories;
+};
+
+}
+
+#endif //__A7ZIP_DIRECTORY_EXTRACT_CALLBACK_H__
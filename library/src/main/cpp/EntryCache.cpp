@@ -0,0 +1,447 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "EntryCache.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include <7zCrc.h>
+
+#include "Log.h"
+#include "Utils.h"
+
+#ifdef LOG_TAG
+#  undef LOG_TAG
+#endif //LOG_TAG
+#define LOG_TAG "EntryCache"
+
+using namespace a7zip;
+
+// A cache file is the header, the key and the data. The key is compared on read,
+// the names of two keys may collide. The size and the CRC catch broken files.
+static const UInt32 CACHE_FILE_MAGIC = 0x32453741; // "A7E2"
+static const char CACHE_FILE_SUFFIX[] = ".entry";
+// Temporary files are named after the file, mkstemp fills the Xs
+static const char TEMP_FILE_SUFFIX[] = ".XXXXXX";
+
+struct CacheFileHeader {
+  UInt32 magic;
+  UInt32 key_size;
+  UInt64 data_size;
+  UInt32 data_crc;
+  UInt32 reserved;
+};
+
+enum CacheFileResult {
+  CACHE_FILE_OK,
+  CACHE_FILE_BROKEN,
+  // The file is for another key with the same name
+  CACHE_FILE_OTHER_KEY,
+};
+
+static std::string MakeKey(const AString& archive_key, UInt32 index) {
+  std::string key(archive_key.Ptr(), archive_key.Len());
+  key += '\0';
+  key += std::to_string(index);
+  return key;
+}
+
+// FNV-1a, collisions are caught by the key in the file
+static std::string MakeFileName(const std::string& key) {
+  UInt64 hash = 0xcbf29ce484222325ULL;
+  for (unsigned char c : key) {
+    hash ^= c;
+    hash *= 0x100000001b3ULL;
+  }
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx%s", static_cast<unsigned long long>(hash), CACHE_FILE_SUFFIX);
+  return name;
+}
+
+static bool ReadFully(int fd, void* data, size_t size) {
+  Byte* bytes = static_cast<Byte*>(data);
+  while (size != 0) {
+    ssize_t n = read(fd, bytes, size);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    bytes += n;
+    size -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+static bool WriteFully(int fd, const void* data, size_t size) {
+  const Byte* bytes = static_cast<const Byte*>(data);
+  while (size != 0) {
+    ssize_t n = write(fd, bytes, size);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    bytes += n;
+    size -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+// Reads the header and the key of the file, the fd is left at the data.
+// The size of the file must match the header.
+static bool ReadFileKey(int fd, CacheFileHeader& header, std::string& key) {
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !ReadFully(fd, &header, sizeof(header)) || header.magic != CACHE_FILE_MAGIC ||
+      static_cast<UInt64>(st.st_size) != sizeof(header) + header.key_size + header.data_size) {
+    return false;
+  }
+  key.resize(header.key_size);
+  return ReadFully(fd, &key[0], key.size());
+}
+
+static CacheFileResult ReadCacheFile(const std::string& path, const std::string& key, CMyComPtr<CReferenceBuf>& buffer) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return CACHE_FILE_BROKEN;
+  }
+
+  CacheFileResult result = CACHE_FILE_BROKEN;
+  CacheFileHeader header;
+  std::string file_key;
+  if (ReadFileKey(fd, header, file_key)) {
+    if (file_key != key) {
+      result = CACHE_FILE_OTHER_KEY;
+    } else if (header.data_size <= SIZE_MAX) {
+      CMyComPtr<CReferenceBuf> loaded(new CReferenceBuf());
+      loaded->Buf.Alloc(static_cast<size_t>(header.data_size));
+      if (ReadFully(fd, loaded->Buf, loaded->Buf.Size()) &&
+          CrcCalc(loaded->Buf, loaded->Buf.Size()) == header.data_crc) {
+        buffer = loaded;
+        result = CACHE_FILE_OK;
+      }
+    }
+  }
+
+  close(fd);
+  return result;
+}
+
+// Writes a temporary file, syncs it and renames it.
+// Readers never see a partial file, even after a power loss.
+static bool WriteCacheFile(const std::string& path, const std::string& key, const Byte* data, size_t size) {
+  std::string temp_path = path + TEMP_FILE_SUFFIX;
+  int fd = mkstemp(&temp_path[0]);
+  if (fd < 0) {
+    LOGE("Can't create the cache file: %s", strerror(errno));
+    return false;
+  }
+
+  CacheFileHeader header = {
+      CACHE_FILE_MAGIC,
+      static_cast<UInt32>(key.size()),
+      static_cast<UInt64>(size),
+      CrcCalc(data, size),
+      0
+  };
+  bool succeeded = WriteFully(fd, &header, sizeof(header)) &&
+      WriteFully(fd, key.data(), key.size()) &&
+      WriteFully(fd, data, size) &&
+      fsync(fd) == 0;
+  succeeded = close(fd) == 0 && succeeded;
+
+  if (!succeeded || rename(temp_path.c_str(), path.c_str()) != 0) {
+    unlink(temp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+EntryCache::EntryCache() :
+    memory_capacity(0),
+    memory_size(0),
+    disk_capacity(0),
+    disk_size(0),
+    memory_hits(0),
+    disk_hits(0),
+    misses(0),
+    memory_evictions(0),
+    disk_evictions(0) { }
+
+void EntryCache::Configure(UInt64 memory_capacity, const char* dir, UInt64 disk_capacity) {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  this->memory_capacity = memory_capacity;
+  TrimMemory();
+
+  std::string new_dir = dir != nullptr && memory_capacity != 0 ? dir : "";
+  if (new_dir != disk_dir) {
+    // Forget the files of the old directory, they are still valid for the next time
+    disk_lru.clear();
+    disk_map.clear();
+    disk_size = 0;
+    disk_dir = new_dir;
+    this->disk_capacity = disk_capacity;
+    if (!disk_dir.empty()) {
+      ScanDisk();
+    }
+  } else {
+    this->disk_capacity = disk_capacity;
+  }
+  TrimDisk();
+}
+
+bool EntryCache::IsEnabled() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return memory_capacity != 0;
+}
+
+UInt64 EntryCache::GetMaxEntrySize() {
+  std::lock_guard<std::mutex> lock(mutex);
+  // An entry is always loaded into memory
+  return memory_capacity;
+}
+
+void EntryCache::ScanDisk() {
+  DIR* dir = opendir(disk_dir.c_str());
+  if (dir == nullptr) {
+    LOGE("Can't open the cache directory: %s", strerror(errno));
+    disk_dir.clear();
+    return;
+  }
+
+  struct ScannedFile {
+    DiskNode node;
+    time_t atime;
+  };
+  std::vector<ScannedFile> files;
+
+  size_t suffix_length = strlen(CACHE_FILE_SUFFIX);
+  size_t temp_suffix_length = strlen(TEMP_FILE_SUFFIX);
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    size_t length = strlen(entry->d_name);
+    std::string path = disk_dir + '/' + entry->d_name;
+    if (length > suffix_length + temp_suffix_length &&
+        strncmp(entry->d_name + length - suffix_length - temp_suffix_length, CACHE_FILE_SUFFIX, suffix_length) == 0 &&
+        entry->d_name[length - temp_suffix_length] == '.') {
+      // Left by a write that didn't finish
+      unlink(path.c_str());
+      continue;
+    }
+    if (length <= suffix_length || strcmp(entry->d_name + length - suffix_length, CACHE_FILE_SUFFIX) != 0) {
+      continue;
+    }
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) continue;
+    CacheFileHeader header;
+    std::string key;
+    struct stat st;
+    bool valid = fstat(fd, &st) == 0 && ReadFileKey(fd, header, key);
+    close(fd);
+
+    if (!valid || disk_map.count(key) != 0) {
+      unlink(path.c_str());
+      continue;
+    }
+    files.push_back({ { key, path, static_cast<UInt64>(st.st_size) }, st.st_atime });
+  }
+  closedir(dir);
+
+  // The most recently accessed first
+  std::sort(files.begin(), files.end(), [](const ScannedFile& a, const ScannedFile& b) {
+    return a.atime > b.atime;
+  });
+  for (ScannedFile& file : files) {
+    disk_lru.push_back(file.node);
+    disk_map[file.node.key] = std::prev(disk_lru.end());
+    disk_size += file.node.size;
+  }
+}
+
+void EntryCache::TrimMemory() {
+  while (memory_size > memory_capacity && !memory_lru.empty()) {
+    MemoryNode& node = memory_lru.back();
+    memory_size -= node.buffer->Buf.Size();
+    memory_map.erase(node.key);
+    memory_lru.pop_back();
+    memory_evictions++;
+  }
+}
+
+void EntryCache::TrimDisk() {
+  while (disk_size > disk_capacity && !disk_lru.empty()) {
+    DiskNode& node = disk_lru.back();
+    unlink(node.path.c_str());
+    disk_size -= node.size;
+    disk_map.erase(node.key);
+    disk_lru.pop_back();
+    disk_evictions++;
+  }
+}
+
+void EntryCache::InsertMemory(const std::string& key, CReferenceBuf* buffer) {
+  auto it = memory_map.find(key);
+  if (it != memory_map.end()) {
+    memory_size -= it->second->buffer->Buf.Size();
+    memory_lru.erase(it->second);
+    memory_map.erase(it);
+  }
+
+  memory_lru.push_front({ key, buffer });
+  memory_map[key] = memory_lru.begin();
+  memory_size += buffer->Buf.Size();
+  TrimMemory();
+}
+
+void EntryCache::InsertDisk(const std::string& key, const std::string& path, UInt64 size) {
+  auto it = disk_map.find(key);
+  if (it != disk_map.end()) {
+    disk_size -= it->second->size;
+    disk_lru.erase(it->second);
+    disk_map.erase(it);
+  }
+
+  disk_lru.push_front({ key, path, size });
+  disk_map[key] = disk_lru.begin();
+  disk_size += size;
+  TrimDisk();
+}
+
+void EntryCache::RemoveDisk(const std::string& key, bool delete_file) {
+  auto it = disk_map.find(key);
+  if (it != disk_map.end()) {
+    if (delete_file) {
+      unlink(it->second->path.c_str());
+    }
+    disk_size -= it->second->size;
+    disk_lru.erase(it->second);
+    disk_map.erase(it);
+  }
+}
+
+bool EntryCache::Get(const AString& archive_key, UInt32 index, CMyComPtr<CReferenceBuf>& buffer) {
+  std::string key = MakeKey(archive_key, index);
+  std::string path;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (memory_capacity == 0) {
+      return false;
+    }
+
+    auto it = memory_map.find(key);
+    if (it != memory_map.end()) {
+      memory_lru.splice(memory_lru.begin(), memory_lru, it->second);
+      buffer = it->second->buffer;
+      memory_hits++;
+      return true;
+    }
+
+    auto disk_it = disk_map.find(key);
+    if (disk_it == disk_map.end()) {
+      misses++;
+      return false;
+    }
+    disk_lru.splice(disk_lru.begin(), disk_lru, disk_it->second);
+    path = disk_it->second->path;
+  }
+
+  // An evicted file can still be read through the fd
+  CMyComPtr<CReferenceBuf> loaded;
+  CacheFileResult result = ReadCacheFile(path, key, loaded);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (result != CACHE_FILE_OK) {
+    // The file of another key is kept for it
+    RemoveDisk(key, result == CACHE_FILE_BROKEN);
+    misses++;
+    return false;
+  }
+  disk_hits++;
+  InsertMemory(key, loaded);
+  buffer = loaded;
+  return true;
+}
+
+void EntryCache::Put(const AString& archive_key, UInt32 index, const Byte* data, size_t size) {
+  std::string key = MakeKey(archive_key, index);
+
+  CMyComPtr<CReferenceBuf> buffer(new CReferenceBuf());
+  buffer->Buf.CopyFrom(data, size);
+
+  std::string dir;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (size > memory_capacity) {
+      return;
+    }
+    InsertMemory(key, buffer);
+    if (!disk_dir.empty() && disk_map.count(key) == 0 && size < disk_capacity) {
+      dir = disk_dir;
+    }
+  }
+
+  if (dir.empty()) {
+    return;
+  }
+
+  // Write the file out of the lock, it's slow
+  std::string path = dir + '/' + MakeFileName(key);
+  if (!WriteCacheFile(path, key, data, size)) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (disk_dir == dir) {
+    InsertDisk(key, path, sizeof(CacheFileHeader) + key.size() + size);
+  }
+}
+
+void EntryCache::Clear() {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  memory_lru.clear();
+  memory_map.clear();
+  memory_size = 0;
+
+  for (DiskNode& node : disk_lru) {
+    unlink(node.path.c_str());
+  }
+  disk_lru.clear();
+  disk_map.clear();
+  disk_size = 0;
+}
+
+void EntryCache::GetStats(Stats& stats) {
+  std::lock_guard<std::mutex> lock(mutex);
+  stats.memory_hits = memory_hits;
+  stats.disk_hits = disk_hits;
+  stats.misses = misses;
+  stats.memory_evictions = memory_evictions;
+  stats.disk_evictions = disk_evictions;
+  stats.memory_size = memory_size;
+  stats.disk_size = disk_size;
+}
+
+EntryCache* EntryCache::GetInstance() {
+  // Never deleted, it may be used while the process exits
+  static EntryCache* instance = new EntryCache();
+  return instance;
+}
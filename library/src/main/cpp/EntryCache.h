@@ -0,0 +1,115 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __A7ZIP_ENTRY_CACHE_H__
+#define __A7ZIP_ENTRY_CACHE_H__
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <include_windows/windows.h>
+#include <Common/MyCom.h>
+#include <Common/MyString.h>
+#include <7zip/Common/StreamObjects.h>
+
+namespace a7zip {
+
+// Decompressed entries keyed by (archive key, index), so revisiting an entry
+// of a solid archive doesn't decode its block again.
+// The memory tier is an LRU bounded in bytes. The disk tier is optional, it's an LRU
+// of files in a directory, bounded in bytes too. Entries are written to both tiers,
+// a disk hit is loaded into memory. The disk tier survives restarts, the archive
+// key must change if the archive file changes.
+class EntryCache {
+ public:
+  // Keep it in sync with EntryCache.Stats in java
+  struct Stats {
+    UInt64 memory_hits;
+    UInt64 disk_hits;
+    UInt64 misses;
+    UInt64 memory_evictions;
+    UInt64 disk_evictions;
+    UInt64 memory_size;
+    UInt64 disk_size;
+  };
+
+  EntryCache();
+
+ public:
+  // 0 memory capacity disables the cache, null dir disables the disk tier
+  void Configure(UInt64 memory_capacity, const char* dir, UInt64 disk_capacity);
+  bool IsEnabled();
+  // Larger entries aren't cached
+  UInt64 GetMaxEntrySize();
+
+  // Returns false if missed
+  bool Get(const AString& archive_key, UInt32 index, CMyComPtr<CReferenceBuf>& buffer);
+  void Put(const AString& archive_key, UInt32 index, const Byte* data, size_t size);
+
+  // Drops all entries of both tiers, the stats are kept
+  void Clear();
+  void GetStats(Stats& stats);
+
+ private:
+  struct MemoryNode {
+    std::string key;
+    CMyComPtr<CReferenceBuf> buffer;
+  };
+
+  struct DiskNode {
+    std::string key;
+    std::string path;
+    UInt64 size;
+  };
+
+  void InsertMemory(const std::string& key, CReferenceBuf* buffer);
+  void InsertDisk(const std::string& key, const std::string& path, UInt64 size);
+  void RemoveDisk(const std::string& key, bool delete_file);
+  void TrimMemory();
+  void TrimDisk();
+  void ScanDisk();
+
+ private:
+  std::mutex mutex;
+
+  UInt64 memory_capacity;
+  UInt64 memory_size;
+  // The most recently used first
+  std::list<MemoryNode> memory_lru;
+  std::unordered_map<std::string, std::list<MemoryNode>::iterator> memory_map;
+
+  std::string disk_dir;
+  UInt64 disk_capacity;
+  UInt64 disk_size;
+  std::list<DiskNode> disk_lru;
+  std::unordered_map<std::string, std::list<DiskNode>::iterator> disk_map;
+
+  UInt64 memory_hits;
+  UInt64 disk_hits;
+  UInt64 misses;
+  UInt64 memory_evictions;
+  UInt64 disk_evictions;
+
+ public:
+  // The cache is created on first use and lives until the process exits
+  static EntryCache* GetInstance();
+};
+
+}
+
+#endif //__A7ZIP_ENTRY_CACHE_H__
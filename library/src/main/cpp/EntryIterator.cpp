@@ -0,0 +1,282 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "EntryIterator.h"
+
+#include <cstring>
+
+#include "ArchiveExtractCallback.h"
+#include "JavaEnv.h"
+#include "Log.h"
+#include "Utils.h"
+
+#ifdef LOG_TAG
+#  undef LOG_TAG
+#endif //LOG_TAG
+#define LOG_TAG "EntryIterator"
+
+using namespace a7zip;
+
+// The producer waits once the consumer is this far behind
+static const size_t BUFFER_CAPACITY = 1 << 20;
+static const size_t MAX_PENDING_ENTRIES = 64;
+
+namespace a7zip {
+
+// Hands the data of an entry over to the iterator
+class EntryIteratorOutStream :
+    public ISequentialOutStream,
+    public CMyUnknownImp
+{
+ public:
+  EntryIteratorOutStream(EntryIterator* iterator, UInt64 seq) : iterator(iterator), seq(seq) { }
+
+ public:
+  MY_UNKNOWN_IMP
+
+  STDMETHOD(Write)(const void* data, UInt32 size, UInt32* processedSize) {
+    if (processedSize != nullptr) {
+      *processedSize = 0;
+    }
+    RETURN_SAME_IF_NOT_ZERO(iterator->OnEntryData(seq, data, size));
+    if (processedSize != nullptr) {
+      *processedSize = size;
+    }
+    return S_OK;
+  }
+
+ private:
+  EntryIterator* iterator;
+  UInt64 seq;
+};
+
+class EntryIteratorCallback : public ArchiveExtractCallback {
+ public:
+  EntryIteratorCallback(EntryIterator* iterator, InArchive* archive, BSTR password) :
+      ArchiveExtractCallback(static_cast<UInt32>(-1), password, CMyComPtr<ISequentialOutStream>(), &iterator->closed),
+      iterator(iterator),
+      archive(archive),
+      seq(0) { }
+
+ public:
+  STDMETHOD(GetStream)(UInt32 index, ISequentialOutStream** outStream, Int32 askExtractMode) {
+    seq = 0;
+
+    if (askExtractMode != NArchive::NExtract::NAskMode::kExtract) {
+      return ArchiveExtractCallback::GetStream(index, outStream, askExtractMode);
+    }
+
+    bool is_dir = false;
+    archive->GetEntryBooleanProperty(index, kpidIsDir, &is_dir);
+    if (is_dir) {
+      return ArchiveExtractCallback::GetStream(index, outStream, askExtractMode);
+    }
+
+    RETURN_SAME_IF_NOT_ZERO(iterator->OnEntryStart(index, seq));
+    CMyComPtr<ISequentialOutStream> stream(new EntryIteratorOutStream(iterator, seq));
+    *outStream = stream.Detach();
+    return S_OK;
+  }
+
+  STDMETHOD(SetOperationResult)(Int32 opRes) {
+    HRESULT result = ArchiveExtractCallback::SetOperationResult(opRes);
+    if (seq != 0) {
+      iterator->OnEntryEnd(seq, GetBetterResult(result));
+      seq = 0;
+    }
+    return result;
+  }
+
+ private:
+  EntryIterator* iterator;
+  InArchive* archive;
+  UInt64 seq;
+};
+
+}
+
+EntryIterator::EntryIterator(InArchive* archive, const UInt32* indices, UInt32 count, BSTR password) :
+    archive(archive),
+    all(indices == nullptr),
+    password(::SysAllocString(password)),
+    buffered(0),
+    read_offset(0),
+    next_seq(0),
+    current_seq(0),
+    released_seq(0),
+    finished(false),
+    result(S_OK),
+    closed(false),
+    retained(true) {
+  if (indices != nullptr) {
+    this->indices.assign(indices, indices + count);
+  }
+  archive->RetainIterator();
+}
+
+EntryIterator::~EntryIterator() {
+  Close();
+  ::SysFreeString(password);
+}
+
+void EntryIterator::Start() {
+  thread = std::thread(&EntryIterator::Run, this);
+}
+
+void EntryIterator::Run() {
+  // The archive may read java streams
+  JavaEnv env;
+  if (!env.IsValid()) {
+    LOGE("Can't attach the producer thread");
+    OnFinished(E_UNKNOWN_ERROR);
+    return;
+  }
+
+  HRESULT result;
+  {
+    CMyComPtr<EntryIteratorCallback> callback(new EntryIteratorCallback(this, archive, password));
+    std::lock_guard<SerialQueue> lock(archive->GetJobQueue());
+    result = archive->Extract(
+        all ? nullptr : indices.data(), static_cast<UInt32>(indices.size()), callback);
+  }
+  OnFinished(result);
+}
+
+HRESULT EntryIterator::OnEntryStart(UInt32 index, UInt64& seq) {
+  std::unique_lock<std::mutex> lock(mutex);
+  condition.wait(lock, [this] { return entries.size() < MAX_PENDING_ENTRIES || closed; });
+  if (closed) {
+    return E_ABORT;
+  }
+
+  seq = ++next_seq;
+  entries.push_back({ seq, index, {}, false, S_OK });
+  condition.notify_all();
+  return S_OK;
+}
+
+HRESULT EntryIterator::OnEntryData(UInt64 seq, const void* data, UInt32 size) {
+  std::unique_lock<std::mutex> lock(mutex);
+  condition.wait(lock, [this, seq] { return buffered < BUFFER_CAPACITY || seq <= released_seq || closed; });
+  if (closed) {
+    return E_ABORT;
+  }
+  if (seq <= released_seq) {
+    // Skipped by the consumer
+    return S_OK;
+  }
+
+  // The entry being written is always the last one
+  const Byte* bytes = static_cast<const Byte*>(data);
+  entries.back().chunks.emplace_back(bytes, bytes + size);
+  buffered += size;
+  condition.notify_all();
+  return S_OK;
+}
+
+void EntryIterator::OnEntryEnd(UInt64 seq, HRESULT result) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (seq > released_seq) {
+    entries.back().finished = true;
+    entries.back().result = result;
+    condition.notify_all();
+  }
+}
+
+void EntryIterator::OnFinished(HRESULT result) {
+  std::lock_guard<std::mutex> lock(mutex);
+  finished = true;
+  this->result = result;
+  condition.notify_all();
+}
+
+HRESULT EntryIterator::Next(UInt32& index) {
+  std::unique_lock<std::mutex> lock(mutex);
+
+  released_seq = current_seq;
+  while (!entries.empty() && entries.front().seq <= released_seq) {
+    for (const std::vector<Byte>& chunk : entries.front().chunks) {
+      buffered -= chunk.size();
+    }
+    entries.pop_front();
+  }
+  read_offset = 0;
+  condition.notify_all();
+
+  condition.wait(lock, [this] { return !entries.empty() || finished || closed; });
+  if (!entries.empty()) {
+    current_seq = entries.front().seq;
+    index = entries.front().index;
+    return S_OK;
+  }
+  if (closed) {
+    return E_ABORT;
+  }
+  return result != S_OK ? result : S_FALSE;
+}
+
+HRESULT EntryIterator::Read(void* data, UInt32 size, UInt32* processed_size) {
+  *processed_size = 0;
+
+  std::unique_lock<std::mutex> lock(mutex);
+  if (current_seq == 0 || entries.empty() || entries.front().seq != current_seq) {
+    // No current entry
+    return S_OK;
+  }
+
+  // Only the producer appends, the reference stays valid
+  Entry& entry = entries.front();
+  condition.wait(lock, [this, &entry] { return !entry.chunks.empty() || entry.finished || finished || closed; });
+
+  if (!entry.chunks.empty()) {
+    std::vector<Byte>& chunk = entry.chunks.front();
+    size_t n = MIN(static_cast<size_t>(size), chunk.size() - read_offset);
+    memcpy(data, chunk.data() + read_offset, n);
+    read_offset += n;
+    if (read_offset == chunk.size()) {
+      buffered -= chunk.size();
+      entry.chunks.pop_front();
+      read_offset = 0;
+      condition.notify_all();
+    }
+    *processed_size = static_cast<UInt32>(n);
+    return S_OK;
+  }
+
+  if (entry.finished) {
+    return entry.result;
+  }
+  if (closed) {
+    return E_ABORT;
+  }
+  // The producer stopped in the middle of the entry
+  return result != S_OK ? result : E_UNEXPECTED_END;
+}
+
+void EntryIterator::Close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    condition.notify_all();
+  }
+  if (thread.joinable()) {
+    thread.join();
+  }
+  if (retained) {
+    retained = false;
+    archive->ReleaseIterator();
+  }
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __A7ZIP_ENTRY_ITERATOR_H__
+#define __A7ZIP_ENTRY_ITERATOR_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <include_windows/windows.h>
+#include <Common/MyCom.h>
+
+#include "InArchive.h"
+
+namespace a7zip {
+
+// Pulls the entries out of one extracting pass, in the order they are decoded.
+// A producer thread runs the extraction and hands the data over in chunks.
+// It blocks once BUFFER_CAPACITY bytes are waiting. The data of a skipped entry
+// is dropped on the producer side without being copied. Directories are skipped.
+// The sync extractions of the archive fail with E_ITERATOR_RUNNING until it's closed.
+class EntryIterator {
+ public:
+  // Null indices for all entries
+  EntryIterator(InArchive* archive, const UInt32* indices, UInt32 count, BSTR password);
+  ~EntryIterator();
+
+ public:
+  void Start();
+  // Moves to the next entry, the rest of the current entry is skipped.
+  // Returns S_FALSE if there are no more entries.
+  HRESULT Next(UInt32& index);
+  // Reads the current entry, processed_size is 0 at the end of the entry
+  HRESULT Read(void* data, UInt32 size, UInt32* processed_size);
+  // Stops the producer and waits for it
+  void Close();
+
+ private:
+  struct Entry {
+    UInt64 seq;
+    UInt32 index;
+    std::deque<std::vector<Byte>> chunks;
+    bool finished;
+    HRESULT result;
+  };
+
+  void Run();
+
+  // Called by the producer
+  HRESULT OnEntryStart(UInt32 index, UInt64& seq);
+  HRESULT OnEntryData(UInt64 seq, const void* data, UInt32 size);
+  void OnEntryEnd(UInt64 seq, HRESULT result);
+  void OnFinished(HRESULT result);
+
+ private:
+  InArchive* archive;
+  std::vector<UInt32> indices;
+  bool all;
+  BSTR password;
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  // Entries started by the producer and not released by the consumer
+  std::deque<Entry> entries;
+  // Bytes in the chunks of the entries
+  size_t buffered;
+  // The read offset in the first chunk of the current entry
+  size_t read_offset;
+  UInt64 next_seq;
+  // The entry read by the consumer, 0 before the first one
+  UInt64 current_seq;
+  // The entries up to it are skipped or read
+  UInt64 released_seq;
+  bool finished;
+  HRESULT result;
+  std::atomic<bool> closed;
+  // The archive is retained for the iterator until it's closed
+  bool retained;
+
+  std::thread thread;
+
+  friend class EntryIteratorCallback;
+  friend class EntryIteratorOutStream;
+};
+
+}
+
+#endif //__A7ZIP_ENTRY_ITERATOR_H__
@@ -0,0 +1,77 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "HashExtractCallback.h"
+
+#include <Windows/PropVariant.h>
+
+#include "Utils.h"
+
+using namespace a7zip;
+
+HashExtractCallback::HashExtractCallback(
+    IInArchive* in_archive,
+    UInt32 algorithms,
+    BSTR password,
+    std::vector<EntryDigest>& digests,
+    const std::atomic<bool>* cancelled
+) :
+    ArchiveExtractCallback(static_cast<UInt32>(-1), password, CMyComPtr<ISequentialOutStream>(), cancelled),
+    in_archive(in_archive),
+    algorithms(algorithms),
+    digests(digests),
+    hash_index(0) { }
+
+HRESULT HashExtractCallback::GetStream(
+    UInt32 index,
+    ISequentialOutStream** outStream,
+    Int32 askExtractMode
+) {
+  hash_stream = nullptr;
+
+  if (askExtractMode != NArchive::NExtract::NAskMode::kExtract) {
+    return ArchiveExtractCallback::GetStream(index, outStream, askExtractMode);
+  }
+
+  if (IsCancelled()) {
+    return E_ABORT;
+  }
+
+  // Null stream for directories
+  *outStream = nullptr;
+
+  NWindows::NCOM::CPropVariant prop;
+  RETURN_SAME_IF_NOT_ZERO(in_archive->GetProperty(index, kpidIsDir, &prop));
+  if (prop.vt == VT_BOOL && prop.boolVal != 0) {
+    return S_OK;
+  }
+
+  hash_stream = new HashOutStream(algorithms, nullptr);
+  hash_index = index;
+
+  CMyComPtr<ISequentialOutStream> stream(hash_stream);
+  *outStream = stream.Detach();
+  return S_OK;
+}
+
+HRESULT HashExtractCallback::SetOperationResult(Int32 opRes) {
+  if (hash_stream != nullptr && opRes == NArchive::NExtract::NOperationResult::kOK) {
+    digests.emplace_back();
+    hash_stream->GetDigest(hash_index, digests.back());
+  }
+  hash_stream = nullptr;
+  return ArchiveExtractCallback::SetOperationResult(opRes);
+}
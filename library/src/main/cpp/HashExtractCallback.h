@@ -0,0 +1,52 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __A7ZIP_HASH_EXTRACT_CALLBACK_H__
+#define __A7ZIP_HASH_EXTRACT_CALLBACK_H__
+
+#include <vector>
+
+#include "ArchiveExtractCallback.h"
+#include "HashOutStream.h"
+
+namespace a7zip {
+
+// Hashes the entries without writing them anywhere, directories are skipped
+class HashExtractCallback : public ArchiveExtractCallback {
+ public:
+  HashExtractCallback(
+      IInArchive* in_archive,
+      UInt32 algorithms,
+      BSTR password,
+      std::vector<EntryDigest>& digests,
+      const std::atomic<bool>* cancelled
+  );
+
+ public:
+  STDMETHOD(GetStream)(UInt32 index, ISequentialOutStream** outStream, Int32 askExtractMode);
+  STDMETHOD(SetOperationResult)(Int32 opRes);
+
+ private:
+  IInArchive* in_archive;
+  UInt32 algorithms;
+  std::vector<EntryDigest>& digests;
+  CMyComPtr<HashOutStream> hash_stream;
+  UInt32 hash_index;
+};
+
+}
+
+#endif //__A7ZIP_HASH_EXTRACT_CALLBACK_H__
@@ -0,0 +1,98 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "HashOutStream.h"
+
+#include <cstring>
+#include <mutex>
+
+#include <7zCrc.h>
+#include <XzCrc64.h>
+
+using namespace a7zip;
+
+// The CRC32 table is generated when p7zip is loaded, but the CRC64 table
+// is only generated by the xz handler
+static std::once_flag crc64_table_once;
+
+HashOutStream::HashOutStream(UInt32 algorithms, ISequentialOutStream* out_stream) :
+    algorithms(algorithms),
+    out_stream(out_stream),
+    size(0),
+    crc32(CRC_INIT_VAL),
+    crc64(CRC64_INIT_VAL) {
+  if ((algorithms & HASH_CRC64) != 0) {
+    std::call_once(crc64_table_once, Crc64GenerateTable);
+  }
+  if ((algorithms & HASH_SHA1) != 0) {
+    Sha1_Init(&sha1);
+  }
+  if ((algorithms & HASH_SHA256) != 0) {
+    Sha256_Init(&sha256);
+  }
+}
+
+void HashOutStream::Update(const Byte* data, size_t size) {
+  this->size += size;
+  if ((algorithms & HASH_CRC32) != 0) {
+    crc32 = CrcUpdate(crc32, data, size);
+  }
+  if ((algorithms & HASH_CRC64) != 0) {
+    crc64 = Crc64Update(crc64, data, size);
+  }
+  if ((algorithms & HASH_SHA1) != 0) {
+    Sha1_Update(&sha1, data, size);
+  }
+  if ((algorithms & HASH_SHA256) != 0) {
+    Sha256_Update(&sha256, data, size);
+  }
+}
+
+HRESULT HashOutStream::Write(const void* data, UInt32 size, UInt32* processedSize) {
+  UInt32 processed = size;
+  HRESULT result = S_OK;
+  if (out_stream != nullptr) {
+    processed = 0;
+    result = out_stream->Write(data, size, &processed);
+  }
+
+  // Only hash the bytes which are written
+  Update(static_cast<const Byte*>(data), processed);
+
+  if (processedSize != nullptr) {
+    *processedSize = processed;
+  }
+  return result;
+}
+
+void HashOutStream::GetDigest(UInt32 index, EntryDigest& digest) {
+  memset(&digest, 0, sizeof(digest));
+  digest.index = index;
+  digest.algorithms = algorithms;
+  digest.size = size;
+  if ((algorithms & HASH_CRC32) != 0) {
+    digest.crc32 = CRC_GET_DIGEST(crc32);
+  }
+  if ((algorithms & HASH_CRC64) != 0) {
+    digest.crc64 = CRC64_GET_DIGEST(crc64);
+  }
+  if ((algorithms & HASH_SHA1) != 0) {
+    Sha1_Final(&sha1, digest.sha1);
+  }
+  if ((algorithms & HASH_SHA256) != 0) {
+    Sha256_Final(&sha256, digest.sha256);
+  }
+}
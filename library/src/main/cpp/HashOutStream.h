@@ -0,0 +1,76 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __A7ZIP_HASH_OUT_STREAM_H__
+#define __A7ZIP_HASH_OUT_STREAM_H__
+
+#include <Common/MyCom.h>
+#include <7zip/IStream.h>
+#include <Sha1.h>
+#include <Sha256.h>
+
+namespace a7zip {
+
+// Keep them in sync with EntryDigest in java
+enum HashAlgorithm {
+  HASH_CRC32 = 1,
+  HASH_CRC64 = 2,
+  HASH_SHA1 = 4,
+  HASH_SHA256 = 8,
+};
+
+struct EntryDigest {
+  UInt32 index;
+  UInt32 algorithms;
+  UInt64 size;
+  UInt32 crc32;
+  UInt64 crc64;
+  Byte sha1[SHA1_DIGEST_SIZE];
+  Byte sha256[SHA256_DIGEST_SIZE];
+};
+
+// Hashes the data on the way to the out stream.
+// Without out stream, the data is only hashed.
+class HashOutStream :
+    public ISequentialOutStream,
+    public CMyUnknownImp
+{
+ public:
+  HashOutStream(UInt32 algorithms, ISequentialOutStream* out_stream);
+
+ public:
+  MY_UNKNOWN_IMP
+
+  STDMETHOD(Write)(const void* data, UInt32 size, UInt32* processedSize);
+
+  void GetDigest(UInt32 index, EntryDigest& digest);
+
+ private:
+  void Update(const Byte* data, size_t size);
+
+ private:
+  UInt32 algorithms;
+  CMyComPtr<ISequentialOutStream> out_stream;
+  UInt64 size;
+  UInt32 crc32;
+  UInt64 crc64;
+  CSha1 sha1;
+  CSha256 sha256;
+};
+
+}
+
+#endif //__A7ZIP_HASH_OUT_STREAM_H__
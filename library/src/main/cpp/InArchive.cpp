@@ -16,168 +16,231 @@
 
 #include "InArchive.h"
 
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include <Common/UTFConvert.h>
 #include <Windows/PropVariant.h>
 #include <7zip/ICoder.h>
 #include <7zip/IPassword.h>
 
-#include "BlackHole.h"
+#include "ArchiveExtractCallback.h"
+#include "ChunkedResource.h"
+#include "CramfsImage.h"
+#include "DirectoryExtractCallback.h"
+#include "EntryCache.h"
+#include "HashExtractCallback.h"
 #include "Log.h"
+#include "ParallelInflate.h"
+#include "ParallelLzma2.h"
+#include "PipelineOutStream.h"
+#include "Trace.h"
 #include "Utils.h"
+#include "XzIndex.h"
+#include "ZipDirectory.h"
 
 using namespace a7zip;
 
-class ArchiveExtractCallback :
-    public IArchiveExtractCallback,
-    public ICryptoGetTextPassword,
+static const UInt16 ZIP_METHOD_DEFLATE = 8;
+// Smaller xz files aren't worth the threads
+static const UInt64 XZ_MIN_PARALLEL_SIZE = 4ULL << 20;
+// Bigger blocks take too much memory to be decoded at once or kept by streams
+static const UInt64 XZ_MAX_BLOCK_SIZE = 256ULL << 20;
+// Smaller CramFS files aren't worth the threads
+static const UInt64 CRAMFS_MIN_PARALLEL_SIZE = 1ULL << 20;
+static const UInt64 SEVEN_ZIP_SIGNATURE_HEADER_SIZE = 32;
+
+namespace a7zip {
+
+// Reads the stream in a scope of the allocator, the streams from GetEntryStream
+// decode on the threads reading them. It's seekable if the stream is.
+class ScopedInStream :
+    public IInStream,
     public CMyUnknownImp
 {
  public:
-  ArchiveExtractCallback(UInt32 index, BSTR password, CMyComPtr<ISequentialOutStream>& out_stream);
-  ~ArchiveExtractCallback();
+  ScopedInStream(ISequentialInStream* stream, Allocator* allocator) :
+      stream(stream),
+      allocator(allocator) {
+    stream->QueryInterface(IID_IInStream, reinterpret_cast<void**>(&seekable_stream));
+  }
 
  public:
-  MY_UNKNOWN_IMP2(IArchiveExtractCallback, ICryptoGetTextPassword)
-
-  STDMETHOD(SetTotal)(UInt64 total);
-  STDMETHOD(SetCompleted)(const UInt64 *completeValue);
+  STDMETHOD(QueryInterface)(REFIID iid, void** outObject) throw() {
+    *outObject = nullptr;
+    if (iid == IID_IUnknown || iid == IID_ISequentialInStream) {
+      *outObject = static_cast<ISequentialInStream*>(this);
+    } else if (iid == IID_IInStream && seekable_stream != nullptr) {
+      *outObject = static_cast<IInStream*>(this);
+    } else {
+      return E_NOINTERFACE;
+    }
+    AddRef();
+    return S_OK;
+  }
 
-  STDMETHOD(GetStream)(UInt32 index, ISequentialOutStream** outStream, Int32 askExtractMode);
-  STDMETHOD(PrepareOperation)(Int32 askExtractMode);
-  STDMETHOD(SetOperationResult)(Int32 opRes);
+  MY_ADDREF_RELEASE
 
-  STDMETHOD(CryptoGetTextPassword)(BSTR *password);
+  STDMETHOD(Read)(void* data, UInt32 size, UInt32* processedSize) {
+    Allocator::Scope scope(allocator);
+    return scope.GetBetterResult(stream->Read(data, size, processedSize));
+  }
 
-  HRESULT GetBetterResult(HRESULT result);
+  STDMETHOD(Seek)(Int64 offset, UInt32 seekOrigin, UInt64* newPosition) {
+    Allocator::Scope scope(allocator);
+    return scope.GetBetterResult(seekable_stream->Seek(offset, seekOrigin, newPosition));
+  }
 
  private:
-  UInt32 index;
-  BSTR password;
-  CMyComPtr<ISequentialOutStream> out_stream;
-  bool has_asked_password;
+  CMyComPtr<ISequentialInStream> stream;
+  CMyComPtr<IInStream> seekable_stream;
+  CMyComPtr<Allocator> allocator;
 };
 
-ArchiveExtractCallback::ArchiveExtractCallback(
-    UInt32 index,
-    BSTR password,
-    CMyComPtr<ISequentialOutStream>& out_stream
+}
+
+InArchive::InArchive(
+    InArchive* parent,
+    CMyComPtr<SharedInStream>& in_stream,
+    CMyComPtr<IInArchive>& in_archive,
+    AString& format_name,
+    CMyComPtr<Allocator>& allocator
 ) :
-    index(index),
-    password(::SysAllocString(password)),
-    out_stream(out_stream),
-    has_asked_password(false) {}
+    parent(parent),
+    in_stream(in_stream),
+    in_archive(in_archive),
+    format_name(format_name),
+    allocator(allocator),
+    iterator_count(0),
+    pipeline_buffer_count(0),
+    pipeline_buffer_size(0),
+    decode_thread_count(0),
+    parallel_chunk_count(0),
+    entry_layouts_loaded(false),
+    zip_directory_loaded(false),
+    xz_index_loaded(false),
+    cramfs_image_loaded(false) { }
 
-ArchiveExtractCallback::~ArchiveExtractCallback() {
-  ::SysFreeString(password);
+InArchive::~InArchive() {
+  // The decoder runs on the archive
+  StopDecoder();
+  this->in_archive->Close();
+  if (parent != nullptr) {
+    delete parent;
+    parent = nullptr;
+  }
 }
 
-HRESULT ArchiveExtractCallback::SetTotal(UInt64 total) {
-  // Ignored
-  return S_OK;
+const AString& InArchive::GetFormatName() {
+  return this->format_name;
 }
 
-HRESULT ArchiveExtractCallback::SetCompleted(const UInt64 *completeValue) {
-  // Ignored
-  return S_OK;
+Allocator* InArchive::GetAllocator() {
+  return this->allocator;
 }
 
-HRESULT ArchiveExtractCallback::GetStream(
-    UInt32 index,
-    ISequentialOutStream** outStream,
-    Int32 askExtractMode
-) {
-  // If it's not extract mode or the index is different, return a black hole to skip data
-  if (askExtractMode != NArchive::NExtract::NAskMode::kExtract || this->index != index) {
-    CMyComPtr<ISequentialOutStream> black_hole(new BlackHole());
-    *outStream = black_hole.Detach();
-    return S_OK;
-  }
+SerialQueue& InArchive::GetJobQueue() {
+  return this->job_queue;
+}
 
-  if (out_stream == nullptr) {
-    return E_NO_OUT_STREAM;
-  }
+void InArchive::RetainIterator() {
+  iterator_count++;
+}
 
-  CMyComPtr<ISequentialOutStream> steam_copy(out_stream);
-  *outStream = steam_copy.Detach();
+void InArchive::ReleaseIterator() {
+  iterator_count--;
+}
 
-  return S_OK;
+bool InArchive::IsIterating() {
+  return iterator_count != 0;
 }
 
-HRESULT ArchiveExtractCallback::PrepareOperation(Int32 askExtractMode) {
-  // Always return S_OK
-  return S_OK;
+HRESULT InArchive::GetOutArchive(CMyComPtr<IOutArchive>& out_archive) {
+  out_archive = nullptr;
+  in_archive->QueryInterface(IID_IOutArchive, reinterpret_cast<void **>(&out_archive));
+  return out_archive != nullptr ? S_OK : E_NOTIMPL;
 }
 
-HRESULT ArchiveExtractCallback::SetOperationResult(Int32 opRes) {
-  // Stop extracting action if operation result is not OK
-  switch (opRes) {
-    case NArchive::NExtract::NOperationResult::kOK:
-      return S_OK;
-    case NArchive::NExtract::NOperationResult::kUnsupportedMethod:
-      return E_UNSUPPORTED_METHOD;
-    case NArchive::NExtract::NOperationResult::kDataError:
-      return E_DATA_ERROR;
-    case NArchive::NExtract::NOperationResult::kCRCError:
-      return E_CRC_ERROR;
-    case NArchive::NExtract::NOperationResult::kUnavailable:
-      return E_UNAVAILABLE;
-    case NArchive::NExtract::NOperationResult::kUnexpectedEnd:
-      return E_UNEXPECTED_END;
-    case NArchive::NExtract::NOperationResult::kDataAfterEnd:
-      return E_DATA_AFTER_END;
-    case NArchive::NExtract::NOperationResult::kIsNotArc:
-      return E_IS_NOT_ARC;
-    case NArchive::NExtract::NOperationResult::kHeadersError:
-      return E_HEADERS_ERROR;
-    case NArchive::NExtract::NOperationResult::kWrongPassword:
-      return E_WRONG_PASSWORD;
-    default:
-      return E_UNKNOWN_ERROR;
-  }
+HRESULT InArchive::GetNumberOfEntries(UInt32& number) {
+  return this->in_archive->GetNumberOfItems(&number);
 }
 
-HRESULT ArchiveExtractCallback::CryptoGetTextPassword(BSTR* password) {
-  has_asked_password = true;
-  *password = ::SysAllocString(this->password);
-  return this->password != nullptr ? S_OK : E_NO_PASSWORD;
+void InArchive::SetCacheKey(const char* key) {
+  std::lock_guard<std::mutex> lock(limits_mutex);
+  this->cache_key = key != nullptr ? key : "";
 }
 
-HRESULT ArchiveExtractCallback::GetBetterResult(HRESULT result) {
-  if (result == S_OK) {
-    return S_OK;
-  } else if (has_asked_password) {
-    if (password != nullptr) {
-      return E_WRONG_PASSWORD;
-    } else {
-      return E_NO_PASSWORD;
-    }
-  } else {
-    return result;
-  }
+void InArchive::SetExtractLimits(const ExtractLimits& limits) {
+  std::lock_guard<std::mutex> lock(limits_mutex);
+  this->limits = limits;
 }
 
-InArchive::InArchive(
-    InArchive* parent,
-    CMyComPtr<IInArchive>& in_archive,
-    AString& format_name
-) :
-    parent(parent),
-    in_archive(in_archive),
-    format_name(format_name) { }
+void InArchive::SetDecodeThreads(UInt32 thread_count) {
+  decode_thread_count = thread_count;
+}
 
-InArchive::~InArchive() {
-  this->in_archive->Close();
-  if (parent != nullptr) {
-    delete parent;
-    parent = nullptr;
-  }
+UInt64 InArchive::GetParallelChunkCount() {
+  return parallel_chunk_count;
 }
 
-const AString& InArchive::GetFormatName() {
-  return this->format_name;
+void InArchive::SetWritePipeline(UInt32 buffer_count, UInt32 buffer_size) {
+  pipeline_buffer_size = buffer_size;
+  pipeline_buffer_count = buffer_count;
 }
 
-HRESULT InArchive::GetNumberOfEntries(UInt32& number) {
-  return this->in_archive->GetNumberOfItems(&number);
+ExtractLimits InArchive::GetExtractLimits() {
+  std::lock_guard<std::mutex> lock(limits_mutex);
+  return limits;
+}
+
+AString InArchive::GetCacheKey() {
+  std::lock_guard<std::mutex> lock(limits_mutex);
+  return cache_key;
+}
+
+HRESULT InArchive::ApplyLimits(const UInt32* indices, UInt32 count, ArchiveExtractCallback* callback) {
+  ExtractLimits limits = GetExtractLimits();
+
+  if (limits.max_memory != 0) {
+    // Refused before the decoders allocate anything
+    if (indices == nullptr) {
+      RETURN_SAME_IF_NOT_ZERO(GetNumberOfEntries(count));
+    }
+    for (UInt32 i = 0; i < count; i++) {
+      UInt32 index = indices != nullptr ? indices[i] : i;
+      if (GetEntryDictionarySize(index, nullptr) > limits.max_memory) {
+        return E_MEMORY_LIMIT_EXCEEDED;
+      }
+    }
+  }
+
+  callback->SetLimits(limits);
+  return S_OK;
+}
+
+bool InArchive::IsCacheable(UInt32 index, const AString& cache_key) {
+  if (cache_key.IsEmpty() || !EntryCache::GetInstance()->IsEnabled()) {
+    return false;
+  }
+
+  // Decrypted data would skip the password check
+  bool encrypted = false;
+  GetEntryBooleanProperty(index, kpidEncrypted, &encrypted);
+  if (encrypted) {
+    return false;
+  }
+
+  Int64 size = 0;
+  if (GetEntryLongProperty(index, kpidSize, &size) == S_OK &&
+      static_cast<UInt64>(size) > EntryCache::GetInstance()->GetMaxEntrySize()) {
+    return false;
+  }
+  return true;
 }
 
 static PropType VarTypeToPropType(VARTYPE var_enum) {
@@ -344,17 +407,786 @@ GET_ENTRY_PROPERTY_END
 
 HRESULT InArchive::GetEntryStream(UInt32 index, ISequentialInStream** stream) {
   *stream = nullptr;
+
+  AString cache_key = GetCacheKey();
+  CMyComPtr<CReferenceBuf> buffer;
+  if (!cache_key.IsEmpty() && EntryCache::GetInstance()->Get(cache_key, index, buffer)) {
+    CBufInStream* buf_in_stream = new CBufInStream();
+    CMyComPtr<ISequentialInStream> cached(buf_in_stream);
+    buf_in_stream->Init(buffer);
+    *stream = cached.Detach();
+    return S_OK;
+  }
+
+  HRESULT result = GetRangeStream(index, stream);
+  if (result != S_FALSE) {
+    return result;
+  }
+
+  CMyComPtr<XzIndex> xz_index;
+  if (GetXzIndex(xz_index)) {
+    CMyComPtr<IInStream> xz_stream;
+    RETURN_SAME_IF_NOT_ZERO(xz_index->OpenStream(&xz_stream));
+    CMyComPtr<ISequentialInStream> scoped_stream(new ScopedInStream(xz_stream, allocator));
+    *stream = scoped_stream.Detach();
+    return S_OK;
+  }
+
+  CMyComPtr<ChunkedResource> cramfs_file;
+  if (GetCramfsFile(index, cramfs_file)) {
+    CMyComPtr<IInStream> cramfs_stream;
+    RETURN_SAME_IF_NOT_ZERO(cramfs_file->OpenStream(&cramfs_stream));
+    CMyComPtr<ISequentialInStream> scoped_stream(new ScopedInStream(cramfs_stream, allocator));
+    *stream = scoped_stream.Detach();
+    return S_OK;
+  }
+
+  StopDecoder();
   CMyComPtr<IInArchiveGetStream> in_archive_get_stream;
   in_archive->QueryInterface(IID_IInArchiveGetStream, reinterpret_cast<void **>(&in_archive_get_stream));
-  if (in_archive_get_stream != nullptr) {
-    return in_archive_get_stream->GetStream(index, stream);
-  } else {
+  if (in_archive_get_stream == nullptr) {
     return E_NOTIMPL;
   }
+
+  CMyComPtr<ISequentialInStream> handler_stream;
+  {
+    Allocator::Scope scope(allocator);
+    result = scope.GetBetterResult(in_archive_get_stream->GetStream(index, &handler_stream));
+  }
+  if (result != S_OK || handler_stream == nullptr) {
+    return result;
+  }
+  CMyComPtr<ISequentialInStream> scoped_stream(new ScopedInStream(handler_stream, allocator));
+  *stream = scoped_stream.Detach();
+  return S_OK;
+}
+
+HRESULT InArchive::GetRangeStream(UInt32 index, ISequentialInStream** stream) {
+  *stream = nullptr;
+
+  // Other formats with stored entries, like tar and iso, return views from IInArchiveGetStream
+  CMyComPtr<ZipDirectory> directory;
+  if (!GetZipDirectory(index, directory)) {
+    return S_FALSE;
+  }
+
+  CMyComPtr<IInStream> data_stream;
+  HRESULT result = directory->OpenEntryData(index, &data_stream);
+  if (result != S_OK) {
+    // Let the handler decode it
+    return S_FALSE;
+  }
+  *stream = data_stream.Detach();
+  return S_OK;
+}
+
+bool InArchive::GetZipDirectory(UInt32 index, CMyComPtr<ZipDirectory>& directory) {
+  if (format_name != "zip" || in_stream == nullptr) {
+    return false;
+  }
+
+  bool encrypted = false;
+  GetEntryBooleanProperty(index, kpidEncrypted, &encrypted);
+  if (encrypted) {
+    return false;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(zip_directory_mutex);
+    if (!zip_directory_loaded) {
+      zip_directory_loaded = true;
+      UInt32 number = 0;
+      if (ZipDirectory::Open(in_stream, zip_directory) != S_OK ||
+          GetNumberOfEntries(number) != S_OK ||
+          zip_directory->GetNumberOfEntries() != number) {
+        zip_directory = nullptr;
+      }
+    }
+    directory = zip_directory;
+  }
+  if (directory == nullptr) {
+    return false;
+  }
+
+  // The handler lists the entries in the order of the directory, make sure it's the same entry
+  ZipDirectory::Entry entry;
+  if (directory->GetEntry(index, entry) != S_OK) {
+    return false;
+  }
+  Int64 size = -1;
+  Int64 packed_size = -1;
+  Int32 crc = 0;
+  GetEntryLongProperty(index, kpidSize, &size);
+  GetEntryLongProperty(index, kpidPackSize, &packed_size);
+  GetEntryIntProperty(index, kpidCRC, &crc);
+  return static_cast<UInt64>(size) == entry.size &&
+      static_cast<UInt64>(packed_size) == entry.packed_size &&
+      static_cast<UInt32>(crc) == entry.crc;
+}
+
+// Returns the largest dictionary in the method string, 0 if none.
+// "LZMA2:24" is 2^24 bytes, "LZMA:3m" is 3 MiB, "PPMD:o6:mem24" is 2^24 bytes.
+static UInt64 ParseDictionarySize(const char* method) {
+  UInt64 max_size = 0;
+  for (const char* p = method; *p != '\0'; p++) {
+    if (*p != ':') continue;
+
+    const char* start = p + 1;
+    if (strncmp(start, "mem", 3) == 0) {
+      start += 3;
+    } else if (strncmp(start, "d=", 2) == 0) {
+      start += 2;
+    }
+    if (*start < '0' || *start > '9') continue;
+
+    char* end;
+    UInt64 value = strtoull(start, &end, 10);
+    UInt64 size;
+    switch (*end) {
+      case 'k':
+      case 'K':
+        size = value << 10;
+        break;
+      case 'm':
+      case 'M':
+        size = value << 20;
+        break;
+      case 'g':
+      case 'G':
+        size = value << 30;
+        break;
+      case 'b':
+      case 'B':
+        size = value;
+        break;
+      default:
+        // A bare number is a power of two
+        size = value < 64 ? (1ULL << value) : 0;
+        break;
+    }
+    max_size = MAX(max_size, size);
+  }
+  return max_size;
+}
+
+UInt64 InArchive::GetEntryDictionarySize(UInt32 index, AString* method) {
+  UInt64 size = 0;
+
+  AString method_string;
+  BSTR bstr_method = nullptr;
+  if (GetEntryStringProperty(index, kpidMethod, &bstr_method) == S_OK) {
+    method_string.SetFromWStr_if_Ascii(bstr_method);
+    ::SysFreeString(bstr_method);
+    size = ParseDictionarySize(method_string);
+  }
+  if (method != nullptr) {
+    *method = method_string;
+  }
+
+  Int64 dictionary_size;
+  if (GetEntryLongProperty(index, kpidDictionarySize, &dictionary_size) == S_OK && dictionary_size > 0) {
+    size = static_cast<UInt64>(dictionary_size);
+  } else {
+    Int32 int_dictionary_size;
+    if (GetEntryIntProperty(index, kpidDictionarySize, &int_dictionary_size) == S_OK && int_dictionary_size > 0) {
+      size = static_cast<UInt64>(int_dictionary_size);
+    }
+  }
+  return size;
+}
+
+HRESULT InArchive::GetEntryLayouts(std::vector<EntryLayout>& layouts) {
+  UInt32 number = 0;
+  RETURN_SAME_IF_NOT_ZERO(GetNumberOfEntries(number));
+
+  bool solid = false;
+  GetArchiveBooleanProperty(kpidSolid, &solid);
+
+  // The entries of a block are decoded in the order of the indices
+  struct BlockState {
+    UInt32 count;
+    UInt64 bytes;
+  };
+  std::unordered_map<Int32, BlockState> blocks;
+
+  layouts.clear();
+  layouts.reserve(number);
+
+  for (UInt32 i = 0; i < number; i++) {
+    layouts.emplace_back();
+    EntryLayout& layout = layouts.back();
+    layout.index = i;
+    layout.block = -1;
+    layout.position = 0;
+    layout.packed_offset = -1;
+    layout.packed_size = -1;
+    layout.dictionary_size = 0;
+    layout.bytes_before = 0;
+
+    bool is_dir = false;
+    GetEntryBooleanProperty(i, kpidIsDir, &is_dir);
+    Int64 size = 0;
+    GetEntryLongProperty(i, kpidSize, &size);
+
+    Int32 block;
+    if (GetEntryIntProperty(i, kpidBlock, &block) == S_OK) {
+      layout.block = block;
+    } else if (solid && !is_dir && size > 0) {
+      // No block property, the archive is one solid stream
+      layout.block = 0;
+    }
+
+    Int64 value;
+    if (GetEntryLongProperty(i, kpidOffset, &value) == S_OK) {
+      layout.packed_offset = value;
+    }
+    if (GetEntryLongProperty(i, kpidPackSize, &value) == S_OK) {
+      layout.packed_size = value;
+    }
+
+    layout.dictionary_size = GetEntryDictionarySize(i, &layout.method);
+
+    if (layout.block >= 0) {
+      BlockState& state = blocks[layout.block];
+      layout.position = state.count++;
+      layout.bytes_before = state.bytes;
+      state.bytes += static_cast<UInt64>(MAX(size, static_cast<Int64>(0)));
+    }
+  }
+
+  return S_OK;
+}
+
+namespace a7zip {
+
+// Passes the data to the out stream and keeps a copy for EntryCache,
+// the copy is dropped once it's over the limit
+class CacheOutStream :
+    public ISequentialOutStream,
+    public CMyUnknownImp
+{
+ public:
+  CacheOutStream(ISequentialOutStream* out_stream, UInt64 limit) :
+      out_stream(out_stream),
+      limit(limit),
+      overflowed(false) { }
+
+ public:
+  MY_UNKNOWN_IMP
+
+  STDMETHOD(Write)(const void* data, UInt32 size, UInt32* processedSize) {
+    UInt32 processed = 0;
+    HRESULT result = out_stream->Write(data, size, &processed);
+
+    if (!overflowed) {
+      if (buffer.size() + processed > limit) {
+        overflowed = true;
+        std::vector<Byte>().swap(buffer);
+      } else {
+        const Byte* bytes = static_cast<const Byte*>(data);
+        buffer.insert(buffer.end(), bytes, bytes + processed);
+      }
+    }
+
+    if (processedSize != nullptr) {
+      *processedSize = processed;
+    }
+    return result;
+  }
+
+  bool IsOverflowed() { return overflowed; }
+  const std::vector<Byte>& GetBuffer() { return buffer; }
+
+ private:
+  CMyComPtr<ISequentialOutStream> out_stream;
+  UInt64 limit;
+  bool overflowed;
+  std::vector<Byte> buffer;
+};
+
+}
+
+// Writes the cached entry to the out stream
+static HRESULT WriteCachedEntry(
+    CReferenceBuf* buffer,
+    ISequentialOutStream* out_stream,
+    const std::atomic<bool>* cancelled
+) {
+  static const size_t CHUNK_SIZE = 1 << 16;
+  const Byte* data = buffer->Buf;
+  size_t size = buffer->Buf.Size();
+  while (size != 0) {
+    if (cancelled != nullptr && cancelled->load()) {
+      return E_ABORT;
+    }
+    UInt32 processed = 0;
+    RETURN_SAME_IF_NOT_ZERO(out_stream->Write(data, static_cast<UInt32>(MIN(size, CHUNK_SIZE)), &processed));
+    if (processed == 0) {
+      return E_FAIL;
+    }
+    data += processed;
+    size -= processed;
+  }
+  return S_OK;
+}
+
+HRESULT InArchive::ExtractEntry(
+    UInt32 index,
+    BSTR password,
+    CMyComPtr<ISequentialOutStream>& out_stream,
+    const std::atomic<bool>* cancelled
+) {
+  TRACE_SPAN(Trace::TRACE_EXTRACT_ENTRY, nullptr);
+
+  // The key of the entry for Put, even if the key is changed while extracting
+  AString cache_key = GetCacheKey();
+  bool cacheable = IsCacheable(index, cache_key);
+  CMyComPtr<CReferenceBuf> buffer;
+  if (cacheable && EntryCache::GetInstance()->Get(cache_key, index, buffer)) {
+    return WriteCachedEntry(buffer, out_stream, cancelled);
+  }
+
+  CMyComPtr<ISequentialOutStream> stream(out_stream);
+  CMyComPtr<PipelineOutStream> pipeline;
+  UInt32 buffer_count = pipeline_buffer_count;
+  if (buffer_count != 0 && out_stream != nullptr) {
+    pipeline = new PipelineOutStream(out_stream, buffer_count, pipeline_buffer_size);
+    stream = pipeline;
+  }
+
+  CacheOutStream* cache_out_stream = nullptr;
+  if (cacheable && out_stream != nullptr) {
+    cache_out_stream = new CacheOutStream(stream, EntryCache::GetInstance()->GetMaxEntrySize());
+    stream = cache_out_stream;
+  }
+
+  // The clocks of a suspended decoder would count the time between the entries,
+  // and the decoding threads aren't counted
+  bool limited = !GetExtractLimits().IsEmpty();
+  HRESULT result = S_FALSE;
+  if (!limited && out_stream != nullptr) {
+    result = ExtractParallel(index, stream, cancelled);
+  }
+  if (!limited && result == S_FALSE) {
+    result = ExtractResumable(index, password, stream, cancelled);
+  }
+  if (result == S_FALSE) {
+    StopDecoder();
+    Allocator::Scope scope(allocator);
+    CMyComPtr<ArchiveExtractCallback> callback(new ArchiveExtractCallback(index, password, stream, cancelled));
+    result = ApplyLimits(&index, 1, callback);
+    if (result == S_OK) {
+      result = this->in_archive->Extract(&index, 1, false, callback);
+      result = callback->GetBetterResult(result);
+      result = scope.GetBetterResult(result);
+    }
+  }
+
+  if (pipeline != nullptr) {
+    // The out stream may fail after the decoder is done
+    HRESULT pipeline_result = pipeline->Finish();
+    if (result == S_OK) {
+      result = pipeline_result;
+    }
+  }
+
+  if (result == S_OK && cache_out_stream != nullptr && !cache_out_stream->IsOverflowed()) {
+    const std::vector<Byte>& data = cache_out_stream->GetBuffer();
+    EntryCache::GetInstance()->Put(cache_key, index, data.data(), data.size());
+  }
+  return result;
+}
+
+bool InArchive::GetRestOfBlock(UInt32 index, std::vector<UInt32>& indices) {
+  bool solid = false;
+  if (GetArchiveBooleanProperty(kpidSolid, &solid) != S_OK || !solid) {
+    return false;
+  }
+
+  LoadEntryLayouts();
+  if (index >= entry_layouts.size() || entry_layouts[index].block < 0) {
+    return false;
+  }
+
+  const EntryLayout& layout = entry_layouts[index];
+  for (const EntryLayout& other : entry_layouts) {
+    if (other.block == layout.block && other.position >= layout.position) {
+      indices.push_back(other.index);
+    }
+  }
+  std::sort(indices.begin(), indices.end());
+  return indices.size() > 1;
+}
+
+void InArchive::LoadEntryLayouts() {
+  if (!entry_layouts_loaded) {
+    entry_layouts_loaded = true;
+    if (GetEntryLayouts(entry_layouts) != S_OK) {
+      entry_layouts.clear();
+    }
+  }
+}
+
+HRESULT InArchive::ExtractParallel(
+    UInt32 index,
+    ISequentialOutStream* out_stream,
+    const std::atomic<bool>* cancelled
+) {
+  UInt32 thread_count = decode_thread_count;
+  if (thread_count < 2) {
+    return S_FALSE;
+  }
+
+  if (format_name == "gzip" && in_stream != nullptr) {
+    // The decoder reads the same stream
+    StopDecoder();
+    Allocator::Scope scope(allocator);
+    UInt64 chunk_count;
+    HRESULT result = ParallelInflate::DecodeGzip(in_stream, out_stream, thread_count, allocator, chunk_count, cancelled);
+    parallel_chunk_count += chunk_count;
+    return scope.GetBetterResult(result);
+  }
+
+  if (format_name == "7z" && in_stream != nullptr) {
+    return Extract7zLzma2(index, out_stream, thread_count, cancelled);
+  }
+
+  if (format_name == "xz" && in_stream != nullptr) {
+    return ExtractXz(out_stream, thread_count, cancelled);
+  }
+
+  CMyComPtr<ChunkedResource> cramfs_file;
+  if (GetCramfsFile(index, cramfs_file)) {
+    if (cramfs_file->GetSize() < CRAMFS_MIN_PARALLEL_SIZE) {
+      return S_FALSE;
+    }
+    return ExtractChunked(cramfs_file, out_stream, thread_count, cancelled);
+  }
+
+  CMyComPtr<ZipDirectory> directory;
+  ZipDirectory::Entry entry;
+  if (!GetZipDirectory(index, directory) || directory->GetEntry(index, entry) != S_OK ||
+      entry.method != ZIP_METHOD_DEFLATE) {
+    return S_FALSE;
+  }
+  CMyComPtr<IInStream> data_stream;
+  if (directory->OpenEntryPackedData(index, &data_stream) != S_OK) {
+    return S_FALSE;
+  }
+  Allocator::Scope scope(allocator);
+  UInt64 chunk_count;
+  HRESULT result = ParallelInflate::DecodeDeflate(
+      data_stream, entry.packed_size, entry.crc, entry.size, out_stream, thread_count, allocator, chunk_count, cancelled);
+  parallel_chunk_count += chunk_count;
+  return scope.GetBetterResult(result);
+}
+
+// LZMA2 alone, "LZMA2:24" but not "LZMA2:24 BCJ" or "LZMA2:24 7zAES"
+static bool IsLzma2Alone(const char* method) {
+  return strncmp(method, "LZMA2", 5) == 0 && (method[5] == '\0' || method[5] == ':') &&
+      strchr(method, ' ') == nullptr;
+}
+
+HRESULT InArchive::Extract7zLzma2(
+    UInt32 index,
+    ISequentialOutStream* out_stream,
+    UInt32 thread_count,
+    const std::atomic<bool>* cancelled
+) {
+  Int64 size = 0;
+  if (GetEntryLongProperty(index, kpidSize, &size) != S_OK ||
+      static_cast<UInt64>(size) < ParallelLzma2::MIN_PARALLEL_SIZE) {
+    return S_FALSE;
+  }
+
+  std::lock_guard<std::mutex> lock(decoder_mutex);
+  LoadEntryLayouts();
+  if (index >= entry_layouts.size()) {
+    return S_FALSE;
+  }
+  const EntryLayout& layout = entry_layouts[index];
+  if (layout.block < 0 || !IsLzma2Alone(layout.method)) {
+    return S_FALSE;
+  }
+
+  // The packed streams follow the signature header in the order of the blocks.
+  // The first entry of a block has the packed size of the block.
+  std::unordered_map<Int32, Int64> block_packed_sizes;
+  UInt64 block_size = 0;
+  for (const EntryLayout& other : entry_layouts) {
+    if (other.block < 0) continue;
+    if (other.position == 0) {
+      block_packed_sizes[other.block] = other.packed_size;
+    }
+    if (other.block == layout.block) {
+      Int64 other_size = 0;
+      GetEntryLongProperty(other.index, kpidSize, &other_size);
+      block_size += static_cast<UInt64>(MAX(other_size, static_cast<Int64>(0)));
+    }
+  }
+  UInt64 packed_offset = SEVEN_ZIP_SIGNATURE_HEADER_SIZE;
+  Int64 archive_offset = 0;
+  if (GetArchiveLongProperty(kpidOffset, &archive_offset) == S_OK) {
+    packed_offset += static_cast<UInt64>(archive_offset);
+  }
+  for (Int32 block = 0; block < layout.block; block++) {
+    auto it = block_packed_sizes.find(block);
+    if (it == block_packed_sizes.end() || it->second < 0) {
+      return S_FALSE;
+    }
+    packed_offset += static_cast<UInt64>(it->second);
+  }
+  Int64 packed_size = block_packed_sizes[layout.block];
+  if (packed_size <= 0) {
+    return S_FALSE;
+  }
+
+  // The suspended decoder reads the clone of the handler, it's kept for the next entry
+  CMyComPtr<IInStream> lzma2_stream(in_stream->Clone());
+  UInt64 begin = layout.bytes_before;
+  UInt64 end = layout.bytes_before + static_cast<UInt64>(size);
+  std::vector<IndependentChunk> pieces;
+  RETURN_SAME_IF_NOT_ZERO(ParallelLzma2::Split(
+      lzma2_stream, packed_offset, static_cast<UInt64>(packed_size), block_size, begin, end, pieces));
+
+  UInt32 crc = 0;
+  Allocator::Scope scope(allocator);
+  HRESULT result = ParallelLzma2::Decode(
+      lzma2_stream, pieces, begin, end, out_stream, thread_count, allocator, cancelled, &crc);
+  result = scope.GetBetterResult(result);
+  if (result != S_OK) {
+    return result;
+  }
+  parallel_chunk_count += ParallelLzma2::CountPieces(pieces, begin, end);
+
+  Int32 expected_crc = 0;
+  if (GetEntryIntProperty(index, kpidCRC, &expected_crc) == S_OK && static_cast<UInt32>(expected_crc) != crc) {
+    return E_CRC_ERROR;
+  }
+  return S_OK;
+}
+
+bool InArchive::GetXzIndex(CMyComPtr<XzIndex>& index) {
+  if (format_name != "xz" || in_stream == nullptr) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(xz_index_mutex);
+  if (!xz_index_loaded) {
+    xz_index_loaded = true;
+    if (XzIndex::Open(in_stream, xz_index) != S_OK || xz_index->GetChunks().size() < 2 ||
+        xz_index->GetMaxChunkSize() > XZ_MAX_BLOCK_SIZE) {
+      xz_index = nullptr;
+    }
+  }
+  index = xz_index;
+  return index != nullptr;
+}
+
+bool InArchive::GetCramfsFile(UInt32 index, CMyComPtr<ChunkedResource>& file) {
+  if (format_name != "CramFS" || in_stream == nullptr) {
+    return false;
+  }
+
+  CMyComPtr<CramfsImage> image;
+  {
+    std::lock_guard<std::mutex> lock(cramfs_image_mutex);
+    if (!cramfs_image_loaded) {
+      cramfs_image_loaded = true;
+      if (CramfsImage::Open(in_stream, cramfs_image) != S_OK) {
+        cramfs_image = nullptr;
+      }
+    }
+    image = cramfs_image;
+  }
+  if (image == nullptr) {
+    return false;
+  }
+
+  // The handler and the image must agree on the file
+  BSTR path = nullptr;
+  Int64 size = -1;
+  if (GetEntryStringProperty(index, kpidPath, &path) != S_OK) {
+    return false;
+  }
+  AString utf8_path;
+  ConvertUnicodeToUTF8(UString(path), utf8_path);
+  ::SysFreeString(path);
+  if (GetEntryLongProperty(index, kpidSize, &size) != S_OK || size <= 0) {
+    return false;
+  }
+  return image->OpenFile(utf8_path, static_cast<UInt64>(size), file) == S_OK;
+}
+
+HRESULT InArchive::ExtractXz(
+    ISequentialOutStream* out_stream,
+    UInt32 thread_count,
+    const std::atomic<bool>* cancelled
+) {
+  CMyComPtr<XzIndex> index;
+  if (!GetXzIndex(index) || index->GetSize() < XZ_MIN_PARALLEL_SIZE) {
+    return S_FALSE;
+  }
+
+  return ExtractChunked(index, out_stream, thread_count, cancelled);
+}
+
+HRESULT InArchive::ExtractChunked(
+    ChunkedResource* resource,
+    ISequentialOutStream* out_stream,
+    UInt32 thread_count,
+    const std::atomic<bool>* cancelled
+) {
+  // The handler reads its own clone, the chunks are read through the clone of the resource
+  Allocator::Scope scope(allocator);
+  HRESULT result = resource->Extract(0, resource->GetSize(), out_stream, thread_count, allocator, cancelled, nullptr);
+  result = scope.GetBetterResult(result);
+  if (result == S_OK) {
+    parallel_chunk_count += resource->GetChunks().size();
+  }
+  return result;
 }
 
-HRESULT InArchive::ExtractEntry(UInt32 index, BSTR password, CMyComPtr<ISequentialOutStream>& out_stream) {
-  CMyComPtr<ArchiveExtractCallback> callback(new ArchiveExtractCallback(index, password, out_stream));
-  HRESULT result = this->in_archive->Extract(&index, 1, false, callback);
-  return callback->GetBetterResult(result);
+HRESULT InArchive::ExtractResumable(
+    UInt32 index,
+    BSTR password,
+    ISequentialOutStream* out_stream,
+    const std::atomic<bool>* cancelled
+) {
+  std::lock_guard<std::mutex> lock(decoder_mutex);
+
+  if (decoder != nullptr && decoder->CanExtract(index, password)) {
+    HRESULT result = decoder->Extract(index, out_stream, cancelled);
+    if (result == S_OK) {
+      return S_OK;
+    }
+    decoder.reset();
+    if (result != S_FALSE) {
+      return result;
+    }
+  }
+  // Only one extraction can run on the archive
+  decoder.reset();
+
+  std::vector<UInt32> indices;
+  if (!GetRestOfBlock(index, indices)) {
+    return S_FALSE;
+  }
+
+  decoder.reset(new ResumableDecoder(this, indices, password));
+  decoder->Start();
+  HRESULT result = decoder->Extract(index, out_stream, cancelled);
+  if (result != S_OK) {
+    decoder.reset();
+  }
+  return result;
+}
+
+void InArchive::StopDecoder() {
+  std::lock_guard<std::mutex> lock(decoder_mutex);
+  decoder.reset();
+}
+
+HRESULT InArchive::TestEntries(BSTR password, const std::atomic<bool>* cancelled) {
+  StopDecoder();
+  Allocator::Scope scope(allocator);
+  // No index matches, every entry goes to a black hole
+  CMyComPtr<ISequentialOutStream> out_stream = nullptr;
+  CMyComPtr<ArchiveExtractCallback> callback(
+      new ArchiveExtractCallback(static_cast<UInt32>(-1), password, out_stream, cancelled));
+  RETURN_SAME_IF_NOT_ZERO(ApplyLimits(nullptr, 0, callback));
+  HRESULT result = this->in_archive->Extract(nullptr, static_cast<UInt32>(-1), true, callback);
+  result = callback->GetBetterResult(result);
+  return scope.GetBetterResult(result);
+}
+
+// Handlers decode solid blocks in the order of the indices,
+// sorted indices let every block be decoded once
+static HRESULT ExtractSorted(
+    IInArchive* in_archive,
+    const UInt32* indices,
+    UInt32 count,
+    IArchiveExtractCallback* callback
+) {
+  if (indices == nullptr) {
+    return in_archive->Extract(nullptr, static_cast<UInt32>(-1), false, callback);
+  }
+
+  std::vector<UInt32> sorted_indices(indices, indices + count);
+  std::sort(sorted_indices.begin(), sorted_indices.end());
+  sorted_indices.erase(std::unique(sorted_indices.begin(), sorted_indices.end()), sorted_indices.end());
+  return in_archive->Extract(
+      sorted_indices.data(), static_cast<UInt32>(sorted_indices.size()), false, callback);
+}
+
+HRESULT InArchive::ExtractToDirectory(
+    const char* path,
+    const UInt32* indices,
+    UInt32 count,
+    BSTR password,
+    UInt32 hash_algorithms,
+    std::vector<EntryDigest>& digests,
+    const std::atomic<bool>* cancelled
+) {
+  TRACE_SPAN(Trace::TRACE_EXTRACT_ENTRY, nullptr);
+  StopDecoder();
+
+  int dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd < 0) {
+    LOGE("Can't open the directory: %s", path);
+    return E_IO_ERROR;
+  }
+
+  HRESULT result;
+  {
+    Allocator::Scope scope(allocator);
+    CMyComPtr<DirectoryExtractCallback> callback(
+        new DirectoryExtractCallback(in_archive, dir_fd, password, hash_algorithms, &digests, cancelled));
+    result = ApplyLimits(indices, count, callback);
+    if (result == S_OK) {
+      result = ExtractSorted(in_archive, indices, count, callback);
+    }
+    if (result == S_OK) {
+      callback->Finish();
+    }
+    result = callback->GetBetterResult(result);
+    result = scope.GetBetterResult(result);
+  }
+
+  // The callback holds fds under it
+  close(dir_fd);
+  return result;
+}
+
+HRESULT InArchive::Extract(const UInt32* indices, UInt32 count, ArchiveExtractCallback* callback) {
+  StopDecoder();
+  return ExtractWithCallback(indices, count, callback);
+}
+
+HRESULT InArchive::ExtractWithCallback(const UInt32* indices, UInt32 count, ArchiveExtractCallback* callback) {
+  TRACE_SPAN(Trace::TRACE_EXTRACT_ENTRY, nullptr);
+  Allocator::Scope scope(allocator);
+  RETURN_SAME_IF_NOT_ZERO(ApplyLimits(indices, count, callback));
+  HRESULT result = ExtractSorted(in_archive, indices, count, callback);
+  result = callback->GetBetterResult(result);
+  return scope.GetBetterResult(result);
+}
+
+HRESULT InArchive::HashEntries(
+    const UInt32* indices,
+    UInt32 count,
+    BSTR password,
+    UInt32 hash_algorithms,
+    std::vector<EntryDigest>& digests,
+    const std::atomic<bool>* cancelled
+) {
+  TRACE_SPAN(Trace::TRACE_EXTRACT_ENTRY, nullptr);
+  StopDecoder();
+  Allocator::Scope scope(allocator);
+  CMyComPtr<HashExtractCallback> callback(
+      new HashExtractCallback(in_archive, hash_algorithms, password, digests, cancelled));
+  RETURN_SAME_IF_NOT_ZERO(ApplyLimits(indices, count, callback));
+  HRESULT result = ExtractSorted(in_archive, indices, count, callback);
+  result = callback->GetBetterResult(result);
+  return scope.GetBetterResult(result);
 }
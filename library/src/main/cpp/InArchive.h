@@ -17,23 +17,86 @@
 #ifndef __A7ZIP_IN_ARCHIVE_H__
 #define __A7ZIP_IN_ARCHIVE_H__
 
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
 #include <include_windows/windows.h>
 #include <Common/MyCom.h>
 #include <Common/MyString.h>
 #include <7zip/Archive/IArchive.h>
 
+#include "Allocator.h"
+#include "ArchiveExtractCallback.h"
+#include "HashOutStream.h"
 #include "PropType.h"
+#include "ResumableDecoder.h"
+#include "SharedInStream.h"
+#include "ThreadPool.h"
 
 namespace a7zip {
 
+class ChunkedResource;
+class CramfsImage;
+class XzIndex;
+class ZipDirectory;
+
+// Where the data of an entry is and what it costs to reach it
+struct EntryLayout {
+  UInt32 index;
+  // The solid block (7z folder or solid stream), -1 if the entry is decoded alone
+  Int32 block;
+  // The position of the entry in its block
+  UInt32 position;
+  // -1 if unknown
+  Int64 packed_offset;
+  Int64 packed_size;
+  AString method;
+  // 0 if unknown
+  UInt64 dictionary_size;
+  // The unpacked bytes decoded in the block before the entry
+  UInt64 bytes_before;
+};
+
 class InArchive {
  public:
-  InArchive(InArchive* parent, CMyComPtr<IInArchive>& in_archive, AString& format_name);
+  InArchive(
+      InArchive* parent,
+      CMyComPtr<SharedInStream>& in_stream,
+      CMyComPtr<IInArchive>& in_archive,
+      AString& format_name,
+      CMyComPtr<Allocator>& allocator
+  );
   ~InArchive();
 
  public:
   const AString& GetFormatName();
+  Allocator* GetAllocator();
+  // Jobs on one archive run one by one in the queue,
+  // lock it to touch the handler out of the thread pool
+  SerialQueue& GetJobQueue();
+  // An open EntryIterator holds the job queue until it's closed. The sync paths
+  // check it before locking the queue, the thread reading the iterator would wait
+  // for itself otherwise.
+  void RetainIterator();
+  void ReleaseIterator();
+  bool IsIterating();
   HRESULT GetNumberOfEntries(UInt32& number);
+  // Returns E_NOTIMPL if the handler can't update the archive
+  HRESULT GetOutArchive(CMyComPtr<IOutArchive>& out_archive);
+  // Entries are cached in EntryCache under the key, empty key for no cache
+  void SetCacheKey(const char* key);
+  // Applied to the extractions started after it
+  void SetExtractLimits(const ExtractLimits& limits);
+  // ExtractEntry writes to the out stream in another thread through the buffers,
+  // 0 buffer count writes in the decoding thread
+  void SetWritePipeline(UInt32 buffer_count, UInt32 buffer_size);
+  // ExtractEntry decodes big gzip streams, deflated zip entries, LZMA2 7z entries,
+  // multi-block xz files and CramFS files with the threads, less than 2 threads leaves them to the handler
+  void SetDecodeThreads(UInt32 thread_count);
+  // Returns how many deflate chunks, LZMA2 pieces, xz blocks and CramFS pages the threads have decoded
+  UInt64 GetParallelChunkCount();
 
   HRESULT GetArchivePropertyType(PROPID prop_id, PropType* prop_type);
   HRESULT GetArchiveBooleanProperty(PROPID prop_id, bool *bool_prop);
@@ -47,14 +110,135 @@ class InArchive {
   HRESULT GetEntryLongProperty(UInt32 index, PROPID prop_id, Int64* long_prop);
   HRESULT GetEntryStringProperty(UInt32 index, PROPID prop_id, BSTR* str_prop);
 
+  // Stored entries are served as seekable views of the archive stream if it's possible,
+  // xz files of many blocks as seekable streams decoding only the blocks read
   HRESULT GetEntryStream(UInt32 index, ISequentialInStream** stream);
+  // Returns the layouts of all entries, in the order of the indices
+  HRESULT GetEntryLayouts(std::vector<EntryLayout>& layouts);
 
-  HRESULT ExtractEntry(UInt32 index, BSTR password, CMyComPtr<ISequentialOutStream>& out_stream);
+  // Returns E_ABORT if cancelled is set while extracting
+  HRESULT ExtractEntry(
+      UInt32 index,
+      BSTR password,
+      CMyComPtr<ISequentialOutStream>& out_stream,
+      const std::atomic<bool>* cancelled = nullptr
+  );
+  // Decodes all entries and checks them
+  HRESULT TestEntries(BSTR password, const std::atomic<bool>* cancelled = nullptr);
+  // Extracts the entries into files under the directory in one pass,
+  // null indices for all entries. The files are hashed if hash_algorithms isn't 0.
+  HRESULT ExtractToDirectory(
+      const char* path,
+      const UInt32* indices,
+      UInt32 count,
+      BSTR password,
+      UInt32 hash_algorithms,
+      std::vector<EntryDigest>& digests,
+      const std::atomic<bool>* cancelled = nullptr
+  );
+  // Extracts the entries with the callback in one pass, null indices for all entries
+  HRESULT Extract(const UInt32* indices, UInt32 count, ArchiveExtractCallback* callback);
+  // Stops the suspended decoder of ExtractEntry, other extractions can't run beside it
+  void StopDecoder();
+  // Hashes the entries in one pass without writing them, null indices for all entries
+  HRESULT HashEntries(
+      const UInt32* indices,
+      UInt32 count,
+      BSTR password,
+      UInt32 hash_algorithms,
+      std::vector<EntryDigest>& digests,
+      const std::atomic<bool>* cancelled = nullptr
+  );
 
  private:
   InArchive* parent;
+  // The stream the archive is read from, the handler reads a clone of it
+  CMyComPtr<SharedInStream> in_stream;
   CMyComPtr<IInArchive> in_archive;
   AString format_name;
+  CMyComPtr<Allocator> allocator;
+  SerialQueue job_queue;
+  std::atomic<UInt32> iterator_count;
+  // Guards cache_key and limits, they are set while extracting
+  std::mutex limits_mutex;
+  AString cache_key;
+  ExtractLimits limits;
+  std::atomic<UInt32> pipeline_buffer_count;
+  std::atomic<UInt32> pipeline_buffer_size;
+  std::atomic<UInt32> decode_thread_count;
+  std::atomic<UInt64> parallel_chunk_count;
+
+  // ExtractEntry resumes a suspended decoder for a later entry of the same solid block
+  std::mutex decoder_mutex;
+  std::unique_ptr<ResumableDecoder> decoder;
+  std::vector<EntryLayout> entry_layouts;
+  bool entry_layouts_loaded;
+
+  // Locates the data of zip entries in in_stream
+  std::mutex zip_directory_mutex;
+  CMyComPtr<ZipDirectory> zip_directory;
+  bool zip_directory_loaded;
+
+  // The blocks of xz files
+  std::mutex xz_index_mutex;
+  CMyComPtr<XzIndex> xz_index;
+  bool xz_index_loaded;
+
+  // The files of CramFS images
+  std::mutex cramfs_image_mutex;
+  CMyComPtr<CramfsImage> cramfs_image;
+  bool cramfs_image_loaded;
+
+ private:
+  AString GetCacheKey();
+  // Returns false if the entry shouldn't be cached under the key
+  bool IsCacheable(UInt32 index, const AString& cache_key);
+  ExtractLimits GetExtractLimits();
+  // Returns E_MEMORY_LIMIT_EXCEEDED if an entry needs a bigger dictionary,
+  // or sets the limits to the callback. Null indices for all entries.
+  HRESULT ApplyLimits(const UInt32* indices, UInt32 count, ArchiveExtractCallback* callback);
+  // Returns the largest dictionary in the method of the entry, 0 if unknown
+  UInt64 GetEntryDictionarySize(UInt32 index, AString* method);
+  HRESULT ExtractWithCallback(const UInt32* indices, UInt32 count, ArchiveExtractCallback* callback);
+  // Returns S_FALSE if the entry isn't decoded with threads, nothing is written then
+  HRESULT ExtractParallel(UInt32 index, ISequentialOutStream* out_stream, const std::atomic<bool>* cancelled);
+  // Returns S_FALSE if the entry isn't in a 7z block of LZMA2 alone
+  HRESULT Extract7zLzma2(
+      UInt32 index,
+      ISequentialOutStream* out_stream,
+      UInt32 thread_count,
+      const std::atomic<bool>* cancelled
+  );
+  // Returns S_FALSE if the xz file doesn't have many blocks
+  HRESULT ExtractXz(ISequentialOutStream* out_stream, UInt32 thread_count, const std::atomic<bool>* cancelled);
+  // Writes all chunks of the resource with the threads
+  HRESULT ExtractChunked(
+      ChunkedResource* resource,
+      ISequentialOutStream* out_stream,
+      UInt32 thread_count,
+      const std::atomic<bool>* cancelled
+  );
+  // Returns S_FALSE if the entry isn't in a solid block, or the decoder stops before it
+  HRESULT ExtractResumable(
+      UInt32 index,
+      BSTR password,
+      ISequentialOutStream* out_stream,
+      const std::atomic<bool>* cancelled
+  );
+  // Loads entry_layouts once, call it with decoder_mutex held
+  void LoadEntryLayouts();
+  // Returns false if the entry isn't followed by other entries in its solid block
+  bool GetRestOfBlock(UInt32 index, std::vector<UInt32>& indices);
+  // Returns S_FALSE if the entry isn't stored as it is, or it can't be located
+  HRESULT GetRangeStream(UInt32 index, ISequentialInStream** stream);
+  // Returns false if the entry can't be located in the zip
+  bool GetZipDirectory(UInt32 index, CMyComPtr<ZipDirectory>& directory);
+  // Returns false if it isn't an xz file of many blocks
+  bool GetXzIndex(CMyComPtr<XzIndex>& index);
+  // Returns false if the entry isn't a regular file of a CramFS image this can read
+  bool GetCramfsFile(UInt32 index, CMyComPtr<ChunkedResource>& file);
+
+  friend class ResumableDecoder;
 };
 
 }
@@ -0,0 +1,135 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "InputStream.h"
+
+#include "JavaEnv.h"
+#include "Utils.h"
+#include "Log.h"
+#include "Trace.h"
+
+// The encoders read in large blocks
+#define ARRAY_SIZE (64 * 1024)
+
+using namespace a7zip;
+
+bool InputStream::initialized = false;
+jmethodID InputStream::method_read = nullptr;
+jmethodID InputStream::method_close = nullptr;
+
+InputStream::InputStream(
+    jobject stream,
+    jbyteArray array
+) :
+    stream(stream),
+    array(array) { }
+
+InputStream::~InputStream() {
+  JavaEnv env;
+  if (!env.IsValid()) return;
+
+  env->CallVoidMethod(stream, method_close);
+  CLEAR_IF_EXCEPTION_PENDING(env);
+
+  env->DeleteGlobalRef(stream);
+  env->DeleteGlobalRef(array);
+  stream = nullptr;
+  array = nullptr;
+}
+
+HRESULT InputStream::Read(void* data, UInt32 size, UInt32* processedSize) {
+  TRACE_SPAN(Trace::TRACE_STREAM_READ, nullptr);
+
+  if (processedSize != nullptr) {
+    *processedSize = 0;
+  }
+
+  if (size == 0) {
+    return S_OK;
+  }
+
+  JavaEnv env;
+  if (!env.IsValid()) return E_JAVA_EXCEPTION;
+
+  // Make size not bigger than ARRAY_SIZE
+  size = MIN(ARRAY_SIZE, size);
+
+  jint read = env->CallIntMethod(stream, method_read, array, 0, size);
+  RETURN_E_JAVA_EXCEPTION_IF_EXCEPTION_PENDING(env);
+
+  // Check EOF
+  if (read <= 0) {
+    return S_OK;
+  }
+
+  env->GetByteArrayRegion(array, 0, read, static_cast<jbyte*>(data));
+  RETURN_E_JAVA_EXCEPTION_IF_EXCEPTION_PENDING(env);
+  TRACE_SPAN_BYTES(read);
+
+  if (processedSize != nullptr) {
+    *processedSize = static_cast<UInt32>(read);
+  }
+
+  return S_OK;
+}
+
+HRESULT InputStream::Initialize(JNIEnv* env) {
+  if (initialized) {
+    return S_OK;
+  }
+
+  jclass clazz = env->FindClass("java/io/InputStream");
+  if (clazz == nullptr) return E_CLASS_NOT_FOUND;
+
+  method_read = env->GetMethodID(clazz, "read", "([BII)I");
+  if (method_read == nullptr) return E_METHOD_NOT_FOUND;
+  method_close = env->GetMethodID(clazz, "close", "()V");
+  if (method_close == nullptr) return E_METHOD_NOT_FOUND;
+
+  initialized = true;
+  return S_OK;
+}
+
+HRESULT InputStream::Create(
+    JNIEnv* env,
+    jobject stream,
+    CMyComPtr<ISequentialInStream>& in_stream
+) {
+  if (!initialized) {
+    return E_NOT_INITIALIZED;
+  }
+
+  jobject g_stream = env->NewGlobalRef(stream);
+  if (g_stream == nullptr) {
+    return E_OUTOFMEMORY;
+  }
+
+  jbyteArray array = env->NewByteArray(ARRAY_SIZE);
+  if (array == nullptr) {
+    env->DeleteGlobalRef(g_stream);
+    return E_FAILED_CONSTRUCT;
+  }
+
+  jbyteArray g_array = static_cast<jbyteArray>(env->NewGlobalRef(array));
+  if (g_array == nullptr) {
+    env->DeleteGlobalRef(g_stream);
+    return E_OUTOFMEMORY;
+  }
+
+  in_stream = new InputStream(g_stream, g_array);
+
+  return S_OK;
+}
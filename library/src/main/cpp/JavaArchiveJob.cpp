@@ -0,0 +1,442 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "JavaArchiveJob.h"
+
+#include <type_traits>
+
+#include <include_windows/windows.h>
+#include <7zip/PropID.h>
+
+#include "InArchive.h"
+#include "JavaEnv.h"
+#include "JavaHelper.h"
+#include "JavaInArchive.h"
+#include "Log.h"
+#include "OpenVolumeCallback.h"
+#include "OutputStream.h"
+#include "SeekableInputStream.h"
+#include "SevenZip.h"
+#include "ThreadPool.h"
+#include "Utils.h"
+
+#ifdef LOG_TAG
+#  undef LOG_TAG
+#endif //LOG_TAG
+#define LOG_TAG "JavaArchiveJob"
+
+using namespace a7zip;
+
+static bool initialized = false;
+static jclass class_string = nullptr;
+static jmethodID method_on_native_success = nullptr;
+static jmethodID method_on_native_failure = nullptr;
+
+// Reports the result to the java ArchiveJob
+class JavaJob : public Job {
+ public:
+  JavaJob(JobPriority priority, jobject job, SerialQueue* serial_queue = nullptr) :
+      Job(priority, serial_queue),
+      job(job) { }
+
+  ~JavaJob() override {
+    if (job != nullptr) {
+      JavaEnv env;
+      if (!env.IsValid()) return;
+      env->DeleteGlobalRef(job);
+      job = nullptr;
+    }
+  }
+
+ public:
+  void Run() override {
+    // Worker threads are attached for the job
+    JavaEnv env;
+    if (!env.IsValid()) {
+      LOGE("Can't attach the worker thread");
+      return;
+    }
+
+    jlong value = 0;
+    jobject object = nullptr;
+    HRESULT result = IsCancelled() ? E_ABORT : Execute(static_cast<JNIEnv*>(env), value, object);
+    // The archive may be closed once the result is reported
+    LeaveSerialQueue();
+
+    if (result == S_OK) {
+      env->CallVoidMethod(job, method_on_native_success, value, object);
+    } else {
+      jstring message = env->NewStringUTF(JavaHelper::GetMessageForCode(result));
+      jboolean password = static_cast<jboolean>(result == E_NO_PASSWORD || result == E_WRONG_PASSWORD);
+      env->CallVoidMethod(job, method_on_native_failure, message, password);
+      env->DeleteLocalRef(message);
+    }
+    CLEAR_IF_EXCEPTION_PENDING(env);
+
+    if (object != nullptr) {
+      env->DeleteLocalRef(object);
+    }
+
+    // Release it while the thread is attached
+    env->DeleteGlobalRef(job);
+    job = nullptr;
+  }
+
+ protected:
+  // Java streams must be released before returning, they are closed on release
+  virtual HRESULT Execute(JNIEnv* env, jlong& value, jobject& object) = 0;
+
+ private:
+  jobject job;
+};
+
+class OpenJob : public JavaJob {
+ public:
+  OpenJob(
+      JobPriority priority,
+      jobject job,
+      CMyComPtr<IInStream>& in_stream,
+      BSTR password,
+      BSTR filename,
+      CMyComPtr<OpenVolumeCallback>& open_volume_callback,
+      SevenZip::OpenOptions& options
+  ) :
+      JavaJob(priority, job),
+      in_stream(in_stream),
+      password(password),
+      filename(filename),
+      open_volume_callback(open_volume_callback),
+      options(options) { }
+
+  ~OpenJob() override {
+    ::SysFreeString(password);
+    ::SysFreeString(filename);
+  }
+
+ protected:
+  HRESULT Execute(JNIEnv*, jlong& value, jobject&) override {
+    InArchive* archive = nullptr;
+    HRESULT result = SevenZip::OpenArchive(in_stream, password, filename, open_volume_callback, options, &archive);
+    // The archive keeps its own references
+    in_stream.Release();
+    open_volume_callback.Release();
+
+    if (result != S_OK || archive == nullptr) {
+      delete archive;
+      return result != S_OK ? result : E_INTERNAL;
+    }
+
+    value = reinterpret_cast<jlong>(archive);
+    return S_OK;
+  }
+
+ private:
+  CMyComPtr<IInStream> in_stream;
+  BSTR password;
+  BSTR filename;
+  CMyComPtr<OpenVolumeCallback> open_volume_callback;
+  SevenZip::OpenOptions options;
+};
+
+class ExtractJob : public JavaJob {
+ public:
+  ExtractJob(
+      JobPriority priority,
+      jobject job,
+      InArchive* archive,
+      UInt32 index,
+      BSTR password,
+      CMyComPtr<ISequentialOutStream>& out_stream
+  ) :
+      JavaJob(priority, job, &archive->GetJobQueue()),
+      archive(archive),
+      index(index),
+      password(password),
+      out_stream(out_stream) { }
+
+  ~ExtractJob() override {
+    ::SysFreeString(password);
+  }
+
+ protected:
+  HRESULT Execute(JNIEnv*, jlong&, jobject&) override {
+    HRESULT result = archive->ExtractEntry(index, password, out_stream, GetCancelledFlag());
+    out_stream.Release();
+    return result;
+  }
+
+ private:
+  InArchive* archive;
+  UInt32 index;
+  BSTR password;
+  CMyComPtr<ISequentialOutStream> out_stream;
+};
+
+class TestJob : public JavaJob {
+ public:
+  TestJob(JobPriority priority, jobject job, InArchive* archive, BSTR password) :
+      JavaJob(priority, job, &archive->GetJobQueue()),
+      archive(archive),
+      password(password) { }
+
+  ~TestJob() override {
+    ::SysFreeString(password);
+  }
+
+ protected:
+  HRESULT Execute(JNIEnv*, jlong&, jobject&) override {
+    return archive->TestEntries(password, GetCancelledFlag());
+  }
+
+ private:
+  InArchive* archive;
+  BSTR password;
+};
+
+class ListJob : public JavaJob {
+ public:
+  ListJob(JobPriority priority, jobject job, InArchive* archive) :
+      JavaJob(priority, job, &archive->GetJobQueue()),
+      archive(archive) { }
+
+ protected:
+  HRESULT Execute(JNIEnv* env, jlong& value, jobject& object) override {
+    UInt32 number = 0;
+    RETURN_SAME_IF_NOT_ZERO(archive->GetNumberOfEntries(number));
+
+    jobjectArray paths = env->NewObjectArray(static_cast<jsize>(number), class_string, nullptr);
+    if (paths == nullptr) {
+      CLEAR_IF_EXCEPTION_PENDING(env);
+      return E_OUTOFMEMORY;
+    }
+
+    for (UInt32 i = 0; i < number; i++) {
+      if (IsCancelled()) {
+        env->DeleteLocalRef(paths);
+        return E_ABORT;
+      }
+
+      BSTR path = nullptr;
+      if (archive->GetEntryStringProperty(i, kpidPath, &path) != S_OK || path == nullptr) {
+        // Leave null for entries without path
+        continue;
+      }
+      jstring jpath = env->NewString(reinterpret_cast<const jchar*>(path), ::SysStringLen(path));
+      ::SysFreeString(path);
+      if (jpath == nullptr) {
+        CLEAR_IF_EXCEPTION_PENDING(env);
+        env->DeleteLocalRef(paths);
+        return E_OUTOFMEMORY;
+      }
+      env->SetObjectArrayElement(paths, static_cast<jsize>(i), jpath);
+      env->DeleteLocalRef(jpath);
+    }
+
+    value = number;
+    object = paths;
+    return S_OK;
+  }
+
+ private:
+  InArchive* archive;
+};
+
+static JobPriority ToJobPriority(jint priority) {
+  if (priority < JOB_PRIORITY_LOW) return JOB_PRIORITY_LOW;
+  if (priority > JOB_PRIORITY_HIGH) return JOB_PRIORITY_HIGH;
+  return static_cast<JobPriority>(priority);
+}
+
+static jlong Submit(Job* job) {
+  return static_cast<jlong>(ThreadPool::GetInstance()->Submit(job));
+}
+
+static jlong NativeOpen(
+    JNIEnv* env,
+    jclass,
+    jobject stream,
+    jstring password,
+    jstring filename,
+    jobject open_volume_callback,
+    jstring preferred_format,
+    jobjectArray allowed_formats,
+    jboolean fallback_enabled,
+    jint max_open_volumes,
+    jboolean volume_prefetch_enabled,
+    jint priority,
+    jobject job
+) {
+  CMyComPtr<IInStream> in_stream = nullptr;
+  HRESULT result = SeekableInputStream::Create(env, stream, in_stream);
+  if (result != S_OK || in_stream == nullptr) {
+    // Call java methods before throw exception
+    if (in_stream != nullptr) {
+      in_stream.Release();
+    }
+    THROW_ARCHIVE_EXCEPTION_RET(env, 0, result);
+  }
+
+  CMyComPtr<OpenVolumeCallback> open_volume_callback_wrapper = nullptr;
+  BSTR bstr_filename = nullptr;
+  if (filename != nullptr && open_volume_callback != nullptr) {
+    result = OpenVolumeCallback::Create(env, open_volume_callback, open_volume_callback_wrapper);
+    if (result != S_OK) {
+      // Call java methods before throw exception
+      in_stream.Release();
+      THROW_ARCHIVE_EXCEPTION_RET(env, 0, result);
+    }
+    bstr_filename = JavaInArchive::JStringToBSTR(env, filename);
+  }
+
+  SevenZip::OpenOptions options;
+  JavaInArchive::GetOpenOptions(env, preferred_format, allowed_formats, fallback_enabled,
+      max_open_volumes, volume_prefetch_enabled, options);
+
+  return Submit(new OpenJob(
+      ToJobPriority(priority),
+      env->NewGlobalRef(job),
+      in_stream,
+      JavaInArchive::JStringToBSTR(env, password),
+      bstr_filename,
+      open_volume_callback_wrapper,
+      options
+  ));
+}
+
+static jlong NativeExtractEntry(
+    JNIEnv* env,
+    jclass,
+    jlong native_ptr,
+    jint index,
+    jstring password,
+    jobject stream,
+    jint priority,
+    jobject job
+) {
+  CHECK_CLOSED_RET(env, 0, native_ptr);
+  InArchive* archive = reinterpret_cast<InArchive*>(native_ptr);
+
+  CMyComPtr<ISequentialOutStream> out_stream = nullptr;
+  HRESULT result = OutputStream::Create(env, stream, out_stream);
+  if (result != S_OK || out_stream == nullptr) {
+    if (out_stream != nullptr) {
+      // Call java methods before throw exception
+      out_stream.Release();
+    }
+    THROW_ARCHIVE_EXCEPTION_RET(env, 0, result);
+  }
+
+  return Submit(new ExtractJob(
+      ToJobPriority(priority),
+      env->NewGlobalRef(job),
+      archive,
+      static_cast<UInt32>(index),
+      JavaInArchive::JStringToBSTR(env, password),
+      out_stream
+  ));
+}
+
+static jlong NativeTest(
+    JNIEnv* env,
+    jclass,
+    jlong native_ptr,
+    jstring password,
+    jint priority,
+    jobject job
+) {
+  CHECK_CLOSED_RET(env, 0, native_ptr);
+  InArchive* archive = reinterpret_cast<InArchive*>(native_ptr);
+
+  return Submit(new TestJob(
+      ToJobPriority(priority),
+      env->NewGlobalRef(job),
+      archive,
+      JavaInArchive::JStringToBSTR(env, password)
+  ));
+}
+
+static jlong NativeList(
+    JNIEnv* env,
+    jclass,
+    jlong native_ptr,
+    jint priority,
+    jobject job
+) {
+  CHECK_CLOSED_RET(env, 0, native_ptr);
+  InArchive* archive = reinterpret_cast<InArchive*>(native_ptr);
+
+  return Submit(new ListJob(ToJobPriority(priority), env->NewGlobalRef(job), archive));
+}
+
+static jboolean NativeCancel(
+    JNIEnv*,
+    jclass,
+    jlong id
+) {
+  return static_cast<jboolean>(ThreadPool::GetInstance()->Cancel(static_cast<UInt64>(id)));
+}
+
+static JNINativeMethod job_methods[] = {
+    { "nativeOpen",
+      "(Lcom/hippo/a7zip/SeekableInputStream;Ljava/lang/String;Ljava/lang/String;Lcom/hippo/a7zip/InArchive$OpenVolumeCallback;Ljava/lang/String;[Ljava/lang/String;ZIZILcom/hippo/a7zip/ArchiveJob;)J",
+      reinterpret_cast<void *>(NativeOpen) },
+    { "nativeExtractEntry",
+      "(JILjava/lang/String;Ljava/io/OutputStream;ILcom/hippo/a7zip/ArchiveJob;)J",
+      reinterpret_cast<void *>(NativeExtractEntry) },
+    { "nativeTest",
+      "(JLjava/lang/String;ILcom/hippo/a7zip/ArchiveJob;)J",
+      reinterpret_cast<void *>(NativeTest) },
+    { "nativeList",
+      "(JILcom/hippo/a7zip/ArchiveJob;)J",
+      reinterpret_cast<void *>(NativeList) },
+    { "nativeCancel",
+      "(J)Z",
+      reinterpret_cast<void *>(NativeCancel) }
+};
+
+HRESULT JavaArchiveJob::Initialize(JNIEnv* env) {
+  if (initialized) {
+    return S_OK;
+  }
+
+  // Worker threads can't find app classes, cache them here
+  jclass clazz = env->FindClass("java/lang/String");
+  if (clazz == nullptr) return E_CLASS_NOT_FOUND;
+  class_string = static_cast<jclass>(env->NewGlobalRef(clazz));
+  if (class_string == nullptr) return E_OUTOFMEMORY;
+
+  clazz = env->FindClass("com/hippo/a7zip/ArchiveJob");
+  if (clazz == nullptr) return E_CLASS_NOT_FOUND;
+  method_on_native_success = env->GetMethodID(clazz, "onNativeSuccess", "(JLjava/lang/Object;)V");
+  if (method_on_native_success == nullptr) return E_METHOD_NOT_FOUND;
+  method_on_native_failure = env->GetMethodID(clazz, "onNativeFailure", "(Ljava/lang/String;Z)V");
+  if (method_on_native_failure == nullptr) return E_METHOD_NOT_FOUND;
+
+  initialized = true;
+  return S_OK;
+}
+
+HRESULT JavaArchiveJob::RegisterMethods(JNIEnv* env) {
+  jclass clazz = env->FindClass("com/hippo/a7zip/ArchiveJob");
+  if (clazz == nullptr) return E_CLASS_NOT_FOUND;
+
+  jint result = env->RegisterNatives(clazz, job_methods, std::extent<decltype(job_methods)>::value);
+  if (result < 0) {
+    return E_FAILED_REGISTER;
+  }
+
+  return S_OK;
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "JavaEntryCache.h"
+
+#include <type_traits>
+
+#include "EntryCache.h"
+#include "JavaHelper.h"
+#include "Utils.h"
+
+using namespace a7zip;
+
+static void NativeConfigure(
+    JNIEnv* env,
+    jclass,
+    jlong memory_capacity,
+    jstring dir,
+    jlong disk_capacity
+) {
+  const char* c_dir = nullptr;
+  if (dir != nullptr) {
+    c_dir = env->GetStringUTFChars(dir, nullptr);
+    if (c_dir == nullptr) return;
+  }
+
+  EntryCache::GetInstance()->Configure(
+      memory_capacity > 0 ? static_cast<UInt64>(memory_capacity) : 0,
+      c_dir,
+      disk_capacity > 0 ? static_cast<UInt64>(disk_capacity) : 0
+  );
+
+  if (c_dir != nullptr) {
+    env->ReleaseStringUTFChars(dir, c_dir);
+  }
+}
+
+static void NativeClear(JNIEnv*, jclass) {
+  EntryCache::GetInstance()->Clear();
+}
+
+static jlongArray NativeGetStats(JNIEnv* env, jclass) {
+  EntryCache::Stats stats;
+  EntryCache::GetInstance()->GetStats(stats);
+
+  jlong values[] = {
+      static_cast<jlong>(stats.memory_hits),
+      static_cast<jlong>(stats.disk_hits),
+      static_cast<jlong>(stats.misses),
+      static_cast<jlong>(stats.memory_evictions),
+      static_cast<jlong>(stats.disk_evictions),
+      static_cast<jlong>(stats.memory_size),
+      static_cast<jlong>(stats.disk_size),
+  };
+  jsize length = std::extent<decltype(values)>::value;
+
+  jlongArray array = env->NewLongArray(length);
+  if (array == nullptr) return nullptr;
+  env->SetLongArrayRegion(array, 0, length, values);
+  return array;
+}
+
+static JNINativeMethod cache_methods[] = {
+    { "nativeConfigure",
+      "(JLjava/lang/String;J)V",
+      reinterpret_cast<void *>(NativeConfigure) },
+    { "nativeClear",
+      "()V",
+      reinterpret_cast<void *>(NativeClear) },
+    { "nativeGetStats",
+      "()[J",
+      reinterpret_cast<void *>(NativeGetStats) }
+};
+
+HRESULT JavaEntryCache::RegisterMethods(JNIEnv* env) {
+  jclass clazz = env->FindClass("com/hippo/a7zip/EntryCache");
+  if (clazz == nullptr) return E_CLASS_NOT_FOUND;
+
+  jint result = env->RegisterNatives(clazz, cache_methods, std::extent<decltype(cache_methods)>::value);
+  if (result < 0) {
+    return E_FAILED_REGISTER;
+  }
+
+  return S_OK;
+}
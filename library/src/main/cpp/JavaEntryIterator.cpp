@@ -0,0 +1,105 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "JavaEntryIterator.h"
+
+#include <type_traits>
+
+#include "EntryIterator.h"
+#include "JavaHelper.h"
+#include "Utils.h"
+
+using namespace a7zip;
+
+static jint NativeNext(
+    JNIEnv* env,
+    jclass,
+    jlong native_ptr
+) {
+  CHECK_CLOSED_RET(env, -1, native_ptr);
+  EntryIterator* iterator = reinterpret_cast<EntryIterator*>(native_ptr);
+
+  UInt32 index = 0;
+  HRESULT result = iterator->Next(index);
+  if (result == S_FALSE) {
+    return -1;
+  }
+  if (result != S_OK) {
+    THROW_ARCHIVE_EXCEPTION_RET(env, -1, result);
+  }
+  return static_cast<jint>(index);
+}
+
+static jint NativeRead(
+    JNIEnv* env,
+    jclass,
+    jlong native_ptr,
+    jbyteArray array,
+    jint offset,
+    jint length
+) {
+  CHECK_CLOSED_RET(env, 0, native_ptr);
+  EntryIterator* iterator = reinterpret_cast<EntryIterator*>(native_ptr);
+
+  jbyte* bytes = env->GetByteArrayElements(array, nullptr);
+  if (bytes == nullptr) THROW_IO_EXCEPTION_RET(env, 0, E_JAVA_EXCEPTION);
+
+  UInt32 processed_size;
+  HRESULT result = iterator->Read(bytes + offset, static_cast<UInt32>(length), &processed_size);
+  env->ReleaseByteArrayElements(array, bytes, 0);
+  if (result != S_OK) THROW_IO_EXCEPTION_RET(env, 0, result);
+
+  if (length != 0 && processed_size == 0) {
+    // End of the entry
+    return -1;
+  }
+
+  return processed_size;
+}
+
+static void NativeClose(
+    JNIEnv* env,
+    jclass,
+    jlong native_ptr
+) {
+  CHECK_CLOSED(env, native_ptr);
+  EntryIterator* iterator = reinterpret_cast<EntryIterator*>(native_ptr);
+  delete iterator;
+}
+
+static JNINativeMethod iterator_methods[] = {
+    { "nativeNext",
+      "(J)I",
+      reinterpret_cast<void *>(NativeNext) },
+    { "nativeRead",
+      "(J[BII)I",
+      reinterpret_cast<void *>(NativeRead) },
+    { "nativeClose",
+      "(J)V",
+      reinterpret_cast<void *>(NativeClose) }
+};
+
+HRESULT JavaEntryIterator::RegisterMethods(JNIEnv* env) {
+  jclass clazz = env->FindClass("com/hippo/a7zip/EntryIterator");
+  if (clazz == nullptr) return E_CLASS_NOT_FOUND;
+
+  jint result = env->RegisterNatives(clazz, iterator_methods, std::extent<decltype(iterator_methods)>::value);
+  if (result < 0) {
+    return E_FAILED_REGISTER;
+  }
+
+  return S_OK;
+}
@@ -51,7 +51,7 @@ jint JavaHelper::ThrowException(
   return result;
 }
 
-static const char* GetMessageForCode(HRESULT code) {
+const char* JavaHelper::GetMessageForCode(HRESULT code) {
   switch (code) {
     case E_NOT_INITIALIZED:
       return "The module is not initialized";
@@ -78,6 +78,10 @@ static const char* GetMessageForCode(HRESULT code) {
       return "Unsupported extract mode";
     case E_NO_OUT_STREAM:
       return "No out stream";
+    case E_NO_IN_STREAM:
+      return "No in stream";
+    case E_ITERATOR_RUNNING:
+      return "An entry iterator is running";
     case E_UNSUPPORTED_METHOD:
       return "Unsupported method";
     case E_DATA_ERROR:
@@ -102,6 +106,22 @@ static const char* GetMessageForCode(HRESULT code) {
       return "Wrong password";
     case E_NO_PASSWORD:
       return "No password";
+    case E_MEMORY_BUDGET_EXCEEDED:
+      return "Memory budget exceeded";
+    case E_OUTPUT_LIMIT_EXCEEDED:
+      return "Output limit exceeded";
+    case E_RATIO_LIMIT_EXCEEDED:
+      return "Compression ratio limit exceeded";
+    case E_MEMORY_LIMIT_EXCEEDED:
+      return "Memory limit exceeded";
+    case E_TIME_LIMIT_EXCEEDED:
+      return "Time limit exceeded";
+    case E_IO_ERROR:
+      return "I/O error";
+    case E_UNSAFE_PATH:
+      return "Unsafe entry path";
+    case E_ABORT:
+      return "Cancelled";
     case E_NOTIMPL:
       return "Not implemented";
     case E_OUTOFMEMORY:
@@ -83,6 +83,8 @@ namespace JavaHelper {
 jint ThrowException(JNIEnv* env, const char* exception_name, const char* message, ...);
 jint ThrowException(JNIEnv* env, const char* exception_name, HRESULT code);
 
+const char* GetMessageForCode(HRESULT code);
+
 }
 }
 
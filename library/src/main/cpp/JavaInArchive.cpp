@@ -17,11 +17,15 @@
 #include "JavaInArchive.h"
 
 #include <cstdio>
+#include <mutex>
 #include <type_traits>
+#include <vector>
 
 #include <include_windows/windows.h>
 #include <7zip/Archive/IArchive.h>
 
+#include "EntryIterator.h"
+#include "HashOutStream.h"
 #include "OpenVolumeCallback.h"
 #include "SeekableInputStream.h"
 #include "JavaHelper.h"
@@ -39,6 +43,12 @@
 
 using namespace a7zip;
 
+static bool initialized = false;
+static jclass class_entry_digest = nullptr;
+static jmethodID constructor_entry_digest = nullptr;
+static jclass class_entry_layout = nullptr;
+static jmethodID constructor_entry_layout = nullptr;
+
 static void CopyJStringToBSTR(BSTR bstr, const jchar* jstr, int length) {
   for (int i = 0; i < length; i++) {
     *bstr++ = *jstr++;
@@ -46,7 +56,7 @@ static void CopyJStringToBSTR(BSTR bstr, const jchar* jstr, int length) {
   *bstr = 0;
 }
 
-static BSTR JStringToBSTR(JNIEnv* env, jstring jstr) {
+BSTR JavaInArchive::JStringToBSTR(JNIEnv* env, jstring jstr) {
   BSTR bstr = nullptr;
   if (jstr != nullptr) {
     jsize length = env->GetStringLength(jstr);
@@ -58,14 +68,58 @@ static BSTR JStringToBSTR(JNIEnv* env, jstring jstr) {
   return bstr;
 }
 
+static void JStringToAString(JNIEnv* env, jstring jstr, AString& astr) {
+  astr.Empty();
+  if (jstr != nullptr) {
+    const char* chars = env->GetStringUTFChars(jstr, nullptr);
+    if (chars != nullptr) {
+      astr = chars;
+      env->ReleaseStringUTFChars(jstr, chars);
+    }
+  }
+}
+
+void JavaInArchive::GetOpenOptions(
+    JNIEnv* env,
+    jstring preferred_format,
+    jobjectArray allowed_formats,
+    jboolean fallback_enabled,
+    jint max_open_volumes,
+    jboolean volume_prefetch_enabled,
+    SevenZip::OpenOptions& options
+) {
+  JStringToAString(env, preferred_format, options.preferred_format);
+  options.allowed_formats.Clear();
+  if (allowed_formats != nullptr) {
+    jsize length = env->GetArrayLength(allowed_formats);
+    for (jsize i = 0; i < length; i++) {
+      jstring format = static_cast<jstring>(env->GetObjectArrayElement(allowed_formats, i));
+      JStringToAString(env, format, options.allowed_formats.AddNew());
+      env->DeleteLocalRef(format);
+    }
+  }
+  options.fallback_enabled = fallback_enabled != JNI_FALSE;
+  options.max_open_volumes = static_cast<unsigned>(MAX(max_open_volumes, 0));
+  options.volume_prefetch_enabled = volume_prefetch_enabled != JNI_FALSE;
+}
+
 static jlong NativeOpen(
     JNIEnv* env,
     jclass,
     jobject stream,
     jstring password,
     jstring filename,
-    jobject open_volume_callback
+    jobject open_volume_callback,
+    jstring preferred_format,
+    jobjectArray allowed_formats,
+    jboolean fallback_enabled,
+    jint max_open_volumes,
+    jboolean volume_prefetch_enabled
 ) {
+  SevenZip::OpenOptions options;
+  JavaInArchive::GetOpenOptions(env, preferred_format, allowed_formats, fallback_enabled,
+      max_open_volumes, volume_prefetch_enabled, options);
+
   CMyComPtr<IInStream> in_stream = nullptr;
   HRESULT result = SeekableInputStream::Create(env, stream, in_stream);
   if (result != S_OK || in_stream == nullptr) {
@@ -89,12 +143,12 @@ static jlong NativeOpen(
       }
       THROW_ARCHIVE_EXCEPTION_RET(env, 0, result);
     }
-    bstr_filename = JStringToBSTR(env, filename);
+    bstr_filename = JavaInArchive::JStringToBSTR(env, filename);
   }
-  bstr_password = JStringToBSTR(env, password);
+  bstr_password = JavaInArchive::JStringToBSTR(env, password);
 
   InArchive* archive = nullptr;
-  result = SevenZip::OpenArchive(in_stream, bstr_password, bstr_filename, open_volume_callback_wrapper, &archive);
+  result = SevenZip::OpenArchive(in_stream, bstr_password, bstr_filename, open_volume_callback_wrapper, options, &archive);
 
   ::SysFreeString(bstr_password);
   ::SysFreeString(bstr_filename);
@@ -240,7 +294,11 @@ static jobject NativeGetEntryStream(
   InArchive* archive = reinterpret_cast<InArchive*>(native_ptr);
 
   CMyComPtr<ISequentialInStream> sequential_in_stream = nullptr;
-  HRESULT result = archive->GetEntryStream(static_cast<UInt32>(index), &sequential_in_stream);
+  HRESULT result = E_ITERATOR_RUNNING;
+  if (!archive->IsIterating()) {
+    std::lock_guard<SerialQueue> lock(archive->GetJobQueue());
+    result = archive->GetEntryStream(static_cast<UInt32>(index), &sequential_in_stream);
+  }
   if (result != S_OK || sequential_in_stream == nullptr) {
     if (sequential_in_stream != nullptr) {
       // Release the stream manually before throw java exception
@@ -259,10 +317,12 @@ static jobject NativeGetEntryStream(
     result = JavaSeekableInputStream::NewInstance(env, in_stream, &object);
     if (object == nullptr) {
       // Release the stream manually before throw java exception
-      in_stream->Release();
-      sequential_in_stream->Release();
+      in_stream.Release();
+      sequential_in_stream.Release();
       THROW_ARCHIVE_EXCEPTION_RET(env, nullptr, result);
     }
+    // The java object holds the reference and releases it in close()
+    in_stream.Detach();
     return object;
   } else {
     // It's just an ISequentialInStream
@@ -270,9 +330,11 @@ static jobject NativeGetEntryStream(
     result = JavaInputStream::NewInstance(env, sequential_in_stream, &object);
     if (object == nullptr) {
       // Release the stream manually before throw java exception
-      sequential_in_stream->Release();
+      sequential_in_stream.Release();
       THROW_ARCHIVE_EXCEPTION_RET(env, nullptr, result);
     }
+    // The java object holds the reference and releases it in close()
+    sequential_in_stream.Detach();
     return object;
   }
 }
@@ -309,7 +371,11 @@ static void NativeExtractEntry(
     CopyJStringToBSTR(bstr_password, j_password, length);
   }
 
-  result = archive->ExtractEntry(static_cast<UInt32>(index), bstr_password, out_stream);
+  result = E_ITERATOR_RUNNING;
+  if (!archive->IsIterating()) {
+    std::lock_guard<SerialQueue> lock(archive->GetJobQueue());
+    result = archive->ExtractEntry(static_cast<UInt32>(index), bstr_password, out_stream);
+  }
 
   if (password != nullptr) {
     ::SysFreeString(bstr_password);
@@ -323,6 +389,440 @@ static void NativeExtractEntry(
   }
 }
 
+static jbyteArray NewDigestBytes(JNIEnv* env, const Byte* bytes, jsize length) {
+  jbyteArray array = env->NewByteArray(length);
+  if (array != nullptr) {
+    env->SetByteArrayRegion(array, 0, length, reinterpret_cast<const jbyte*>(bytes));
+  }
+  return array;
+}
+
+static jobject NewEntryDigest(JNIEnv* env, const EntryDigest& digest) {
+  jbyteArray sha1 = nullptr;
+  if ((digest.algorithms & HASH_SHA1) != 0) {
+    sha1 = NewDigestBytes(env, digest.sha1, SHA1_DIGEST_SIZE);
+    if (sha1 == nullptr) return nullptr;
+  }
+  jbyteArray sha256 = nullptr;
+  if ((digest.algorithms & HASH_SHA256) != 0) {
+    sha256 = NewDigestBytes(env, digest.sha256, SHA256_DIGEST_SIZE);
+    if (sha256 == nullptr) return nullptr;
+  }
+
+  jobject object = env->NewObject(
+      class_entry_digest,
+      constructor_entry_digest,
+      static_cast<jint>(digest.index),
+      static_cast<jint>(digest.algorithms),
+      static_cast<jlong>(digest.size),
+      static_cast<jint>(digest.crc32),
+      static_cast<jlong>(digest.crc64),
+      sha1,
+      sha256
+  );
+
+  if (sha1 != nullptr) env->DeleteLocalRef(sha1);
+  if (sha256 != nullptr) env->DeleteLocalRef(sha256);
+  return object;
+}
+
+static jobjectArray NewEntryDigestArray(JNIEnv* env, const std::vector<EntryDigest>& digests) {
+  jobjectArray array = env->NewObjectArray(static_cast<jsize>(digests.size()), class_entry_digest, nullptr);
+  if (array == nullptr) return nullptr;
+
+  for (size_t i = 0; i < digests.size(); i++) {
+    jobject digest = NewEntryDigest(env, digests[i]);
+    if (digest == nullptr) return nullptr;
+    env->SetObjectArrayElement(array, static_cast<jsize>(i), digest);
+    env->DeleteLocalRef(digest);
+  }
+
+  return array;
+}
+
+static jobjectArray NativeGetEntryLayouts(
+    JNIEnv* env,
+    jclass,
+    jlong native_ptr
+) {
+  CHECK_CLOSED_RET(env, nullptr, native_ptr);
+  InArchive* archive = reinterpret_cast<InArchive*>(native_ptr);
+
+  std::vector<EntryLayout> layouts;
+  HRESULT result = archive->GetEntryLayouts(layouts);
+  if (result != S_OK) {
+    THROW_ARCHIVE_EXCEPTION_RET(env, nullptr, result);
+  }
+
+  jobjectArray array = env->NewObjectArray(static_cast<jsize>(layouts.size()), class_entry_layout, nullptr);
+  if (array == nullptr) return nullptr;
+
+  for (size_t i = 0; i < layouts.size(); i++) {
+    const EntryLayout& layout = layouts[i];
+    jstring method = nullptr;
+    if (!layout.method.IsEmpty()) {
+      method = env->NewStringUTF(layout.method);
+      if (method == nullptr) return nullptr;
+    }
+    jobject object = env->NewObject(
+        class_entry_layout,
+        constructor_entry_layout,
+        static_cast<jint>(layout.index),
+        static_cast<jint>(layout.block),
+        static_cast<jint>(layout.position),
+        static_cast<jlong>(layout.packed_offset),
+        static_cast<jlong>(layout.packed_size),
+        method,
+        static_cast<jlong>(layout.dictionary_size),
+        static_cast<jlong>(layout.bytes_before)
+    );
+    if (method != nullptr) env->DeleteLocalRef(method);
+    if (object == nullptr) return nullptr;
+    env->SetObjectArrayElement(array, static_cast<jsize>(i), object);
+    env->DeleteLocalRef(object);
+  }
+
+  return array;
+}
+
+static jobject NativeExtractEntryWithDigest(
+    JNIEnv* env,
+    jclass,
+    jlong native_ptr,
+    jint index,
+    jstring password,
+    jobject stream,
+    jint algorithms
+) {
+  CHECK_CLOSED_RET(env, nullptr, native_ptr);
+  InArchive* archive = reinterpret_cast<InArchive*>(native_ptr);
+
+  // Only hash it without stream
+  CMyComPtr<ISequentialOutStream> out_stream = nullptr;
+  if (stream != nullptr) {
+    HRESULT result = OutputStream::Create(env, stream, out_stream);
+    if (result != S_OK || out_stream == nullptr) {
+      if (out_stream != nullptr) {
+        // Call java methods before throw exception
+        out_stream.Release();
+      }
+      THROW_ARCHIVE_EXCEPTION_RET(env, nullptr, result);
+    }
+  }
+
+  CMyComPtr<HashOutStream> hash_stream(new HashOutStream(static_cast<UInt32>(algorithms), out_stream));
+  out_stream.Release();
+  CMyComPtr<ISequentialOutStream> hash_out_stream(hash_stream);
+
+  BSTR bstr_password = JavaInArchive::JStringToBSTR(env, password);
+  HRESULT result = E_ITERATOR_RUNNING;
+  if (!archive->IsIterating()) {
+    std::lock_guard<SerialQueue> lock(archive->GetJobQueue());
+    result = archive->ExtractEntry(static_cast<UInt32>(index), bstr_password, hash_out_stream);
+  }
+  ::SysFreeString(bstr_password);
+
+  EntryDigest digest;
+  hash_stream->GetDigest(static_cast<UInt32>(index), digest);
+
+  // Call java methods before throw exception
+  hash_out_stream.Release();
+  hash_stream.Release();
+
+  if (result != S_OK) {
+    THROW_ARCHIVE_EXCEPTION_RET(env, nullptr, result);
+  }
+
+  return NewEntryDigest(env, digest);
+}
+
+// Indices and path are nullable, null path for hashing only
+static jobjectArray ExtractOrHashEntries(
+    JNIEnv* env,
+    InArchive* archive,
+    jstring path,
+    jstring password,
+    jintArray indices,
+    jint algorithms
+) {
+  const char* c_path = nullptr;
+  if (path != nullptr) {
+    c_path = env->GetStringUTFChars(path, nullptr);
+    if (c_path == nullptr) {
+      THROW_ARCHIVE_EXCEPTION_RET(env, nullptr, E_OUTOFMEMORY);
+    }
+  }
+
+  jint* j_indices = nullptr;
+  jsize count = 0;
+  if (indices != nullptr) {
+    count = env->GetArrayLength(indices);
+    j_indices = env->GetIntArrayElements(indices, nullptr);
+  }
+
+  std::vector<EntryDigest> digests;
+  BSTR bstr_password = JavaInArchive::JStringToBSTR(env, password);
+  HRESULT result;
+  std::unique_lock<SerialQueue> lock;
+  if (archive->IsIterating()) {
+    result = E_ITERATOR_RUNNING;
+  } else if (c_path != nullptr) {
+    lock = std::unique_lock<SerialQueue>(archive->GetJobQueue());
+    result = archive->ExtractToDirectory(
+        c_path,
+        reinterpret_cast<const UInt32*>(j_indices),
+        static_cast<UInt32>(count),
+        bstr_password,
+        static_cast<UInt32>(algorithms),
+        digests
+    );
+  } else {
+    lock = std::unique_lock<SerialQueue>(archive->GetJobQueue());
+    result = archive->HashEntries(
+        reinterpret_cast<const UInt32*>(j_indices),
+        static_cast<UInt32>(count),
+        bstr_password,
+        static_cast<UInt32>(algorithms),
+        digests
+    );
+  }
+  if (lock.owns_lock()) {
+    lock.unlock();
+  }
+  ::SysFreeString(bstr_password);
+
+  if (j_indices != nullptr) {
+    env->ReleaseIntArrayElements(indices, j_indices, JNI_ABORT);
+  }
+  if (c_path != nullptr) {
+    env->ReleaseStringUTFChars(path, c_path);
+  }
+
+  if (result != S_OK) {
+    THROW_ARCHIVE_EXCEPTION_RET(env, nullptr, result);
+  }
+
+  return algorithms != 0 ? NewEntryDigestArray(env, digests) : nullptr;
+}
+
+static jobjectArray NativeExtractToDirectory(
+    JNIEnv* env,
+    jclass,
+    jlong native_ptr,
+    jstring path,
+    jstring password,
+    jintArray indices,
+    jint algorithms
+) {
+  CHECK_CLOSED_RET(env, nullptr, native_ptr);
+  InArchive* archive = reinterpret_cast<InArchive*>(native_ptr);
+  return ExtractOrHashEntries(env, archive, path, password, indices, algorithms);
+}
+
+static jobjectArray NativeHashEntries(
+    JNIEnv* env,
+    jclass,
+    jlong native_ptr,
+    jstring password,
+    jintArray indices,
+    jint algorithms
+) {
+  CHECK_CLOSED_RET(env, nullptr, native_ptr);
+  InArchive* archive = reinterpret_cast<InArchive*>(native_ptr);
+  return ExtractOrHashEntries(env, archive, nullptr, password, indices, algorithms);
+}
+
+static jlong NativeIterateEntries(
+    JNIEnv* env,
+    jclass,
+    jlong native_ptr,
+    jstring password,
+    jintArray indices
+) {
+  CHECK_CLOSED_RET(env, 0, native_ptr);
+  InArchive* archive = reinterpret_cast<InArchive*>(native_ptr);
+
+  // The second producer would wait for the first one
+  if (archive->IsIterating()) {
+    THROW_ARCHIVE_EXCEPTION_RET(env, 0, E_ITERATOR_RUNNING);
+  }
+
+  jint* j_indices = nullptr;
+  jsize count = 0;
+  if (indices != nullptr) {
+    count = env->GetArrayLength(indices);
+    j_indices = env->GetIntArrayElements(indices, nullptr);
+  }
+
+  BSTR bstr_password = JavaInArchive::JStringToBSTR(env, password);
+  EntryIterator* iterator = new EntryIterator(
+      archive, reinterpret_cast<const UInt32*>(j_indices), static_cast<UInt32>(count), bstr_password);
+  ::SysFreeString(bstr_password);
+
+  if (j_indices != nullptr) {
+    env->ReleaseIntArrayElements(indices, j_indices, JNI_ABORT);
+  }
+
+  iterator->Start();
+  return reinterpret_cast<jlong>(iterator);
+}
+
+static void NativeSetCacheKey(
+    JNIEnv* env,
+    jclass,
+    jlong native_ptr,
+    jstring key
+) {
+  CHECK_CLOSED(env, native_ptr);
+  InArchive* archive = reinterpret_cast<InArchive*>(native_ptr);
+
+  if (key == nullptr) {
+    archive->SetCacheKey(nullptr);
+    return;
+  }
+  const char* c_key = env->GetStringUTFChars(key, nullptr);
+  if (c_key == nullptr) return;
+  archive->SetCacheKey(c_key);
+  env->ReleaseStringUTFChars(key, c_key);
+}
+
+static void NativeSetMemoryBudget(
+    JNIEnv* env,
+    jclass,
+    jlong native_ptr,
+    jlong budget
+) {
+  CHECK_CLOSED(env, native_ptr);
+  InArchive* archive = reinterpret_cast<InArchive*>(native_ptr);
+  archive->GetAllocator()->SetBudget(budget > 0 ? static_cast<UInt64>(budget) : 0);
+}
+
+static void NativeSetExtractLimits(
+    JNIEnv* env,
+    jclass,
+    jlong native_ptr,
+    jlong max_output_bytes,
+    jint max_ratio,
+    jlong max_memory,
+    jlong max_wall_time_ms,
+    jlong max_cpu_time_ms
+) {
+  CHECK_CLOSED(env, native_ptr);
+  InArchive* archive = reinterpret_cast<InArchive*>(native_ptr);
+  ExtractLimits limits;
+  limits.max_output_bytes = static_cast<UInt64>(MAX(max_output_bytes, 0));
+  limits.max_ratio = static_cast<UInt32>(MAX(max_ratio, 0));
+  limits.max_memory = static_cast<UInt64>(MAX(max_memory, 0));
+  limits.max_wall_time_ms = static_cast<UInt64>(MAX(max_wall_time_ms, 0));
+  limits.max_cpu_time_ms = static_cast<UInt64>(MAX(max_cpu_time_ms, 0));
+  archive->SetExtractLimits(limits);
+}
+
+static void NativeSetWritePipeline(
+    JNIEnv* env,
+    jclass,
+    jlong native_ptr,
+    jint buffer_count,
+    jint buffer_size
+) {
+  CHECK_CLOSED(env, native_ptr);
+  InArchive* archive = reinterpret_cast<InArchive*>(native_ptr);
+  archive->SetWritePipeline(static_cast<UInt32>(MAX(buffer_count, 0)), static_cast<UInt32>(MAX(buffer_size, 0)));
+}
+
+static void NativeSetDecodeThreads(
+    JNIEnv* env,
+    jclass,
+    jlong native_ptr,
+    jint thread_count
+) {
+  CHECK_CLOSED(env, native_ptr);
+  InArchive* archive = reinterpret_cast<InArchive*>(native_ptr);
+  archive->SetDecodeThreads(static_cast<UInt32>(MAX(thread_count, 0)));
+}
+
+static jlong NativeGetParallelChunkCount(
+    JNIEnv* env,
+    jclass,
+    jlong native_ptr
+) {
+  CHECK_CLOSED_RET(env, 0, native_ptr);
+  InArchive* archive = reinterpret_cast<InArchive*>(native_ptr);
+  return static_cast<jlong>(archive->GetParallelChunkCount());
+}
+
+static void NativeSetHugePagesEnabled(
+    JNIEnv* env,
+    jclass,
+    jlong native_ptr,
+    jboolean enabled
+) {
+  CHECK_CLOSED(env, native_ptr);
+  InArchive* archive = reinterpret_cast<InArchive*>(native_ptr);
+  archive->GetAllocator()->SetHugePagesEnabled(enabled != JNI_FALSE);
+}
+
+static jlong NativeGetMemoryUsage(
+    JNIEnv* env,
+    jclass,
+    jlong native_ptr
+) {
+  CHECK_CLOSED_RET(env, 0, native_ptr);
+  InArchive* archive = reinterpret_cast<InArchive*>(native_ptr);
+  return static_cast<jlong>(archive->GetAllocator()->GetCurrentBytes());
+}
+
+static jlong NativeGetPeakMemoryUsage(
+    JNIEnv* env,
+    jclass,
+    jlong native_ptr
+) {
+  CHECK_CLOSED_RET(env, 0, native_ptr);
+  InArchive* archive = reinterpret_cast<InArchive*>(native_ptr);
+  return static_cast<jlong>(archive->GetAllocator()->GetPeakBytes());
+}
+
+static void NativeSetBufferPoolCapacity(
+    JNIEnv* env,
+    jclass,
+    jlong native_ptr,
+    jlong capacity
+) {
+  CHECK_CLOSED(env, native_ptr);
+  InArchive* archive = reinterpret_cast<InArchive*>(native_ptr);
+  archive->GetAllocator()->SetPoolCapacity(capacity > 0 ? static_cast<UInt64>(capacity) : 0);
+}
+
+static jlong NativeGetBufferPoolHits(
+    JNIEnv* env,
+    jclass,
+    jlong native_ptr
+) {
+  CHECK_CLOSED_RET(env, 0, native_ptr);
+  InArchive* archive = reinterpret_cast<InArchive*>(native_ptr);
+  return static_cast<jlong>(archive->GetAllocator()->GetPoolHits());
+}
+
+static jlong NativeGetBufferPoolMisses(
+    JNIEnv* env,
+    jclass,
+    jlong native_ptr
+) {
+  CHECK_CLOSED_RET(env, 0, native_ptr);
+  InArchive* archive = reinterpret_cast<InArchive*>(native_ptr);
+  return static_cast<jlong>(archive->GetAllocator()->GetPoolMisses());
+}
+
+static jlong NativeGetBufferPoolRetainedBytes(
+    JNIEnv* env,
+    jclass,
+    jlong native_ptr
+) {
+  CHECK_CLOSED_RET(env, 0, native_ptr);
+  InArchive* archive = reinterpret_cast<InArchive*>(native_ptr);
+  return static_cast<jlong>(archive->GetAllocator()->GetPoolRetainedBytes());
+}
+
 static void NativeClose(
     JNIEnv* env,
     jclass,
@@ -335,7 +835,7 @@ static void NativeClose(
 
 static JNINativeMethod archive_methods[] = {
     { "nativeOpen",
-      "(Lcom/hippo/a7zip/SeekableInputStream;Ljava/lang/String;Ljava/lang/String;Lcom/hippo/a7zip/InArchive$OpenVolumeCallback;)J",
+      "(Lcom/hippo/a7zip/SeekableInputStream;Ljava/lang/String;Ljava/lang/String;Lcom/hippo/a7zip/InArchive$OpenVolumeCallback;Ljava/lang/String;[Ljava/lang/String;ZIZ)J",
       reinterpret_cast<void *>(NativeOpen) },
     { "nativeGetFormatName",
       "(J)Ljava/lang/String;",
@@ -379,11 +879,88 @@ static JNINativeMethod archive_methods[] = {
     { "nativeExtractEntry",
       "(JILjava/lang/String;Ljava/io/OutputStream;)V",
       reinterpret_cast<void *>(NativeExtractEntry) },
+    { "nativeGetEntryLayouts",
+      "(J)[Lcom/hippo/a7zip/EntryLayout;",
+      reinterpret_cast<void *>(NativeGetEntryLayouts) },
+    { "nativeExtractEntryWithDigest",
+      "(JILjava/lang/String;Ljava/io/OutputStream;I)Lcom/hippo/a7zip/EntryDigest;",
+      reinterpret_cast<void *>(NativeExtractEntryWithDigest) },
+    { "nativeExtractToDirectory",
+      "(JLjava/lang/String;Ljava/lang/String;[II)[Lcom/hippo/a7zip/EntryDigest;",
+      reinterpret_cast<void *>(NativeExtractToDirectory) },
+    { "nativeHashEntries",
+      "(JLjava/lang/String;[II)[Lcom/hippo/a7zip/EntryDigest;",
+      reinterpret_cast<void *>(NativeHashEntries) },
+    { "nativeIterateEntries",
+      "(JLjava/lang/String;[I)J",
+      reinterpret_cast<void *>(NativeIterateEntries) },
+    { "nativeSetCacheKey",
+      "(JLjava/lang/String;)V",
+      reinterpret_cast<void *>(NativeSetCacheKey) },
+    { "nativeSetMemoryBudget",
+      "(JJ)V",
+      reinterpret_cast<void *>(NativeSetMemoryBudget) },
+    { "nativeSetExtractLimits",
+      "(JJIJJJ)V",
+      reinterpret_cast<void *>(NativeSetExtractLimits) },
+    { "nativeSetWritePipeline",
+      "(JII)V",
+      reinterpret_cast<void *>(NativeSetWritePipeline) },
+    { "nativeSetDecodeThreads",
+      "(JI)V",
+      reinterpret_cast<void *>(NativeSetDecodeThreads) },
+    { "nativeGetParallelChunkCount",
+      "(J)J",
+      reinterpret_cast<void *>(NativeGetParallelChunkCount) },
+    { "nativeSetHugePagesEnabled",
+      "(JZ)V",
+      reinterpret_cast<void *>(NativeSetHugePagesEnabled) },
+    { "nativeGetMemoryUsage",
+      "(J)J",
+      reinterpret_cast<void *>(NativeGetMemoryUsage) },
+    { "nativeGetPeakMemoryUsage",
+      "(J)J",
+      reinterpret_cast<void *>(NativeGetPeakMemoryUsage) },
+    { "nativeSetBufferPoolCapacity",
+      "(JJ)V",
+      reinterpret_cast<void *>(NativeSetBufferPoolCapacity) },
+    { "nativeGetBufferPoolHits",
+      "(J)J",
+      reinterpret_cast<void *>(NativeGetBufferPoolHits) },
+    { "nativeGetBufferPoolMisses",
+      "(J)J",
+      reinterpret_cast<void *>(NativeGetBufferPoolMisses) },
+    { "nativeGetBufferPoolRetainedBytes",
+      "(J)J",
+      reinterpret_cast<void *>(NativeGetBufferPoolRetainedBytes) },
     { "nativeClose",
       "(J)V",
       reinterpret_cast<void *>(NativeClose) }
 };
 
+HRESULT JavaInArchive::Initialize(JNIEnv* env) {
+  if (initialized) {
+    return S_OK;
+  }
+
+  jclass clazz = env->FindClass("com/hippo/a7zip/EntryDigest");
+  if (clazz == nullptr) return E_CLASS_NOT_FOUND;
+  class_entry_digest = static_cast<jclass>(env->NewGlobalRef(clazz));
+  if (class_entry_digest == nullptr) return E_OUTOFMEMORY;
+  constructor_entry_digest = env->GetMethodID(clazz, "<init>", "(IIJIJ[B[B)V");
+  if (constructor_entry_digest == nullptr) return E_METHOD_NOT_FOUND;
+
+  clazz = env->FindClass("com/hippo/a7zip/EntryLayout");
+  if (clazz == nullptr) return E_CLASS_NOT_FOUND;
+  class_entry_layout = static_cast<jclass>(env->NewGlobalRef(clazz));
+  if (class_entry_layout == nullptr) return E_OUTOFMEMORY;
+  constructor_entry_layout = env->GetMethodID(clazz, "<init>", "(IIIJJLjava/lang/String;JJ)V");
+  if (constructor_entry_layout == nullptr) return E_METHOD_NOT_FOUND;
+
+  initialized = true;
+  return S_OK;
+}
+
 HRESULT JavaInArchive::RegisterMethods(JNIEnv* env) {
   jclass clazz = env->FindClass("com/hippo/a7zip/InArchive");
   if (clazz == nullptr) return E_CLASS_NOT_FOUND;
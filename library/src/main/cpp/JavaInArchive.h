@@ -21,11 +21,28 @@
 
 #include <Common/MyWindows.h>
 
+#include "SevenZip.h"
+
 namespace a7zip {
 namespace JavaInArchive {
 
+HRESULT Initialize(JNIEnv* env);
 HRESULT RegisterMethods(JNIEnv* env);
 
+// Returns null if jstr is null, free it with SysFreeString
+BSTR JStringToBSTR(JNIEnv* env, jstring jstr);
+
+// Converts the open options passed to nativeOpen
+void GetOpenOptions(
+    JNIEnv* env,
+    jstring preferred_format,
+    jobjectArray allowed_formats,
+    jboolean fallback_enabled,
+    jint max_open_volumes,
+    jboolean volume_prefetch_enabled,
+    SevenZip::OpenOptions& options
+);
+
 }
 }
 
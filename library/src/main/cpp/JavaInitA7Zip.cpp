@@ -16,14 +16,22 @@
 
 #include <jni.h>
 
+#include "Allocator.h"
+#include "InputStream.h"
 #include "SeekableInputStream.h"
+#include "JavaArchiveJob.h"
+#include "JavaEntryCache.h"
+#include "JavaEntryIterator.h"
 #include "JavaEnv.h"
 #include "JavaInArchive.h"
 #include "JavaSeekableInputStream.h"
 #include "JavaInputStream.h"
+#include "JavaOutArchive.h"
+#include "JavaTrace.h"
+#include "JavaZipDirectory.h"
 #include "OpenVolumeCallback.h"
 #include "OutputStream.h"
-#include "SevenZip.h"
+#include "SeekableOutputStream.h"
 #include "Utils.h"
 
 using namespace a7zip;
@@ -35,17 +43,27 @@ jint JNI_OnLoad(JavaVM* vm, void*) {
     return JNI_ERR;
   }
 
+  Allocator::Initialize();
   JavaEnv::Initialize(vm);
   RETURN_JNI_ERR_IF_NOT_ZERO(SeekableInputStream::Initialize(env));
   RETURN_JNI_ERR_IF_NOT_ZERO(JavaSeekableInputStream::Initialize(env));
   RETURN_JNI_ERR_IF_NOT_ZERO(JavaInputStream::Initialize(env));
   RETURN_JNI_ERR_IF_NOT_ZERO(OpenVolumeCallback::Initialize(env));
   RETURN_JNI_ERR_IF_NOT_ZERO(OutputStream::Initialize(env));
-  RETURN_JNI_ERR_IF_NOT_ZERO(SevenZip::Initialize());
+  RETURN_JNI_ERR_IF_NOT_ZERO(SeekableOutputStream::Initialize(env));
+  RETURN_JNI_ERR_IF_NOT_ZERO(InputStream::Initialize(env));
+  RETURN_JNI_ERR_IF_NOT_ZERO(JavaArchiveJob::Initialize(env));
+  RETURN_JNI_ERR_IF_NOT_ZERO(JavaInArchive::Initialize(env));
 
   RETURN_JNI_ERR_IF_NOT_ZERO(JavaInArchive::RegisterMethods(static_cast<JNIEnv*>(env)));
   RETURN_JNI_ERR_IF_NOT_ZERO(JavaSeekableInputStream::RegisterMethods(static_cast<JNIEnv*>(env)));
   RETURN_JNI_ERR_IF_NOT_ZERO(JavaInputStream::RegisterMethods(static_cast<JNIEnv*>(env)));
+  RETURN_JNI_ERR_IF_NOT_ZERO(JavaTrace::RegisterMethods(static_cast<JNIEnv*>(env)));
+  RETURN_JNI_ERR_IF_NOT_ZERO(JavaEntryIterator::RegisterMethods(static_cast<JNIEnv*>(env)));
+  RETURN_JNI_ERR_IF_NOT_ZERO(JavaEntryCache::RegisterMethods(static_cast<JNIEnv*>(env)));
+  RETURN_JNI_ERR_IF_NOT_ZERO(JavaZipDirectory::RegisterMethods(static_cast<JNIEnv*>(env)));
+  RETURN_JNI_ERR_IF_NOT_ZERO(JavaOutArchive::RegisterMethods(static_cast<JNIEnv*>(env)));
+  RETURN_JNI_ERR_IF_NOT_ZERO(JavaArchiveJob::RegisterMethods(static_cast<JNIEnv*>(env)));
 
   return JNI_VERSION_1_6;
 }
@@ -0,0 +1,235 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "JavaOutArchive.h"
+
+#include <sys/stat.h>
+#include <type_traits>
+#include <vector>
+
+#include "InputStream.h"
+#include "InArchive.h"
+#include "JavaHelper.h"
+#include "JavaInArchive.h"
+#include "OutArchive.h"
+#include "SeekableOutputStream.h"
+#include "Utils.h"
+
+using namespace a7zip;
+
+static jlong NativeCreate(
+    JNIEnv* env,
+    jclass,
+    jstring format
+) {
+  const char* format_chars = env->GetStringUTFChars(format, nullptr);
+  if (format_chars == nullptr) {
+    THROW_ARCHIVE_EXCEPTION_RET(env, 0, E_OUTOFMEMORY);
+  }
+
+  OutArchive* archive = nullptr;
+  HRESULT result = OutArchive::Create(format_chars, &archive);
+  env->ReleaseStringUTFChars(format, format_chars);
+
+  if (result != S_OK || archive == nullptr) {
+    delete archive;
+    THROW_ARCHIVE_EXCEPTION_RET(env, 0, result != S_OK ? result : E_INTERNAL);
+  }
+
+  return reinterpret_cast<jlong>(archive);
+}
+
+static jlong NativeUpdate(
+    JNIEnv* env,
+    jclass,
+    jlong in_archive_ptr
+) {
+  CHECK_CLOSED_RET(env, 0, in_archive_ptr);
+  InArchive* source = reinterpret_cast<InArchive*>(in_archive_ptr);
+
+  OutArchive* archive = nullptr;
+  HRESULT result = OutArchive::Update(source, &archive);
+
+  if (result != S_OK || archive == nullptr) {
+    delete archive;
+    THROW_ARCHIVE_EXCEPTION_RET(env, 0, result != S_OK ? result : E_INTERNAL);
+  }
+
+  return reinterpret_cast<jlong>(archive);
+}
+
+static HRESULT GetEntries(
+    JNIEnv* env,
+    jintArray indices,
+    jobjectArray paths,
+    jlongArray sizes,
+    jlongArray times,
+    jbooleanArray dirs,
+    jobjectArray file_paths,
+    jintArray fds,
+    jobjectArray streams,
+    std::vector<OutEntry>& entries
+) {
+  jsize count = env->GetArrayLength(paths);
+  std::vector<jlong> size_values(static_cast<size_t>(count));
+  std::vector<jlong> time_values(static_cast<size_t>(count));
+  std::vector<jboolean> dir_values(static_cast<size_t>(count));
+  std::vector<jint> fd_values(static_cast<size_t>(count));
+  std::vector<jint> index_values(static_cast<size_t>(count));
+  if (count != 0) {
+    env->GetIntArrayRegion(indices, 0, count, index_values.data());
+    env->GetLongArrayRegion(sizes, 0, count, size_values.data());
+    env->GetLongArrayRegion(times, 0, count, time_values.data());
+    env->GetBooleanArrayRegion(dirs, 0, count, dir_values.data());
+    env->GetIntArrayRegion(fds, 0, count, fd_values.data());
+  }
+
+  entries.resize(static_cast<size_t>(count));
+  for (jsize i = 0; i < count; i++) {
+    OutEntry& entry = entries[i];
+    entry.index_in_archive = index_values[i];
+    if (entry.index_in_archive >= 0) {
+      // Copied from the source archive
+      continue;
+    }
+
+    jstring path = static_cast<jstring>(env->GetObjectArrayElement(paths, i));
+    BSTR bstr_path = JavaInArchive::JStringToBSTR(env, path);
+    if (bstr_path != nullptr) {
+      entry.path = bstr_path;
+      ::SysFreeString(bstr_path);
+    }
+    env->DeleteLocalRef(path);
+
+    entry.is_dir = dir_values[i] != JNI_FALSE;
+    entry.modified_time = time_values[i];
+    entry.fd = fd_values[i];
+
+    jstring file_path = static_cast<jstring>(env->GetObjectArrayElement(file_paths, i));
+    if (file_path != nullptr) {
+      const char* chars = env->GetStringUTFChars(file_path, nullptr);
+      if (chars == nullptr) return E_OUTOFMEMORY;
+      entry.file_path = chars;
+      env->ReleaseStringUTFChars(file_path, chars);
+      env->DeleteLocalRef(file_path);
+    }
+
+    jobject stream = env->GetObjectArrayElement(streams, i);
+    if (stream != nullptr) {
+      RETURN_SAME_IF_NOT_ZERO(InputStream::Create(env, stream, entry.stream));
+      env->DeleteLocalRef(stream);
+    }
+
+    if (size_values[i] >= 0) {
+      entry.size = static_cast<UInt64>(size_values[i]);
+    } else if (entry.fd >= 0) {
+      struct stat st;
+      if (fstat(entry.fd, &st) != 0) return E_IO_ERROR;
+      entry.size = static_cast<UInt64>(st.st_size);
+    }
+  }
+
+  return S_OK;
+}
+
+static void NativeWrite(
+    JNIEnv* env,
+    jclass,
+    jlong native_ptr,
+    jintArray indices,
+    jobjectArray paths,
+    jlongArray sizes,
+    jlongArray times,
+    jbooleanArray dirs,
+    jobjectArray file_paths,
+    jintArray fds,
+    jobjectArray streams,
+    jint level,
+    jint thread_count,
+    jstring method,
+    jstring password,
+    jobject stream
+) {
+  CHECK_CLOSED(env, native_ptr);
+  OutArchive* archive = reinterpret_cast<OutArchive*>(native_ptr);
+
+  HRESULT result;
+  {
+    // Java streams are closed at the end of the scope, before throwing exceptions
+    std::vector<OutEntry> entries;
+    CMyComPtr<IOutStream> out_stream;
+    result = GetEntries(env, indices, paths, sizes, times, dirs, file_paths, fds, streams, entries);
+    if (result == S_OK) {
+      result = SeekableOutputStream::Create(env, stream, out_stream);
+    }
+
+    if (result == S_OK) {
+      OutOptions options;
+      options.level = static_cast<UInt32>(MAX(level, 0));
+      options.thread_count = static_cast<UInt32>(MAX(thread_count, 0));
+      BSTR bstr_method = JavaInArchive::JStringToBSTR(env, method);
+      if (bstr_method != nullptr) {
+        options.method = bstr_method;
+        ::SysFreeString(bstr_method);
+      }
+
+      BSTR bstr_password = JavaInArchive::JStringToBSTR(env, password);
+      result = archive->Write(entries, options, bstr_password, out_stream);
+      ::SysFreeString(bstr_password);
+    }
+  }
+
+  if (result != S_OK) {
+    THROW_ARCHIVE_EXCEPTION(env, result);
+  }
+}
+
+static void NativeClose(
+    JNIEnv* env,
+    jclass,
+    jlong native_ptr
+) {
+  CHECK_CLOSED(env, native_ptr);
+  OutArchive* archive = reinterpret_cast<OutArchive*>(native_ptr);
+  delete archive;
+}
+
+static JNINativeMethod out_archive_methods[] = {
+    { "nativeCreate",
+      "(Ljava/lang/String;)J",
+      reinterpret_cast<void *>(NativeCreate) },
+    { "nativeUpdate",
+      "(J)J",
+      reinterpret_cast<void *>(NativeUpdate) },
+    { "nativeWrite",
+      "(J[I[Ljava/lang/String;[J[J[Z[Ljava/lang/String;[I[Ljava/io/InputStream;IILjava/lang/String;Ljava/lang/String;Lcom/hippo/a7zip/SeekableOutputStream;)V",
+      reinterpret_cast<void *>(NativeWrite) },
+    { "nativeClose",
+      "(J)V",
+      reinterpret_cast<void *>(NativeClose) }
+};
+
+HRESULT JavaOutArchive::RegisterMethods(JNIEnv* env) {
+  jclass clazz = env->FindClass("com/hippo/a7zip/OutArchive");
+  if (clazz == nullptr) return E_CLASS_NOT_FOUND;
+
+  jint result = env->RegisterNatives(clazz, out_archive_methods, std::extent<decltype(out_archive_methods)>::value);
+  if (result < 0) {
+    return E_FAILED_REGISTER;
+  }
+
+  return S_OK;
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "JavaTrace.h"
+
+#include <type_traits>
+
+#include "JavaHelper.h"
+#include "Trace.h"
+#include "Utils.h"
+
+using namespace a7zip;
+
+static jboolean NativeIsEnabled(
+    JNIEnv*,
+    jclass
+) {
+  return static_cast<jboolean>(Trace::IsEnabled());
+}
+
+static void NativeSetRecording(
+    JNIEnv*,
+    jclass,
+    jboolean recording
+) {
+  Trace::SetRecording(recording != JNI_FALSE);
+}
+
+static jlongArray NativeSnapshot(
+    JNIEnv* env,
+    jclass
+) {
+  Trace::Counter counters[Trace::TRACE_POINT_COUNT];
+  Trace::Snapshot(counters);
+
+  // calls, bytes and nanos of each trace point
+  jlong values[Trace::TRACE_POINT_COUNT * 3];
+  for (int i = 0; i < Trace::TRACE_POINT_COUNT; i++) {
+    values[i * 3] = static_cast<jlong>(counters[i].calls);
+    values[i * 3 + 1] = static_cast<jlong>(counters[i].bytes);
+    values[i * 3 + 2] = static_cast<jlong>(counters[i].nanos);
+  }
+
+  jlongArray array = env->NewLongArray(Trace::TRACE_POINT_COUNT * 3);
+  if (array == nullptr) {
+    return nullptr;
+  }
+  env->SetLongArrayRegion(array, 0, Trace::TRACE_POINT_COUNT * 3, values);
+  return array;
+}
+
+static void NativeReset(
+    JNIEnv*,
+    jclass
+) {
+  Trace::Reset();
+}
+
+static void NativeExportChromeTrace(
+    JNIEnv* env,
+    jclass,
+    jstring path
+) {
+  const char* c_path = env->GetStringUTFChars(path, nullptr);
+  if (c_path == nullptr) return;
+  HRESULT result = Trace::ExportChromeTrace(c_path);
+  env->ReleaseStringUTFChars(path, c_path);
+
+  if (result == E_NOTIMPL) {
+    THROW_EXCEPTION(env, CLASS_NAME_ILLEGAL_STATE_EXCEPTION, "Trace is not compiled in");
+  } else if (result != S_OK) {
+    THROW_EXCEPTION(env, CLASS_NAME_IO_EXCEPTION, "Can't write the trace file");
+  }
+}
+
+static JNINativeMethod trace_methods[] = {
+    { "nativeIsEnabled",
+      "()Z",
+      reinterpret_cast<void *>(NativeIsEnabled) },
+    { "nativeSetRecording",
+      "(Z)V",
+      reinterpret_cast<void *>(NativeSetRecording) },
+    { "nativeSnapshot",
+      "()[J",
+      reinterpret_cast<void *>(NativeSnapshot) },
+    { "nativeReset",
+      "()V",
+      reinterpret_cast<void *>(NativeReset) },
+    { "nativeExportChromeTrace",
+      "(Ljava/lang/String;)V",
+      reinterpret_cast<void *>(NativeExportChromeTrace) }
+};
+
+HRESULT JavaTrace::RegisterMethods(JNIEnv* env) {
+  jclass clazz = env->FindClass("com/hippo/a7zip/Trace");
+  if (clazz == nullptr) return E_CLASS_NOT_FOUND;
+
+  jint result = env->RegisterNatives(clazz, trace_methods, std::extent<decltype(trace_methods)>::value);
+  if (result < 0) {
+    return E_FAILED_REGISTER;
+  }
+
+  return S_OK;
+}
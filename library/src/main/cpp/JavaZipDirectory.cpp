@@ -0,0 +1,196 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "JavaZipDirectory.h"
+
+#include <type_traits>
+
+#include "JavaHelper.h"
+#include "JavaInArchive.h"
+#include "SeekableInputStream.h"
+#include "SharedInStream.h"
+#include "Utils.h"
+#include "ZipDirectory.h"
+
+using namespace a7zip;
+
+// Keep it in sync with ZipDirectory in java
+enum EntryInfo {
+  INFO_SIZE,
+  INFO_PACKED_SIZE,
+  INFO_CRC,
+  INFO_METHOD,
+  INFO_FLAGS,
+  INFO_DOS_TIME,
+  INFO_IS_DIR,
+  INFO_COUNT,
+};
+
+static jlong NativeOpen(
+    JNIEnv* env,
+    jclass,
+    jobject stream
+) {
+  CMyComPtr<IInStream> in_stream = nullptr;
+  HRESULT result = SeekableInputStream::Create(env, stream, in_stream);
+  if (result != S_OK || in_stream == nullptr) {
+    // Call java methods before throw exception
+    if (in_stream != nullptr) {
+      in_stream.Release();
+    }
+    THROW_ARCHIVE_EXCEPTION_RET(env, 0, result);
+  }
+
+  CMyComPtr<SharedInStream> shared_in_stream(new SharedInStream(in_stream));
+  in_stream.Release();
+
+  CMyComPtr<ZipDirectory> directory;
+  result = ZipDirectory::Open(shared_in_stream, directory);
+  if (result != S_OK) {
+    // Call java methods before throw exception
+    shared_in_stream.Release();
+    directory.Release();
+    THROW_ARCHIVE_EXCEPTION_RET(env, 0, result);
+  }
+
+  return reinterpret_cast<jlong>(directory.Detach());
+}
+
+static jint NativeGetNumberOfEntries(
+    JNIEnv* env,
+    jclass,
+    jlong native_ptr
+) {
+  CHECK_CLOSED_RET(env, 0, native_ptr);
+  ZipDirectory* directory = reinterpret_cast<ZipDirectory*>(native_ptr);
+  return static_cast<jint>(directory->GetNumberOfEntries());
+}
+
+static jbyteArray NativeGetEntryName(
+    JNIEnv* env,
+    jclass,
+    jlong native_ptr,
+    jint index
+) {
+  CHECK_CLOSED_RET(env, nullptr, native_ptr);
+  ZipDirectory* directory = reinterpret_cast<ZipDirectory*>(native_ptr);
+
+  ZipDirectory::Entry entry;
+  HRESULT result = directory->GetEntry(static_cast<UInt32>(index), entry);
+  if (result != S_OK) {
+    THROW_ARCHIVE_EXCEPTION_RET(env, nullptr, result);
+  }
+
+  jsize length = static_cast<jsize>(entry.name.size());
+  jbyteArray array = env->NewByteArray(length);
+  if (array == nullptr) return nullptr;
+  env->SetByteArrayRegion(array, 0, length, reinterpret_cast<const jbyte*>(entry.name.data()));
+  return array;
+}
+
+static void NativeGetEntryInfo(
+    JNIEnv* env,
+    jclass,
+    jlong native_ptr,
+    jint index,
+    jlongArray info
+) {
+  CHECK_CLOSED(env, native_ptr);
+  ZipDirectory* directory = reinterpret_cast<ZipDirectory*>(native_ptr);
+
+  ZipDirectory::Entry entry;
+  HRESULT result = directory->GetEntry(static_cast<UInt32>(index), entry);
+  if (result != S_OK) {
+    THROW_ARCHIVE_EXCEPTION(env, result);
+  }
+
+  jlong values[INFO_COUNT];
+  values[INFO_SIZE] = static_cast<jlong>(entry.size);
+  values[INFO_PACKED_SIZE] = static_cast<jlong>(entry.packed_size);
+  values[INFO_CRC] = static_cast<jlong>(entry.crc);
+  values[INFO_METHOD] = entry.method;
+  values[INFO_FLAGS] = entry.flags;
+  values[INFO_DOS_TIME] = static_cast<jlong>(entry.dos_time);
+  values[INFO_IS_DIR] = entry.is_dir ? 1 : 0;
+  env->SetLongArrayRegion(info, 0, INFO_COUNT, values);
+}
+
+static jlong NativeOpenEntry(
+    JNIEnv* env,
+    jclass,
+    jlong native_ptr,
+    jint index,
+    jstring password
+) {
+  CHECK_CLOSED_RET(env, 0, native_ptr);
+  ZipDirectory* directory = reinterpret_cast<ZipDirectory*>(native_ptr);
+
+  BSTR bstr_password = JavaInArchive::JStringToBSTR(env, password);
+  InArchive* archive = nullptr;
+  HRESULT result = directory->OpenEntry(static_cast<UInt32>(index), bstr_password, &archive);
+  ::SysFreeString(bstr_password);
+
+  if (result != S_OK || archive == nullptr) {
+    delete archive;
+    THROW_ARCHIVE_EXCEPTION_RET(env, 0, result != S_OK ? result : E_INTERNAL);
+  }
+
+  return reinterpret_cast<jlong>(archive);
+}
+
+static void NativeClose(
+    JNIEnv* env,
+    jclass,
+    jlong native_ptr
+) {
+  CHECK_CLOSED(env, native_ptr);
+  ZipDirectory* directory = reinterpret_cast<ZipDirectory*>(native_ptr);
+  // The opened entries keep it alive
+  directory->Release();
+}
+
+static JNINativeMethod directory_methods[] = {
+    { "nativeOpen",
+      "(Lcom/hippo/a7zip/SeekableInputStream;)J",
+      reinterpret_cast<void *>(NativeOpen) },
+    { "nativeGetNumberOfEntries",
+      "(J)I",
+      reinterpret_cast<void *>(NativeGetNumberOfEntries) },
+    { "nativeGetEntryName",
+      "(JI)[B",
+      reinterpret_cast<void *>(NativeGetEntryName) },
+    { "nativeGetEntryInfo",
+      "(JI[J)V",
+      reinterpret_cast<void *>(NativeGetEntryInfo) },
+    { "nativeOpenEntry",
+      "(JILjava/lang/String;)J",
+      reinterpret_cast<void *>(NativeOpenEntry) },
+    { "nativeClose",
+      "(J)V",
+      reinterpret_cast<void *>(NativeClose) }
+};
+
+HRESULT JavaZipDirectory::RegisterMethods(JNIEnv* env) {
+  jclass clazz = env->FindClass("com/hippo/a7zip/ZipDirectory");
+  if (clazz == nullptr) return E_CLASS_NOT_FOUND;
+
+  jint result = env->RegisterNatives(clazz, directory_methods, std::extent<decltype(directory_methods)>::value);
+  if (result < 0) {
+    return E_FAILED_REGISTER;
+  }
+
+  return S_OK;
+}
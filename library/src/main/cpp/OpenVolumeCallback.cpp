@@ -25,6 +25,8 @@
 #include "Utils.h"
 #include "Log.h"
 
+#define NAME_STACK_BUFFER_SIZE 256
+
 using namespace a7zip;
 
 bool OpenVolumeCallback::initialized = false;
@@ -43,17 +45,23 @@ OpenVolumeCallback::~OpenVolumeCallback() {
 HRESULT OpenVolumeCallback::OpenVolume(const wchar_t *name, CMyComPtr<IInStream>& in_stream) {
   JavaEnv env;
 
-  // const wchar_t* to jstring
+  // const wchar_t* to jstring, volume names are short, avoid heap for them
   unsigned len = MyStringLen(name);
-  jchar *buffer = reinterpret_cast<jchar *>(malloc(len * sizeof(jchar)));
-  if (buffer == nullptr) {
-    return E_OUTOFMEMORY;
+  jchar stack_buffer[NAME_STACK_BUFFER_SIZE];
+  jchar *buffer = stack_buffer;
+  if (len > NAME_STACK_BUFFER_SIZE) {
+    buffer = reinterpret_cast<jchar *>(malloc(len * sizeof(jchar)));
+    if (buffer == nullptr) {
+      return E_OUTOFMEMORY;
+    }
   }
   for (int i = 0; i < len; i++) {
     buffer[i] = static_cast<jchar>(name[i]);
   }
   jstring j_name = env->NewString(buffer, len);
-  free(buffer);
+  if (buffer != stack_buffer) {
+    free(buffer);
+  }
   if (j_name == nullptr) {
     return E_OUTOFMEMORY;
   }
@@ -0,0 +1,148 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "OutArchive.h"
+
+#include <mutex>
+#include <strings.h>
+#include <unistd.h>
+
+#include <Windows/PropVariant.h>
+
+#include "ArchiveUpdateCallback.h"
+#include "InArchive.h"
+#include "SevenZip.h"
+#include "Utils.h"
+
+#define MAX_PROPERTIES 8
+
+using namespace a7zip;
+
+OutArchive::OutArchive(
+    CMyComPtr<IOutArchive>& out_archive,
+    AString& format_name,
+    InArchive* source
+) :
+    out_archive(out_archive),
+    format_name(format_name),
+    source(source) { }
+
+const AString& OutArchive::GetFormatName() {
+  return this->format_name;
+}
+
+HRESULT OutArchive::SetOptions(const OutOptions& options, bool encrypted) {
+  CMyComPtr<ISetProperties> set_properties;
+  out_archive->QueryInterface(IID_ISetProperties, reinterpret_cast<void **>(&set_properties));
+  if (set_properties == nullptr) {
+    return S_OK;
+  }
+
+  bool is_7z = strcasecmp(format_name, "7z") == 0;
+  bool is_zip = strcasecmp(format_name, "zip") == 0;
+
+  UInt32 thread_count = options.thread_count;
+  if (thread_count == 0) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    thread_count = cores > 0 ? static_cast<UInt32>(cores) : 1;
+  }
+
+  const wchar_t* names[MAX_PROPERTIES];
+  NWindows::NCOM::CPropVariant values[MAX_PROPERTIES];
+  UInt32 count = 0;
+
+  names[count] = L"x";
+  values[count++] = MIN(options.level, static_cast<UInt32>(9));
+  names[count] = L"mt";
+  values[count++] = thread_count;
+  if (!options.method.IsEmpty()) {
+    // The method of the first coder of 7z is property 0
+    names[count] = is_7z ? L"0" : L"m";
+    values[count++] = options.method.Ptr();
+  }
+  if (encrypted && is_7z) {
+    // Encrypts the paths too
+    names[count] = L"he";
+    values[count++] = true;
+  }
+  if (encrypted && is_zip) {
+    // ZipCrypto is broken
+    names[count] = L"em";
+    values[count++] = L"AES256";
+  }
+
+  return set_properties->SetProperties(names, values, count);
+}
+
+HRESULT OutArchive::Write(
+    std::vector<OutEntry>& entries,
+    const OutOptions& options,
+    BSTR password,
+    IOutStream* out_stream,
+    const std::atomic<bool>* cancelled
+) {
+  // The handler reads the kept entries from the stream of the source
+  std::unique_lock<SerialQueue> lock;
+  if (source != nullptr) {
+    if (source->IsIterating()) {
+      return E_ITERATOR_RUNNING;
+    }
+    lock = std::unique_lock<SerialQueue>(source->GetJobQueue());
+    source->StopDecoder();
+  } else {
+    for (const OutEntry& entry : entries) {
+      if (entry.index_in_archive >= 0) {
+        return E_INVALIDARG;
+      }
+    }
+  }
+
+  RETURN_SAME_IF_NOT_ZERO(SetOptions(options, password != nullptr));
+
+  CMyComPtr<ArchiveUpdateCallback> callback(new ArchiveUpdateCallback(entries, password, cancelled));
+  HRESULT result = out_archive->UpdateItems(out_stream, static_cast<UInt32>(entries.size()), callback);
+  result = callback->GetBetterResult(result);
+
+  // Close the streams which the handler didn't ask for
+  for (OutEntry& entry : entries) {
+    entry.stream = nullptr;
+  }
+
+  return result;
+}
+
+HRESULT OutArchive::Create(const char* format_name, OutArchive** archive) {
+  *archive = nullptr;
+
+  CMyComPtr<IOutArchive> out_archive;
+  RETURN_SAME_IF_NOT_ZERO(SevenZip::CreateOutArchive(format_name, out_archive));
+
+  AString name(format_name);
+  *archive = new OutArchive(out_archive, name, nullptr);
+  return S_OK;
+}
+
+HRESULT OutArchive::Update(InArchive* source, OutArchive** archive) {
+  *archive = nullptr;
+
+  // The handler which opened the archive updates it
+  CMyComPtr<IOutArchive> out_archive;
+  RETURN_SAME_IF_NOT_ZERO(source->GetOutArchive(out_archive));
+
+  AString name(source->GetFormatName());
+  *archive = new OutArchive(out_archive, name, source);
+  return S_OK;
+}
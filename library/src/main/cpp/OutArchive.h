@@ -0,0 +1,104 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __A7ZIP_OUT_ARCHIVE_H__
+#define __A7ZIP_OUT_ARCHIVE_H__
+
+#include <atomic>
+#include <vector>
+
+#include <include_windows/windows.h>
+#include <Common/MyCom.h>
+#include <Common/MyString.h>
+#include <7zip/Archive/IArchive.h>
+
+namespace a7zip {
+
+class InArchive;
+
+// An entry of a new archive, the data is read from the file, the fd or the stream.
+// An entry of the source archive is copied as it is, without recompressing it.
+struct OutEntry {
+  // The index in the source archive, -1 for a new entry
+  Int32 index_in_archive;
+  UString path;
+  bool is_dir;
+  UInt64 size;
+  // In milliseconds, -1 if unknown
+  Int64 modified_time;
+  // Opened when the entry is compressed, empty if it's not a file
+  AString file_path;
+  // Read with pread, it's not closed. -1 if it's not an fd.
+  int fd;
+  CMyComPtr<ISequentialInStream> stream;
+
+  OutEntry():
+      index_in_archive(-1),
+      is_dir(false),
+      size(0),
+      modified_time(-1),
+      fd(-1) { }
+};
+
+struct OutOptions {
+  // 0 stores the entries, 9 compresses them best
+  UInt32 level;
+  // Threads for the encoders, 0 for all cores.
+  // LZMA2 of 7z splits the stream into blocks, zip compresses the entries in parallel.
+  UInt32 thread_count;
+  // Empty for the default of the format, LZMA2 for 7z and Deflate for zip
+  UString method;
+
+  OutOptions():
+      level(5),
+      thread_count(0) { }
+};
+
+class OutArchive {
+ public:
+  OutArchive(CMyComPtr<IOutArchive>& out_archive, AString& format_name, InArchive* source);
+
+ public:
+  const AString& GetFormatName();
+  // The streams of the entries are released after writing, the entries can't be written again.
+  // The source archive is read while writing, the stream must not be the one of the source.
+  HRESULT Write(
+      std::vector<OutEntry>& entries,
+      const OutOptions& options,
+      BSTR password,
+      IOutStream* out_stream,
+      const std::atomic<bool>* cancelled = nullptr
+  );
+
+ private:
+  HRESULT SetOptions(const OutOptions& options, bool encrypted);
+
+ private:
+  CMyComPtr<IOutArchive> out_archive;
+  AString format_name;
+  // The archive being updated, it must outlive this. Null for a new archive.
+  InArchive* source;
+
+ public:
+  // Returns E_NOTIMPL if the format can't create archives
+  static HRESULT Create(const char* format_name, OutArchive** archive);
+  // Updates the source archive, returns E_NOTIMPL if the format can't update archives
+  static HRESULT Update(InArchive* source, OutArchive** archive);
+};
+
+}
+
+#endif //__A7ZIP_OUT_ARCHIVE_H__
@@ -19,6 +19,7 @@
 #include "JavaEnv.h"
 #include "Utils.h"
 #include "Log.h"
+#include "Trace.h"
 
 #define ARRAY_SIZE DEFAULT_BUFFER_SIZE
 
@@ -49,6 +50,8 @@ OutputStream::~OutputStream() {
 }
 
 HRESULT OutputStream::Write(const void* data, UInt32 size, UInt32* processedSize) {
+  TRACE_SPAN(Trace::TRACE_OUTPUT_WRITE, nullptr);
+
   if (processedSize != nullptr) {
     *processedSize = 0;
   }
@@ -70,6 +73,7 @@ HRESULT OutputStream::Write(const void* data, UInt32 size, UInt32* processedSize
   // Write data to sink
   env->CallVoidMethod(stream, method_write, array, 0, size);
   RETURN_E_JAVA_EXCEPTION_IF_EXCEPTION_PENDING(env);
+  TRACE_SPAN_BYTES(size);
 
   if (processedSize != nullptr) {
     *processedSize = size;
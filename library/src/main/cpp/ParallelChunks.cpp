@@ -0,0 +1,266 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "ParallelChunks.h"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <7zCrc.h>
+#include <Alloc.h>
+
+#include "JavaEnv.h"
+#include "Log.h"
+#include "Utils.h"
+
+#ifdef LOG_TAG
+#  undef LOG_TAG
+#endif //LOG_TAG
+#define LOG_TAG "ParallelChunks"
+
+#define MAX_PENDING_BYTES (256ULL << 20)
+#define MAX_WRITE_SIZE (1U << 20)
+
+using namespace a7zip;
+
+namespace a7zip {
+
+// A buffer from BigAlloc, so it's accounted to the allocator of the thread
+class ChunkBuffer {
+ public:
+  ChunkBuffer() : data(nullptr) { }
+  ~ChunkBuffer() { BigFree(data); }
+
+ public:
+  bool Alloc(size_t size) {
+    data = static_cast<Byte*>(BigAlloc(MAX(size, static_cast<size_t>(1))));
+    return data != nullptr;
+  }
+  Byte* Get() { return data; }
+
+ private:
+  Byte* data;
+};
+
+struct DecodedChunk {
+  HRESULT result;
+  ChunkBuffer buffer;
+};
+
+class ChunkWorkers {
+ public:
+  ChunkWorkers(
+      IInStream* stream,
+      const std::vector<IndependentChunk>& chunks,
+      ChunkCodec* codec,
+      size_t first,
+      size_t last,
+      UInt32 thread_count,
+      Allocator* allocator
+  ) :
+      stream(stream),
+      chunks(chunks),
+      codec(codec),
+      first(first),
+      last(last),
+      thread_count(thread_count),
+      allocator(allocator),
+      decoded(last - first),
+      next_chunk(first),
+      consumed(first),
+      pending_bytes(0),
+      stopped(false) { }
+
+  ~ChunkWorkers() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopped = true;
+      condition.notify_all();
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+  }
+
+ public:
+  void Start() {
+    for (UInt32 i = 0; i < thread_count; i++) {
+      threads.emplace_back(&ChunkWorkers::Loop, this);
+    }
+  }
+
+  // Waits for the chunk, the previous ones must be released
+  DecodedChunk* Take(size_t index) {
+    std::unique_lock<std::mutex> lock(mutex);
+    consumed = index;
+    condition.notify_all();
+    condition.wait(lock, [this, index] { return decoded[index - first] != nullptr; });
+    return decoded[index - first].get();
+  }
+
+  void Release(size_t index) {
+    std::unique_ptr<DecodedChunk> chunk;
+    std::lock_guard<std::mutex> lock(mutex);
+    chunk.swap(decoded[index - first]);
+    pending_bytes -= chunks[index].size;
+    condition.notify_all();
+  }
+
+ private:
+  void Loop() {
+    // The stream may be a java stream
+    JavaEnv env;
+    Allocator::Scope scope(allocator);
+
+    while (true) {
+      size_t index;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [this] { return stopped || next_chunk >= last || CanTake(); });
+        if (stopped || next_chunk >= last) {
+          return;
+        }
+        index = next_chunk++;
+        pending_bytes += chunks[index].size;
+      }
+
+      std::unique_ptr<DecodedChunk> chunk(new DecodedChunk());
+      chunk->result = scope.GetBetterResult(DecodeChunk(index, chunk->buffer));
+
+      std::lock_guard<std::mutex> lock(mutex);
+      decoded[index - first] = std::move(chunk);
+      condition.notify_all();
+    }
+  }
+
+  bool CanTake() {
+    // One chunk is always allowed, or the writer could wait forever
+    return next_chunk <= consumed + thread_count &&
+        (pending_bytes == 0 || pending_bytes + chunks[next_chunk].size <= MAX_PENDING_BYTES);
+  }
+
+  HRESULT DecodeChunk(size_t index, ChunkBuffer& data) {
+    const IndependentChunk& chunk = chunks[index];
+    ChunkBuffer packed;
+    if (!packed.Alloc(static_cast<size_t>(chunk.packed_size)) || !data.Alloc(static_cast<size_t>(chunk.size))) {
+      return E_OUTOFMEMORY;
+    }
+    RETURN_SAME_IF_NOT_ZERO(Read(chunk.packed_offset, packed.Get(), static_cast<size_t>(chunk.packed_size)));
+    return codec->DecodeChunk(index, chunk, packed.Get(), data.Get());
+  }
+
+  HRESULT Read(UInt64 offset, Byte* data, size_t size) {
+    std::lock_guard<std::mutex> lock(stream_mutex);
+    RETURN_SAME_IF_NOT_ZERO(stream->Seek(static_cast<Int64>(offset), STREAM_SEEK_SET, nullptr));
+    while (size != 0) {
+      UInt32 processed = 0;
+      RETURN_SAME_IF_NOT_ZERO(stream->Read(data, static_cast<UInt32>(MIN(size, static_cast<size_t>(UINT32_MAX))), &processed));
+      if (processed == 0) {
+        return E_UNEXPECTED_END;
+      }
+      data += processed;
+      size -= processed;
+    }
+    return S_OK;
+  }
+
+ private:
+  IInStream* stream;
+  const std::vector<IndependentChunk>& chunks;
+  ChunkCodec* codec;
+  size_t first;
+  size_t last;
+  UInt32 thread_count;
+  Allocator* allocator;
+  std::mutex stream_mutex;
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::vector<std::unique_ptr<DecodedChunk>> decoded;
+  size_t next_chunk;
+  size_t consumed;
+  UInt64 pending_bytes;
+  bool stopped;
+
+  std::vector<std::thread> threads;
+};
+
+}
+
+static HRESULT WriteFully(ISequentialOutStream* out_stream, const Byte* data, size_t size) {
+  while (size != 0) {
+    UInt32 processed = 0;
+    RETURN_SAME_IF_NOT_ZERO(out_stream->Write(data, static_cast<UInt32>(MIN(size, static_cast<size_t>(MAX_WRITE_SIZE))), &processed));
+    if (processed == 0) {
+      return E_FAIL;
+    }
+    data += processed;
+    size -= processed;
+  }
+  return S_OK;
+}
+
+HRESULT ParallelChunks::Decode(
+    IInStream* stream,
+    const std::vector<IndependentChunk>& chunks,
+    ChunkCodec* codec,
+    UInt64 begin,
+    UInt64 end,
+    ISequentialOutStream* out_stream,
+    UInt32 thread_count,
+    Allocator* allocator,
+    const std::atomic<bool>* cancelled,
+    UInt32* crc
+) {
+  // The chunks overlapping [begin, end)
+  size_t first = 0;
+  while (first < chunks.size() && chunks[first].offset + chunks[first].size <= begin) {
+    first++;
+  }
+  size_t last = first;
+  while (last < chunks.size() && chunks[last].offset < end) {
+    last++;
+  }
+
+  UInt32 digest = CRC_INIT_VAL;
+  ChunkWorkers workers(stream, chunks, codec, first, last, MAX(thread_count, 1U), allocator);
+  workers.Start();
+
+  for (size_t i = first; i < last; i++) {
+    DecodedChunk* chunk = workers.Take(i);
+    RETURN_SAME_IF_NOT_ZERO(chunk->result);
+    if (cancelled != nullptr && cancelled->load()) {
+      return E_ABORT;
+    }
+
+    const IndependentChunk& info = chunks[i];
+    UInt64 from = MAX(begin, info.offset) - info.offset;
+    UInt64 to = MIN(end, info.offset + info.size) - info.offset;
+    const Byte* data = chunk->buffer.Get() + from;
+    size_t size = static_cast<size_t>(to - from);
+    digest = CrcUpdate(digest, data, size);
+    RETURN_SAME_IF_NOT_ZERO(WriteFully(out_stream, data, size));
+    workers.Release(i);
+  }
+
+  if (crc != nullptr) {
+    *crc = CRC_GET_DIGEST(digest);
+  }
+  return S_OK;
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __A7ZIP_PARALLEL_CHUNKS_H__
+#define __A7ZIP_PARALLEL_CHUNKS_H__
+
+#include <atomic>
+#include <vector>
+
+#include <include_windows/windows.h>
+#include <7zip/IStream.h>
+
+#include "Allocator.h"
+
+namespace a7zip {
+
+// A piece of a packed stream which decodes without the data before it
+struct IndependentChunk {
+  // In the packed stream
+  UInt64 packed_offset;
+  UInt64 packed_size;
+  // In the unpacked data
+  UInt64 offset;
+  UInt64 size;
+};
+
+// Decodes one chunk. It's called on many threads at once.
+class ChunkCodec {
+ public:
+  virtual ~ChunkCodec() { }
+
+  // The chunk is chunks[index] of the decoded chunks. The packed data has
+  // chunk.packed_size bytes, the data has room for chunk.size bytes.
+  virtual HRESULT DecodeChunk(size_t index, const IndependentChunk& chunk, const Byte* packed, Byte* data) = 0;
+};
+
+// Decodes independent chunks with threads and writes them in order.
+// A thread takes the next chunk only if it's at most thread_count chunks ahead
+// of the writer, and the decoded chunks waiting to be written stay under 256 MiB.
+// The buffers are allocated with the allocator, the memory budget applies.
+class ParallelChunks {
+ public:
+  // Writes the unpacked bytes [begin, end), the chunks are in order and cover them.
+  // The CRC32 of the written bytes is set to crc if it isn't null.
+  static HRESULT Decode(
+      IInStream* stream,
+      const std::vector<IndependentChunk>& chunks,
+      ChunkCodec* codec,
+      UInt64 begin,
+      UInt64 end,
+      ISequentialOutStream* out_stream,
+      UInt32 thread_count,
+      Allocator* allocator,
+      const std::atomic<bool>* cancelled,
+      UInt32* crc
+  );
+};
+
+}
+
+#endif //__A7ZIP_PARALLEL_CHUNKS_H__
@@ -0,0 +1,1089 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "ParallelInflate.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <7zCrc.h>
+#include <Alloc.h>
+
+#include "Allocator.h"
+#include "JavaEnv.h"
+#include "Log.h"
+#include "Utils.h"
+
+#ifdef LOG_TAG
+#  undef LOG_TAG
+#endif //LOG_TAG
+#define LOG_TAG "ParallelInflate"
+
+// The compressed bytes of a chunk
+#define CHUNK_SIZE (1 << 20)
+// Smaller streams are left to the handler
+#define MIN_PARALLEL_SIZE (4 << 20)
+#define WINDOW_SIZE (32 * 1024)
+// A chunk decoding to more symbols is left to the serial decoder
+#define MAX_CHUNK_SYMBOLS (16 << 20)
+// The serial decoder writes when it has this much
+#define FLUSH_SIZE (4 << 20)
+#define READ_BUFFER_SIZE (CHUNK_SIZE + 64 * 1024)
+#define LUT_BITS 10
+// Zeros read after the end, more of them means a broken stream
+#define MAX_PADDING_BYTES 8
+
+#define GZIP_FLAG_HCRC 0x02
+#define GZIP_FLAG_EXTRA 0x04
+#define GZIP_FLAG_NAME 0x08
+#define GZIP_FLAG_COMMENT 0x10
+#define GZIP_FLAG_RESERVED 0xE0
+
+using namespace a7zip;
+
+static const UInt16 LENGTH_BASES[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const Byte LENGTH_EXTRAS[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const UInt16 DISTANCE_BASES[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const Byte DISTANCE_EXTRAS[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+static const Byte CODE_LENGTH_ORDER[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+namespace a7zip {
+
+// The threads share the stream, a read is a seek and a read under the lock
+class InflateSource {
+ public:
+  InflateSource(IInStream* stream, UInt64 offset, UInt64 size) :
+      stream(stream),
+      offset(offset),
+      size(size) { }
+
+ public:
+  UInt64 GetSize() { return size; }
+
+  HRESULT Read(UInt64 position, Byte* data, size_t length, size_t& processed) {
+    processed = 0;
+    if (position >= size) {
+      return S_OK;
+    }
+    length = static_cast<size_t>(MIN(static_cast<UInt64>(length), size - position));
+
+    std::lock_guard<std::mutex> lock(mutex);
+    RETURN_SAME_IF_NOT_ZERO(stream->Seek(static_cast<Int64>(offset + position), STREAM_SEEK_SET, nullptr));
+    while (processed < length) {
+      UInt32 n = 0;
+      RETURN_SAME_IF_NOT_ZERO(stream->Read(data + processed, static_cast<UInt32>(length - processed), &n));
+      if (n == 0) {
+        break;
+      }
+      processed += n;
+    }
+    return S_OK;
+  }
+
+ private:
+  IInStream* stream;
+  UInt64 offset;
+  UInt64 size;
+  std::mutex mutex;
+};
+
+// Reads bits from the least significant one. Seeking inside the buffer is cheap,
+// the block finder seeks to every bit of a chunk.
+class BitReader {
+ public:
+  explicit BitReader(InflateSource* source) :
+      source(source),
+      buffer(READ_BUFFER_SIZE),
+      buffer_start(0),
+      buffer_length(0),
+      byte_position(0),
+      bits(0),
+      bit_count(0),
+      padding(0),
+      result(S_OK) { }
+
+ public:
+  HRESULT GetResult() { return result; }
+  UInt64 GetPosition() { return byte_position * 8 - bit_count; }
+
+  void Seek(UInt64 bit_position) {
+    UInt64 byte = bit_position >> 3;
+    if (byte < buffer_start || byte >= buffer_start + buffer_length) {
+      Load(byte);
+    }
+    byte_position = byte;
+    bits = 0;
+    bit_count = 0;
+    padding = 0;
+    if ((bit_position & 7) != 0) {
+      Refill();
+      Drop(static_cast<unsigned>(bit_position & 7));
+    }
+  }
+
+  // Makes at least 56 bits ready, returns false after too many bytes past the end
+  bool Refill() {
+    if (byte_position + 8 <= buffer_start + buffer_length) {
+      // Android ABIs are little-endian. The bytes above bit_count are added
+      // again by the next refill, at the same bits.
+      UInt64 word;
+      memcpy(&word, buffer.data() + (byte_position - buffer_start), sizeof(word));
+      bits |= word << bit_count;
+      unsigned n = (63 - bit_count) >> 3;
+      byte_position += n;
+      bit_count += n << 3;
+      return true;
+    }
+
+    while (bit_count < 56) {
+      if (byte_position >= buffer_start + buffer_length && !Load(byte_position)) {
+        // Zeros past the end
+        if (++padding > MAX_PADDING_BYTES) {
+          return false;
+        }
+        byte_position++;
+        bit_count += 8;
+        continue;
+      }
+      bits |= static_cast<UInt64>(buffer[byte_position - buffer_start]) << bit_count;
+      byte_position++;
+      bit_count += 8;
+    }
+    return true;
+  }
+
+  UInt32 Peek(unsigned n) { return static_cast<UInt32>(bits & ((1ULL << n) - 1)); }
+  void Drop(unsigned n) { bits >>= n; bit_count -= n; }
+  UInt32 Bits(unsigned n) {
+    UInt32 value = Peek(n);
+    Drop(n);
+    return value;
+  }
+  void AlignToByte() { Drop(bit_count & 7); }
+  // The position is past the end
+  bool IsOverrun() { return GetPosition() > source->GetSize() * 8; }
+
+ private:
+  bool Load(UInt64 byte) {
+    size_t processed = 0;
+    HRESULT read_result = source->Read(byte, buffer.data(), buffer.size(), processed);
+    if (read_result != S_OK) {
+      result = read_result;
+      processed = 0;
+    }
+    buffer_start = byte;
+    buffer_length = processed;
+    return processed != 0;
+  }
+
+ private:
+  InflateSource* source;
+  std::vector<Byte> buffer;
+  UInt64 buffer_start;
+  size_t buffer_length;
+  // The next byte to put into bits
+  UInt64 byte_position;
+  UInt64 bits;
+  unsigned bit_count;
+  unsigned padding;
+  HRESULT result;
+};
+
+// A canonical Huffman code. Codes up to LUT_BITS are looked up in one step,
+// longer ones are decoded bit by bit.
+class Huffman {
+ public:
+  // Code lengths codes must be complete, the others can have a single code of one bit
+  bool Build(const Byte* lengths, unsigned n, bool code_lengths) {
+    memset(count, 0, sizeof(count));
+    for (unsigned i = 0; i < n; i++) {
+      count[lengths[i]]++;
+    }
+    if (count[0] == n) {
+      // No code, decoding any symbol fails
+      memset(lut, 0, sizeof(lut));
+      return !code_lengths;
+    }
+
+    int left = 1;
+    unsigned max_length = 0;
+    for (unsigned length = 1; length <= 15; length++) {
+      left <<= 1;
+      left -= count[length];
+      if (left < 0) {
+        return false;
+      }
+      if (count[length] != 0) {
+        max_length = length;
+      }
+    }
+    if (left > 0 && (code_lengths || max_length != 1)) {
+      return false;
+    }
+    // A complete code of short codes fills the whole table
+    if (left > 0 || max_length > LUT_BITS) {
+      memset(lut, 0, sizeof(lut));
+    }
+
+    UInt16 offsets[16];
+    UInt16 next_codes[16];
+    offsets[1] = 0;
+    next_codes[1] = 0;
+    for (unsigned length = 1; length < 15; length++) {
+      offsets[length + 1] = offsets[length] + count[length];
+      next_codes[length + 1] = static_cast<UInt16>((next_codes[length] + count[length]) << 1);
+    }
+    for (unsigned i = 0; i < n; i++) {
+      unsigned length = lengths[i];
+      if (length == 0) continue;
+      symbols[offsets[length]++] = static_cast<UInt16>(i);
+
+      UInt32 code = next_codes[length]++;
+      if (length <= LUT_BITS) {
+        UInt32 reversed = 0;
+        for (unsigned bit = 0; bit < length; bit++) {
+          reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+        }
+        for (UInt32 index = reversed; index < (1 << LUT_BITS); index += 1 << length) {
+          lut[index] = static_cast<UInt16>((i << 4) | length);
+        }
+      }
+    }
+    return true;
+  }
+
+  // At least 15 bits must be ready, returns -1 for an invalid code
+  int Decode(BitReader& reader) const {
+    UInt16 entry = lut[reader.Peek(LUT_BITS)];
+    if (entry != 0) {
+      reader.Drop(entry & 15);
+      return entry >> 4;
+    }
+
+    UInt32 peeked = reader.Peek(15);
+    int code = 0;
+    int first = 0;
+    int index = 0;
+    for (unsigned length = 1; length <= 15; length++) {
+      code |= (peeked >> (length - 1)) & 1;
+      int n = count[length];
+      if (code - n < first) {
+        reader.Drop(length);
+        return symbols[index + (code - first)];
+      }
+      index += n;
+      first += n;
+      first <<= 1;
+      code <<= 1;
+    }
+    return -1;
+  }
+
+ private:
+  UInt16 count[16];
+  UInt16 symbols[288];
+  // The symbol and the length, 0 for the slow path
+  UInt16 lut[1 << LUT_BITS];
+};
+
+static Huffman fixed_literals;
+static Huffman fixed_distances;
+static std::once_flag fixed_once;
+
+static void BuildFixedCodes() {
+  Byte lengths[288];
+  memset(lengths, 8, 144);
+  memset(lengths + 144, 9, 112);
+  memset(lengths + 256, 7, 24);
+  memset(lengths + 280, 8, 8);
+  fixed_literals.Build(lengths, 288, false);
+  // 30 and 31 are invalid, but they make the code complete
+  memset(lengths, 5, 32);
+  fixed_distances.Build(lengths, 32, false);
+}
+
+enum InflateStatus {
+  // Stopped at a block boundary at or after the stop position
+  INFLATE_BOUNDARY,
+  // The final block is done
+  INFLATE_END,
+  // The output reached the limit, it can continue
+  INFLATE_FULL,
+  INFLATE_ERROR,
+  // The allocator refused to grow the output
+  INFLATE_NO_MEMORY,
+};
+
+// A growing array from BigAlloc, so it's accounted to the allocator of the thread.
+// Growing returns false instead of throwing if the budget refuses it.
+template <typename T>
+class InflateBuffer {
+ public:
+  InflateBuffer() : items(nullptr), length(0), capacity(0) { }
+  ~InflateBuffer() { BigFree(items); }
+
+  InflateBuffer(const InflateBuffer&) = delete;
+  InflateBuffer& operator=(const InflateBuffer&) = delete;
+
+ public:
+  size_t size() const { return length; }
+  T* data() { return items; }
+  const T* data() const { return items; }
+  T& operator[](size_t index) { return items[index]; }
+  const T& operator[](size_t index) const { return items[index]; }
+
+  bool push_back(T item) {
+    if (length == capacity && !Grow(length + 1)) return false;
+    items[length++] = item;
+    return true;
+  }
+  bool resize(size_t new_length) {
+    if (new_length > capacity && !Grow(new_length)) return false;
+    length = new_length;
+    return true;
+  }
+  void clear() { length = 0; }
+  // Drops the first items
+  void EraseFront(size_t count) {
+    memmove(items, items + count, (length - count) * sizeof(T));
+    length -= count;
+  }
+  // Gives the memory back
+  void Free() {
+    BigFree(items);
+    items = nullptr;
+    length = 0;
+    capacity = 0;
+  }
+
+ private:
+  bool Grow(size_t min_capacity) {
+    size_t new_capacity = MAX(min_capacity, MAX(capacity * 2, static_cast<size_t>(WINDOW_SIZE)));
+    T* new_items = static_cast<T*>(BigAlloc(new_capacity * sizeof(T)));
+    if (new_items == nullptr) return false;
+    if (length != 0) {
+      memcpy(new_items, items, length * sizeof(T));
+    }
+    BigFree(items);
+    items = new_items;
+    capacity = new_capacity;
+    return true;
+  }
+
+ private:
+  T* items;
+  size_t length;
+  size_t capacity;
+};
+
+// Decodes into the buffer, the window is whatever is in it before.
+// Bytes for the serial decoder, 16-bit symbols with markers for the chunks.
+template <typename T>
+class Inflater {
+ public:
+  Inflater(BitReader& reader, InflateBuffer<T>& out) :
+      reader(reader),
+      out(out),
+      state(STATE_HEADER),
+      final(false),
+      stored_left(0),
+      literals(nullptr),
+      distances(nullptr) {
+    std::call_once(fixed_once, BuildFixedCodes);
+  }
+
+ public:
+  // At a block boundary
+  void Reset(bool end) {
+    state = end ? STATE_END : STATE_HEADER;
+    final = end;
+  }
+
+  bool ReadHeader() {
+    if (!reader.Refill()) return false;
+    final = reader.Bits(1) != 0;
+    switch (reader.Bits(2)) {
+      case 0: {
+        reader.AlignToByte();
+        if (!reader.Refill()) return false;
+        UInt32 length = reader.Bits(16);
+        UInt32 inverted = reader.Bits(16);
+        if (length != (~inverted & 0xFFFF)) return false;
+        stored_left = length;
+        state = STATE_STORED;
+        return true;
+      }
+      case 1:
+        literals = &fixed_literals;
+        distances = &fixed_distances;
+        state = STATE_HUFFMAN;
+        return true;
+      case 2:
+        if (!ReadDynamicCodes()) return false;
+        literals = &dynamic_literals;
+        distances = &dynamic_distances;
+        state = STATE_HUFFMAN;
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  // Blocks starting before stop_bit are decoded
+  InflateStatus Run(UInt64 stop_bit, size_t max_size) {
+    while (true) {
+      switch (state) {
+        case STATE_END:
+          return INFLATE_END;
+        case STATE_HEADER:
+          if (final) {
+            state = STATE_END;
+            return INFLATE_END;
+          }
+          if (reader.GetPosition() >= stop_bit) {
+            return INFLATE_BOUNDARY;
+          }
+          if (!ReadHeader()) return INFLATE_ERROR;
+          break;
+        case STATE_STORED:
+          while (stored_left != 0) {
+            if (out.size() >= max_size) return INFLATE_FULL;
+            if (!reader.Refill()) return INFLATE_ERROR;
+            // All the bytes ready
+            for (unsigned i = MIN(stored_left, 7u); i != 0; i--) {
+              if (!out.push_back(static_cast<T>(reader.Bits(8)))) return INFLATE_NO_MEMORY;
+            }
+            stored_left -= MIN(stored_left, 7u);
+          }
+          state = STATE_HEADER;
+          break;
+        case STATE_HUFFMAN: {
+          InflateStatus status = DecodeHuffman(max_size);
+          if (status != INFLATE_BOUNDARY) return status;
+          state = STATE_HEADER;
+          break;
+        }
+      }
+      if (reader.IsOverrun()) return INFLATE_ERROR;
+    }
+  }
+
+ private:
+  bool ReadDynamicCodes() {
+    if (!reader.Refill()) return false;
+    unsigned literal_count = reader.Bits(5) + 257;
+    unsigned distance_count = reader.Bits(5) + 1;
+    unsigned code_length_count = reader.Bits(4) + 4;
+    if (literal_count > 286 || distance_count > 30) return false;
+
+    Byte lengths[320];
+    memset(lengths, 0, 19);
+    for (unsigned i = 0; i < code_length_count; i++) {
+      if (!reader.Refill()) return false;
+      lengths[CODE_LENGTH_ORDER[i]] = static_cast<Byte>(reader.Bits(3));
+    }
+    Huffman code_lengths;
+    if (!code_lengths.Build(lengths, 19, true)) return false;
+
+    unsigned total = literal_count + distance_count;
+    unsigned index = 0;
+    while (index < total) {
+      if (!reader.Refill()) return false;
+      int symbol = code_lengths.Decode(reader);
+      if (symbol < 0) return false;
+      if (symbol < 16) {
+        lengths[index++] = static_cast<Byte>(symbol);
+        continue;
+      }
+
+      Byte length = 0;
+      unsigned repeat;
+      if (symbol == 16) {
+        if (index == 0) return false;
+        length = lengths[index - 1];
+        repeat = 3 + reader.Bits(2);
+      } else if (symbol == 17) {
+        repeat = 3 + reader.Bits(3);
+      } else {
+        repeat = 11 + reader.Bits(7);
+      }
+      if (index + repeat > total) return false;
+      memset(lengths + index, length, repeat);
+      index += repeat;
+    }
+
+    // No end of block, it never ends
+    if (lengths[256] == 0) return false;
+    return dynamic_literals.Build(lengths, literal_count, false) &&
+        dynamic_distances.Build(lengths + literal_count, distance_count, false);
+  }
+
+  InflateStatus DecodeHuffman(size_t max_size) {
+    const Huffman& literal_code = *literals;
+    const Huffman& distance_code = *distances;
+    while (true) {
+      if (out.size() >= max_size) return INFLATE_FULL;
+      // A symbol with its distance takes 48 bits at most
+      if (!reader.Refill()) return INFLATE_ERROR;
+
+      int symbol = literal_code.Decode(reader);
+      if (symbol < 256) {
+        if (symbol < 0) return INFLATE_ERROR;
+        if (!out.push_back(static_cast<T>(symbol))) return INFLATE_NO_MEMORY;
+        continue;
+      }
+      if (symbol == 256) {
+        return INFLATE_BOUNDARY;
+      }
+
+      symbol -= 257;
+      if (symbol >= 29) return INFLATE_ERROR;
+      size_t length = LENGTH_BASES[symbol] + reader.Bits(LENGTH_EXTRAS[symbol]);
+      int distance_symbol = distance_code.Decode(reader);
+      if (distance_symbol < 0 || distance_symbol >= 30) return INFLATE_ERROR;
+      size_t distance = DISTANCE_BASES[distance_symbol] + reader.Bits(DISTANCE_EXTRAS[distance_symbol]);
+
+      size_t n = out.size();
+      if (distance > n) return INFLATE_ERROR;
+      if (!out.resize(n + length)) return INFLATE_NO_MEMORY;
+      T* dst = out.data() + n;
+      const T* src = dst - distance;
+      for (size_t i = 0; i < length; i++) {
+        dst[i] = src[i];
+      }
+    }
+  }
+
+ private:
+  enum State {
+    STATE_HEADER,
+    STATE_STORED,
+    STATE_HUFFMAN,
+    STATE_END,
+  };
+
+  BitReader& reader;
+  InflateBuffer<T>& out;
+  State state;
+  bool final;
+  UInt32 stored_left;
+  const Huffman* literals;
+  const Huffman* distances;
+  Huffman dynamic_literals;
+  Huffman dynamic_distances;
+};
+
+// Symbols under 256 are bytes, the others are markers of the byte at
+// (symbol - 256) in the 32 KiB window before the chunk
+struct InflateChunk {
+  bool valid;
+  UInt64 start_bit;
+  UInt64 end_bit;
+  bool final;
+  InflateBuffer<UInt16> symbols;
+};
+
+// Decodes the chunks on the threads, at most thread_count chunks ahead of the consumer
+class ChunkDecoder {
+ public:
+  ChunkDecoder(
+      InflateSource* source,
+      UInt32 thread_count,
+      Allocator* allocator,
+      const std::atomic<bool>* cancelled
+  ) :
+      source(source),
+      thread_count(thread_count),
+      allocator(allocator),
+      chunk_count(static_cast<size_t>((source->GetSize() + CHUNK_SIZE - 1) / CHUNK_SIZE)),
+      chunks(chunk_count),
+      next_chunk(1),
+      consumed(0),
+      stopped(false),
+      cancelled(cancelled) { }
+
+  ~ChunkDecoder() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopped = true;
+      condition.notify_all();
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+  }
+
+ public:
+  size_t GetChunkCount() { return chunk_count; }
+  UInt64 GetChunkEnd(size_t index) { return MIN(static_cast<UInt64>(index + 1) * CHUNK_SIZE, source->GetSize()) * 8; }
+
+  void Start() {
+    for (UInt32 i = 0; i < thread_count; i++) {
+      threads.emplace_back(&ChunkDecoder::Loop, this);
+    }
+  }
+
+  // Waits for the chunk, the previous ones are dropped
+  std::unique_ptr<InflateChunk> Take(size_t index) {
+    std::unique_lock<std::mutex> lock(mutex);
+    consumed = index;
+    condition.notify_all();
+    condition.wait(lock, [this, index] { return chunks[index] != nullptr; });
+    return std::move(chunks[index]);
+  }
+
+ private:
+  void Loop() {
+    // The stream may be a java stream
+    JavaEnv env;
+    // The symbols are accounted to the allocator
+    Allocator::Scope scope(allocator);
+
+    while (true) {
+      size_t index;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [this] {
+          return stopped || next_chunk >= chunk_count || next_chunk <= consumed + thread_count;
+        });
+        if (stopped || next_chunk >= chunk_count) {
+          return;
+        }
+        index = next_chunk++;
+      }
+
+      std::unique_ptr<InflateChunk> chunk(new InflateChunk());
+      Decode(index, *chunk);
+
+      std::lock_guard<std::mutex> lock(mutex);
+      chunks[index] = std::move(chunk);
+      condition.notify_all();
+    }
+  }
+
+  bool IsStopped() {
+    return stopped || (cancelled != nullptr && cancelled->load());
+  }
+
+  void Decode(size_t index, InflateChunk& chunk) {
+    chunk.valid = false;
+    UInt64 begin_bit = static_cast<UInt64>(index) * CHUNK_SIZE * 8;
+    UInt64 end_bit = GetChunkEnd(index);
+
+    BitReader reader(source);
+    Inflater<UInt16> inflater(reader, chunk.symbols);
+    UInt32 candidates = 0;
+    for (UInt64 bit = begin_bit; bit < end_bit; bit++) {
+      if ((bit & 0xFFFF) == 0 && IsStopped()) {
+        return;
+      }
+
+      // Peeks the positions of a byte at once
+      if ((bit & 7) == 0) {
+        reader.Seek(bit);
+        if (!reader.Refill()) return;
+        candidates = reader.Peek(24);
+      }
+      UInt32 header = candidates >> (bit & 7);
+      // Not final and dynamic, at most 286 literal codes and 30 distance codes
+      if ((header & 7) != 4 || ((header >> 3) & 31) > 29 || ((header >> 8) & 31) > 29) continue;
+
+      reader.Seek(bit);
+      chunk.symbols.clear();
+      inflater.Reset(false);
+      if (!inflater.ReadHeader()) continue;
+
+      // The unknown window
+      if (!chunk.symbols.resize(WINDOW_SIZE)) return;
+      for (UInt16 i = 0; i < WINDOW_SIZE; i++) {
+        chunk.symbols[i] = static_cast<UInt16>(256 + i);
+      }
+
+      InflateStatus status = inflater.Run(end_bit, WINDOW_SIZE + MAX_CHUNK_SYMBOLS);
+      if (status == INFLATE_ERROR) {
+        continue;
+      }
+      if (status == INFLATE_FULL || status == INFLATE_NO_MEMORY) {
+        // Too big, leave it to the serial decoder
+        chunk.symbols.Free();
+        return;
+      }
+
+      chunk.valid = true;
+      chunk.start_bit = bit;
+      chunk.end_bit = reader.GetPosition();
+      chunk.final = status == INFLATE_END;
+      chunk.symbols.EraseFront(WINDOW_SIZE);
+      return;
+    }
+  }
+
+ private:
+  InflateSource* source;
+  UInt32 thread_count;
+  Allocator* allocator;
+  size_t chunk_count;
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::vector<std::unique_ptr<InflateChunk>> chunks;
+  size_t next_chunk;
+  size_t consumed;
+  bool stopped;
+  const std::atomic<bool>* cancelled;
+
+  std::vector<std::thread> threads;
+};
+
+// Writes the data and keeps the last 32 KiB as the window of the next data
+class InflateWriter {
+ public:
+  InflateWriter(ISequentialOutStream* out_stream, const std::atomic<bool>* cancelled) :
+      out_stream(out_stream),
+      cancelled(cancelled),
+      crc(CRC_INIT_VAL),
+      size(0),
+      chunk_count(0) { }
+
+ public:
+  // The CRC and the size are counted from here
+  void Reset() {
+    crc = CRC_INIT_VAL;
+    size = 0;
+  }
+  UInt32 GetCrc() { return CRC_GET_DIGEST(crc); }
+  UInt64 GetSize() { return size; }
+  // The chunks of the threads written, not reset
+  UInt64 GetChunkCount() { return chunk_count; }
+
+  // Writes the bytes after the written ones, and drops all but the window
+  HRESULT Flush(InflateBuffer<Byte>& data, size_t& written) {
+    RETURN_SAME_IF_NOT_ZERO(Write(data.data() + written, data.size() - written));
+    if (data.size() > WINDOW_SIZE) {
+      data.EraseFront(data.size() - WINDOW_SIZE);
+    }
+    written = data.size();
+    return S_OK;
+  }
+
+  // Replaces the markers with the window and writes the chunk, the window is updated
+  HRESULT WriteChunk(const InflateChunk& chunk, InflateBuffer<Byte>& window) {
+    chunk_count++;
+
+    Byte full_window[WINDOW_SIZE];
+    size_t window_size = MIN(window.size(), static_cast<size_t>(WINDOW_SIZE));
+    memset(full_window, 0, WINDOW_SIZE - window_size);
+    memcpy(full_window + WINDOW_SIZE - window_size, window.data() + window.size() - window_size, window_size);
+
+    std::vector<Byte> data(MIN(chunk.symbols.size(), static_cast<size_t>(FLUSH_SIZE)));
+    size_t position = 0;
+    while (position < chunk.symbols.size()) {
+      size_t n = MIN(data.size(), chunk.symbols.size() - position);
+      const UInt16* symbols = chunk.symbols.data() + position;
+      for (size_t i = 0; i < n; i++) {
+        UInt16 symbol = symbols[i];
+        data[i] = symbol < 256 ? static_cast<Byte>(symbol) : full_window[symbol - 256];
+      }
+      RETURN_SAME_IF_NOT_ZERO(Write(data.data(), n));
+      position += n;
+    }
+
+    // The new window is the tail of the old window and the chunk
+    std::vector<Byte> new_window(full_window, full_window + WINDOW_SIZE);
+    size_t tail = MIN(chunk.symbols.size(), static_cast<size_t>(WINDOW_SIZE));
+    new_window.erase(new_window.begin(), new_window.begin() + tail);
+    for (size_t i = chunk.symbols.size() - tail; i < chunk.symbols.size(); i++) {
+      UInt16 symbol = chunk.symbols[i];
+      new_window.push_back(symbol < 256 ? static_cast<Byte>(symbol) : full_window[symbol - 256]);
+    }
+    // The padding isn't real data
+    size_t known = MIN(window_size + chunk.symbols.size(), static_cast<size_t>(WINDOW_SIZE));
+    if (!window.resize(known)) {
+      return E_OUTOFMEMORY;
+    }
+    memcpy(window.data(), new_window.data() + new_window.size() - known, known);
+    return S_OK;
+  }
+
+ private:
+  HRESULT Write(const Byte* data, size_t length) {
+    if (cancelled != nullptr && cancelled->load()) {
+      return E_ABORT;
+    }
+    crc = CrcUpdate(crc, data, length);
+    size += length;
+    while (length != 0) {
+      UInt32 processed = 0;
+      RETURN_SAME_IF_NOT_ZERO(out_stream->Write(data, static_cast<UInt32>(MIN(length, static_cast<size_t>(FLUSH_SIZE))), &processed));
+      if (processed == 0) {
+        return E_FAIL;
+      }
+      data += processed;
+      length -= processed;
+    }
+    return S_OK;
+  }
+
+ private:
+  ISequentialOutStream* out_stream;
+  const std::atomic<bool>* cancelled;
+  UInt32 crc;
+  UInt64 size;
+  UInt64 chunk_count;
+};
+
+}
+
+// Decodes serially until a block boundary at or after stop_bit, or the end
+static HRESULT RunSerial(
+    Inflater<Byte>& inflater,
+    BitReader& reader,
+    InflateBuffer<Byte>& data,
+    size_t& written,
+    InflateWriter& writer,
+    UInt64 stop_bit,
+    bool& end
+) {
+  while (true) {
+    InflateStatus status = inflater.Run(stop_bit, written + FLUSH_SIZE);
+    switch (status) {
+      case INFLATE_FULL:
+        RETURN_SAME_IF_NOT_ZERO(writer.Flush(data, written));
+        break;
+      case INFLATE_BOUNDARY:
+      case INFLATE_END:
+        end = status == INFLATE_END;
+        return writer.Flush(data, written);
+      case INFLATE_NO_MEMORY:
+        return E_OUTOFMEMORY;
+      default:
+        return reader.GetResult() != S_OK ? reader.GetResult() : E_DATA_ERROR;
+    }
+  }
+}
+
+// Decodes the deflate stream at the start of the source, end is the byte after it
+static HRESULT Inflate(
+    InflateSource* source,
+    UInt32 thread_count,
+    Allocator* allocator,
+    InflateWriter& writer,
+    UInt64& end,
+    const std::atomic<bool>* cancelled
+) {
+  ChunkDecoder chunks(source, thread_count, allocator, cancelled);
+  chunks.Start();
+
+  BitReader reader(source);
+  InflateBuffer<Byte> data;
+  size_t written = 0;
+  Inflater<Byte> inflater(reader, data);
+
+  bool finished = false;
+  for (size_t index = 1; !finished; index++) {
+    UInt64 position = reader.GetPosition();
+    if (index >= chunks.GetChunkCount()) {
+      RETURN_SAME_IF_NOT_ZERO(RunSerial(inflater, reader, data, written, writer, UINT64_MAX, finished));
+      if (!finished) return E_DATA_ERROR;
+      break;
+    }
+
+    std::unique_ptr<InflateChunk> chunk = chunks.Take(index);
+    if (chunk->valid && chunk->start_bit >= position) {
+      // Decode up to the chunk, it lines up if the previous block ends right there
+      RETURN_SAME_IF_NOT_ZERO(RunSerial(inflater, reader, data, written, writer, chunk->start_bit, finished));
+      if (!finished && reader.GetPosition() == chunk->start_bit) {
+        RETURN_SAME_IF_NOT_ZERO(writer.WriteChunk(*chunk, data));
+        written = data.size();
+        reader.Seek(chunk->end_bit);
+        finished = chunk->final;
+        inflater.Reset(finished);
+      }
+    } else {
+      RETURN_SAME_IF_NOT_ZERO(RunSerial(inflater, reader, data, written, writer, chunks.GetChunkEnd(index), finished));
+    }
+  }
+
+  end = (reader.GetPosition() + 7) / 8;
+  return S_OK;
+}
+
+static HRESULT ReadFully(IInStream* stream, UInt64 offset, Byte* data, size_t size) {
+  RETURN_SAME_IF_NOT_ZERO(stream->Seek(static_cast<Int64>(offset), STREAM_SEEK_SET, nullptr));
+  while (size != 0) {
+    UInt32 processed = 0;
+    RETURN_SAME_IF_NOT_ZERO(stream->Read(data, static_cast<UInt32>(size), &processed));
+    if (processed == 0) {
+      return E_UNEXPECTED_END;
+    }
+    data += processed;
+    size -= processed;
+  }
+  return S_OK;
+}
+
+static HRESULT SkipZeroTerminated(IInStream* stream, UInt64& offset, UInt64 stream_size) {
+  Byte buffer[256];
+  while (offset < stream_size) {
+    size_t n = static_cast<size_t>(MIN(static_cast<UInt64>(sizeof(buffer)), stream_size - offset));
+    RETURN_SAME_IF_NOT_ZERO(ReadFully(stream, offset, buffer, n));
+    const void* zero = memchr(buffer, 0, n);
+    if (zero != nullptr) {
+      offset += static_cast<const Byte*>(zero) - buffer + 1;
+      return S_OK;
+    }
+    offset += n;
+  }
+  return E_UNEXPECTED_END;
+}
+
+// Returns S_FALSE if it isn't a gzip member header
+static HRESULT ReadGzipHeader(IInStream* stream, UInt64 offset, UInt64 stream_size, UInt64& data_offset) {
+  Byte header[10];
+  if (stream_size < offset + sizeof(header) || ReadFully(stream, offset, header, sizeof(header)) != S_OK) {
+    return S_FALSE;
+  }
+  if (header[0] != 0x1F || header[1] != 0x8B || header[2] != 8 || (header[3] & GZIP_FLAG_RESERVED) != 0) {
+    return S_FALSE;
+  }
+
+  Byte flags = header[3];
+  offset += sizeof(header);
+  if ((flags & GZIP_FLAG_EXTRA) != 0) {
+    Byte extra_length[2];
+    RETURN_SAME_IF_NOT_ZERO(ReadFully(stream, offset, extra_length, sizeof(extra_length)));
+    offset += sizeof(extra_length) + (extra_length[0] | (extra_length[1] << 8));
+  }
+  if ((flags & GZIP_FLAG_NAME) != 0) {
+    RETURN_SAME_IF_NOT_ZERO(SkipZeroTerminated(stream, offset, stream_size));
+  }
+  if ((flags & GZIP_FLAG_COMMENT) != 0) {
+    RETURN_SAME_IF_NOT_ZERO(SkipZeroTerminated(stream, offset, stream_size));
+  }
+  if ((flags & GZIP_FLAG_HCRC) != 0) {
+    offset += 2;
+  }
+  if (offset > stream_size) {
+    return E_UNEXPECTED_END;
+  }
+
+  data_offset = offset;
+  return S_OK;
+}
+
+static UInt32 GetUInt32(const Byte* p) {
+  return static_cast<UInt32>(p[0]) | (static_cast<UInt32>(p[1]) << 8) |
+      (static_cast<UInt32>(p[2]) << 16) | (static_cast<UInt32>(p[3]) << 24);
+}
+
+HRESULT ParallelInflate::DecodeGzip(
+    IInStream* stream,
+    ISequentialOutStream* out_stream,
+    UInt32 thread_count,
+    Allocator* allocator,
+    UInt64& chunk_count,
+    const std::atomic<bool>* cancelled
+) {
+  chunk_count = 0;
+
+  UInt64 stream_size;
+  RETURN_SAME_IF_NOT_ZERO(stream->Seek(0, STREAM_SEEK_END, &stream_size));
+  if (thread_count < 2 || stream_size < MIN_PARALLEL_SIZE) {
+    return S_FALSE;
+  }
+
+  UInt64 data_offset;
+  HRESULT result = ReadGzipHeader(stream, 0, stream_size, data_offset);
+  if (result != S_OK) {
+    // Let the handler report it
+    return S_FALSE;
+  }
+
+  InflateWriter writer(out_stream, cancelled);
+  while (true) {
+    writer.Reset();
+
+    UInt64 end;
+    {
+      InflateSource source(stream, data_offset, stream_size - data_offset);
+      result = Inflate(&source, thread_count, allocator, writer, end, cancelled);
+      chunk_count = writer.GetChunkCount();
+      RETURN_SAME_IF_NOT_ZERO(result);
+    }
+
+    // No serial retry, see ParallelInflate
+    Byte trailer[8];
+    RETURN_SAME_IF_NOT_ZERO(ReadFully(stream, data_offset + end, trailer, sizeof(trailer)));
+    if (GetUInt32(trailer) != writer.GetCrc() || GetUInt32(trailer + 4) != static_cast<UInt32>(writer.GetSize())) {
+      return E_CRC_ERROR;
+    }
+
+    // Members are concatenated, like gzip -d does. Data after them is ignored.
+    UInt64 offset = data_offset + end + sizeof(trailer);
+    if (ReadGzipHeader(stream, offset, stream_size, data_offset) != S_OK) {
+      return S_OK;
+    }
+  }
+}
+
+HRESULT ParallelInflate::DecodeDeflate(
+    IInStream* stream,
+    UInt64 packed_size,
+    UInt32 crc,
+    UInt64 size,
+    ISequentialOutStream* out_stream,
+    UInt32 thread_count,
+    Allocator* allocator,
+    UInt64& chunk_count,
+    const std::atomic<bool>* cancelled
+) {
+  chunk_count = 0;
+  if (thread_count < 2 || packed_size < MIN_PARALLEL_SIZE) {
+    return S_FALSE;
+  }
+
+  InflateWriter writer(out_stream, cancelled);
+  UInt64 end;
+  {
+    InflateSource source(stream, 0, packed_size);
+    HRESULT result = Inflate(&source, thread_count, allocator, writer, end, cancelled);
+    chunk_count = writer.GetChunkCount();
+    RETURN_SAME_IF_NOT_ZERO(result);
+  }
+  if (end > packed_size) {
+    return E_DATA_ERROR;
+  }
+  // No serial retry, see ParallelInflate
+  if (writer.GetCrc() != crc || writer.GetSize() != size) {
+    return E_CRC_ERROR;
+  }
+  return S_OK;
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __A7ZIP_PARALLEL_INFLATE_H__
+#define __A7ZIP_PARALLEL_INFLATE_H__
+
+#include <atomic>
+
+#include <include_windows/windows.h>
+#include <7zip/IStream.h>
+
+#include "Allocator.h"
+
+namespace a7zip {
+
+// Decodes a big deflate stream with threads, the way of pugz and rapidgzip.
+//
+// The compressed stream is cut into chunks. A thread finds the first dynamic block
+// in its chunk by trying every bit position, and decodes from there without the 32 KiB
+// before it: back-references into the unknown window are kept as markers. The calling
+// thread checks that the previous chunk ends right where the next one starts, replaces
+// the markers with the real window and writes the data. A chunk which doesn't line up,
+// or has no dynamic block, is decoded serially from where the previous one ends.
+// The CRC32 and the size are checked at the end.
+// The symbols and the data are allocated with the allocator, the memory budget applies.
+//
+// A mismatch of the CRC32 or the size is an error, there is no serial retry. A chunk is
+// used only if the serial decoder stops at a block boundary right at its start bit, so its
+// symbols are what the serial decoder would have decoded from there, and a mismatch means
+// the stream is broken. The data is written already, a retry couldn't take it back either.
+class ParallelInflate {
+ public:
+  // Decodes the members of a gzip stream. chunk_count is set to the chunks decoded by the threads.
+  // Returns S_FALSE if it's too small for threads or it isn't a gzip, nothing is written then.
+  static HRESULT DecodeGzip(
+      IInStream* stream,
+      ISequentialOutStream* out_stream,
+      UInt32 thread_count,
+      Allocator* allocator,
+      UInt64& chunk_count,
+      const std::atomic<bool>* cancelled
+  );
+
+  // Decodes the raw deflate data of a zip entry, the stream starts with it.
+  // chunk_count is set to the chunks decoded by the threads.
+  // Returns S_FALSE if it's too small for threads, nothing is written then.
+  static HRESULT DecodeDeflate(
+      IInStream* stream,
+      UInt64 packed_size,
+      UInt32 crc,
+      UInt64 size,
+      ISequentialOutStream* out_stream,
+      UInt32 thread_count,
+      Allocator* allocator,
+      UInt64& chunk_count,
+      const std::atomic<bool>* cancelled
+  );
+};
+
+}
+
+#endif //__A7ZIP_PARALLEL_INFLATE_H__
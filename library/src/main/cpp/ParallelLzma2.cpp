@@ -0,0 +1,241 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "ParallelLzma2.h"
+
+#include <vector>
+
+#include <Alloc.h>
+#include <Lzma2Dec.h>
+
+#include "Log.h"
+#include "ParallelChunks.h"
+#include "Utils.h"
+
+#ifdef LOG_TAG
+#  undef LOG_TAG
+#endif //LOG_TAG
+#define LOG_TAG "ParallelLzma2"
+
+// A bigger piece takes too much memory
+#define MAX_PIECE_SIZE (256ULL << 20)
+
+#define LZMA2_CONTROL_END 0x00
+#define LZMA2_CONTROL_COPY_RESET_DIC 0x01
+#define LZMA2_CONTROL_COPY 0x02
+#define LZMA2_CONTROL_LZMA 0x80
+#define LZMA2_GET_MODE(control) (((control) >> 5) & 3)
+// Resets the state and sets new properties
+#define LZMA2_MODE_NEW_PROP 2
+// Resets the dictionary too
+#define LZMA2_MODE_RESET_DIC 3
+
+// The piece is decoded into one buffer, it's the dictionary.
+// The property only sizes a dictionary which isn't allocated.
+#define LZMA2_PROP_ANY 40
+
+using namespace a7zip;
+
+namespace a7zip {
+
+class Lzma2ChunkCodec : public ChunkCodec {
+ public:
+  HRESULT DecodeChunk(size_t, const IndependentChunk& chunk, const Byte* packed, Byte* data) {
+    CLzma2Dec decoder;
+    Lzma2Dec_Construct(&decoder);
+    if (Lzma2Dec_AllocateProbs(&decoder, LZMA2_PROP_ANY, &g_Alloc) != SZ_OK) {
+      return E_OUTOFMEMORY;
+    }
+    decoder.decoder.dic = data;
+    decoder.decoder.dicBufSize = static_cast<SizeT>(chunk.size);
+    Lzma2Dec_Init(&decoder);
+
+    SizeT packed_size = static_cast<SizeT>(chunk.packed_size);
+    ELzmaStatus status;
+    SRes result = Lzma2Dec_DecodeToDic(&decoder, decoder.decoder.dicBufSize, packed, &packed_size, LZMA_FINISH_ANY, &status);
+    if (result == SZ_OK && (packed_size != chunk.packed_size || decoder.decoder.dicPos != chunk.size)) {
+      result = SZ_ERROR_DATA;
+    }
+    if (result == SZ_OK) {
+      // The end marker checks that the last chunk of the piece is complete
+      static const Byte END = LZMA2_CONTROL_END;
+      SizeT end_size = 1;
+      result = Lzma2Dec_DecodeToDic(&decoder, decoder.decoder.dicBufSize, &END, &end_size, LZMA_FINISH_END, &status);
+      if (result == SZ_OK && status != LZMA_STATUS_FINISHED_WITH_MARK) {
+        result = SZ_ERROR_DATA;
+      }
+    }
+    Lzma2Dec_FreeProbs(&decoder, &g_Alloc);
+
+    switch (result) {
+      case SZ_OK:
+        return S_OK;
+      case SZ_ERROR_MEM:
+        return E_OUTOFMEMORY;
+      default:
+        return E_DATA_ERROR;
+    }
+  }
+};
+
+}
+
+static HRESULT ReadFully(IInStream* stream, UInt64 offset, Byte* data, size_t size) {
+  RETURN_SAME_IF_NOT_ZERO(stream->Seek(static_cast<Int64>(offset), STREAM_SEEK_SET, nullptr));
+  while (size != 0) {
+    UInt32 processed = 0;
+    RETURN_SAME_IF_NOT_ZERO(stream->Read(data, static_cast<UInt32>(size), &processed));
+    if (processed == 0) {
+      return E_UNEXPECTED_END;
+    }
+    data += processed;
+    size -= processed;
+  }
+  return S_OK;
+}
+
+// Splits the stream into pieces starting with a dictionary reset.
+// Returns S_FALSE if it isn't an LZMA2 stream of the sizes.
+static HRESULT Scan(
+    IInStream* stream,
+    UInt64 offset,
+    UInt64 packed_size,
+    UInt64 size,
+    std::vector<IndependentChunk>& pieces
+) {
+  UInt64 position = 0;
+  UInt64 unpacked = 0;
+  // A copy chunk resetting the dictionary doesn't set the properties,
+  // the piece starting with it is independent only if the next LZMA chunk sets them
+  bool need_prop = false;
+
+  while (true) {
+    Byte header[6];
+    if (position >= packed_size) {
+      return S_FALSE;
+    }
+    size_t read_size = static_cast<size_t>(MIN(static_cast<UInt64>(sizeof(header)), packed_size - position));
+    RETURN_SAME_IF_NOT_ZERO(ReadFully(stream, offset + position, header, read_size));
+    Byte control = header[0];
+    if (control == LZMA2_CONTROL_END) {
+      break;
+    }
+
+    size_t header_size;
+    UInt64 chunk_size;
+    UInt64 chunk_packed_size;
+    bool reset;
+    if (control == LZMA2_CONTROL_COPY_RESET_DIC || control == LZMA2_CONTROL_COPY) {
+      header_size = 3;
+      if (header_size > read_size) return S_FALSE;
+      chunk_size = ((static_cast<UInt32>(header[1]) << 8) | header[2]) + 1;
+      chunk_packed_size = chunk_size;
+      reset = control == LZMA2_CONTROL_COPY_RESET_DIC;
+    } else if (control >= LZMA2_CONTROL_LZMA) {
+      unsigned mode = LZMA2_GET_MODE(control);
+      header_size = mode >= LZMA2_MODE_NEW_PROP ? 6 : 5;
+      if (header_size > read_size) return S_FALSE;
+      chunk_size = ((static_cast<UInt32>(control & 0x1F) << 16) | (static_cast<UInt32>(header[1]) << 8) | header[2]) + 1;
+      chunk_packed_size = ((static_cast<UInt32>(header[3]) << 8) | header[4]) + 1;
+      reset = mode == LZMA2_MODE_RESET_DIC;
+
+      if (need_prop && mode < LZMA2_MODE_NEW_PROP && pieces.size() > 1) {
+        // It depends on the properties of the previous piece
+        IndependentChunk& previous = pieces[pieces.size() - 2];
+        previous.packed_size += pieces.back().packed_size;
+        previous.size += pieces.back().size;
+        pieces.pop_back();
+      }
+      need_prop = false;
+    } else {
+      return S_FALSE;
+    }
+
+    if (reset || pieces.empty()) {
+      IndependentChunk piece;
+      piece.packed_offset = offset + position;
+      piece.packed_size = 0;
+      piece.offset = unpacked;
+      piece.size = 0;
+      pieces.push_back(piece);
+      need_prop = control == LZMA2_CONTROL_COPY_RESET_DIC;
+    }
+
+    UInt64 total_size = header_size + chunk_packed_size;
+    pieces.back().packed_size += total_size;
+    pieces.back().size += chunk_size;
+    position += total_size;
+    unpacked += chunk_size;
+  }
+
+  // The end marker isn't in the last piece
+  return position + 1 == packed_size && unpacked == size ? S_OK : S_FALSE;
+}
+
+HRESULT ParallelLzma2::Split(
+    IInStream* stream,
+    UInt64 offset,
+    UInt64 packed_size,
+    UInt64 size,
+    UInt64 begin,
+    UInt64 end,
+    std::vector<IndependentChunk>& pieces
+) {
+  pieces.clear();
+  if (end > size || begin > end || end - begin < MIN_PARALLEL_SIZE) {
+    return S_FALSE;
+  }
+
+  RETURN_SAME_IF_NOT_ZERO(Scan(stream, offset, packed_size, size, pieces));
+
+  for (const IndependentChunk& piece : pieces) {
+    if (piece.offset + piece.size <= begin || piece.offset >= end) continue;
+    if (piece.size > MAX_PIECE_SIZE) {
+      return S_FALSE;
+    }
+  }
+  return CountPieces(pieces, begin, end) < 2 ? S_FALSE : S_OK;
+}
+
+size_t ParallelLzma2::CountPieces(const std::vector<IndependentChunk>& pieces, UInt64 begin, UInt64 end) {
+  size_t count = 0;
+  for (const IndependentChunk& piece : pieces) {
+    if (piece.offset + piece.size <= begin || piece.offset >= end) continue;
+    count++;
+  }
+  return count;
+}
+
+HRESULT ParallelLzma2::Decode(
+    IInStream* stream,
+    const std::vector<IndependentChunk>& pieces,
+    UInt64 begin,
+    UInt64 end,
+    ISequentialOutStream* out_stream,
+    UInt32 thread_count,
+    Allocator* allocator,
+    const std::atomic<bool>* cancelled,
+    UInt32* crc
+) {
+  if (thread_count < 2) {
+    return S_FALSE;
+  }
+
+  Lzma2ChunkCodec codec;
+  return ParallelChunks::Decode(
+      stream, pieces, &codec, begin, end, out_stream, thread_count, allocator, cancelled, crc);
+}
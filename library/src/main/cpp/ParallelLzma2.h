@@ -0,0 +1,77 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __A7ZIP_PARALLEL_LZMA2_H__
+#define __A7ZIP_PARALLEL_LZMA2_H__
+
+#include <atomic>
+#include <vector>
+
+#include <include_windows/windows.h>
+#include <7zip/IStream.h>
+
+#include "Allocator.h"
+#include "ParallelChunks.h"
+
+namespace a7zip {
+
+// Decodes an LZMA2 stream with threads.
+//
+// A multithreaded LZMA2 encoder compresses blocks of the input alone, each block
+// starts with a chunk which resets the dictionary, the state and the properties.
+// The control bytes of the chunks are scanned for these resets, the pieces between
+// them are decoded by ParallelChunks. A stream of one block can't be decoded this way.
+class ParallelLzma2 {
+ public:
+  // Smaller ranges are left to the handler
+  static const UInt64 MIN_PARALLEL_SIZE = 4ULL << 20;
+
+  // Splits the stream at the offset into the pieces, it has size unpacked bytes.
+  // Returns S_FALSE if the unpacked bytes [begin, end) are small or fall in one piece,
+  // they should be decoded as usual then.
+  static HRESULT Split(
+      IInStream* stream,
+      UInt64 offset,
+      UInt64 packed_size,
+      UInt64 size,
+      UInt64 begin,
+      UInt64 end,
+      std::vector<IndependentChunk>& pieces
+  );
+
+  // Returns how many pieces the unpacked bytes [begin, end) fall in
+  static size_t CountPieces(const std::vector<IndependentChunk>& pieces, UInt64 begin, UInt64 end);
+
+  // Writes the unpacked bytes [begin, end) of the pieces from Split.
+  // Pieces before begin aren't decoded.
+  // The CRC32 of the written bytes is set to crc if it isn't null.
+  static HRESULT Decode(
+      IInStream* stream,
+      const std::vector<IndependentChunk>& pieces,
+      UInt64 begin,
+      UInt64 end,
+      ISequentialOutStream* out_stream,
+      UInt32 thread_count,
+      Allocator* allocator,
+      const std::atomic<bool>* cancelled,
+      UInt32* crc
+  );
+};
+
+}
+
+#endif //__A7ZIP_PARALLEL_LZMA2_H__
@@ -0,0 +1,184 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "PipelineOutStream.h"
+
+#include <cstring>
+
+#include "JavaEnv.h"
+#include "Log.h"
+#include "Utils.h"
+
+#ifdef LOG_TAG
+#  undef LOG_TAG
+#endif //LOG_TAG
+#define LOG_TAG "PipelineOutStream"
+
+using namespace a7zip;
+
+static HRESULT WriteFully(ISequentialOutStream* out_stream, const Byte* data, size_t size) {
+  while (size != 0) {
+    UInt32 processed = 0;
+    RETURN_SAME_IF_NOT_ZERO(out_stream->Write(data, static_cast<UInt32>(size), &processed));
+    if (processed == 0) {
+      return E_FAIL;
+    }
+    data += processed;
+    size -= processed;
+  }
+  return S_OK;
+}
+
+PipelineOutStream::PipelineOutStream(
+    ISequentialOutStream* out_stream,
+    UInt32 buffer_count,
+    UInt32 buffer_size
+) :
+    out_stream(out_stream),
+    buffer_count(MAX(buffer_count, static_cast<UInt32>(2))),
+    buffer_size(MAX(buffer_size, static_cast<UInt32>(DEFAULT_BUFFER_SIZE))),
+    current(0),
+    current_size(0),
+    finishing(false),
+    stopped(false),
+    result(S_OK) {
+  // The others are allocated when the out stream falls behind,
+  // reserved so the thread can read the buffers while one is added
+  buffers.reserve(this->buffer_count);
+  buffers.emplace_back(this->buffer_size);
+}
+
+PipelineOutStream::~PipelineOutStream() {
+  Stop();
+}
+
+HRESULT PipelineOutStream::Write(const void* data, UInt32 size, UInt32* processedSize) {
+  if (processedSize != nullptr) {
+    *processedSize = 0;
+  }
+
+  const Byte* bytes = reinterpret_cast<const Byte*>(data);
+  while (size != 0) {
+    if (current_size == buffer_size) {
+      RETURN_SAME_IF_NOT_ZERO(Submit());
+    }
+
+    size_t length = MIN(static_cast<size_t>(size), buffer_size - current_size);
+    memcpy(buffers[current].data() + current_size, bytes, length);
+    current_size += length;
+    bytes += length;
+    size -= length;
+    if (processedSize != nullptr) {
+      *processedSize += static_cast<UInt32>(length);
+    }
+  }
+
+  return S_OK;
+}
+
+HRESULT PipelineOutStream::Submit() {
+  std::unique_lock<std::mutex> lock(mutex);
+  if (result != S_OK) {
+    return result;
+  }
+
+  if (!thread.joinable()) {
+    thread = std::thread(&PipelineOutStream::Run, this);
+  }
+  full_buffers.emplace_back(current, current_size);
+  condition.notify_all();
+
+  if (free_buffers.empty() && buffers.size() < buffer_count) {
+    buffers.emplace_back(buffer_size);
+    free_buffers.push_back(buffers.size() - 1);
+  }
+  // Back pressure, the decoder waits for the out stream
+  condition.wait(lock, [this] { return !free_buffers.empty() || result != S_OK; });
+  if (result != S_OK) {
+    return result;
+  }
+
+  current = free_buffers.front();
+  free_buffers.pop_front();
+  current_size = 0;
+  return S_OK;
+}
+
+void PipelineOutStream::Run() {
+  // The out stream may be a java stream, keep the thread attached for all writes
+  JavaEnv env;
+  if (!env.IsValid()) {
+    LOGE("Can't attach the pipeline thread");
+  }
+
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    condition.wait(lock, [this] { return !full_buffers.empty() || finishing || stopped; });
+    if (stopped || full_buffers.empty()) {
+      break;
+    }
+
+    std::pair<size_t, size_t> buffer = full_buffers.front();
+    full_buffers.pop_front();
+    const Byte* data = buffers[buffer.first].data();
+    lock.unlock();
+    HRESULT write_result = WriteFully(out_stream, data, buffer.second);
+    lock.lock();
+
+    if (write_result != S_OK && result == S_OK) {
+      result = write_result;
+    }
+    free_buffers.push_back(buffer.first);
+    condition.notify_all();
+  }
+}
+
+HRESULT PipelineOutStream::Finish() {
+  if (!thread.joinable()) {
+    // Everything fits in one buffer, no need to hand it over
+    HRESULT write_result = result;
+    if (write_result == S_OK) {
+      write_result = WriteFully(out_stream, buffers[current].data(), current_size);
+    }
+    current_size = 0;
+    return write_result;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (current_size != 0 && result == S_OK) {
+      full_buffers.emplace_back(current, current_size);
+      current_size = 0;
+    }
+    finishing = true;
+    condition.notify_all();
+  }
+  thread.join();
+  return result;
+}
+
+void PipelineOutStream::Stop() {
+  if (!thread.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopped = true;
+    condition.notify_all();
+  }
+  thread.join();
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __A7ZIP_PIPELINE_OUT_STREAM_H__
+#define __A7ZIP_PIPELINE_OUT_STREAM_H__
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <include_windows/windows.h>
+#include <Common/MyCom.h>
+#include <7zip/IStream.h>
+
+namespace a7zip {
+
+// Lets the decoder and the out stream run at the same time.
+// Writes are copied into a ring of buffers, a thread drains the full ones to the out stream.
+// The decoder waits only if all buffers are full. Errors of the out stream are returned
+// by the next Write or Finish. Data smaller than a buffer is written without the thread.
+class PipelineOutStream :
+    public ISequentialOutStream,
+    public CMyUnknownImp
+{
+ public:
+  PipelineOutStream(ISequentialOutStream* out_stream, UInt32 buffer_count, UInt32 buffer_size);
+  virtual ~PipelineOutStream();
+
+ public:
+  MY_UNKNOWN_IMP
+
+  STDMETHOD(Write)(const void* data, UInt32 size, UInt32* processedSize);
+
+  // Writes the rest and waits for the thread, returns the first error of the out stream
+  HRESULT Finish();
+
+ private:
+  void Run();
+  // Hands the current buffer to the thread and takes a free one
+  HRESULT Submit();
+  // Drops the buffers not written yet and waits for the thread
+  void Stop();
+
+ private:
+  CMyComPtr<ISequentialOutStream> out_stream;
+  UInt32 buffer_count;
+  UInt32 buffer_size;
+  std::vector<std::vector<Byte>> buffers;
+
+  // The buffer being filled, only touched by the writer of this stream
+  size_t current;
+  size_t current_size;
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::deque<size_t> free_buffers;
+  // The indices and the sizes of the full buffers, the oldest is the first
+  std::deque<std::pair<size_t, size_t>> full_buffers;
+  bool finishing;
+  bool stopped;
+  HRESULT result;
+
+  std::thread thread;
+};
+
+}
+
+#endif //__A7ZIP_PIPELINE_OUT_STREAM_H__
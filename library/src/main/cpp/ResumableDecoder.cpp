@@ -0,0 +1,217 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ResumableDecoder.h"
+
+#include <algorithm>
+#include <cwchar>
+
+#include "ArchiveExtractCallback.h"
+#include "BlackHole.h"
+#include "InArchive.h"
+#include "JavaEnv.h"
+#include "Log.h"
+#include "Utils.h"
+
+#ifdef LOG_TAG
+#  undef LOG_TAG
+#endif //LOG_TAG
+#define LOG_TAG "ResumableDecoder"
+
+using namespace a7zip;
+
+static const std::chrono::seconds IDLE_TIMEOUT(30);
+// The interval to check the cancelled flag of a request
+static const std::chrono::milliseconds CANCEL_CHECK_INTERVAL(100);
+
+static bool IsSamePassword(BSTR a, BSTR b) {
+  if (a == nullptr || b == nullptr) {
+    return a == b;
+  }
+  return wcscmp(a, b) == 0;
+}
+
+namespace a7zip {
+
+class ResumableExtractCallback : public ArchiveExtractCallback {
+ public:
+  ResumableExtractCallback(ResumableDecoder* decoder, BSTR password) :
+      ArchiveExtractCallback(static_cast<UInt32>(-1), password, CMyComPtr<ISequentialOutStream>(), &decoder->stopped),
+      decoder(decoder),
+      index(0),
+      extracting(false) { }
+
+ public:
+  STDMETHOD(GetStream)(UInt32 index, ISequentialOutStream** outStream, Int32 askExtractMode) {
+    extracting = false;
+
+    if (askExtractMode != NArchive::NExtract::NAskMode::kExtract) {
+      return ArchiveExtractCallback::GetStream(index, outStream, askExtractMode);
+    }
+
+    RETURN_SAME_IF_NOT_ZERO(decoder->OnGetStream(index, outStream));
+    this->index = index;
+    extracting = true;
+    return S_OK;
+  }
+
+  STDMETHOD(SetOperationResult)(Int32 opRes) {
+    HRESULT result = ArchiveExtractCallback::SetOperationResult(opRes);
+    if (extracting) {
+      decoder->OnEntryEnd(index, GetBetterResult(result));
+      extracting = false;
+    }
+    return result;
+  }
+
+ private:
+  ResumableDecoder* decoder;
+  UInt32 index;
+  bool extracting;
+};
+
+}
+
+ResumableDecoder::ResumableDecoder(InArchive* archive, const std::vector<UInt32>& indices, BSTR password) :
+    archive(archive),
+    indices(indices),
+    password(::SysAllocString(password)),
+    next_position(0),
+    has_request(false),
+    request_index(0),
+    request_done(false),
+    request_result(S_OK),
+    finished(false),
+    stopped(false) { }
+
+ResumableDecoder::~ResumableDecoder() {
+  Stop();
+  ::SysFreeString(password);
+}
+
+void ResumableDecoder::Start() {
+  thread = std::thread(&ResumableDecoder::Run, this);
+}
+
+void ResumableDecoder::Run() {
+  // The archive may read java streams and the entries may go to java streams
+  JavaEnv env;
+  if (!env.IsValid()) {
+    LOGE("Can't attach the decoder thread");
+    std::lock_guard<std::mutex> lock(mutex);
+    finished = true;
+    condition.notify_all();
+    return;
+  }
+
+  HRESULT result;
+  {
+    CMyComPtr<ResumableExtractCallback> callback(new ResumableExtractCallback(this, password));
+    result = archive->ExtractWithCallback(indices.data(), static_cast<UInt32>(indices.size()), callback);
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  finished = true;
+  if (has_request && !request_done) {
+    // Nothing is written if the entry isn't reached
+    request_done = true;
+    request_result = result != S_OK && !stopped ? result : S_FALSE;
+  }
+  condition.notify_all();
+}
+
+HRESULT ResumableDecoder::OnGetStream(UInt32 index, ISequentialOutStream** out_stream) {
+  std::unique_lock<std::mutex> lock(mutex);
+
+  auto it = std::find(indices.begin() + next_position, indices.end(), index);
+  if (it != indices.end()) {
+    next_position = static_cast<size_t>(it - indices.begin());
+  }
+
+  // Suspend until an entry is requested
+  if (!condition.wait_for(lock, IDLE_TIMEOUT, [this] { return has_request || stopped; })) {
+    LOGD("Stop the idle decoder");
+    stopped = true;
+  }
+  if (stopped) {
+    return E_ABORT;
+  }
+
+  if (index == request_index) {
+    CMyComPtr<ISequentialOutStream> stream(request_stream);
+    *out_stream = stream.Detach();
+  } else {
+    // Skip over the entries before the requested one
+    CMyComPtr<ISequentialOutStream> black_hole(new BlackHole());
+    *out_stream = black_hole.Detach();
+  }
+  return S_OK;
+}
+
+void ResumableDecoder::OnEntryEnd(UInt32 index, HRESULT result) {
+  std::lock_guard<std::mutex> lock(mutex);
+  next_position++;
+  if (has_request && index == request_index) {
+    has_request = false;
+    request_stream.Release();
+    request_done = true;
+    request_result = result;
+    condition.notify_all();
+  }
+}
+
+bool ResumableDecoder::CanExtract(UInt32 index, BSTR password) {
+  std::lock_guard<std::mutex> lock(mutex);
+  return !finished && !stopped && IsSamePassword(this->password, password) &&
+      std::find(indices.begin() + next_position, indices.end(), index) != indices.end();
+}
+
+HRESULT ResumableDecoder::Extract(UInt32 index, ISequentialOutStream* out_stream, const std::atomic<bool>* cancelled) {
+  std::unique_lock<std::mutex> lock(mutex);
+  if (finished || stopped) {
+    return S_FALSE;
+  }
+
+  has_request = true;
+  request_index = index;
+  request_stream = out_stream;
+  request_done = false;
+  condition.notify_all();
+
+  while (!request_done) {
+    if (cancelled != nullptr && cancelled->load()) {
+      // The entry is half written, the decoder can't be resumed
+      lock.unlock();
+      Stop();
+      return E_ABORT;
+    }
+    condition.wait_for(lock, CANCEL_CHECK_INTERVAL);
+  }
+
+  request_stream.Release();
+  return request_result;
+}
+
+void ResumableDecoder::Stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopped = true;
+    condition.notify_all();
+  }
+  if (thread.joinable()) {
+    thread.join();
+  }
+}
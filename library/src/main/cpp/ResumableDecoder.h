@@ -0,0 +1,87 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __A7ZIP_RESUMABLE_DECODER_H__
+#define __A7ZIP_RESUMABLE_DECODER_H__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <include_windows/windows.h>
+#include <Common/MyCom.h>
+#include <7zip/IStream.h>
+
+namespace a7zip {
+
+class InArchive;
+
+// Keeps the decoding of a solid block suspended after an entry, so a later entry
+// of the block continues from there instead of decoding the block from its start.
+// A thread runs IInArchive::Extract over the rest of the block and waits in GetStream
+// until an entry is requested. Entries before the requested one go to a black hole.
+// The thread stops itself after IDLE_TIMEOUT without requests, releasing the decoder memory.
+class ResumableDecoder {
+ public:
+  // The indices are the rest of the block in decoding order
+  ResumableDecoder(InArchive* archive, const std::vector<UInt32>& indices, BSTR password);
+  ~ResumableDecoder();
+
+ public:
+  void Start();
+  // Returns true if the entry is still ahead and the password is the same
+  bool CanExtract(UInt32 index, BSTR password);
+  // Returns S_FALSE if the decoder stopped before reaching the entry,
+  // nothing is written to the out stream then
+  HRESULT Extract(UInt32 index, ISequentialOutStream* out_stream, const std::atomic<bool>* cancelled);
+  // Stops the thread and waits for it
+  void Stop();
+
+ private:
+  void Run();
+
+  // Called by the thread
+  HRESULT OnGetStream(UInt32 index, ISequentialOutStream** out_stream);
+  void OnEntryEnd(UInt32 index, HRESULT result);
+
+ private:
+  InArchive* archive;
+  std::vector<UInt32> indices;
+  BSTR password;
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  // The next entry the thread can reach
+  size_t next_position;
+  bool has_request;
+  UInt32 request_index;
+  CMyComPtr<ISequentialOutStream> request_stream;
+  bool request_done;
+  HRESULT request_result;
+  bool finished;
+  std::atomic<bool> stopped;
+
+  std::thread thread;
+
+  friend class ResumableExtractCallback;
+};
+
+}
+
+#endif //__A7ZIP_RESUMABLE_DECODER_H__
@@ -20,6 +20,7 @@
 #include "JavaEnv.h"
 #include "Utils.h"
 #include "Log.h"
+#include "Trace.h"
 
 #define ARRAY_SIZE DEFAULT_BUFFER_SIZE
 
@@ -53,6 +54,8 @@ SeekableInputStream::~SeekableInputStream() {
 }
 
 HRESULT SeekableInputStream::Read(void* data, UInt32 size, UInt32* processedSize) {
+  TRACE_SPAN(Trace::TRACE_STREAM_READ, nullptr);
+
   if (processedSize != nullptr) {
     *processedSize = 0;
   }
@@ -77,6 +80,7 @@ HRESULT SeekableInputStream::Read(void* data, UInt32 size, UInt32* processedSize
 
   env->GetByteArrayRegion(array, 0, read, static_cast<jbyte*>(data));
   RETURN_E_JAVA_EXCEPTION_IF_EXCEPTION_PENDING(env);
+  TRACE_SPAN_BYTES(read);
 
   if (processedSize != nullptr) {
     *processedSize = static_cast<UInt32>(read);
@@ -86,6 +90,8 @@ HRESULT SeekableInputStream::Read(void* data, UInt32 size, UInt32* processedSize
 }
 
 HRESULT SeekableInputStream::Seek(Int64 offset, UInt32 seekOrigin, UInt64* newPosition) {
+  TRACE_SPAN(Trace::TRACE_STREAM_SEEK, nullptr);
+
   JavaEnv env;
   if (!env.IsValid()) return E_JAVA_EXCEPTION;
 
@@ -0,0 +1,65 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __A7ZIP_SEEKABLE_OUTPUT_STREAM_H__
+#define __A7ZIP_SEEKABLE_OUTPUT_STREAM_H__
+
+#include <jni.h>
+
+#include <7zip/IStream.h>
+#include <Common/MyCom.h>
+
+namespace a7zip {
+
+// IOutStream over com.hippo.a7zip.SeekableOutputStream, the archive is written to it
+class SeekableOutputStream :
+    public IOutStream,
+    public CMyUnknownImp
+{
+ private:
+  SeekableOutputStream(jobject stream, jbyteArray array);
+
+ public:
+  virtual ~SeekableOutputStream();
+
+ public:
+  MY_UNKNOWN_IMP1(IOutStream)
+
+  STDMETHOD(Write)(const void* data, UInt32 size, UInt32* processedSize);
+  STDMETHOD(Seek)(Int64 offset, UInt32 seekOrigin, UInt64* newPosition);
+  STDMETHOD(SetSize)(UInt64 newSize);
+
+ private:
+  jobject stream;
+  jbyteArray array;
+
+ public:
+  static HRESULT Initialize(JNIEnv* env);
+  static HRESULT Create(JNIEnv* env, jobject stream, CMyComPtr<IOutStream>& out_stream);
+
+ private:
+  static bool initialized;
+  static jmethodID method_write;
+  static jmethodID method_seek;
+  static jmethodID method_tell;
+  static jmethodID method_size;
+  static jmethodID method_truncate;
+  static jmethodID method_close;
+};
+
+}
+
+#endif //__A7ZIP_SEEKABLE_OUTPUT_STREAM_H__
@@ -17,15 +17,22 @@
 #include "SevenZip.h"
 
 #include <dlfcn.h>
+#include <mutex>
+#include <strings.h>
+#include <vector>
 
 #include <Windows/PropVariant.h>
 #include <7zip/Archive/IArchive.h>
 #include <7zip/IPassword.h>
 
+#include "Allocator.h"
 #include "Log.h"
+#include "Trace.h"
 #include "Utils.h"
 
 #include "OpenVolumeCallback.h"
+#include "SharedInStream.h"
+#include "VolumeManager.h"
 
 #ifdef LOG_TAG
 #  undef LOG_TAG
@@ -72,13 +79,30 @@ class CompressCodecsInfo :
   STDMETHOD(CreateEncoder)(UInt32 index, const GUID* interfaceID, void** coder);
 };
 
-static bool initialized = false;
+// Methods and formats are loaded on first use,
+// library loading doesn't pay for them if no archive is opened
+static std::once_flag methods_once;
+static HRESULT methods_result = S_OK;
+static std::once_flag formats_once;
+static HRESULT formats_result = S_OK;
+
+// Rarely used formats are in the extra module, they're offered
+// only if no format in p7zip can open the archive. It's loaded
+// with the formats, before any archive is opened, since its handlers
+// register themselves into the tables of p7zip without any lock.
+static HRESULT extra_module_result = S_OK;
+
 static void* handle = nullptr;
 static CObjectVector<Method> methods;
 static CObjectVector<Format> formats;
+static UInt32 format_number = 0;
+static CObjectVector<Format> extra_formats;
 static CompressCodecsInfo compress_codecs_info;
 
+static HRESULT InitializeMethods();
+
 HRESULT CompressCodecsInfo::GetNumMethods(UInt32 *numMethods) {
+  RETURN_SAME_IF_NOT_ZERO(InitializeMethods());
   if (numMethods != nullptr) {
     *numMethods = methods.Size();
   }
@@ -86,6 +110,7 @@ HRESULT CompressCodecsInfo::GetNumMethods(UInt32 *numMethods) {
 }
 
 HRESULT CompressCodecsInfo::GetProperty(UInt32 index, PROPID propID, PROPVARIANT* value) {
+  RETURN_SAME_IF_NOT_ZERO(InitializeMethods());
   Method& method = methods[index];
 
   switch (propID) {
@@ -112,6 +137,7 @@ HRESULT CompressCodecsInfo::CreateDecoder(
     const GUID* interfaceID,
     void** coder
 ) {
+  RETURN_SAME_IF_NOT_ZERO(InitializeMethods());
   Method& method = methods[index];
 
   if (method.has_decoder) {
@@ -126,6 +152,7 @@ HRESULT CompressCodecsInfo::CreateEncoder(
     const GUID* interfaceID,
     void** coder
 ) {
+  RETURN_SAME_IF_NOT_ZERO(InitializeMethods());
   Method& method = methods[index];
 
   if (method.has_encoder) {
@@ -186,11 +213,11 @@ class ArchiveOpenCallback2 :
   ArchiveOpenCallback2(
       BSTR password,
       BSTR filename,
-      CMyComPtr<OpenVolumeCallback>& callback
+      CMyComPtr<VolumeManager>& volume_manager
   ):
       ArchiveOpenCallback(password),
       filename(filename),
-      callback(callback) { }
+      volume_manager(volume_manager) { }
 
  public:
   MY_UNKNOWN_IMP3(
@@ -209,14 +236,14 @@ class ArchiveOpenCallback2 :
 
   STDMETHOD(GetStream)(const wchar_t *name, IInStream **inStream) {
     CMyComPtr<IInStream> stream = nullptr;
-    HRESULT result = callback->OpenVolume(name, stream);
+    HRESULT result = volume_manager->GetStream(name, stream);
     *inStream = stream.Detach();
     return result != S_OK ? S_FALSE : S_OK;
   }
 
  private:
   UString filename;
-  CMyComPtr<OpenVolumeCallback> callback;
+  CMyComPtr<VolumeManager> volume_manager;
 };
 
 #define GET_PROP_METHOD(METHOD_NAME, PROP_TYPE, VALUE_TYPE, CONVERTER)         \
@@ -297,12 +324,11 @@ static void AppendMultiSignature(
   }
 }
 
-static HRESULT LoadFormats() {
-  UInt32 format_number = 0;
-
+// Loads the formats registered since the first_index
+static HRESULT LoadFormats(CObjectVector<Format>& formats, UInt32 first_index, UInt32& format_number) {
   RETURN_SAME_IF_NOT_ZERO(GetNumberOfFormats(&format_number));
 
-  for(UInt32 i = 0; i < format_number; i++) {
+  for(UInt32 i = first_index; i < format_number; i++) {
     Format& format = formats.AddNew();
 
 #   define GET_PROP(METHOD, PROP, VALUE, ASSIGNED)                              \
@@ -343,18 +369,70 @@ static HRESULT LoadFormats() {
   return S_OK;
 }
 
+static HRESULT LoadExtraModule();
+
+static HRESULT InitializeMethods() {
+  // The codecs of the extra module must be registered first
+  RETURN_SAME_IF_NOT_ZERO(SevenZip::Initialize());
+  std::call_once(methods_once, [] { methods_result = LoadMethods(); });
+  return methods_result;
+}
+
 HRESULT SevenZip::Initialize() {
-  if (initialized) {
-    return S_OK;
-  }
+  std::call_once(formats_once, [] {
+    formats_result = LoadFormats(formats, 0, format_number);
+    if (formats_result == S_OK) {
+      extra_module_result = LoadExtraModule();
+    }
+  });
+  return formats_result;
+}
+
+#ifdef A7ZIP_EXTRA_MODULE
 
-  RETURN_SAME_IF_NOT_ZERO(LoadMethods());
-  RETURN_SAME_IF_NOT_ZERO(LoadFormats());
+// The module is next to p7zip
+static HRESULT GetExtraModulePath(AString& path) {
+  Dl_info info;
+  if (dladdr(reinterpret_cast<void*>(&CreateObject), &info) == 0 || info.dli_fname == nullptr) {
+    return E_FAIL;
+  }
 
-  initialized = true;
+  path = info.dli_fname;
+  int slash = path.ReverseFind('/');
+  path.DeleteFrom(static_cast<unsigned>(slash + 1));
+  path += A7ZIP_EXTRA_MODULE;
   return S_OK;
 }
 
+static HRESULT LoadExtraModule() {
+  AString path;
+  RETURN_SAME_IF_NOT_ZERO(GetExtraModulePath(path));
+
+  // The handlers register themselves in the static initializers.
+  // It's never closed, the handlers are in the tables of p7zip.
+  handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  if (handle == nullptr) {
+    LOGE("Can't load %s: %s", path.Ptr(), dlerror());
+    return E_FAIL;
+  }
+
+  UInt32 number = 0;
+  return LoadFormats(extra_formats, format_number, number);
+}
+
+#else
+
+static HRESULT LoadExtraModule() {
+  return E_NOTIMPL;
+}
+
+#endif
+
+static HRESULT InitializeExtraModule() {
+  RETURN_SAME_IF_NOT_ZERO(SevenZip::Initialize());
+  return extra_module_result;
+}
+
 static HRESULT ReadFully(CMyComPtr<IInStream>& stream, Byte* data, UInt32 size, UInt32* processedSize) {
   UInt32 read = 0;
 
@@ -374,14 +452,16 @@ static HRESULT ReadFully(CMyComPtr<IInStream>& stream, Byte* data, UInt32 size,
 }
 
 static HRESULT OpenInArchive(
-    GUID& class_id,
+    Format& format,
     CMyComPtr<IInStream>& in_stream,
     BSTR password,
     BSTR filename,
-    CMyComPtr<OpenVolumeCallback>& open_volume_callback,
+    CMyComPtr<VolumeManager>& volume_manager,
     CMyComPtr<IInArchive>& in_archive
 ) {
-  RETURN_SAME_IF_NOT_ZERO(CreateObject(&class_id, &IID_IInArchive, reinterpret_cast<void **>(&in_archive)));
+  TRACE_SPAN(Trace::TRACE_OPEN_FORMAT, format.name);
+
+  RETURN_SAME_IF_NOT_ZERO(CreateObject(&format.class_id, &IID_IInArchive, reinterpret_cast<void **>(&in_archive)));
 
   UInt64 newPosition = 0;
   HRESULT result = in_stream->Seek(0, STREAM_SEEK_SET, &newPosition);
@@ -394,14 +474,17 @@ static HRESULT OpenInArchive(
   UInt64 maxCheckStartPosition = 1 << 22;
 
   ArchiveOpenCallback* callback_ptr = nullptr;
-  if (filename != nullptr && open_volume_callback != nullptr) {
-    callback_ptr = new ArchiveOpenCallback2(password, filename, open_volume_callback);
+  if (filename != nullptr && volume_manager != nullptr) {
+    callback_ptr = new ArchiveOpenCallback2(password, filename, volume_manager);
   } else {
     callback_ptr = new ArchiveOpenCallback(password);
   }
   CMyComPtr<ArchiveOpenCallback> callback(callback_ptr);
 
-  result = in_archive->Open(in_stream, &maxCheckStartPosition, callback);
+  {
+    TRACE_SPAN(Trace::TRACE_IN_ARCHIVE_OPEN, format.name);
+    result = in_archive->Open(in_stream, &maxCheckStartPosition, callback);
+  }
   result = callback->GetBetterResult(result);
   if (result != S_OK) {
     in_archive->Close();
@@ -412,79 +495,219 @@ static HRESULT OpenInArchive(
   return S_OK;
 }
 
-static HRESULT OpenInArchive(
-    CMyComPtr<IInStream>& in_stream,
-    BSTR password,
-    BSTR filename,
-    CMyComPtr<OpenVolumeCallback>& open_volume_callback,
-    CMyComPtr<IInArchive>& in_archive,
-    AString& format_name
-) {
-  bool formats_checked[formats.Size()];
-  memset(formats_checked, 0, formats.Size() * sizeof(bool));
+static bool IsFormatAllowed(const Format& format, const SevenZip::OpenOptions& options) {
+  if (options.allowed_formats.Size() == 0) {
+    return true;
+  }
+  if (!format.has_name) {
+    return false;
+  }
+  for (unsigned i = 0; i < options.allowed_formats.Size(); i++) {
+    if (strcasecmp(format.name, options.allowed_formats[i]) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
 
-  for (int i = 0; i < formats.Size(); i++) {
-    Format& format = formats[i];
+static bool IsFormatPreferred(const Format& format, const SevenZip::OpenOptions& options) {
+  return !options.preferred_format.IsEmpty() && format.has_name &&
+      strcasecmp(format.name, options.preferred_format) == 0;
+}
 
-    // Skip format without signatures
-    if (format.signatures.Size() == 0) {
-      continue;
-    }
+static bool IsSignatureMatched(const Format& format, CMyComPtr<IInStream>& in_stream) {
+  // Check each signature
+  for (int j = 0; j < format.signatures.Size(); j++) {
+    const CByteBuffer& signature = format.signatures[j];
+
+    UInt32 processedSize;
+    CByteBuffer bytes(signature.Size());
+
+    UInt64 newPosition;
+    CONTINUE_IF_NOT_ZERO(in_stream->Seek(format.signature_offset, STREAM_SEEK_SET, &newPosition));
+    if (newPosition != format.signature_offset) continue;
+    CONTINUE_IF_NOT_ZERO(ReadFully(in_stream, bytes, static_cast<UInt32>(signature.Size()), &processedSize));
+    if (processedSize != signature.Size() || bytes != signature) continue;
 
-    // Check each signature
-    for (int j = 0; j < format.signatures.Size(); j++) {
-      CByteBuffer& signature = format.signatures[j];
+    return true;
+  }
 
-      UInt32 processedSize;
-      CByteBuffer bytes(signature.Size());
+  return false;
+}
 
-      UInt64 newPosition;
-      CONTINUE_IF_NOT_ZERO(in_stream->Seek(format.signature_offset, STREAM_SEEK_SET, &newPosition));
-      if (newPosition != format.signature_offset) continue;
-      CONTINUE_IF_NOT_ZERO(ReadFully(in_stream, bytes, static_cast<UInt32>(signature.Size()), &processedSize));
-      if (processedSize != signature.Size() || bytes != signature) continue;
+class FormatProber {
+ public:
+  FormatProber(
+      CMyComPtr<IInStream>& in_stream,
+      BSTR password,
+      BSTR filename,
+      CMyComPtr<VolumeManager>& volume_manager,
+      const SevenZip::OpenOptions& options
+  ) :
+      in_stream(in_stream),
+      password(password),
+      filename(filename),
+      volume_manager(volume_manager),
+      options(options),
+      extra_added(false),
+      extra_start(0) { }
 
-      // The signature matched, try to open it
-      HRESULT result = OpenInArchive(format.class_id, in_stream, password, filename, open_volume_callback, in_archive);
+ public:
+  HRESULT Open(CMyComPtr<IInArchive>& in_archive, AString& format_name) {
+    AddFormats(formats);
 
-      // Mark the format
-      formats_checked[i] = true;
+    HRESULT result;
 
-      if (result == S_OK) {
-        format_name = format.name;
-        return S_OK;
+    // The caller knows the format, try it before reading any signature
+    if (!options.preferred_format.IsEmpty()) {
+      result = OpenPreferred(0, in_archive, format_name);
+      if (result == S_FALSE && AddExtraFormats()) {
+        result = OpenPreferred(extra_start, in_archive, format_name);
       }
-
-      if (result == E_NO_PASSWORD || result == E_WRONG_PASSWORD) {
-        // It's a password error, the archive format is confirmed
+      if (result != S_FALSE && result != E_UNKNOWN_FORMAT) {
         return result;
       }
+    }
 
-      // Can't open archive in this format
-      // Skip this format
-      break;
+    result = OpenBySignature(0, in_archive, format_name);
+    if (result == E_UNKNOWN_FORMAT && AddExtraFormats()) {
+      result = OpenBySignature(extra_start, in_archive, format_name);
+    }
+    if (result != E_UNKNOWN_FORMAT) {
+      return result;
+    }
+
+    if (!options.fallback_enabled) {
+      return E_UNKNOWN_FORMAT;
     }
+
+    // Try other unchecked formats
+    for (unsigned i = 0; i < candidates.size(); i++) {
+      if (!checked[i]) {
+        result = TryFormat(i, in_archive, format_name);
+        if (result != E_UNKNOWN_FORMAT) {
+          return result;
+        }
+      }
+    }
+
+    return E_UNKNOWN_FORMAT;
   }
 
-  // Try other unchecked formats
-  for (int i = 0; i < formats.Size(); i++) {
-    if (!formats_checked[i]) {
-      Format& format = formats[i];
-      HRESULT result = OpenInArchive(format.class_id, in_stream, password, filename, open_volume_callback, in_archive);
+ private:
+  // Formats not allowed are never added
+  void AddFormats(CObjectVector<Format>& list) {
+    for (int i = 0; i < list.Size(); i++) {
+      if (IsFormatAllowed(list[i], options)) {
+        candidates.push_back(&list[i]);
+        checked.push_back(false);
+      }
+    }
+  }
 
-      if (result == S_OK) {
-        format_name = format.name;
-        return S_OK;
+  bool AddExtraFormats() {
+    if (extra_added) {
+      return false;
+    }
+    extra_added = true;
+    extra_start = static_cast<unsigned>(candidates.size());
+
+    // Skip loading the module if it can't offer any allowed format
+    if (options.allowed_formats.Size() != 0) {
+      bool all_found = true;
+      for (unsigned i = 0; i < options.allowed_formats.Size() && all_found; i++) {
+        bool found = false;
+        for (unsigned j = 0; j < extra_start && !found; j++) {
+          found = candidates[j]->has_name && strcasecmp(candidates[j]->name, options.allowed_formats[i]) == 0;
+        }
+        all_found = found;
       }
+      if (all_found) {
+        return false;
+      }
+    }
 
-      if (result == E_NO_PASSWORD || result == E_WRONG_PASSWORD) {
-        // It's a password error, the archive format is confirmed
-        return result;
+    if (InitializeExtraModule() != S_OK) {
+      return false;
+    }
+    AddFormats(extra_formats);
+    return candidates.size() != extra_start;
+  }
+
+  // Returns S_FALSE if the preferred format isn't found
+  HRESULT OpenPreferred(unsigned start, CMyComPtr<IInArchive>& in_archive, AString& format_name) {
+    for (unsigned i = start; i < candidates.size(); i++) {
+      if (!checked[i] && IsFormatPreferred(*candidates[i], options)) {
+        return TryFormat(i, in_archive, format_name);
       }
     }
+    return S_FALSE;
   }
 
-  return E_UNKNOWN_FORMAT;
+  HRESULT OpenBySignature(unsigned start, CMyComPtr<IInArchive>& in_archive, AString& format_name) {
+    for (unsigned i = start; i < candidates.size(); i++) {
+      // Skip format without signatures
+      if (checked[i] || candidates[i]->signatures.Size() == 0) {
+        continue;
+      }
+
+      if (IsSignatureMatched(*candidates[i], in_stream)) {
+        // The signature matched, try to open it
+        HRESULT result = TryFormat(i, in_archive, format_name);
+        if (result != E_UNKNOWN_FORMAT) {
+          return result;
+        }
+      }
+    }
+    return E_UNKNOWN_FORMAT;
+  }
+
+  // Returns E_UNKNOWN_FORMAT if the format can't open the archive
+  HRESULT TryFormat(unsigned index, CMyComPtr<IInArchive>& in_archive, AString& format_name) {
+    Format& format = *candidates[index];
+    HRESULT result = OpenInArchive(format, in_stream, password, filename, volume_manager, in_archive);
+
+    // Mark the format
+    checked[index] = true;
+
+    if (result == S_OK) {
+      format_name = format.name;
+      return S_OK;
+    }
+
+    if (result == E_NO_PASSWORD || result == E_WRONG_PASSWORD) {
+      // It's a password error, the archive format is confirmed
+      return result;
+    }
+
+    // Can't open archive in this format
+    return E_UNKNOWN_FORMAT;
+  }
+
+ private:
+  CMyComPtr<IInStream>& in_stream;
+  BSTR password;
+  BSTR filename;
+  CMyComPtr<VolumeManager>& volume_manager;
+  const SevenZip::OpenOptions& options;
+
+  std::vector<Format*> candidates;
+  std::vector<bool> checked;
+  bool extra_added;
+  unsigned extra_start;
+};
+
+static HRESULT OpenInArchive(
+    CMyComPtr<IInStream>& in_stream,
+    BSTR password,
+    BSTR filename,
+    CMyComPtr<VolumeManager>& volume_manager,
+    const SevenZip::OpenOptions& options,
+    CMyComPtr<IInArchive>& in_archive,
+    AString& format_name
+) {
+  FormatProber prober(in_stream, password, filename, volume_manager, options);
+  return prober.Open(in_archive, format_name);
 }
 
 HRESULT SevenZip::OpenArchive(
@@ -492,25 +715,44 @@ HRESULT SevenZip::OpenArchive(
     BSTR password,
     BSTR filename,
     CMyComPtr<OpenVolumeCallback>& open_volume_callback,
+    const OpenOptions& options,
     InArchive** archive
 ) {
+  TRACE_SPAN(Trace::TRACE_OPEN_ARCHIVE, nullptr);
+
+  RETURN_SAME_IF_NOT_ZERO(Initialize());
+
   HRESULT result = S_FALSE;
   InArchive* previous_archive = nullptr;
 
   CMyComPtr<IInStream> arg_in_stream = in_stream;
   BSTR arg_password = password;
   BSTR arg_filename = filename;
-  CMyComPtr<OpenVolumeCallback> arg_open_volume_callback = open_volume_callback;
+  CMyComPtr<VolumeManager> arg_volume_manager = nullptr;
+  if (open_volume_callback != nullptr) {
+    arg_volume_manager = new VolumeManager(
+        open_volume_callback, options.max_open_volumes, options.volume_prefetch_enabled);
+  }
+  OpenOptions arg_options = options;
+
+  // All nested archives share one allocator
+  CMyComPtr<Allocator> allocator(new Allocator());
+  Allocator::Scope scope(allocator);
 
   while (true) {
     CMyComPtr<IInArchive> in_archive = nullptr;
     AString format_name;
 
+    // The handler reads a clone of the stream, the archive reads the stream beside it
+    CMyComPtr<SharedInStream> shared_in_stream(new SharedInStream(arg_in_stream));
+    CMyComPtr<IInStream> handler_in_stream(shared_in_stream->Clone());
+
     result = OpenInArchive(
-        arg_in_stream,
+        handler_in_stream,
         arg_password,
         arg_filename,
-        arg_open_volume_callback,
+        arg_volume_manager,
+        arg_options,
         in_archive,
         format_name
     );
@@ -526,12 +768,12 @@ HRESULT SevenZip::OpenArchive(
       break;
     }
 
-    previous_archive = new InArchive(previous_archive, in_archive, format_name);
+    previous_archive = new InArchive(previous_archive, shared_in_stream, in_archive, format_name, allocator);
 
     // Break if it has no entry or more than one entry
     UInt32 number = 0;
     previous_archive->GetNumberOfEntries(number);
-    if (number != 1) {
+    if (number != 1 || !options.nested_enabled) {
       break;
     }
 
@@ -559,9 +801,33 @@ HRESULT SevenZip::OpenArchive(
     // Clear arguments for the first archive
     arg_password = nullptr;
     arg_filename = nullptr;
-    arg_open_volume_callback = nullptr;
+    arg_volume_manager = nullptr;
+    // The format hints are for the first archive, keep the fallback switch
+    arg_options.preferred_format.Empty();
+    arg_options.allowed_formats.Clear();
   }
 
   *archive = previous_archive;
-  return *archive != nullptr ? S_OK : result;
+  return *archive != nullptr ? S_OK : scope.GetBetterResult(result);
+}
+
+HRESULT SevenZip::CreateOutArchive(const char* format_name, CMyComPtr<IOutArchive>& out_archive) {
+  RETURN_SAME_IF_NOT_ZERO(Initialize());
+
+  for (int i = 0; i < formats.Size(); i++) {
+    Format& format = formats[i];
+    if (!format.has_name || strcasecmp(format.name, format_name) != 0) {
+      continue;
+    }
+
+    // The handlers are built without IOutArchive in EXTRACT builds
+    HRESULT result = CreateObject(&format.class_id, &IID_IOutArchive, reinterpret_cast<void **>(&out_archive));
+    if (result != S_OK || out_archive == nullptr) {
+      out_archive = nullptr;
+      return E_NOTIMPL;
+    }
+    return S_OK;
+  }
+
+  return E_UNKNOWN_FORMAT;
 }
@@ -25,6 +25,7 @@
 #include <Common/MyString.h>
 
 #include <7zip/ICoder.h>
+#include <7zip/Archive/IArchive.h>
 
 #include "InArchive.h"
 #include "OpenVolumeCallback.h"
@@ -32,14 +33,41 @@
 namespace a7zip {
 namespace SevenZip {
 
+// Format names are compared case-insensitively
+struct OpenOptions {
+  // Tried first without checking the signature, empty for none
+  AString preferred_format;
+  // Other formats are never tried, empty for all formats
+  CObjectVector<AString> allowed_formats;
+  // Tries the formats whose signatures don't match if all others failed
+  bool fallback_enabled;
+  // Idle volumes are closed beyond it, and reopened on next read
+  unsigned max_open_volumes;
+  // Reads the start of the next volume in the thread pool
+  bool volume_prefetch_enabled;
+  // Opens the entry of a single-entry archive as an archive too
+  bool nested_enabled;
+
+  OpenOptions():
+      fallback_enabled(true),
+      max_open_volumes(8),
+      volume_prefetch_enabled(true),
+      nested_enabled(true) { }
+};
+
+// Loads the formats on first call, it's thread-safe.
+// OpenArchive calls it, there is no need to call it in advance.
 HRESULT Initialize();
 HRESULT OpenArchive(
     CMyComPtr<IInStream>& stream,
     BSTR password,
     BSTR filename,
     CMyComPtr<OpenVolumeCallback>& callback,
+    const OpenOptions& options,
     InArchive** archive
 );
+// Returns E_NOTIMPL if the format can't create archives, like all formats in EXTRACT builds
+HRESULT CreateOutArchive(const char* format_name, CMyComPtr<IOutArchive>& out_archive);
 
 }
 }
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "SharedInStream.h"
+
+#include "Utils.h"
+
+using namespace a7zip;
+
+SharedInStream::SharedInStream(IInStream* stream) :
+    source(new Source()),
+    position(0) {
+  source->stream = stream;
+  source->position_known = false;
+  source->position = 0;
+}
+
+SharedInStream::SharedInStream(const std::shared_ptr<Source>& source) :
+    source(source),
+    position(0) { }
+
+HRESULT SharedInStream::Read(void* data, UInt32 size, UInt32* processedSize) {
+  UInt32 processed = 0;
+  HRESULT result = ReadAt(position, data, size, &processed);
+  position += processed;
+  if (processedSize != nullptr) {
+    *processedSize = processed;
+  }
+  return result;
+}
+
+HRESULT SharedInStream::Seek(Int64 offset, UInt32 seekOrigin, UInt64* newPosition) {
+  Int64 new_position;
+  switch (seekOrigin) {
+    case STREAM_SEEK_SET:
+      new_position = offset;
+      break;
+    case STREAM_SEEK_CUR:
+      new_position = static_cast<Int64>(position) + offset;
+      break;
+    case STREAM_SEEK_END: {
+      UInt64 size = 0;
+      {
+        std::lock_guard<std::mutex> lock(source->mutex);
+        source->position_known = false;
+        RETURN_SAME_IF_NOT_ZERO(source->stream->Seek(0, STREAM_SEEK_END, &size));
+        source->position_known = true;
+        source->position = size;
+      }
+      new_position = static_cast<Int64>(size) + offset;
+      break;
+    }
+    default:
+      return E_INVALIDARG;
+  }
+  if (new_position < 0) {
+    return STG_E_INVALIDFUNCTION;
+  }
+
+  position = static_cast<UInt64>(new_position);
+  if (newPosition != nullptr) {
+    *newPosition = position;
+  }
+  return S_OK;
+}
+
+HRESULT SharedInStream::ReadAt(UInt64 offset, void* data, UInt32 size, UInt32* processed_size) {
+  *processed_size = 0;
+  std::lock_guard<std::mutex> lock(source->mutex);
+  if (!source->position_known || source->position != offset) {
+    source->position_known = false;
+    RETURN_SAME_IF_NOT_ZERO(source->stream->Seek(static_cast<Int64>(offset), STREAM_SEEK_SET, nullptr));
+  }
+  source->position_known = false;
+  RETURN_SAME_IF_NOT_ZERO(source->stream->Read(data, size, processed_size));
+  source->position_known = true;
+  source->position = offset + *processed_size;
+  return S_OK;
+}
+
+SharedInStream* SharedInStream::Clone() {
+  return new SharedInStream(source);
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __A7ZIP_SHARED_IN_STREAM_H__
+#define __A7ZIP_SHARED_IN_STREAM_H__
+
+#include <memory>
+#include <mutex>
+
+#include <include_windows/windows.h>
+#include <Common/MyCom.h>
+#include <7zip/IStream.h>
+
+namespace a7zip {
+
+// Shares a stream among readers with their own positions.
+// A read seeks and reads the stream under one lock, so the handler of an archive,
+// the entry views and the chunk readers beside it never move the position of each other.
+// Each reader takes a clone, one clone isn't thread-safe.
+class SharedInStream :
+    public IInStream,
+    public CMyUnknownImp
+{
+ public:
+  explicit SharedInStream(IInStream* stream);
+
+ public:
+  MY_UNKNOWN_IMP2(ISequentialInStream, IInStream)
+  STDMETHOD(Read)(void* data, UInt32 size, UInt32* processedSize);
+  STDMETHOD(Seek)(Int64 offset, UInt32 seekOrigin, UInt64* newPosition);
+
+  // Reads at the offset without moving the position. Thread-safe.
+  HRESULT ReadAt(UInt64 offset, void* data, UInt32 size, UInt32* processed_size);
+  // Another reader of the stream, at the start
+  SharedInStream* Clone();
+
+ private:
+  struct Source {
+    std::mutex mutex;
+    CMyComPtr<IInStream> stream;
+    // The position of the stream, a sequential read skips the seek.
+    // It's unknown after an error.
+    bool position_known;
+    UInt64 position;
+  };
+
+  explicit SharedInStream(const std::shared_ptr<Source>& source);
+
+ private:
+  std::shared_ptr<Source> source;
+  UInt64 position;
+};
+
+}
+
+#endif //__A7ZIP_SHARED_IN_STREAM_H__
@@ -0,0 +1,221 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ThreadPool.h"
+
+using namespace a7zip;
+
+// The index of the worker running on this thread, -1 for other threads
+static thread_local int current_worker = -1;
+
+Job::Job(JobPriority priority, SerialQueue* serial_queue) :
+    ref_count(0),
+    priority(priority),
+    id(0),
+    cancelled(false),
+    serial_queue(serial_queue) { }
+
+ULONG Job::AddRef() {
+  return ++ref_count;
+}
+
+ULONG Job::Release() {
+  ULONG count = --ref_count;
+  if (count == 0) {
+    delete this;
+  }
+  return count;
+}
+
+void Job::LeaveSerialQueue() {
+  if (serial_queue == nullptr) {
+    return;
+  }
+  Job* next = serial_queue->Leave();
+  serial_queue = nullptr;
+  if (next != nullptr) {
+    ThreadPool::GetInstance()->Enqueue(next);
+  }
+}
+
+SerialQueue::SerialQueue() :
+    busy(false),
+    waiters(0) { }
+
+void SerialQueue::lock() {
+  std::unique_lock<std::mutex> lock(mutex);
+  waiters++;
+  condition.wait(lock, [this] { return !busy; });
+  waiters--;
+  busy = true;
+}
+
+void SerialQueue::unlock() {
+  Job* next = Leave();
+  if (next != nullptr) {
+    ThreadPool::GetInstance()->Enqueue(next);
+  }
+}
+
+bool SerialQueue::Enter(Job* job) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (busy || waiters != 0) {
+    jobs.push_back(job);
+    return false;
+  }
+  busy = true;
+  return true;
+}
+
+Job* SerialQueue::Leave() {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (waiters != 0 || jobs.empty()) {
+    busy = false;
+    condition.notify_all();
+    return nullptr;
+  }
+
+  // The oldest of the highest priority, the queue stays busy for it
+  auto next = jobs.begin();
+  for (auto it = jobs.begin(); it != jobs.end(); ++it) {
+    if ((*it)->priority > (*next)->priority) {
+      next = it;
+    }
+  }
+  Job* job = *next;
+  jobs.erase(next);
+  return job;
+}
+
+ThreadPool::ThreadPool(unsigned worker_count) :
+    next_worker(0),
+    pending_count(0),
+    next_id(1) {
+  if (worker_count == 0) {
+    worker_count = 1;
+  }
+  for (unsigned i = 0; i < worker_count; i++) {
+    workers.emplace_back(new Worker());
+  }
+  // Start threads after all workers are created, they steal from each other
+  for (unsigned i = 0; i < worker_count; i++) {
+    std::thread(&ThreadPool::Loop, this, i).detach();
+  }
+}
+
+UInt64 ThreadPool::Submit(Job* job) {
+  job->AddRef();
+
+  UInt64 id = next_id++;
+  job->id = id;
+  {
+    std::lock_guard<std::mutex> lock(jobs_mutex);
+    jobs[id] = job;
+  }
+
+  if (job->serial_queue == nullptr || job->serial_queue->Enter(job)) {
+    Enqueue(job);
+  }
+
+  return id;
+}
+
+void ThreadPool::Enqueue(Job* job) {
+  // Keep the jobs from a worker on it, they are likely to share data
+  unsigned index = current_worker >= 0 ?
+      static_cast<unsigned>(current_worker) : next_worker++ % workers.size();
+  {
+    Worker& worker = *workers[index];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    worker.queues[job->priority].push_back(job);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(idle_mutex);
+    pending_count++;
+  }
+  idle_condition.notify_one();
+}
+
+bool ThreadPool::Cancel(UInt64 id) {
+  std::lock_guard<std::mutex> lock(jobs_mutex);
+  auto it = jobs.find(id);
+  if (it == jobs.end()) {
+    return false;
+  }
+  it->second->Cancel();
+  return true;
+}
+
+Job* ThreadPool::TakeFrom(Worker& worker, JobPriority priority) {
+  std::lock_guard<std::mutex> lock(worker.mutex);
+  std::deque<Job*>& queue = worker.queues[priority];
+  if (queue.empty()) {
+    return nullptr;
+  }
+  // Jobs are coarse, take the oldest to keep them fair
+  Job* job = queue.front();
+  queue.pop_front();
+  return job;
+}
+
+Job* ThreadPool::Take(unsigned index) {
+  unsigned count = static_cast<unsigned>(workers.size());
+  for (int priority = JOB_PRIORITY_COUNT - 1; priority >= 0; priority--) {
+    // Own queue first, then steal from the next workers
+    for (unsigned i = 0; i < count; i++) {
+      Job* job = TakeFrom(*workers[(index + i) % count], static_cast<JobPriority>(priority));
+      if (job != nullptr) {
+        return job;
+      }
+    }
+  }
+  return nullptr;
+}
+
+void ThreadPool::Loop(unsigned index) {
+  current_worker = static_cast<int>(index);
+
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(idle_mutex);
+      idle_condition.wait(lock, [this] { return pending_count != 0; });
+      pending_count--;
+    }
+
+    // A pending job is reserved, but another worker may have taken it
+    // from the deque it was pushed to, so look around until it's found
+    Job* job;
+    while ((job = Take(index)) == nullptr) {
+      std::this_thread::yield();
+    }
+
+    job->Run();
+    job->LeaveSerialQueue();
+
+    {
+      std::lock_guard<std::mutex> lock(jobs_mutex);
+      jobs.erase(job->id);
+    }
+    job->Release();
+  }
+}
+
+ThreadPool* ThreadPool::GetInstance() {
+  // Never deleted, the workers are detached
+  static ThreadPool* instance = new ThreadPool(std::thread::hardware_concurrency());
+  return instance;
+}
@@ -0,0 +1,163 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __A7ZIP_THREAD_POOL_H__
+#define __A7ZIP_THREAD_POOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <Common/MyWindows.h>
+
+namespace a7zip {
+
+// Keep it in sync with ArchiveJob.PRIORITY_* in java
+enum JobPriority {
+  JOB_PRIORITY_LOW,
+  JOB_PRIORITY_NORMAL,
+  JOB_PRIORITY_HIGH,
+  JOB_PRIORITY_COUNT,
+};
+
+class SerialQueue;
+
+class Job {
+ public:
+  // The jobs of a serial queue run one by one, null to run it beside any other job
+  explicit Job(JobPriority priority, SerialQueue* serial_queue = nullptr);
+  virtual ~Job() { }
+
+ public:
+  ULONG AddRef();
+  ULONG Release();
+
+  JobPriority GetPriority() { return priority; }
+  UInt64 GetId() { return id; }
+
+  void Cancel() { cancelled = true; }
+  bool IsCancelled() { return cancelled; }
+  // Long operations poll it to stop early
+  const std::atomic<bool>* GetCancelledFlag() { return &cancelled; }
+
+  // Runs on a worker thread. A job cancelled before running still runs,
+  // it should check IsCancelled() and report the cancellation.
+  virtual void Run() = 0;
+
+ protected:
+  // Lets the next job of the serial queue run. The pool calls it after Run(),
+  // call it earlier if the owner of the queue may be gone after Run(), e.g. before
+  // reporting the result which may close the archive.
+  void LeaveSerialQueue();
+
+ private:
+  std::atomic<ULONG> ref_count;
+  JobPriority priority;
+  UInt64 id;
+  std::atomic<bool> cancelled;
+  SerialQueue* serial_queue;
+
+  friend class ThreadPool;
+  friend class SerialQueue;
+};
+
+// Runs the jobs submitted with it one by one, higher priority jobs first.
+// The queued jobs wait out of the workers, so a worker never waits for another job.
+// Threads out of the pool lock it to run beside no job of it, it's BasicLockable.
+// Don't lock it on a worker or twice on one thread.
+class SerialQueue {
+ public:
+  SerialQueue();
+
+ public:
+  void lock();
+  void unlock();
+
+ private:
+  // Returns false if the job is queued
+  bool Enter(Job* job);
+  // Returns the job to run next, null if the queue is free
+  Job* Leave();
+
+ private:
+  std::mutex mutex;
+  std::condition_variable condition;
+  // A job or a locking thread is running
+  bool busy;
+  // Threads waiting in lock(), they go before the queued jobs
+  unsigned waiters;
+  std::deque<Job*> jobs;
+
+  friend class Job;
+  friend class ThreadPool;
+};
+
+// A work-stealing pool sized to the cores.
+// Each worker has a deque per priority. Jobs submitted from a worker go to its own deques,
+// others are spread over the workers. An idle worker steals from the others,
+// higher priority jobs are always taken before lower ones.
+class ThreadPool {
+ public:
+  explicit ThreadPool(unsigned worker_count);
+
+ public:
+  // Returns the id of the job, the pool holds a reference until the job is done
+  UInt64 Submit(Job* job);
+  // Returns false if the job is done or unknown
+  bool Cancel(UInt64 id);
+
+  unsigned GetWorkerCount() { return static_cast<unsigned>(workers.size()); }
+
+ private:
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Job*> queues[JOB_PRIORITY_COUNT];
+  };
+
+  // Pushes the job to the deques of a worker
+  void Enqueue(Job* job);
+  void Loop(unsigned index);
+  Job* Take(unsigned index);
+  Job* TakeFrom(Worker& worker, JobPriority priority);
+
+ private:
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::atomic<unsigned> next_worker;
+
+  std::mutex idle_mutex;
+  std::condition_variable idle_condition;
+  std::atomic<UInt64> pending_count;
+
+  std::mutex jobs_mutex;
+  std::unordered_map<UInt64, Job*> jobs;
+  std::atomic<UInt64> next_id;
+
+  friend class Job;
+  friend class SerialQueue;
+
+ public:
+  // The pool is created on first use and lives until the process exits
+  static ThreadPool* GetInstance();
+};
+
+}
+
+#endif //__A7ZIP_THREAD_POOL_H__
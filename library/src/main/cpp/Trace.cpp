@@ -0,0 +1,237 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Trace.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+
+#include "Utils.h"
+
+using namespace a7zip;
+
+#ifdef A7ZIP_TRACE
+
+// The newest events overwrite the oldest ones
+#define MAX_EVENT_COUNT (64 * 1024)
+
+static const char* const POINT_NAMES[Trace::TRACE_POINT_COUNT] = {
+    "OpenArchive",
+    "OpenFormat",
+    "IInArchive::Open",
+    "ExtractEntry",
+    "SeekableInputStream::Read",
+    "SeekableInputStream::Seek",
+    "OutputStream::Write",
+};
+
+struct AtomicCounter {
+  std::atomic<UInt64> calls;
+  std::atomic<UInt64> bytes;
+  std::atomic<UInt64> nanos;
+};
+
+// A slot is published with its state, EVENT_EMPTY, EVENT_WRITING,
+// or EventReady(ticket) once the event of that ticket is complete.
+// The fields are atomic so that the export never races the writers,
+// it reads a slot only if its state is the same before and after.
+#define EVENT_EMPTY 0
+#define EVENT_WRITING 1
+
+struct Event {
+  std::atomic<UInt64> state;
+  std::atomic<int> point;
+  std::atomic<const char*> detail;
+  std::atomic<pid_t> tid;
+  std::atomic<UInt64> start;
+  std::atomic<UInt64> duration;
+  std::atomic<UInt64> bytes;
+};
+
+static AtomicCounter counters[Trace::TRACE_POINT_COUNT];
+static std::atomic<bool> recording(false);
+static std::atomic<UInt64> event_count(0);
+static Event events[MAX_EVENT_COUNT];
+
+static inline UInt64 EventReady(UInt64 ticket) {
+  return (ticket + 1) * 2;
+}
+
+static UInt64 NowNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<UInt64>(ts.tv_sec) * 1000000000ULL + static_cast<UInt64>(ts.tv_nsec);
+}
+
+Trace::Span::Span(TracePoint point, const char* detail) :
+    point(point),
+    detail(detail),
+    start(NowNanos()),
+    bytes(0) { }
+
+Trace::Span::~Span() {
+  UInt64 duration = NowNanos() - start;
+
+  AtomicCounter& counter = counters[point];
+  counter.calls.fetch_add(1, std::memory_order_relaxed);
+  counter.bytes.fetch_add(bytes, std::memory_order_relaxed);
+  counter.nanos.fetch_add(duration, std::memory_order_relaxed);
+
+  if (recording.load(std::memory_order_relaxed)) {
+    UInt64 ticket = event_count.fetch_add(1, std::memory_order_relaxed);
+    Event& event = events[ticket % MAX_EVENT_COUNT];
+
+    // Drop the event if a writer a whole ring ahead still holds the slot
+    UInt64 state = event.state.load(std::memory_order_relaxed);
+    do {
+      if (state == EVENT_WRITING) {
+        return;
+      }
+    } while (!event.state.compare_exchange_weak(state, EVENT_WRITING, std::memory_order_acquire));
+
+    event.point.store(point, std::memory_order_relaxed);
+    event.detail.store(detail, std::memory_order_relaxed);
+    event.tid.store(gettid(), std::memory_order_relaxed);
+    event.start.store(start, std::memory_order_relaxed);
+    event.duration.store(duration, std::memory_order_relaxed);
+    event.bytes.store(bytes, std::memory_order_relaxed);
+    event.state.store(EventReady(ticket), std::memory_order_release);
+  }
+}
+
+bool Trace::IsEnabled() {
+  return true;
+}
+
+void Trace::SetRecording(bool recording) {
+  ::recording = recording;
+}
+
+void Trace::Snapshot(Counter counters[TRACE_POINT_COUNT]) {
+  for (int i = 0; i < TRACE_POINT_COUNT; i++) {
+    counters[i].calls = ::counters[i].calls.load(std::memory_order_relaxed);
+    counters[i].bytes = ::counters[i].bytes.load(std::memory_order_relaxed);
+    counters[i].nanos = ::counters[i].nanos.load(std::memory_order_relaxed);
+  }
+}
+
+void Trace::Reset() {
+  for (int i = 0; i < TRACE_POINT_COUNT; i++) {
+    counters[i].calls = 0;
+    counters[i].bytes = 0;
+    counters[i].nanos = 0;
+  }
+  event_count = 0;
+  for (int i = 0; i < MAX_EVENT_COUNT; i++) {
+    UInt64 state = events[i].state.load(std::memory_order_relaxed);
+    if (state != EVENT_WRITING) {
+      events[i].state.compare_exchange_strong(state, EVENT_EMPTY, std::memory_order_relaxed);
+    }
+  }
+}
+
+static void WriteJsonString(FILE* file, const char* str) {
+  fputc('"', file);
+  for (; *str != '\0'; str++) {
+    char c = *str;
+    if (c == '"' || c == '\\') {
+      fputc('\\', file);
+      fputc(c, file);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      fprintf(file, "\\u%04x", c);
+    } else {
+      fputc(c, file);
+    }
+  }
+  fputc('"', file);
+}
+
+HRESULT Trace::ExportChromeTrace(const char* path) {
+  FILE* file = fopen(path, "w");
+  if (file == nullptr) {
+    return E_FAIL;
+  }
+
+  UInt64 count = event_count;
+  UInt64 first = count > MAX_EVENT_COUNT ? count - MAX_EVENT_COUNT : 0;
+  pid_t pid = getpid();
+
+  bool empty = true;
+
+  fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", file);
+  for (UInt64 i = first; i < count; i++) {
+    Event& slot = events[i % MAX_EVENT_COUNT];
+
+    // Skip the events which are still being written or already overwritten
+    UInt64 state = slot.state.load(std::memory_order_acquire);
+    if (state != EventReady(i)) {
+      continue;
+    }
+    int point = slot.point.load(std::memory_order_relaxed);
+    const char* detail = slot.detail.load(std::memory_order_relaxed);
+    pid_t tid = slot.tid.load(std::memory_order_relaxed);
+    UInt64 start = slot.start.load(std::memory_order_relaxed);
+    UInt64 duration = slot.duration.load(std::memory_order_relaxed);
+    UInt64 bytes = slot.bytes.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.state.load(std::memory_order_relaxed) != state) {
+      continue;
+    }
+
+    if (!empty) {
+      fputc(',', file);
+    }
+    empty = false;
+    fputs("\n{\"name\":", file);
+    WriteJsonString(file, POINT_NAMES[point]);
+    fprintf(file, ",\"cat\":\"a7zip\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"bytes\":%llu",
+            static_cast<int>(pid), static_cast<int>(tid), start / 1000.0, duration / 1000.0,
+            static_cast<unsigned long long>(bytes));
+    if (detail != nullptr) {
+      fputs(",\"detail\":", file);
+      WriteJsonString(file, detail);
+    }
+    fputs("}}", file);
+  }
+  fputs("\n]}\n", file);
+
+  bool failed = ferror(file) != 0;
+  failed |= fclose(file) != 0;
+  return failed ? E_FAIL : S_OK;
+}
+
+#else
+
+bool Trace::IsEnabled() {
+  return false;
+}
+
+void Trace::SetRecording(bool) { }
+
+void Trace::Snapshot(Counter counters[TRACE_POINT_COUNT]) {
+  memset(counters, 0, sizeof(Counter) * TRACE_POINT_COUNT);
+}
+
+void Trace::Reset() { }
+
+HRESULT Trace::ExportChromeTrace(const char*) {
+  return E_NOTIMPL;
+}
+
+#endif
@@ -0,0 +1,86 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __A7ZIP_TRACE_H__
+#define __A7ZIP_TRACE_H__
+
+#include <Common/MyWindows.h>
+
+// Spans are compiled only if A7ZIP_TRACE is defined, see option TRACE in CMakeLists.txt.
+// A span counts the calls, bytes and nanoseconds of its trace point,
+// and records an event for Chrome trace if recording is on.
+#ifdef A7ZIP_TRACE
+#  define TRACE_SPAN(POINT, DETAIL) a7zip::Trace::Span __trace_span__((POINT), (DETAIL))
+#  define TRACE_SPAN_BYTES(BYTES) __trace_span__.SetBytes(BYTES)
+#else
+#  define TRACE_SPAN(POINT, DETAIL) do { } while (0)
+#  define TRACE_SPAN_BYTES(BYTES) do { } while (0)
+#endif
+
+namespace a7zip {
+namespace Trace {
+
+// Keep it in sync with Trace.Stage in java
+enum TracePoint {
+  TRACE_OPEN_ARCHIVE,
+  TRACE_OPEN_FORMAT,
+  TRACE_IN_ARCHIVE_OPEN,
+  TRACE_EXTRACT_ENTRY,
+  TRACE_STREAM_READ,
+  TRACE_STREAM_SEEK,
+  TRACE_OUTPUT_WRITE,
+  TRACE_POINT_COUNT,
+};
+
+struct Counter {
+  UInt64 calls;
+  UInt64 bytes;
+  UInt64 nanos;
+};
+
+class Span {
+ public:
+  // The detail must outlive the trace, it's recorded as the pointer
+  Span(TracePoint point, const char* detail);
+  ~Span();
+
+ public:
+  void SetBytes(UInt64 bytes) { this->bytes = bytes; }
+
+ private:
+  TracePoint point;
+  const char* detail;
+  UInt64 start;
+  UInt64 bytes;
+};
+
+bool IsEnabled();
+
+void SetRecording(bool recording);
+
+// Copies the counters of all trace points
+void Snapshot(Counter counters[TRACE_POINT_COUNT]);
+
+// Clears the counters and the recorded events
+void Reset();
+
+// Writes the recorded events in Chrome trace JSON format
+HRESULT ExportChromeTrace(const char* path);
+
+}
+}
+
+#endif //__A7ZIP_TRACE_H__
@@ -39,6 +39,8 @@
 #define E_UNKNOWN_FORMAT ((HRESULT)0x82240002L)
 #define E_UNSUPPORTED_EXTRACT_MODE ((HRESULT)0x82240003L)
 #define E_NO_OUT_STREAM ((HRESULT)0x82240004L)
+#define E_NO_IN_STREAM ((HRESULT)0x82240005L)
+#define E_ITERATOR_RUNNING ((HRESULT)0x82240006L)
 
 #define E_UNSUPPORTED_METHOD ((HRESULT)0x82250000L)
 #define E_DATA_ERROR ((HRESULT)0x82250001L)
@@ -53,6 +55,15 @@
 #define E_WRONG_PASSWORD ((HRESULT)0x82250010L)
 #define E_NO_PASSWORD ((HRESULT)0x82250011L)
 
+#define E_MEMORY_BUDGET_EXCEEDED ((HRESULT)0x82260000L)
+#define E_OUTPUT_LIMIT_EXCEEDED ((HRESULT)0x82260001L)
+#define E_RATIO_LIMIT_EXCEEDED ((HRESULT)0x82260002L)
+#define E_MEMORY_LIMIT_EXCEEDED ((HRESULT)0x82260003L)
+#define E_TIME_LIMIT_EXCEEDED ((HRESULT)0x82260004L)
+
+#define E_IO_ERROR ((HRESULT)0x82270000L)
+#define E_UNSAFE_PATH ((HRESULT)0x82270001L)
+
 #define CLEAR_IF_EXCEPTION_PENDING(ENV)                               \
   do {                                                                \
     if ((ENV)->ExceptionCheck()) {                                    \
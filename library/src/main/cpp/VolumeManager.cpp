@@ -0,0 +1,375 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "VolumeManager.h"
+
+#include <cstring>
+#include <vector>
+
+#include "JavaEnv.h"
+#include "Log.h"
+#include "ThreadPool.h"
+#include "Utils.h"
+
+#ifdef LOG_TAG
+#  undef LOG_TAG
+#endif //LOG_TAG
+#define LOG_TAG "VolumeManager"
+
+// The first bytes of the next volume to read in advance,
+// it covers the headers of the volume and the first blocks
+#define PREFETCH_SIZE (64 * 1024)
+// The current volume and the next one
+#define MIN_OPEN_VOLUMES 2
+
+#define UNKNOWN_POSITION static_cast<UInt64>(-1)
+
+using namespace a7zip;
+
+namespace a7zip {
+
+class PrefetchJob : public Job {
+ public:
+  explicit PrefetchJob(CMyComPtr<VolumeStream>& volume) :
+      Job(JOB_PRIORITY_LOW),
+      volume(volume) { }
+
+ public:
+  void Run() override {
+    // Keep the thread attached for all java calls of the job
+    JavaEnv env;
+    if (!env.IsValid()) return;
+    volume->Prefetch();
+  }
+
+ private:
+  CMyComPtr<VolumeStream> volume;
+};
+
+}
+
+VolumeStream::VolumeStream(VolumeManager* manager, const wchar_t* name) :
+    ref_count(0),
+    manager(manager),
+    name(name),
+    stream_position(UNKNOWN_POSITION),
+    size(0),
+    position(0),
+    prefetched_size(0),
+    next_prefetched(false) {
+  manager->Add(this);
+}
+
+VolumeStream::~VolumeStream() {
+  manager->Remove(this);
+}
+
+ULONG VolumeStream::AddRef() throw() {
+  return ++ref_count;
+}
+
+ULONG VolumeStream::Release() throw() {
+  ULONG count = --ref_count;
+  if (count == 0) {
+    delete this;
+  }
+  return count;
+}
+
+HRESULT VolumeStream::EnsureOpened() {
+  if (stream != nullptr) {
+    manager->Touch(this);
+    return S_OK;
+  }
+  return manager->Open(this);
+}
+
+HRESULT VolumeStream::ReadFromStream(void* data, UInt32 size, UInt32* processedSize) {
+  RETURN_SAME_IF_NOT_ZERO(EnsureOpened());
+
+  if (stream_position != position) {
+    UInt64 new_position;
+    HRESULT result = stream->Seek(position, STREAM_SEEK_SET, &new_position);
+    if (result != S_OK) {
+      stream_position = UNKNOWN_POSITION;
+      return result;
+    }
+    stream_position = new_position;
+  }
+
+  UInt32 processed = 0;
+  HRESULT result = stream->Read(data, size, &processed);
+  if (result != S_OK) {
+    stream_position = UNKNOWN_POSITION;
+    return result;
+  }
+
+  position += processed;
+  stream_position = position;
+  *processedSize = processed;
+  return S_OK;
+}
+
+HRESULT VolumeStream::Read(void* data, UInt32 size, UInt32* processedSize) {
+  if (processedSize != nullptr) {
+    *processedSize = 0;
+  }
+
+  if (size == 0) {
+    return S_OK;
+  }
+
+  UInt32 processed = 0;
+  bool prefetch_next;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (position < prefetched_size) {
+      processed = static_cast<UInt32>(MIN(static_cast<UInt64>(size), prefetched_size - position));
+      memcpy(data, prefetched + position, processed);
+      position += processed;
+    } else {
+      if (prefetched_size != 0) {
+        // It's passed
+        prefetched.Free();
+        prefetched_size = 0;
+      }
+      RETURN_SAME_IF_NOT_ZERO(ReadFromStream(data, size, &processed));
+    }
+
+    // Half of the volume is read, it's time to warm up the next one
+    prefetch_next = !next_prefetched && position >= this->size / 2;
+    if (prefetch_next) {
+      next_prefetched = true;
+    }
+  }
+
+  if (prefetch_next) {
+    manager->PrefetchNext(this);
+  }
+
+  if (processedSize != nullptr) {
+    *processedSize = processed;
+  }
+
+  return S_OK;
+}
+
+HRESULT VolumeStream::Seek(Int64 offset, UInt32 seekOrigin, UInt64* newPosition) {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  Int64 actual_offset;
+
+  switch (seekOrigin) {
+    case STREAM_SEEK_SET: {
+      actual_offset = offset;
+      break;
+    }
+    case STREAM_SEEK_CUR: {
+      actual_offset = static_cast<Int64>(position) + offset;
+      break;
+    }
+    case STREAM_SEEK_END: {
+      actual_offset = static_cast<Int64>(size) + offset;
+      break;
+    }
+    default: {
+      return E_INVALIDARG;
+    }
+  }
+
+  if (actual_offset < 0) {
+    return E_INVALIDARG;
+  }
+
+  // The java stream is seeked on the next read
+  position = static_cast<UInt64>(actual_offset);
+
+  if (newPosition != nullptr) {
+    *newPosition = position;
+  }
+
+  return S_OK;
+}
+
+HRESULT VolumeStream::GetSize(UInt64* size) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (size != nullptr) {
+    *size = this->size;
+  }
+  return S_OK;
+}
+
+void VolumeStream::Prefetch() {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  // Skip it if the volume is being read
+  if (position != 0 || prefetched_size != 0) {
+    return;
+  }
+
+  size_t capacity = static_cast<size_t>(MIN(static_cast<UInt64>(PREFETCH_SIZE), size));
+  if (capacity == 0) {
+    return;
+  }
+
+  CByteBuffer buffer(capacity);
+  size_t read = 0;
+  while (read < capacity) {
+    UInt32 processed = 0;
+    if (ReadFromStream(buffer + read, static_cast<UInt32>(capacity - read), &processed) != S_OK || processed == 0) {
+      break;
+    }
+    read += processed;
+  }
+
+  // Restore the position, the buffered bytes are read from the start
+  position = 0;
+
+  if (read != 0) {
+    prefetched.CopyFrom(buffer, read);
+    prefetched_size = read;
+  }
+}
+
+VolumeManager::VolumeManager(
+    CMyComPtr<OpenVolumeCallback>& callback,
+    unsigned max_open,
+    bool prefetch_enabled
+) :
+    ref_count(0),
+    callback(callback),
+    max_open(MAX(max_open, static_cast<unsigned>(MIN_OPEN_VOLUMES))),
+    prefetch_enabled(prefetch_enabled) { }
+
+ULONG VolumeManager::AddRef() {
+  return ++ref_count;
+}
+
+ULONG VolumeManager::Release() {
+  ULONG count = --ref_count;
+  if (count == 0) {
+    delete this;
+  }
+  return count;
+}
+
+HRESULT VolumeManager::GetStream(const wchar_t* name, CMyComPtr<IInStream>& stream) {
+  CMyComPtr<VolumeStream> volume(new VolumeStream(this, name));
+
+  {
+    std::lock_guard<std::mutex> lock(volume->mutex);
+
+    if (Open(volume) != S_OK) {
+      return S_FALSE;
+    }
+
+    // Handlers check the sizes of all volumes while opening,
+    // keep it so the volume doesn't need to be opened for it
+    UInt64 size = 0;
+    RETURN_SAME_IF_NOT_ZERO(volume->stream->Seek(0, STREAM_SEEK_END, &size));
+    volume->size = size;
+    volume->stream_position = size;
+  }
+
+  stream = volume;
+  return S_OK;
+}
+
+void VolumeManager::Add(VolumeStream* volume) {
+  std::lock_guard<std::mutex> lock(mutex);
+  volumes.push_back(volume);
+}
+
+void VolumeManager::Remove(VolumeStream* volume) {
+  std::lock_guard<std::mutex> lock(mutex);
+  volumes.remove(volume);
+  opened.remove(volume);
+}
+
+HRESULT VolumeManager::Open(VolumeStream* volume) {
+  CMyComPtr<IInStream> stream;
+  RETURN_SAME_IF_NOT_ZERO(callback->OpenVolume(volume->name, stream));
+
+  // Close them after unlocking, closing calls java
+  std::vector<CMyComPtr<IInStream>> closing;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Close the least recently used volumes which are not in use
+    for (auto it = opened.begin(); it != opened.end() && opened.size() >= max_open;) {
+      VolumeStream* victim = *it;
+      if (victim != volume && victim->mutex.try_lock()) {
+        closing.push_back(victim->stream);
+        victim->stream.Release();
+        victim->stream_position = UNKNOWN_POSITION;
+        victim->mutex.unlock();
+        it = opened.erase(it);
+      } else {
+        ++it;
+      }
+    }
+
+    opened.push_back(volume);
+  }
+
+  volume->stream = stream;
+  volume->stream_position = 0;
+  return S_OK;
+}
+
+void VolumeManager::Touch(VolumeStream* volume) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (opened.empty() || opened.back() == volume) {
+    return;
+  }
+  opened.remove(volume);
+  opened.push_back(volume);
+}
+
+void VolumeManager::PrefetchNext(VolumeStream* volume) {
+  if (!prefetch_enabled) {
+    return;
+  }
+
+  CMyComPtr<VolumeStream> next;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto it = volumes.begin();
+    while (it != volumes.end() && *it != volume) {
+      ++it;
+    }
+    if (it == volumes.end() || ++it == volumes.end()) {
+      return;
+    }
+
+    // Skip the volume if it's being destroyed
+    VolumeStream* candidate = *it;
+    ULONG count = candidate->ref_count.load();
+    do {
+      if (count == 0) {
+        return;
+      }
+    } while (!candidate->ref_count.compare_exchange_weak(count, count + 1));
+    next.Attach(candidate);
+  }
+
+  ThreadPool::GetInstance()->Submit(new PrefetchJob(next));
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __A7ZIP_VOLUME_MANAGER_H__
+#define __A7ZIP_VOLUME_MANAGER_H__
+
+#include <atomic>
+#include <list>
+#include <mutex>
+
+#include <Common/MyBuffer.h>
+#include <Common/MyCom.h>
+#include <Common/MyString.h>
+#include <7zip/IStream.h>
+
+#include "OpenVolumeCallback.h"
+
+namespace a7zip {
+
+class VolumeManager;
+
+// A volume of a multi-volume archive. The java stream under it is closed
+// by VolumeManager if too many volumes are open, and reopened on the next read.
+// Seek only moves the position, the java stream is seeked on read.
+class VolumeStream :
+    public IInStream,
+    public IStreamGetSize
+{
+ public:
+  VolumeStream(VolumeManager* manager, const wchar_t* name);
+  virtual ~VolumeStream();
+
+ public:
+  MY_QUERYINTERFACE_BEGIN2(IInStream)
+  MY_QUERYINTERFACE_ENTRY(IStreamGetSize)
+  MY_QUERYINTERFACE_END
+
+  // It's shared with the prefetch job on another thread
+  STDMETHOD_(ULONG, AddRef)() throw();
+  STDMETHOD_(ULONG, Release)() throw();
+
+  STDMETHOD(Read)(void* data, UInt32 size, UInt32* processedSize);
+  STDMETHOD(Seek)(Int64 offset, UInt32 seekOrigin, UInt64* newPosition);
+
+  STDMETHOD(GetSize)(UInt64* size);
+
+ private:
+  // The caller must hold the mutex
+  HRESULT EnsureOpened();
+  HRESULT ReadFromStream(void* data, UInt32 size, UInt32* processedSize);
+  void Prefetch();
+
+ private:
+  std::atomic<ULONG> ref_count;
+  CMyComPtr<VolumeManager> manager;
+  UString name;
+
+  std::mutex mutex;
+  CMyComPtr<IInStream> stream;
+  // The position of the java stream, it may differ from the position after seeking
+  UInt64 stream_position;
+  UInt64 size;
+  UInt64 position;
+
+  CByteBuffer prefetched;
+  size_t prefetched_size;
+  bool next_prefetched;
+
+  friend class VolumeManager;
+  friend class PrefetchJob;
+};
+
+// Keeps at most max_open volumes open, the least recently used one is closed first.
+// While a volume is being read, the first blocks of the next volume are
+// read into memory in the thread pool.
+class VolumeManager {
+ public:
+  VolumeManager(CMyComPtr<OpenVolumeCallback>& callback, unsigned max_open, bool prefetch_enabled);
+
+ public:
+  ULONG AddRef();
+  ULONG Release();
+
+  // Returns S_FALSE if the volume doesn't exist
+  HRESULT GetStream(const wchar_t* name, CMyComPtr<IInStream>& stream);
+
+ private:
+  void Add(VolumeStream* volume);
+  void Remove(VolumeStream* volume);
+  // Opens the java stream of the volume, closes others if needed
+  HRESULT Open(VolumeStream* volume);
+  void Touch(VolumeStream* volume);
+  void PrefetchNext(VolumeStream* volume);
+
+ private:
+  std::atomic<ULONG> ref_count;
+  CMyComPtr<OpenVolumeCallback> callback;
+  unsigned max_open;
+  bool prefetch_enabled;
+
+  std::mutex mutex;
+  // In the order they are requested
+  std::list<VolumeStream*> volumes;
+  // The least recently used is the first
+  std::list<VolumeStream*> opened;
+
+  friend class VolumeStream;
+};
+
+}
+
+#endif //__A7ZIP_VOLUME_MANAGER_H__
@@ -0,0 +1,307 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "XzIndex.h"
+
+#include <cstring>
+
+#include <7zCrc.h>
+#include <Alloc.h>
+#include <Xz.h>
+
+#include "Log.h"
+#include "Utils.h"
+
+#ifdef LOG_TAG
+#  undef LOG_TAG
+#endif //LOG_TAG
+#define LOG_TAG "XzIndex"
+
+#define STREAM_HEADER_SIZE 12
+#define STREAM_FOOTER_SIZE 12
+// Bigger indexes are likely broken
+#define MAX_INDEX_SIZE (64 << 20)
+#define MAX_VAR_INT_SIZE 9
+// The decoded blocks kept for the streams
+#define STREAM_CACHE_SIZE (64 << 20)
+
+using namespace a7zip;
+
+static const Byte STREAM_MAGIC[6] = { 0xFD, '7', 'z', 'X', 'Z', 0x00 };
+static const Byte FOOTER_MAGIC[2] = { 'Y', 'Z' };
+
+static UInt32 GetUInt32(const Byte* p) {
+  return static_cast<UInt32>(p[0]) | (static_cast<UInt32>(p[1]) << 8) |
+      (static_cast<UInt32>(p[2]) << 16) | (static_cast<UInt32>(p[3]) << 24);
+}
+
+static void SetUInt32(Byte* p, UInt32 value) {
+  p[0] = static_cast<Byte>(value);
+  p[1] = static_cast<Byte>(value >> 8);
+  p[2] = static_cast<Byte>(value >> 16);
+  p[3] = static_cast<Byte>(value >> 24);
+}
+
+static UInt32 Crc32(const Byte* data, size_t size) {
+  return CRC_GET_DIGEST(CrcUpdate(CRC_INIT_VAL, data, size));
+}
+
+static UInt64 Pad4(UInt64 size) {
+  return (size + 3) & ~static_cast<UInt64>(3);
+}
+
+// Returns the bytes read, 0 if it's broken
+static size_t ReadVarInt(const Byte* p, size_t size, UInt64& value) {
+  value = 0;
+  for (size_t i = 0; i < MIN(size, static_cast<size_t>(MAX_VAR_INT_SIZE)); i++) {
+    value |= static_cast<UInt64>(p[i] & 0x7F) << (7 * i);
+    if ((p[i] & 0x80) == 0) {
+      return (i != 0 && p[i] == 0) ? 0 : i + 1;
+    }
+  }
+  return 0;
+}
+
+static void WriteVarInt(std::vector<Byte>& data, UInt64 value) {
+  while (value >= 0x80) {
+    data.push_back(static_cast<Byte>(value | 0x80));
+    value >>= 7;
+  }
+  data.push_back(static_cast<Byte>(value));
+}
+
+static HRESULT ReadFully(IInStream* stream, UInt64 offset, Byte* data, size_t size) {
+  RETURN_SAME_IF_NOT_ZERO(stream->Seek(static_cast<Int64>(offset), STREAM_SEEK_SET, nullptr));
+  while (size != 0) {
+    UInt32 processed = 0;
+    RETURN_SAME_IF_NOT_ZERO(stream->Read(data, static_cast<UInt32>(size), &processed));
+    if (processed == 0) {
+      return E_UNEXPECTED_END;
+    }
+    data += processed;
+    size -= processed;
+  }
+  return S_OK;
+}
+
+static bool IsValidFlags(const Byte* flags) {
+  return flags[0] == 0 && (flags[1] & 0xF0) == 0;
+}
+
+XzIndex::XzIndex(SharedInStream* stream) : ChunkedResource(stream, STREAM_CACHE_SIZE) { }
+
+HRESULT XzIndex::ReadStream(
+    UInt64 end,
+    UInt64& start,
+    std::vector<IndependentChunk>& stream_blocks
+) {
+  if (end < STREAM_HEADER_SIZE + STREAM_FOOTER_SIZE) {
+    return S_FALSE;
+  }
+
+  Byte footer[STREAM_FOOTER_SIZE];
+  RETURN_SAME_IF_NOT_ZERO(ReadFully(stream, end - STREAM_FOOTER_SIZE, footer, sizeof(footer)));
+  if (memcmp(footer + 10, FOOTER_MAGIC, sizeof(FOOTER_MAGIC)) != 0 ||
+      Crc32(footer + 4, 6) != GetUInt32(footer) ||
+      !IsValidFlags(footer + 8)) {
+    return S_FALSE;
+  }
+
+  UInt64 index_size = (static_cast<UInt64>(GetUInt32(footer + 4)) + 1) * 4;
+  if (index_size > MAX_INDEX_SIZE || index_size + STREAM_HEADER_SIZE + STREAM_FOOTER_SIZE > end) {
+    return S_FALSE;
+  }
+  UInt64 index_offset = end - STREAM_FOOTER_SIZE - index_size;
+  std::vector<Byte> index(static_cast<size_t>(index_size));
+  RETURN_SAME_IF_NOT_ZERO(ReadFully(stream, index_offset, index.data(), index.size()));
+  if (index[0] != 0 || Crc32(index.data(), index.size() - 4) != GetUInt32(index.data() + index.size() - 4)) {
+    return S_FALSE;
+  }
+
+  // The indicator, the count, the records, the padding and the CRC32
+  size_t position = 1;
+  size_t limit = index.size() - 4;
+  UInt64 count;
+  size_t n = ReadVarInt(index.data() + position, limit - position, count);
+  if (n == 0 || count > limit) {
+    return S_FALSE;
+  }
+  position += n;
+
+  UInt64 blocks_size = 0;
+  for (UInt64 i = 0; i < count; i++) {
+    UInt64 unpadded_size;
+    UInt64 size;
+    n = ReadVarInt(index.data() + position, limit - position, unpadded_size);
+    if (n == 0) return S_FALSE;
+    position += n;
+    n = ReadVarInt(index.data() + position, limit - position, size);
+    if (n == 0) return S_FALSE;
+    position += n;
+    if (unpadded_size == 0 || unpadded_size > index_offset) {
+      return S_FALSE;
+    }
+
+    IndependentChunk block;
+    block.packed_offset = blocks_size;
+    block.packed_size = Pad4(unpadded_size);
+    block.offset = 0;
+    block.size = size;
+    stream_blocks.push_back(block);
+    BlockInfo info;
+    info.unpadded_size = unpadded_size;
+    memcpy(info.stream_flags, footer + 8, sizeof(info.stream_flags));
+    infos.push_back(info);
+    blocks_size += block.packed_size;
+  }
+  for (; position < limit; position++) {
+    if (index[position] != 0) return S_FALSE;
+  }
+  if (blocks_size + STREAM_HEADER_SIZE > index_offset) {
+    return S_FALSE;
+  }
+
+  start = index_offset - blocks_size - STREAM_HEADER_SIZE;
+  Byte header[STREAM_HEADER_SIZE];
+  RETURN_SAME_IF_NOT_ZERO(ReadFully(stream, start, header, sizeof(header)));
+  if (memcmp(header, STREAM_MAGIC, sizeof(STREAM_MAGIC)) != 0 ||
+      memcmp(header + 6, footer + 8, 2) != 0 ||
+      Crc32(header + 6, 2) != GetUInt32(header + 8)) {
+    return S_FALSE;
+  }
+
+  for (IndependentChunk& block : stream_blocks) {
+    block.packed_offset += start + STREAM_HEADER_SIZE;
+  }
+  return S_OK;
+}
+
+HRESULT XzIndex::Load() {
+  UInt64 end;
+  RETURN_SAME_IF_NOT_ZERO(stream->Seek(0, STREAM_SEEK_END, &end));
+
+  // The streams are read from the last one
+  std::vector<std::vector<IndependentChunk>> streams;
+  std::vector<std::vector<BlockInfo>> stream_infos;
+  while (end != 0) {
+    // Stream padding, four zero bytes at a time
+    Byte padding[4];
+    if (end < sizeof(padding)) {
+      return S_FALSE;
+    }
+    RETURN_SAME_IF_NOT_ZERO(ReadFully(stream, end - sizeof(padding), padding, sizeof(padding)));
+    if (GetUInt32(padding) == 0) {
+      end -= sizeof(padding);
+      continue;
+    }
+
+    streams.emplace_back();
+    infos.clear();
+    UInt64 start;
+    HRESULT result = ReadStream(end, start, streams.back());
+    if (result != S_OK) {
+      return result;
+    }
+    stream_infos.emplace_back();
+    stream_infos.back().swap(infos);
+    end = start;
+  }
+
+  UInt64 offset = 0;
+  for (size_t i = streams.size(); i-- != 0;) {
+    for (IndependentChunk& block : streams[i]) {
+      block.offset = offset;
+      offset += block.size;
+      chunks.push_back(block);
+    }
+    infos.insert(infos.end(), stream_infos[i].begin(), stream_infos[i].end());
+  }
+  SetChunksLoaded();
+  return chunks.empty() ? S_FALSE : S_OK;
+}
+
+HRESULT XzIndex::DecodeChunk(size_t index, const IndependentChunk& chunk, const Byte* packed, Byte* data) {
+  const BlockInfo& info = infos[index];
+
+  Byte header[STREAM_HEADER_SIZE];
+  memcpy(header, STREAM_MAGIC, sizeof(STREAM_MAGIC));
+  memcpy(header + 6, info.stream_flags, 2);
+  SetUInt32(header + 8, Crc32(info.stream_flags, 2));
+
+  // The index of the block and the footer
+  std::vector<Byte> tail;
+  tail.push_back(0);
+  WriteVarInt(tail, 1);
+  WriteVarInt(tail, info.unpadded_size);
+  WriteVarInt(tail, chunk.size);
+  while (tail.size() % 4 != 0) {
+    tail.push_back(0);
+  }
+  UInt32 index_crc = Crc32(tail.data(), tail.size());
+  tail.resize(tail.size() + 4);
+  SetUInt32(tail.data() + tail.size() - 4, index_crc);
+  size_t footer_offset = tail.size();
+  tail.resize(tail.size() + STREAM_FOOTER_SIZE);
+  Byte* footer = tail.data() + footer_offset;
+  SetUInt32(footer + 4, static_cast<UInt32>(footer_offset / 4 - 1));
+  memcpy(footer + 8, info.stream_flags, 2);
+  SetUInt32(footer, Crc32(footer + 4, 6));
+  memcpy(footer + 10, FOOTER_MAGIC, sizeof(FOOTER_MAGIC));
+
+  CXzUnpacker unpacker;
+  XzUnpacker_Construct(&unpacker, &g_Alloc);
+  XzUnpacker_Init(&unpacker);
+
+  const Byte* parts[3] = { header, packed, tail.data() };
+  size_t part_sizes[3] = { sizeof(header), static_cast<size_t>(chunk.packed_size), tail.size() };
+  size_t written = 0;
+  SRes result = SZ_OK;
+  for (int i = 0; i < 3 && result == SZ_OK; i++) {
+    SizeT src_size = part_sizes[i];
+    SizeT dest_size = static_cast<SizeT>(chunk.size - written);
+    ECoderStatus status;
+    // The end mode lets the decoder read the end of the block after the data is full
+    result = XzUnpacker_Code(&unpacker, data + written, &dest_size, parts[i], &src_size, CODER_FINISH_END, &status);
+    written += dest_size;
+    if (result == SZ_OK && src_size != part_sizes[i]) {
+      result = SZ_ERROR_DATA;
+    }
+  }
+  if (result == SZ_OK && (written != chunk.size || !XzUnpacker_IsStreamWasFinished(&unpacker))) {
+    result = SZ_ERROR_DATA;
+  }
+  XzUnpacker_Free(&unpacker);
+
+  switch (result) {
+    case SZ_OK:
+      return S_OK;
+    case SZ_ERROR_MEM:
+      return E_OUTOFMEMORY;
+    case SZ_ERROR_CRC:
+      return E_CRC_ERROR;
+    default:
+      return E_DATA_ERROR;
+  }
+}
+
+HRESULT XzIndex::Open(SharedInStream* stream, CMyComPtr<XzIndex>& index) {
+  CMyComPtr<XzIndex> xz_index(new XzIndex(stream));
+  HRESULT result = xz_index->Load();
+  if (result == S_OK) {
+    index = xz_index;
+  }
+  return result;
+}
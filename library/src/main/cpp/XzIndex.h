@@ -0,0 +1,63 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __A7ZIP_XZ_INDEX_H__
+#define __A7ZIP_XZ_INDEX_H__
+
+#include <vector>
+
+#include <include_windows/windows.h>
+#include <Common/MyCom.h>
+#include <7zip/IStream.h>
+
+#include "ChunkedResource.h"
+
+namespace a7zip {
+
+// The blocks of an xz file, read from the indexes of its streams.
+// xz -T0 and pixz split the data into many blocks, each of them decodes
+// without the others. A block is decoded alone by wrapping it into an xz stream
+// of one block: the header of its stream, the block, and an index of the block.
+// The chunks are the blocks of all streams.
+class XzIndex : public ChunkedResource {
+ public:
+  // Decodes the block with its check, the packed data is the block with the padding
+  HRESULT DecodeChunk(size_t index, const IndependentChunk& chunk, const Byte* packed, Byte* data);
+
+ private:
+  explicit XzIndex(SharedInStream* stream);
+
+  HRESULT Load();
+  // Reads the stream ending at the end, returns S_FALSE if there is no valid stream
+  HRESULT ReadStream(UInt64 end, UInt64& start, std::vector<IndependentChunk>& stream_blocks);
+
+ private:
+  struct BlockInfo {
+    UInt64 unpadded_size;
+    Byte stream_flags[2];
+  };
+
+  std::vector<BlockInfo> infos;
+
+ public:
+  // Returns S_FALSE if it isn't an xz file, or an index is broken
+  static HRESULT Open(SharedInStream* stream, CMyComPtr<XzIndex>& index);
+};
+
+}
+
+#endif //__A7ZIP_XZ_INDEX_H__
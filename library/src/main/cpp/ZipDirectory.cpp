@@ -0,0 +1,523 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ZipDirectory.h"
+
+#include <cstring>
+
+#include "Log.h"
+#include "SevenZip.h"
+#include "Utils.h"
+
+#ifdef LOG_TAG
+#  undef LOG_TAG
+#endif //LOG_TAG
+#define LOG_TAG "ZipDirectory"
+
+using namespace a7zip;
+
+static const UInt32 LOCAL_HEADER_SIGNATURE = 0x04034b50;
+static const UInt32 RECORD_SIGNATURE = 0x02014b50;
+static const UInt32 EOCD_SIGNATURE = 0x06054b50;
+static const UInt32 ZIP64_EOCD_SIGNATURE = 0x06064b50;
+static const UInt32 ZIP64_LOCATOR_SIGNATURE = 0x07064b50;
+static const UInt32 DESCRIPTOR_SIGNATURE = 0x08074b50;
+
+static const size_t LOCAL_HEADER_SIZE = 30;
+static const size_t RECORD_SIZE = 46;
+static const size_t EOCD_SIZE = 22;
+static const size_t ZIP64_EOCD_SIZE = 56;
+static const size_t ZIP64_LOCATOR_SIZE = 20;
+static const size_t MAX_COMMENT_SIZE = 0xFFFF;
+
+static const UInt16 ZIP64_EXTRA_ID = 0x0001;
+static const UInt16 FLAG_ENCRYPTED = 1 << 0;
+static const UInt16 FLAG_DESCRIPTOR = 1 << 3;
+static const UInt16 FLAG_UTF8 = 1 << 11;
+
+static const UInt16 METHOD_STORED = 0;
+static const UInt32 DOS_DIRECTORY_ATTRIBUTE = 0x10;
+
+// The offsets of the records are 32-bit
+static const UInt64 MAX_DIRECTORY_SIZE = 0xFFFFFFFF;
+// The directory is scanned through a window of it
+static const size_t SCAN_WINDOW_SIZE = 64 * 1024;
+// Read with the fixed fields of a record, enough for the name and extra of most records
+static const size_t RECORD_READ_SIZE = 512;
+
+static inline UInt16 GetUi16(const Byte* p) {
+  return static_cast<UInt16>(p[0] | (p[1] << 8));
+}
+
+static inline UInt32 GetUi32(const Byte* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<UInt32>(p[3]) << 24);
+}
+
+static inline UInt64 GetUi64(const Byte* p) {
+  return GetUi32(p) | (static_cast<UInt64>(GetUi32(p + 4)) << 32);
+}
+
+static inline void SetUi16(Byte* p, UInt16 v) {
+  p[0] = static_cast<Byte>(v);
+  p[1] = static_cast<Byte>(v >> 8);
+}
+
+static inline void SetUi32(Byte* p, UInt32 v) {
+  SetUi16(p, static_cast<UInt16>(v));
+  SetUi16(p + 2, static_cast<UInt16>(v >> 16));
+}
+
+static inline void SetUi64(Byte* p, UInt64 v) {
+  SetUi32(p, static_cast<UInt32>(v));
+  SetUi32(p + 4, static_cast<UInt32>(v >> 32));
+}
+
+// Finds the zip64 extra in the extra field, returns null if none
+static Byte* FindZip64Extra(Byte* extra, size_t length, size_t& extra_length) {
+  size_t pos = 0;
+  while (pos + 4 <= length) {
+    UInt16 id = GetUi16(extra + pos);
+    size_t size = GetUi16(extra + pos + 2);
+    if (pos + 4 + size > length) {
+      break;
+    }
+    if (id == ZIP64_EXTRA_ID) {
+      extra_length = size;
+      return extra + pos + 4;
+    }
+    pos += 4 + size;
+  }
+  return nullptr;
+}
+
+namespace a7zip {
+
+// A range of the zip, followed by the bytes of tail.
+// The local header and the data of an entry with a synthesized directory for OpenEntry,
+// or the data alone for OpenEntryPackedData.
+class ZipEntryStream :
+    public IInStream,
+    public CMyUnknownImp
+{
+ public:
+  ZipEntryStream(ZipDirectory* directory, UInt64 offset, UInt64 length, std::vector<Byte>& tail) :
+      directory(directory),
+      offset(offset),
+      length(length),
+      position(0) {
+    this->tail.swap(tail);
+  }
+
+ public:
+  MY_UNKNOWN_IMP2(ISequentialInStream, IInStream)
+
+  STDMETHOD(Read)(void* data, UInt32 size, UInt32* processedSize) {
+    if (processedSize != nullptr) {
+      *processedSize = 0;
+    }
+
+    UInt32 processed = 0;
+    HRESULT result = S_OK;
+    if (position < length) {
+      UInt32 n = static_cast<UInt32>(MIN(static_cast<UInt64>(size), length - position));
+      result = directory->ReadAt(offset + position, data, n, &processed);
+    } else if (position < length + tail.size()) {
+      size_t tail_position = static_cast<size_t>(position - length);
+      processed = static_cast<UInt32>(MIN(static_cast<size_t>(size), tail.size() - tail_position));
+      memcpy(data, tail.data() + tail_position, processed);
+    }
+
+    position += processed;
+    if (processedSize != nullptr) {
+      *processedSize = processed;
+    }
+    return result;
+  }
+
+  STDMETHOD(Seek)(Int64 offset, UInt32 seekOrigin, UInt64* newPosition) {
+    Int64 new_position;
+    switch (seekOrigin) {
+      case STREAM_SEEK_SET:
+        new_position = offset;
+        break;
+      case STREAM_SEEK_CUR:
+        new_position = static_cast<Int64>(position) + offset;
+        break;
+      case STREAM_SEEK_END:
+        new_position = static_cast<Int64>(length + tail.size()) + offset;
+        break;
+      default:
+        return E_INVALIDARG;
+    }
+    if (new_position < 0) {
+      return STG_E_INVALIDFUNCTION;
+    }
+
+    position = static_cast<UInt64>(new_position);
+    if (newPosition != nullptr) {
+      *newPosition = position;
+    }
+    return S_OK;
+  }
+
+ private:
+  CMyComPtr<ZipDirectory> directory;
+  UInt64 offset;
+  UInt64 length;
+  std::vector<Byte> tail;
+  UInt64 position;
+};
+
+}
+
+ZipDirectory::ZipDirectory(SharedInStream* stream) :
+    stream(stream->Clone()),
+    stream_size(0),
+    base(0),
+    directory_start(0),
+    directory_size(0) { }
+
+HRESULT ZipDirectory::ReadAt(UInt64 offset, void* data, UInt32 size, UInt32* processed_size) {
+  return stream->ReadAt(offset, data, size, processed_size);
+}
+
+HRESULT ZipDirectory::ReadFully(UInt64 offset, void* data, size_t size) {
+  Byte* bytes = static_cast<Byte*>(data);
+  while (size != 0) {
+    UInt32 processed = 0;
+    RETURN_SAME_IF_NOT_ZERO(ReadAt(offset, bytes, static_cast<UInt32>(MIN(size, static_cast<size_t>(1 << 30))), &processed));
+    if (processed == 0) {
+      return E_UNEXPECTED_END;
+    }
+    offset += processed;
+    bytes += processed;
+    size -= processed;
+  }
+  return S_OK;
+}
+
+HRESULT ZipDirectory::Load() {
+  RETURN_SAME_IF_NOT_ZERO(stream->Seek(0, STREAM_SEEK_END, &stream_size));
+  if (stream_size < EOCD_SIZE) {
+    return E_IS_NOT_ARC;
+  }
+
+  // The end of central directory record is followed by the comment
+  size_t tail_size = static_cast<size_t>(MIN(stream_size, static_cast<UInt64>(EOCD_SIZE + MAX_COMMENT_SIZE)));
+  UInt64 tail_offset = stream_size - tail_size;
+  std::vector<Byte> tail(tail_size);
+  RETURN_SAME_IF_NOT_ZERO(ReadFully(tail_offset, tail.data(), tail_size));
+
+  size_t eocd = tail_size - EOCD_SIZE;
+  while (true) {
+    if (GetUi32(&tail[eocd]) == EOCD_SIGNATURE && eocd + EOCD_SIZE + GetUi16(&tail[eocd + 20]) <= tail_size) {
+      break;
+    }
+    if (eocd == 0) {
+      return E_IS_NOT_ARC;
+    }
+    eocd--;
+  }
+
+  UInt64 eocd_offset = tail_offset + eocd;
+  UInt64 count = GetUi16(&tail[eocd + 10]);
+  directory_size = GetUi32(&tail[eocd + 12]);
+  UInt64 directory_offset = GetUi32(&tail[eocd + 16]);
+  UInt64 directory_end = eocd_offset;
+
+  if (eocd_offset >= ZIP64_LOCATOR_SIZE) {
+    Byte locator[ZIP64_LOCATOR_SIZE];
+    RETURN_SAME_IF_NOT_ZERO(ReadFully(eocd_offset - ZIP64_LOCATOR_SIZE, locator, ZIP64_LOCATOR_SIZE));
+    if (GetUi32(locator) == ZIP64_LOCATOR_SIGNATURE && eocd_offset >= ZIP64_LOCATOR_SIZE + ZIP64_EOCD_SIZE) {
+      // It's right before the locator unless the record has an extensible data sector
+      UInt64 zip64_offset = eocd_offset - ZIP64_LOCATOR_SIZE - ZIP64_EOCD_SIZE;
+      Byte zip64[ZIP64_EOCD_SIZE];
+      RETURN_SAME_IF_NOT_ZERO(ReadFully(zip64_offset, zip64, ZIP64_EOCD_SIZE));
+      if (GetUi32(zip64) != ZIP64_EOCD_SIGNATURE) {
+        zip64_offset = GetUi64(locator + 8);
+        if (zip64_offset > stream_size - ZIP64_EOCD_SIZE) {
+          return E_HEADERS_ERROR;
+        }
+        RETURN_SAME_IF_NOT_ZERO(ReadFully(zip64_offset, zip64, ZIP64_EOCD_SIZE));
+        if (GetUi32(zip64) != ZIP64_EOCD_SIGNATURE) {
+          return E_HEADERS_ERROR;
+        }
+      }
+      count = GetUi64(zip64 + 32);
+      directory_size = GetUi64(zip64 + 40);
+      directory_offset = GetUi64(zip64 + 48);
+      directory_end = zip64_offset;
+    }
+  }
+
+  // The directory ends right before the end records,
+  // the offsets are relative to the start of the zip
+  if (directory_size > directory_end || directory_offset > directory_end - directory_size) {
+    return E_HEADERS_ERROR;
+  }
+  base = directory_end - directory_size - directory_offset;
+  if (directory_size > MAX_DIRECTORY_SIZE) {
+    return E_HEADERS_ERROR;
+  }
+
+  directory_start = base + directory_offset;
+
+  // Only the fixed fields are needed for where the next record is
+  std::vector<Byte> window(static_cast<size_t>(MIN(directory_size, static_cast<UInt64>(SCAN_WINDOW_SIZE))));
+  UInt64 window_start = 0;
+  size_t window_length = 0;
+  offsets.reserve(static_cast<size_t>(MIN(count, directory_size / RECORD_SIZE)));
+  UInt64 pos = 0;
+  while (pos + RECORD_SIZE <= directory_size) {
+    if (pos < window_start || pos + RECORD_SIZE > window_start + window_length) {
+      window_start = pos;
+      window_length = static_cast<size_t>(MIN(static_cast<UInt64>(window.size()), directory_size - pos));
+      RETURN_SAME_IF_NOT_ZERO(ReadFully(directory_start + pos, window.data(), window_length));
+    }
+    const Byte* record = &window[static_cast<size_t>(pos - window_start)];
+    if (GetUi32(record) != RECORD_SIGNATURE) {
+      break;
+    }
+    UInt64 length = RECORD_SIZE + GetUi16(record + 28) + GetUi16(record + 30) + GetUi16(record + 32);
+    if (pos + length > directory_size) {
+      break;
+    }
+    offsets.push_back(static_cast<UInt32>(pos));
+    pos += length;
+  }
+
+  if (offsets.empty() && count != 0) {
+    return E_HEADERS_ERROR;
+  }
+  if (offsets.size() != count) {
+    // The count of the end record is truncated to 16 bits without zip64
+    LOGW("%u records, the count is %llu", static_cast<unsigned>(offsets.size()), static_cast<unsigned long long>(count));
+  }
+  return S_OK;
+}
+
+HRESULT ZipDirectory::GetRecord(UInt32 index, std::vector<Byte>& bytes, Entry& entry, bool& zip64) {
+  if (index >= offsets.size()) {
+    return E_INVALIDARG;
+  }
+
+  // Load() checked that the record is in the directory
+  UInt64 offset = directory_start + offsets[index];
+  UInt64 remaining = directory_size - offsets[index];
+  bytes.resize(static_cast<size_t>(MIN(remaining, static_cast<UInt64>(RECORD_READ_SIZE))));
+  RETURN_SAME_IF_NOT_ZERO(ReadFully(offset, bytes.data(), bytes.size()));
+  if (GetUi32(bytes.data()) != RECORD_SIGNATURE) {
+    // The stream changed after Load()
+    return E_HEADERS_ERROR;
+  }
+  size_t name_length = GetUi16(&bytes[28]);
+  size_t extra_length = GetUi16(&bytes[30]);
+  size_t length = RECORD_SIZE + name_length + extra_length + GetUi16(&bytes[32]);
+  if (length > remaining) {
+    return E_HEADERS_ERROR;
+  }
+  size_t read = bytes.size();
+  if (length > read) {
+    bytes.resize(length);
+    RETURN_SAME_IF_NOT_ZERO(ReadFully(offset + read, &bytes[read], length - read));
+  } else {
+    bytes.resize(length);
+  }
+  const Byte* record = bytes.data();
+
+  UInt16 made_by = GetUi16(record + 4);
+  entry.flags = GetUi16(record + 8);
+  entry.method = GetUi16(record + 10);
+  entry.dos_time = GetUi32(record + 12);
+  entry.crc = GetUi32(record + 16);
+  entry.packed_size = GetUi32(record + 20);
+  entry.size = GetUi32(record + 24);
+  entry.local_offset = GetUi32(record + 42);
+  entry.name.assign(reinterpret_cast<const char*>(record + RECORD_SIZE), name_length);
+  entry.utf8 = (entry.flags & FLAG_UTF8) != 0;
+  UInt32 attributes = GetUi32(record + 38);
+  entry.is_dir = (!entry.name.empty() && entry.name.back() == '/') ||
+      ((made_by >> 8) == 0 && (attributes & DOS_DIRECTORY_ATTRIBUTE) != 0);
+
+  // The fields are in the zip64 extra if they are 0xFFFFFFFF
+  zip64 = false;
+  size_t zip64_length = 0;
+  const Byte* extra = FindZip64Extra(const_cast<Byte*>(record + RECORD_SIZE + name_length), extra_length, zip64_length);
+  if (extra != nullptr) {
+    size_t pos = 0;
+    if (entry.size == 0xFFFFFFFF && pos + 8 <= zip64_length) {
+      entry.size = GetUi64(extra + pos);
+      pos += 8;
+      zip64 = true;
+    }
+    if (entry.packed_size == 0xFFFFFFFF && pos + 8 <= zip64_length) {
+      entry.packed_size = GetUi64(extra + pos);
+      pos += 8;
+      zip64 = true;
+    }
+    if (entry.local_offset == 0xFFFFFFFF && pos + 8 <= zip64_length) {
+      entry.local_offset = GetUi64(extra + pos);
+    }
+  }
+  entry.local_offset += base;
+
+  return S_OK;
+}
+
+HRESULT ZipDirectory::GetEntry(UInt32 index, Entry& entry) {
+  std::vector<Byte> record;
+  bool zip64;
+  return GetRecord(index, record, entry, zip64);
+}
+
+HRESULT ZipDirectory::GetDataOffset(const Entry& entry, UInt64& data_offset) {
+  Byte local_header[LOCAL_HEADER_SIZE];
+  RETURN_SAME_IF_NOT_ZERO(ReadFully(entry.local_offset, local_header, LOCAL_HEADER_SIZE));
+  if (GetUi32(local_header) != LOCAL_HEADER_SIGNATURE) {
+    return E_HEADERS_ERROR;
+  }
+  data_offset = entry.local_offset + LOCAL_HEADER_SIZE + GetUi16(local_header + 26) + GetUi16(local_header + 28);
+  return S_OK;
+}
+
+HRESULT ZipDirectory::OpenEntryData(UInt32 index, IInStream** stream) {
+  *stream = nullptr;
+
+  Entry entry;
+  RETURN_SAME_IF_NOT_ZERO(GetEntry(index, entry));
+  if (entry.method != METHOD_STORED || entry.size != entry.packed_size) {
+    return S_FALSE;
+  }
+  return OpenEntryPackedData(index, stream);
+}
+
+HRESULT ZipDirectory::OpenEntryPackedData(UInt32 index, IInStream** stream) {
+  *stream = nullptr;
+
+  Entry entry;
+  RETURN_SAME_IF_NOT_ZERO(GetEntry(index, entry));
+  if (entry.is_dir || (entry.flags & FLAG_ENCRYPTED) != 0) {
+    return S_FALSE;
+  }
+
+  UInt64 data_offset;
+  RETURN_SAME_IF_NOT_ZERO(GetDataOffset(entry, data_offset));
+  if (entry.packed_size > stream_size || data_offset > stream_size - entry.packed_size) {
+    return E_UNEXPECTED_END;
+  }
+
+  std::vector<Byte> no_tail;
+  CMyComPtr<IInStream> data_stream(new ZipEntryStream(this, data_offset, entry.packed_size, no_tail));
+  *stream = data_stream.Detach();
+  return S_OK;
+}
+
+HRESULT ZipDirectory::OpenEntry(UInt32 index, BSTR password, InArchive** archive) {
+  *archive = nullptr;
+
+  std::vector<Byte> record;
+  Entry entry;
+  bool zip64;
+  RETURN_SAME_IF_NOT_ZERO(GetRecord(index, record, entry, zip64));
+  size_t record_length = record.size();
+
+  UInt64 data_offset;
+  RETURN_SAME_IF_NOT_ZERO(GetDataOffset(entry, data_offset));
+  if (entry.packed_size > stream_size || data_offset > stream_size - entry.packed_size) {
+    return E_UNEXPECTED_END;
+  }
+
+  UInt64 length = data_offset - entry.local_offset + entry.packed_size;
+  if ((entry.flags & FLAG_DESCRIPTOR) != 0) {
+    // The signature of the data descriptor is optional
+    Byte signature[4];
+    UInt64 descriptor_length = zip64 ? 20 : 12;
+    if (ReadFully(entry.local_offset + length, signature, sizeof(signature)) == S_OK &&
+        GetUi32(signature) == DESCRIPTOR_SIGNATURE) {
+      descriptor_length += 4;
+    }
+    length += descriptor_length;
+  }
+  if (entry.local_offset + length > stream_size) {
+    return E_UNEXPECTED_END;
+  }
+
+  // The record of the entry, with the local header at the start
+  std::vector<Byte> tail;
+  tail.swap(record);
+  SetUi16(&tail[34], 0);
+  if (GetUi32(&tail[42]) != 0xFFFFFFFF) {
+    SetUi32(&tail[42], 0);
+  } else {
+    size_t name_length = GetUi16(&tail[28]);
+    size_t zip64_length = 0;
+    Byte* extra = FindZip64Extra(&tail[RECORD_SIZE + name_length], GetUi16(&tail[30]), zip64_length);
+    size_t pos = (GetUi32(&tail[24]) == 0xFFFFFFFF ? 8 : 0) + (GetUi32(&tail[20]) == 0xFFFFFFFF ? 8 : 0);
+    if (extra != nullptr && pos + 8 <= zip64_length) {
+      SetUi64(extra + pos, 0);
+    }
+  }
+
+  UInt64 directory_offset = length;
+  bool zip64_end = directory_offset >= 0xFFFFFFFF;
+  if (zip64_end) {
+    size_t pos = tail.size();
+    tail.resize(pos + ZIP64_EOCD_SIZE + ZIP64_LOCATOR_SIZE);
+    Byte* p = &tail[pos];
+    SetUi32(p, ZIP64_EOCD_SIGNATURE);
+    SetUi64(p + 4, ZIP64_EOCD_SIZE - 12);
+    SetUi16(p + 12, 45);
+    SetUi16(p + 14, 45);
+    SetUi32(p + 16, 0);
+    SetUi32(p + 20, 0);
+    SetUi64(p + 24, 1);
+    SetUi64(p + 32, 1);
+    SetUi64(p + 40, record_length);
+    SetUi64(p + 48, directory_offset);
+    p += ZIP64_EOCD_SIZE;
+    SetUi32(p, ZIP64_LOCATOR_SIGNATURE);
+    SetUi32(p + 4, 0);
+    SetUi64(p + 8, length + record_length);
+    SetUi32(p + 16, 1);
+  }
+  size_t pos = tail.size();
+  tail.resize(pos + EOCD_SIZE);
+  Byte* p = &tail[pos];
+  SetUi32(p, EOCD_SIGNATURE);
+  SetUi16(p + 4, 0);
+  SetUi16(p + 6, 0);
+  SetUi16(p + 8, 1);
+  SetUi16(p + 10, 1);
+  SetUi32(p + 12, static_cast<UInt32>(record_length));
+  SetUi32(p + 16, zip64_end ? 0xFFFFFFFF : static_cast<UInt32>(directory_offset));
+  SetUi16(p + 20, 0);
+
+  CMyComPtr<IInStream> entry_stream(new ZipEntryStream(this, entry.local_offset, length, tail));
+  CMyComPtr<OpenVolumeCallback> no_callback;
+  SevenZip::OpenOptions options;
+  options.preferred_format = "zip";
+  options.allowed_formats.Add(AString("zip"));
+  options.fallback_enabled = false;
+  options.nested_enabled = false;
+  return SevenZip::OpenArchive(entry_stream, password, nullptr, no_callback, options, archive);
+}
+
+HRESULT ZipDirectory::Open(SharedInStream* stream, CMyComPtr<ZipDirectory>& directory) {
+  CMyComPtr<ZipDirectory> loaded(new ZipDirectory(stream));
+  RETURN_SAME_IF_NOT_ZERO(loaded->Load());
+  directory = loaded;
+  return S_OK;
+}
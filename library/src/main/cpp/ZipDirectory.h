@@ -0,0 +1,104 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __A7ZIP_ZIP_DIRECTORY_H__
+#define __A7ZIP_ZIP_DIRECTORY_H__
+
+#include <string>
+#include <vector>
+
+#include <include_windows/windows.h>
+#include <Common/MyCom.h>
+#include <7zip/IStream.h>
+
+#include "InArchive.h"
+#include "SharedInStream.h"
+
+namespace a7zip {
+
+// Scans the central directory of a zip once for where the records are,
+// and reads and decodes a record from the stream only on access.
+// An offset per record is all it keeps, opening a zip with many entries
+// costs one pass over the directory, instead of the zip handler building
+// an item for every record.
+//
+// An entry is extracted by opening a single-entry view of the zip with the zip handler:
+// the local header and the data of the entry, followed by a copy of its record.
+class ZipDirectory :
+    public IUnknown,
+    public CMyUnknownImp
+{
+ public:
+  struct Entry {
+    // The raw bytes, UTF-8 if utf8 is set
+    std::string name;
+    bool utf8;
+    bool is_dir;
+    UInt16 flags;
+    UInt16 method;
+    UInt32 crc;
+    UInt32 dos_time;
+    UInt64 size;
+    UInt64 packed_size;
+    // From the start of the stream
+    UInt64 local_offset;
+  };
+
+ public:
+  MY_UNKNOWN_IMP
+
+  UInt32 GetNumberOfEntries() { return static_cast<UInt32>(offsets.size()); }
+  HRESULT GetEntry(UInt32 index, Entry& entry);
+  // The archive has only one entry, it's the entry of the index
+  HRESULT OpenEntry(UInt32 index, BSTR password, InArchive** archive);
+  // A seekable view of the data of a stored and unencrypted entry, read straight from the zip.
+  // Returns S_FALSE if the entry is compressed or encrypted.
+  HRESULT OpenEntryData(UInt32 index, IInStream** stream);
+  // A seekable view of the packed data of an unencrypted entry.
+  // Returns S_FALSE if the entry is encrypted.
+  HRESULT OpenEntryPackedData(UInt32 index, IInStream** stream);
+
+  // Thread-safe, the entry views and the handler share the stream
+  HRESULT ReadAt(UInt64 offset, void* data, UInt32 size, UInt32* processed_size);
+
+ private:
+  explicit ZipDirectory(SharedInStream* stream);
+
+  HRESULT ReadFully(UInt64 offset, void* data, size_t size);
+  HRESULT Load();
+  // Reads the local header for where the data of the entry starts
+  HRESULT GetDataOffset(const Entry& entry, UInt64& data_offset);
+  // Reads the record bytes, returns the sizes and offset in its zip64 extra
+  HRESULT GetRecord(UInt32 index, std::vector<Byte>& record, Entry& entry, bool& zip64);
+
+ private:
+  CMyComPtr<SharedInStream> stream;
+  UInt64 stream_size;
+  // Added to the offsets in the zip, non-zero if there is data before the zip
+  UInt64 base;
+  // From the start of the stream
+  UInt64 directory_start;
+  UInt64 directory_size;
+  // From the start of the directory
+  std::vector<UInt32> offsets;
+
+ public:
+  static HRESULT Open(SharedInStream* stream, CMyComPtr<ZipDirectory>& directory);
+};
+
+}
+
+#endif //__A7ZIP_ZIP_DIRECTORY_H__
@@ -0,0 +1,148 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package com.hippo.a7zip;
+
+import android.support.annotation.Keep;
+import android.support.annotation.Nullable;
+import java.io.OutputStream;
+
+/**
+ * An operation running in the native thread pool, which is sized to the cores.
+ * Jobs with higher priority are taken first. Jobs on the same archive run one by one.
+ *
+ * The callback is called on a pool thread.
+ */
+public abstract class ArchiveJob<T> {
+
+  // Keep them in sync with JobPriority in native
+  public static final int PRIORITY_LOW = 0;
+  public static final int PRIORITY_NORMAL = 1;
+  public static final int PRIORITY_HIGH = 2;
+
+  public interface Callback<T> {
+
+    void onSuccess(T result);
+
+    /**
+     * The message of the exception is {@code "Cancelled"} if the job is cancelled.
+     */
+    void onFailure(ArchiveException e);
+  }
+
+  private final Callback<T> callback;
+  private volatile long id;
+  private volatile boolean done;
+  private volatile boolean cancelled;
+
+  ArchiveJob(Callback<T> callback) {
+    this.callback = callback;
+  }
+
+  /**
+   * Cancels the job. A pending job fails without running,
+   * a running job stops at the next block.
+   * Returns false if the job is already done.
+   */
+  public boolean cancel() {
+    if (done) {
+      return false;
+    }
+    cancelled = true;
+    return nativeCancel(id);
+  }
+
+  public boolean isCancelled() {
+    return cancelled;
+  }
+
+  public boolean isDone() {
+    return done;
+  }
+
+  ArchiveJob<T> submit(long id) {
+    this.id = id;
+    // It might be cancelled before the id is known
+    if (cancelled) {
+      nativeCancel(id);
+    }
+    return this;
+  }
+
+  /**
+   * Converts the native result to the result of the job.
+   */
+  abstract T onResult(long value, @Nullable Object object);
+
+  /**
+   * Called after the callback, the job is done.
+   */
+  void onDone() {}
+
+  @Keep
+  private void onNativeSuccess(long value, @Nullable Object object) {
+    T result;
+    try {
+      result = onResult(value, object);
+    } finally {
+      done = true;
+    }
+    try {
+      callback.onSuccess(result);
+    } finally {
+      onDone();
+    }
+  }
+
+  @Keep
+  private void onNativeFailure(String message, boolean password) {
+    done = true;
+    try {
+      callback.onFailure(password ? new PasswordException(message) : new ArchiveException(message));
+    } finally {
+      onDone();
+    }
+  }
+
+  static native long nativeOpen(
+      SeekableInputStream stream,
+      String password,
+      String filename,
+      InArchive.OpenVolumeCallback openVolumeCallback,
+      String preferredFormat,
+      String[] allowedFormats,
+      boolean fallbackEnabled,
+      int maxOpenVolumes,
+      boolean volumePrefetchEnabled,
+      int priority,
+      ArchiveJob job
+  ) throws ArchiveException;
+
+  static native long nativeExtractEntry(
+      long nativePtr,
+      int index,
+      String password,
+      OutputStream os,
+      int priority,
+      ArchiveJob job
+  ) throws ArchiveException;
+
+  static native long nativeTest(long nativePtr, String password, int priority, ArchiveJob job);
+
+  static native long nativeList(long nativePtr, int priority, ArchiveJob job);
+
+  private static native boolean nativeCancel(long id);
+}
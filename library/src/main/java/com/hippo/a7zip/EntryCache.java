@@ -0,0 +1,96 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package com.hippo.a7zip;
+
+import android.support.annotation.NonNull;
+import android.support.annotation.Nullable;
+import java.io.File;
+
+/**
+ * A process-wide cache of decompressed entries, so revisiting an entry
+ * doesn't decode it again. It's disabled until {@link #configure(long, File, long)}.
+ *
+ * <p>Entries are cached under the key of the archive, see {@link InArchive#setCacheKey(String)},
+ * and served by {@link InArchive#extractEntry(int, java.io.OutputStream)} and
+ * {@link InArchive#getEntryStream(int)}. Encrypted entries are never cached.
+ */
+public final class EntryCache {
+
+  private EntryCache() {}
+
+  public static final class Stats {
+
+    public final long memoryHits;
+    public final long diskHits;
+    public final long misses;
+    public final long memoryEvictions;
+    public final long diskEvictions;
+    public final long memorySize;
+    public final long diskSize;
+
+    private Stats(long[] values) {
+      memoryHits = values[0];
+      diskHits = values[1];
+      misses = values[2];
+      memoryEvictions = values[3];
+      diskEvictions = values[4];
+      memorySize = values[5];
+      diskSize = values[6];
+    }
+
+    @Override
+    public String toString() {
+      return "Stats{memoryHits=" + memoryHits + ", diskHits=" + diskHits + ", misses=" + misses
+          + ", memoryEvictions=" + memoryEvictions + ", diskEvictions=" + diskEvictions
+          + ", memorySize=" + memorySize + ", diskSize=" + diskSize + "}";
+    }
+  }
+
+  /**
+   * Configures the cache. An entry larger than {@code memoryCapacity} is not cached.
+   * The files in {@code diskDir} are reused, it should be a directory only for the cache,
+   * like a subdirectory of {@code Context.getCacheDir()}.
+   *
+   * @param memoryCapacity the capacity of the memory tier in bytes, {@code 0} to disable the cache
+   * @param diskDir the directory of the disk tier, {@code null} to disable the disk tier
+   * @param diskCapacity the capacity of the disk tier in bytes
+   */
+  public static void configure(long memoryCapacity, @Nullable File diskDir, long diskCapacity) {
+    if (diskDir != null && !diskDir.isDirectory() && !diskDir.mkdirs()) {
+      diskDir = null;
+    }
+    nativeConfigure(memoryCapacity, diskDir != null ? diskDir.getPath() : null, diskCapacity);
+  }
+
+  /**
+   * Drops all entries in memory and on disk. The stats are kept.
+   */
+  public static void clear() {
+    nativeClear();
+  }
+
+  @NonNull
+  public static Stats getStats() {
+    return new Stats(nativeGetStats());
+  }
+
+  private static native void nativeConfigure(long memoryCapacity, String diskDir, long diskCapacity);
+
+  private static native void nativeClear();
+
+  private static native long[] nativeGetStats();
+}
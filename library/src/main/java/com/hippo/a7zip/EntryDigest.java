@@ -0,0 +1,113 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package com.hippo.a7zip;
+
+import android.support.annotation.Keep;
+import android.support.annotation.Nullable;
+
+/**
+ * The digests of an entry, computed while it's extracted.
+ */
+public final class EntryDigest {
+
+  // Keep them in sync with HashAlgorithm in native
+  public static final int CRC32 = 1;
+  public static final int CRC64 = 2;
+  public static final int SHA1 = 4;
+  public static final int SHA256 = 8;
+
+  private final int index;
+  private final int algorithms;
+  private final long size;
+  private final int crc32;
+  private final long crc64;
+  @Nullable
+  private final byte[] sha1;
+  @Nullable
+  private final byte[] sha256;
+
+  @Keep
+  private EntryDigest(
+      int index,
+      int algorithms,
+      long size,
+      int crc32,
+      long crc64,
+      @Nullable byte[] sha1,
+      @Nullable byte[] sha256
+  ) {
+    this.index = index;
+    this.algorithms = algorithms;
+    this.size = size;
+    this.crc32 = crc32;
+    this.crc64 = crc64;
+    this.sha1 = sha1;
+    this.sha256 = sha256;
+  }
+
+  /**
+   * Returns the index of the entry.
+   */
+  public int getIndex() {
+    return index;
+  }
+
+  /**
+   * Returns the algorithms computed, a combination of {@link #CRC32}, {@link #CRC64},
+   * {@link #SHA1} and {@link #SHA256}.
+   */
+  public int getAlgorithms() {
+    return algorithms;
+  }
+
+  /**
+   * Returns the bytes of the entry.
+   */
+  public long getSize() {
+    return size;
+  }
+
+  /**
+   * Returns the CRC32, {@code 0} if it's not computed.
+   */
+  public int getCrc32() {
+    return crc32;
+  }
+
+  /**
+   * Returns the CRC64 (ECMA-182, the one of xz), {@code 0} if it's not computed.
+   */
+  public long getCrc64() {
+    return crc64;
+  }
+
+  /**
+   * Returns the SHA-1, {@code null} if it's not computed.
+   */
+  @Nullable
+  public byte[] getSha1() {
+    return sha1 != null ? sha1.clone() : null;
+  }
+
+  /**
+   * Returns the SHA-256, {@code null} if it's not computed.
+   */
+  @Nullable
+  public byte[] getSha256() {
+    return sha256 != null ? sha256.clone() : null;
+  }
+}
@@ -0,0 +1,169 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package com.hippo.a7zip;
+
+import android.support.annotation.NonNull;
+import android.support.annotation.Nullable;
+import java.io.Closeable;
+import java.io.IOException;
+import java.io.InputStream;
+
+/**
+ * Iterates the entries of an archive in the order they are decoded,
+ * with one decoding pass. Solid blocks are decoded only once.
+ *
+ * <p>A native thread decodes ahead and waits when it's 1 MiB ahead of the reader.
+ * An entry that is not fully read is skipped on {@link #next()},
+ * its remaining data is dropped without being copied. Directories are skipped.
+ *
+ * <p>It keeps the archive open until it's closed. Until then the synchronous
+ * extractions of the archive, entry streams, {@link InArchive#extractTo(java.io.File)},
+ * {@link InArchive#hashEntries(InArchive.EntryFilter, int)} and other iterators
+ * throw an {@link ArchiveException} instead of waiting for it,
+ * asynchronous jobs wait for it.
+ *
+ * @see InArchive#entries()
+ */
+public final class EntryIterator implements Closeable {
+
+  private long nativePtr;
+  @Nullable
+  private InArchive archive;
+  @Nullable
+  private Entry current;
+
+  EntryIterator(long nativePtr, @NonNull InArchive archive) {
+    this.nativePtr = nativePtr;
+    this.archive = archive;
+  }
+
+  private void checkClosed() {
+    if (nativePtr == 0) {
+      throw new IllegalStateException("This EntryIterator is closed.");
+    }
+  }
+
+  /**
+   * Moves to the next entry. The stream of the previous entry becomes invalid.
+   *
+   * @return the next entry, {@code null} if there are no more entries
+   * @throws ArchiveException if the decoding fails
+   */
+  @Nullable
+  public Entry next() throws ArchiveException {
+    checkClosed();
+
+    if (current != null) {
+      current.invalidate();
+      current = null;
+    }
+
+    int index = nativeNext(nativePtr);
+    if (index < 0) {
+      return null;
+    }
+    current = new Entry(index);
+    return current;
+  }
+
+  /**
+   * Stops the decoding and releases the archive.
+   */
+  @Override
+  public void close() {
+    if (current != null) {
+      current.invalidate();
+      current = null;
+    }
+    if (nativePtr != 0) {
+      nativeClose(nativePtr);
+      nativePtr = 0;
+    }
+    if (archive != null) {
+      archive.onIteratorClosed();
+      archive = null;
+    }
+  }
+
+  /**
+   * An entry of the iteration.
+   */
+  public final class Entry {
+
+    private final int index;
+    @NonNull
+    private final EntryInputStream stream = new EntryInputStream();
+    private boolean valid = true;
+
+    private Entry(int index) {
+      this.index = index;
+    }
+
+    private void invalidate() {
+      valid = false;
+    }
+
+    /**
+     * Returns the index of the entry.
+     */
+    public int getIndex() {
+      return index;
+    }
+
+    /**
+     * Returns the stream of the entry.
+     * It's valid until {@link EntryIterator#next()} or {@link EntryIterator#close()}.
+     * Closing the stream doesn't skip the entry.
+     */
+    @NonNull
+    public InputStream getInputStream() {
+      return stream;
+    }
+
+    private class EntryInputStream extends InputStream {
+
+      private final byte[] scratch = new byte[1];
+
+      @Override
+      public int read() throws IOException {
+        return (read(scratch, 0, 1) != -1) ? scratch[0] & 0xff : -1;
+      }
+
+      @Override
+      public int read(@NonNull byte[] b) throws IOException {
+        return read(b, 0, b.length);
+      }
+
+      @Override
+      public int read(@NonNull byte[] b, int off, int len) throws IOException {
+        if (!valid || nativePtr == 0) {
+          throw new IOException("The entry is passed.");
+        }
+        if (off < 0 || len < 0 || len > b.length - off) {
+          throw new IndexOutOfBoundsException();
+        }
+        return nativeRead(nativePtr, b, off, len);
+      }
+    }
+  }
+
+  private static native int nativeNext(long nativePtr) throws ArchiveException;
+
+  private static native int nativeRead(long nativePtr, byte[] b, int off, int len) throws IOException;
+
+  private static native void nativeClose(long nativePtr);
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package com.hippo.a7zip;
+
+import android.support.annotation.Keep;
+import android.support.annotation.Nullable;
+
+/**
+ * Where the data of an entry is and what it costs to reach it.
+ * Entries in the same solid block are decoded from the start of the block,
+ * reading them in the order of {@link #getPosition()} decodes the block only once.
+ *
+ * @see InArchive#getEntryLayouts()
+ * @see InArchive#sortByDecodeOrder(int[])
+ */
+public final class EntryLayout {
+
+  private final int index;
+  private final int block;
+  private final int position;
+  private final long packedOffset;
+  private final long packedSize;
+  @Nullable
+  private final String method;
+  private final long dictionarySize;
+  private final long bytesBefore;
+
+  @Keep
+  private EntryLayout(
+      int index,
+      int block,
+      int position,
+      long packedOffset,
+      long packedSize,
+      @Nullable String method,
+      long dictionarySize,
+      long bytesBefore
+  ) {
+    this.index = index;
+    this.block = block;
+    this.position = position;
+    this.packedOffset = packedOffset;
+    this.packedSize = packedSize;
+    this.method = method;
+    this.dictionarySize = dictionarySize;
+    this.bytesBefore = bytesBefore;
+  }
+
+  /**
+   * Returns the index of the entry.
+   */
+  public int getIndex() {
+    return index;
+  }
+
+  /**
+   * Returns the solid block (7z folder or solid stream) of the entry,
+   * {@code -1} if the entry is decoded alone.
+   */
+  public int getBlock() {
+    return block;
+  }
+
+  /**
+   * Returns the position of the entry in its block.
+   */
+  public int getPosition() {
+    return position;
+  }
+
+  /**
+   * Returns the offset of the packed data in the archive, {@code -1} if unknown.
+   */
+  public long getPackedOffset() {
+    return packedOffset;
+  }
+
+  /**
+   * Returns the size of the packed data, {@code -1} if unknown.
+   */
+  public long getPackedSize() {
+    return packedSize;
+  }
+
+  /**
+   * Returns the method chain, like {@code "LZMA2:24 BCJ"}, {@code null} if unknown.
+   */
+  @Nullable
+  public String getMethod() {
+    return method;
+  }
+
+  /**
+   * Returns the dictionary size in bytes, {@code 0} if unknown.
+   */
+  public long getDictionarySize() {
+    return dictionarySize;
+  }
+
+  /**
+   * Returns the unpacked bytes decoded in the block before the entry.
+   */
+  public long getBytesBefore() {
+    return bytesBefore;
+  }
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+package com.hippo.a7zip;
+
+/**
+ * The limits of one extraction, for untrusted archives like zip bombs.
+ * They are checked in the decoders while decoding, {@code 0} means unlimited.
+ *
+ * @see InArchive#setExtractLimits(ExtractLimits)
+ */
+public class ExtractLimits {
+
+  long maxOutputBytes;
+  int maxRatio;
+  long maxMemory;
+  long maxWallTimeMillis;
+  long maxCpuTimeMillis;
+
+  /**
+   * The bytes the extraction decodes, including the ones of the skipped entries
+   * in the same solid blocks. "Output limit exceeded" if it's exceeded.
+   */
+  public ExtractLimits setMaxOutputBytes(long bytes) {
+    this.maxOutputBytes = Math.max(bytes, 0);
+    return this;
+  }
+
+  /**
+   * The decoded bytes per compressed byte of the extraction, checked after the first MiB.
+   * "Compression ratio limit exceeded" if it's exceeded.
+   */
+  public ExtractLimits setMaxRatio(int ratio) {
+    this.maxRatio = Math.max(ratio, 0);
+    return this;
+  }
+
+  /**
+   * The dictionary of each entry, read from its method before decoding.
+   * "Memory limit exceeded" if it's exceeded. {@link InArchive#setMemoryBudget(long)}
+   * limits the memory which is actually allocated.
+   */
+  public ExtractLimits setMaxMemory(long bytes) {
+    this.maxMemory = Math.max(bytes, 0);
+    return this;
+  }
+
+  /**
+   * The time from the start of the extraction. "Time limit exceeded" if it's exceeded.
+   */
+  public ExtractLimits setMaxWallTime(long millis) {
+    this.maxWallTimeMillis = Math.max(millis, 0);
+    return this;
+  }
+
+  /**
+   * The CPU time of the thread which extracts. "Time limit exceeded" if it's exceeded.
+   */
+  public ExtractLimits setMaxCpuTime(long millis) {
+    this.maxCpuTimeMillis = Math.max(millis, 0);
+    return this;
+  }
+}
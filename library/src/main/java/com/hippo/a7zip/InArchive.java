@@ -26,6 +26,8 @@ import java.io.IOException;
 import java.io.InputStream;
 import java.io.OutputStream;
 import java.nio.charset.Charset;
+import java.util.Arrays;
+import java.util.Comparator;
 
 public class InArchive implements Closeable {
 
@@ -34,15 +36,21 @@ public class InArchive implements Closeable {
   private Charset charset;
   @Nullable
   private String password;
+  @Nullable
+  private EntryLayout[] entryLayouts;
+
+  // Guarded by this
+  private int runningJobs;
+  private volatile boolean closeRequested;
 
-  private InArchive(long nativePtr, @Nullable Charset charset, @Nullable String password) {
+  InArchive(long nativePtr, @Nullable Charset charset, @Nullable String password) {
     this.nativePtr = nativePtr;
     this.charset = charset;
     this.password = password;
   }
 
   private void checkClosed() {
-    if (nativePtr == 0) {
+    if (nativePtr == 0 || closeRequested) {
       throw new IllegalStateException("This InArchive is closed.");
     }
   }
@@ -75,7 +83,7 @@ public class InArchive implements Closeable {
     return new String(bytes, charset);
   }
 
-  private static String applyCharsetToPassword(String str, Charset charset) {
+  static String applyCharsetToPassword(String str, Charset charset) {
     if (str == null || charset == null) {
       return str;
     }
@@ -286,6 +294,12 @@ public class InArchive implements Closeable {
   /**
    * Returns the stream of the entry. Only a few archive formats support it.
    *
+   * <p>A stored and unencrypted entry, like a zip entry of method 0 or a tar entry,
+   * is a {@link SeekableInputStream} reading straight from the archive.
+   * An xz file of many blocks, like one from {@code xz -T0}, is a {@link SeekableInputStream}
+   * too, a seek decodes from the start of the block the position falls in.
+   * So is a file of a CramFS image, a seek decodes only the page the position falls in.
+   *
    * @param index the index of the entry
    * @return the stream of the entry
    * @throws ArchiveException if the archive format doesn't support the operation or get error
@@ -333,8 +347,490 @@ public class InArchive implements Closeable {
     }
   }
 
+  /**
+   * Extracts the context of the entry into the output stream, and hashes it on the way.
+   * The data isn't read again to compute the digest.
+   *
+   * @param index the index of the entry
+   * @param password the password of the entry, {@code null} for the password used to open the archive
+   * @param os the output steam to receive the content, {@code null} to only hash it,
+   *           it will be closed at the end of this method
+   * @param algorithms the combination of {@link EntryDigest#CRC32}, {@link EntryDigest#CRC64},
+   *                   {@link EntryDigest#SHA1} and {@link EntryDigest#SHA256}
+   * @return the digest of the entry
+   * @throws ArchiveException if get error
+   */
+  @SuppressWarnings("ThrowFromFinallyBlock")
+  @NonNull
+  public EntryDigest extractEntry(
+      int index,
+      @Nullable String password,
+      @Nullable OutputStream os,
+      int algorithms
+  ) throws ArchiveException {
+    try {
+      checkClosed();
+      return nativeExtractEntryWithDigest(nativePtr, index, password != null ? password : this.password, os, algorithms);
+    } finally {
+      if (os != null) {
+        try {
+          os.close();
+        } catch (IOException e) {
+          throw new ArchiveException("Catch IOException while closing the OutputStream", e);
+        }
+      }
+    }
+  }
+
+  /**
+   * Extracts all entries into files under the directory.
+   *
+   * @see #extractTo(File, EntryFilter)
+   */
+  public void extractTo(@NonNull File dir) throws ArchiveException {
+    extractTo(dir, null);
+  }
+
+  /**
+   * Extracts the entries into files under the directory, the directory is created if missing.
+   * All entries are decoded and written in native code in one pass.
+   * Modification times and permissions are restored.
+   * An entry whose path goes out of the directory fails the extraction
+   * with an {@link ArchiveException} of "Unsafe entry path".
+   *
+   * @param dir the directory
+   * @param filter the filter of the entries, {@code null} for all entries
+   * @throws ArchiveException if get error
+   */
+  public void extractTo(@NonNull File dir, @Nullable EntryFilter filter) throws ArchiveException {
+    extractTo(dir, filter, 0);
+  }
+
+  /**
+   * Extracts the entries into files under the directory, and hashes the files while writing.
+   *
+   * @param algorithms the combination of {@link EntryDigest#CRC32}, {@link EntryDigest#CRC64},
+   *                   {@link EntryDigest#SHA1} and {@link EntryDigest#SHA256}
+   * @return the digests of the files in the order they are extracted,
+   *         {@code null} if {@code algorithms} is {@code 0}
+   * @see #extractTo(File, EntryFilter)
+   */
+  @Nullable
+  public EntryDigest[] extractTo(@NonNull File dir, @Nullable EntryFilter filter, int algorithms) throws ArchiveException {
+    checkClosed();
+
+    if (!dir.isDirectory() && !dir.mkdirs()) {
+      throw new ArchiveException("Can't create the directory: " + dir.getPath());
+    }
+
+    return nativeExtractToDirectory(nativePtr, dir.getPath(), password, getIndices(filter), algorithms);
+  }
+
+  /**
+   * Hashes the entries without writing them anywhere, in one pass over the archive.
+   * Directories are skipped.
+   *
+   * @param filter the filter of the entries, {@code null} for all entries
+   * @param algorithms the combination of {@link EntryDigest#CRC32}, {@link EntryDigest#CRC64},
+   *                   {@link EntryDigest#SHA1} and {@link EntryDigest#SHA256}
+   * @return the digests in the order they are decoded
+   * @throws ArchiveException if get error
+   */
+  @NonNull
+  public EntryDigest[] hashEntries(@Nullable EntryFilter filter, int algorithms) throws ArchiveException {
+    checkClosed();
+    return nativeHashEntries(nativePtr, password, getIndices(filter), algorithms);
+  }
+
+  @Nullable
+  private int[] getIndices(@Nullable EntryFilter filter) {
+    if (filter == null) {
+      return null;
+    }
+
+    int size = getNumberOfEntries();
+    int[] accepted = new int[size];
+    int count = 0;
+    for (int i = 0; i < size; i++) {
+      if (filter.accept(i, getEntryPath(i))) {
+        accepted[count++] = i;
+      }
+    }
+    return Arrays.copyOf(accepted, count);
+  }
+
+  /**
+   * Iterates all entries in the order they are decoded, with one decoding pass.
+   * The archive stays open until the iterator is closed.
+   *
+   * @throws ArchiveException if another iterator of the archive isn't closed
+   * @see EntryIterator
+   */
+  @NonNull
+  public EntryIterator entries() throws ArchiveException {
+    return entries(null);
+  }
+
+  /**
+   * Iterates the entries accepted by the filter in the order they are decoded,
+   * with one decoding pass. The archive stays open until the iterator is closed.
+   *
+   * @param filter the filter of the entries, {@code null} for all entries
+   * @throws ArchiveException if another iterator of the archive isn't closed
+   * @see EntryIterator
+   */
+  @NonNull
+  public EntryIterator entries(@Nullable EntryFilter filter) throws ArchiveException {
+    int[] indices = getIndices(filter);
+    synchronized (this) {
+      checkClosed();
+      EntryIterator iterator = new EntryIterator(nativeIterateEntries(nativePtr, password, indices), this);
+      runningJobs++;
+      return iterator;
+    }
+  }
+
+  /**
+   * Returns the layouts of all entries, indexed by entry index.
+   * It tells which entries share a solid block and how much data
+   * must be decoded before each entry.
+   *
+   * @throws ArchiveException if get error
+   */
+  @NonNull
+  public EntryLayout[] getEntryLayouts() throws ArchiveException {
+    checkClosed();
+    if (entryLayouts == null) {
+      entryLayouts = nativeGetEntryLayouts(nativePtr);
+    }
+    return entryLayouts;
+  }
+
+  /**
+   * Sorts the indices into the cheapest order to read the entries.
+   * The entries in the same solid block are grouped and ordered by their positions
+   * so each block is decoded once. The entries decoded alone follow, ordered by
+   * their packed data offsets to avoid seeking back.
+   *
+   * @param indices the entry indices, it isn't modified
+   * @return the sorted indices
+   * @throws ArchiveException if get error
+   */
+  @NonNull
+  public int[] sortByDecodeOrder(@NonNull int[] indices) throws ArchiveException {
+    final EntryLayout[] layouts = getEntryLayouts();
+
+    Integer[] boxed = new Integer[indices.length];
+    for (int i = 0; i < indices.length; i++) {
+      boxed[i] = indices[i];
+    }
+
+    Arrays.sort(boxed, new Comparator<Integer>() {
+      @Override
+      public int compare(Integer o1, Integer o2) {
+        EntryLayout l1 = layouts[o1];
+        EntryLayout l2 = layouts[o2];
+        boolean solid1 = l1.getBlock() >= 0;
+        boolean solid2 = l2.getBlock() >= 0;
+        if (solid1 != solid2) {
+          return solid1 ? -1 : 1;
+        }
+        if (solid1) {
+          if (l1.getBlock() != l2.getBlock()) {
+            return l1.getBlock() < l2.getBlock() ? -1 : 1;
+          }
+          return compareInt(l1.getPosition(), l2.getPosition());
+        }
+        long offset1 = l1.getPackedOffset();
+        long offset2 = l2.getPackedOffset();
+        if (offset1 >= 0 && offset2 >= 0 && offset1 != offset2) {
+          return offset1 < offset2 ? -1 : 1;
+        }
+        return compareInt(o1, o2);
+      }
+    });
+
+    int[] result = new int[boxed.length];
+    for (int i = 0; i < boxed.length; i++) {
+      result[i] = boxed[i];
+    }
+    return result;
+  }
+
+  private static int compareInt(int x, int y) {
+    return x < y ? -1 : (x == y ? 0 : 1);
+  }
+
+  /**
+   * Sets the key of this archive in {@link EntryCache}, {@code null} to not cache the entries.
+   * The key must identify the content of the archive, entries of archives with
+   * the same key are shared. Archives opened from files have a key of
+   * the path, the length and the last modified time.
+   */
+  public void setCacheKey(@Nullable String key) {
+    checkClosed();
+    nativeSetCacheKey(nativePtr, key);
+  }
+
+  /**
+   * Sets the memory budget of the decoders of this archive.
+   * An operation which needs more memory fails with
+   * an {@link ArchiveException} of "Memory budget exceeded",
+   * before the memory is allocated. It covers the threads of the decoders
+   * and the reads of {@link #getEntryStream(int)}. Archives created with
+   * {@link OutArchive} aren't covered.
+   *
+   * @param budget the budget in bytes, {@code 0} for unlimited
+   */
+  public void setMemoryBudget(long budget) {
+    checkClosed();
+    nativeSetMemoryBudget(nativePtr, budget);
+  }
+
+  /**
+   * Sets the limits of each extraction of this archive, like extracting an entry,
+   * testing or hashing. An extraction which exceeds a limit fails with
+   * an {@link ArchiveException}, see {@link ExtractLimits} for the messages.
+   * Streams from {@link #getEntryStream(int)} aren't limited.
+   *
+   * @param limits {@code null} for no limit
+   */
+  public void setExtractLimits(@Nullable ExtractLimits limits) {
+    checkClosed();
+    if (limits == null) {
+      limits = new ExtractLimits();
+    }
+    nativeSetExtractLimits(nativePtr, limits.maxOutputBytes, limits.maxRatio,
+        limits.maxMemory, limits.maxWallTimeMillis, limits.maxCpuTimeMillis);
+  }
+
+  /**
+   * Lets {@link #extractEntry(int, OutputStream)} decode and write at the same time.
+   * The decoded data goes through a ring of buffers, another thread writes them
+   * to the stream and computes the digests, so a slow stream doesn't stall the decoder.
+   * The decoder waits only if all buffers are full. It's disabled by default.
+   *
+   * @param bufferCount the buffers in the ring, {@code 0} to disable it
+   * @param bufferSize the size of each buffer, like 1 MiB
+   */
+  public void setWritePipeline(int bufferCount, int bufferSize) {
+    checkClosed();
+    nativeSetWritePipeline(nativePtr, bufferCount, bufferSize);
+  }
+
+  /**
+   * Lets {@link #extractEntry(int, OutputStream)} decode big entries with threads.
+   * For gzip streams and deflated zip entries, each thread finds a block boundary
+   * in its part of the stream and decodes from there. For 7z entries in a block of
+   * LZMA2 alone, the threads decode the pieces starting with a dictionary reset,
+   * which multithreaded encoders write. For xz files of many blocks, the threads
+   * decode the blocks listed in the index. For files of CramFS images, the threads
+   * decode the pages listed in the page table. The parts are stitched in order and
+   * the checks are verified. Small entries and extractions with limits are decoded
+   * as usual. It's disabled by default.
+   *
+   * @param threadCount the threads, less than {@code 2} to disable it
+   */
+  public void setDecodeThreads(int threadCount) {
+    checkClosed();
+    nativeSetDecodeThreads(nativePtr, threadCount);
+  }
+
+  /**
+   * Returns how many deflate chunks of gzip and zip, LZMA2 pieces of 7z entries,
+   * xz blocks and CramFS pages the decode threads have decoded.
+   *
+   * @see #setDecodeThreads(int)
+   */
+  public long getParallelChunkCount() {
+    checkClosed();
+    return nativeGetParallelChunkCount(nativePtr);
+  }
+
+  /**
+   * Sets whether big dictionary buffers are mapped with huge pages.
+   * It's enabled by default.
+   */
+  public void setHugePagesEnabled(boolean enabled) {
+    checkClosed();
+    nativeSetHugePagesEnabled(nativePtr, enabled);
+  }
+
+  /**
+   * Returns the bytes which the decoders of this archive are holding.
+   */
+  public long getMemoryUsage() {
+    checkClosed();
+    return nativeGetMemoryUsage(nativePtr);
+  }
+
+  /**
+   * Returns the max bytes which the decoders of this archive have held.
+   */
+  public long getPeakMemoryUsage() {
+    checkClosed();
+    return nativeGetPeakMemoryUsage(nativePtr);
+  }
+
+  /**
+   * Sets the max bytes of freed decoder buffers kept for the next extraction.
+   * Dictionaries, models and windows of the same size are reused
+   * instead of being allocated again. It's 64 MiB by default.
+   *
+   * @param capacity the capacity in bytes, {@code 0} to disable the pool
+   */
+  public void setBufferPoolCapacity(long capacity) {
+    checkClosed();
+    nativeSetBufferPoolCapacity(nativePtr, capacity);
+  }
+
+  /**
+   * Returns how many decoder buffers are taken from the pool.
+   */
+  public long getBufferPoolHits() {
+    checkClosed();
+    return nativeGetBufferPoolHits(nativePtr);
+  }
+
+  /**
+   * Returns how many decoder buffers are allocated because the pool has none.
+   */
+  public long getBufferPoolMisses() {
+    checkClosed();
+    return nativeGetBufferPoolMisses(nativePtr);
+  }
+
+  /**
+   * Returns the bytes of decoder buffers kept in the pool.
+   */
+  public long getBufferPoolRetainedBytes() {
+    checkClosed();
+    return nativeGetBufferPoolRetainedBytes(nativePtr);
+  }
+
+  /**
+   * Extracts the context of the entry into the output stream in the native thread pool.
+   * The output stream is closed when the job is done.
+   * {@code null} password means the password used to open the archive.
+   *
+   * @see #extractEntry(int, String, OutputStream)
+   */
+  @NonNull
+  public ArchiveJob<Void> extractEntryAsync(
+      int index,
+      @Nullable String password,
+      @NonNull OutputStream os,
+      int priority,
+      @NonNull ArchiveJob.Callback<Void> callback
+  ) throws ArchiveException {
+    ArchiveJob<Void> job = new InArchiveJob<Void>(callback) {
+      @Override
+      Void onResult(long value, @Nullable Object object) {
+        return null;
+      }
+    };
+    String pw = password != null ? password : this.password;
+    synchronized (this) {
+      checkClosed();
+      runningJobs++;
+      try {
+        return job.submit(ArchiveJob.nativeExtractEntry(nativePtr, index, pw, os, priority, job));
+      } catch (ArchiveException e) {
+        runningJobs--;
+        throw e;
+      }
+    }
+  }
+
+  /**
+   * Decodes all entries and checks them in the native thread pool.
+   */
+  @NonNull
+  public ArchiveJob<Void> testAsync(int priority, @NonNull ArchiveJob.Callback<Void> callback) {
+    ArchiveJob<Void> job = new InArchiveJob<Void>(callback) {
+      @Override
+      Void onResult(long value, @Nullable Object object) {
+        return null;
+      }
+    };
+    synchronized (this) {
+      checkClosed();
+      runningJobs++;
+      return job.submit(ArchiveJob.nativeTest(nativePtr, password, priority, job));
+    }
+  }
+
+  /**
+   * Gets the paths of all entries in the native thread pool.
+   * The path is {@code null} if the entry doesn't have one.
+   */
+  @NonNull
+  public ArchiveJob<String[]> listEntriesAsync(int priority, @NonNull ArchiveJob.Callback<String[]> callback) {
+    ArchiveJob<String[]> job = new InArchiveJob<String[]>(callback) {
+      @Override
+      String[] onResult(long value, @Nullable Object object) {
+        String[] paths = (String[]) object;
+        if (paths != null) {
+          for (int i = 0; i < paths.length; i++) {
+            paths[i] = applyCharsetToString(paths[i], charset);
+          }
+        }
+        return paths;
+      }
+    };
+    synchronized (this) {
+      checkClosed();
+      runningJobs++;
+      return job.submit(ArchiveJob.nativeList(nativePtr, priority, job));
+    }
+  }
+
+  // Keeps the archive open until the job is done
+  private abstract class InArchiveJob<T> extends ArchiveJob<T> {
+
+    InArchiveJob(Callback<T> callback) {
+      super(callback);
+    }
+
+    @Override
+    void onDone() {
+      releaseJob();
+    }
+  }
+
+  private synchronized void releaseJob() {
+    runningJobs--;
+    if (runningJobs == 0 && closeRequested) {
+      closeRequested = false;
+      close();
+    }
+  }
+
+  void onIteratorClosed() {
+    releaseJob();
+  }
+
+  // Keeps the archive open for the OutArchive updating it, until it's closed
+  synchronized long retainForUpdate() {
+    checkClosed();
+    runningJobs++;
+    return nativePtr;
+  }
+
+  void onUpdateClosed() {
+    releaseJob();
+  }
+
+  /**
+   * Closes the archive. If there are running jobs,
+   * it's closed after the last one is done.
+   */
   @Override
-  public void close() {
+  public synchronized void close() {
+    if (runningJobs != 0) {
+      closeRequested = true;
+      return;
+    }
     if (nativePtr != 0) {
       nativeClose(nativePtr);
       nativePtr = 0;
@@ -342,21 +838,36 @@ public class InArchive implements Closeable {
   }
 
   /**
-   * Returns {@code true} if the archive is closed.
+   * Returns {@code true} if the archive is closed,
+   * or it will be closed after the running jobs.
    */
-  public boolean isClosed() {
-    return nativePtr == 0;
+  public synchronized boolean isClosed() {
+    return nativePtr == 0 || closeRequested;
   }
 
   @NonNull
   public static InArchive open(File file) throws ArchiveException {
+    return open(file, null);
+  }
+
+  /**
+   * Opens an archive from the file, the format hints in {@code options} are applied.
+   */
+  @NonNull
+  public static InArchive open(File file, @Nullable OpenOptions options) throws ArchiveException {
     try {
-      return open(new FileSeekableInputStream(file), null, null, file.getName(), new OpenVolumeInDirCallback(file.getParentFile()));
+      InArchive archive = open(new FileSeekableInputStream(file), null, null, file.getName(), new OpenVolumeInDirCallback(file.getParentFile()), options);
+      archive.setCacheKey(getCacheKey(file));
+      return archive;
     } catch (FileNotFoundException e) {
       throw new ArchiveException("Can't open the archive: " + file.getPath(), e);
     }
   }
 
+  private static String getCacheKey(File file) {
+    return file.getAbsolutePath() + ':' + file.length() + ':' + file.lastModified();
+  }
+
   @NonNull
   public static InArchive open(SeekableInputStream stream) throws ArchiveException {
     return open(stream, null, null, null, null);
@@ -376,9 +887,33 @@ public class InArchive implements Closeable {
       @Nullable String password,
       @Nullable String filename,
       @Nullable OpenVolumeCallback openVolumeCallback
+  ) throws ArchiveException {
+    return open(stream, charset, password, filename, openVolumeCallback, null);
+  }
+
+  /**
+   * Opens an archive to read from the specified stream.
+   *
+   * {@code options} limits the formats to try, {@code null} tries all formats.
+   *
+   * @see #open(SeekableInputStream, Charset, String, String, OpenVolumeCallback)
+   */
+  @NonNull
+  public static InArchive open(
+      SeekableInputStream stream,
+      @Nullable Charset charset,
+      @Nullable String password,
+      @Nullable String filename,
+      @Nullable OpenVolumeCallback openVolumeCallback,
+      @Nullable OpenOptions options
   ) throws ArchiveException {
     password = applyCharsetToPassword(password, charset);
-    long nativePtr = nativeOpen(stream, password, filename, openVolumeCallback);
+    if (options == null) {
+      options = new OpenOptions();
+    }
+    long nativePtr = nativeOpen(stream, password, filename, openVolumeCallback,
+        options.preferredFormat, options.allowedFormats, options.fallbackEnabled,
+        options.maxOpenVolumes, options.volumePrefetchEnabled);
 
     if (nativePtr == 0) {
       // It should not be 0
@@ -388,6 +923,41 @@ public class InArchive implements Closeable {
     return new InArchive(nativePtr, charset, password);
   }
 
+  /**
+   * Opens an archive in the native thread pool.
+   *
+   * @see #open(SeekableInputStream, Charset, String, String, OpenVolumeCallback, OpenOptions)
+   */
+  @NonNull
+  public static ArchiveJob<InArchive> openAsync(
+      SeekableInputStream stream,
+      @Nullable final Charset charset,
+      @Nullable String password,
+      @Nullable String filename,
+      @Nullable OpenVolumeCallback openVolumeCallback,
+      @Nullable OpenOptions options,
+      int priority,
+      @NonNull ArchiveJob.Callback<InArchive> callback
+  ) throws ArchiveException {
+    final String pw = applyCharsetToPassword(password, charset);
+    ArchiveJob<InArchive> job = new ArchiveJob<InArchive>(callback) {
+      @Override
+      InArchive onResult(long value, @Nullable Object object) {
+        return new InArchive(value, charset, pw);
+      }
+    };
+    if (options == null) {
+      options = new OpenOptions();
+    }
+    return job.submit(ArchiveJob.nativeOpen(stream, pw, filename, openVolumeCallback,
+        options.preferredFormat, options.allowedFormats, options.fallbackEnabled,
+        options.maxOpenVolumes, options.volumePrefetchEnabled, priority, job));
+  }
+
+  public interface EntryFilter {
+    boolean accept(int index, @NonNull String path);
+  }
+
   @Keep
   public interface OpenVolumeCallback {
     @NonNull
@@ -413,11 +983,76 @@ public class InArchive implements Closeable {
     }
   }
 
+  /**
+   * Format hints for opening an archive.
+   * Format names are the ones returned by {@link #getFormatName()},
+   * like {@code "zip"}, {@code "7z"} and {@code "Rar"}, case-insensitive.
+   */
+  public static class OpenOptions {
+
+    @Nullable
+    private String preferredFormat;
+    @Nullable
+    private String[] allowedFormats;
+    private boolean fallbackEnabled = true;
+    private int maxOpenVolumes = 8;
+    private boolean volumePrefetchEnabled = true;
+
+    /**
+     * The format is tried first, even before checking signatures.
+     */
+    public OpenOptions setPreferredFormat(@Nullable String format) {
+      this.preferredFormat = format;
+      return this;
+    }
+
+    /**
+     * Only these formats are tried. {@code null} or empty allows all formats.
+     */
+    public OpenOptions setAllowedFormats(@Nullable String... formats) {
+      this.allowedFormats = formats != null && formats.length != 0 ? formats.clone() : null;
+      return this;
+    }
+
+    /**
+     * If enabled, the formats whose signatures don't match are tried at last.
+     * It's enabled by default.
+     */
+    public OpenOptions setFallbackEnabled(boolean enabled) {
+      this.fallbackEnabled = enabled;
+      return this;
+    }
+
+    /**
+     * At most {@code count} volumes of a multi-volume archive are kept open,
+     * others are closed and reopened when they are read again.
+     * It's 8 by default, and at least 2.
+     */
+    public OpenOptions setMaxOpenVolumes(int count) {
+      this.maxOpenVolumes = Math.max(count, 2);
+      return this;
+    }
+
+    /**
+     * If enabled, the start of the next volume is read in background
+     * while reading a volume. It's enabled by default.
+     */
+    public OpenOptions setVolumePrefetchEnabled(boolean enabled) {
+      this.volumePrefetchEnabled = enabled;
+      return this;
+    }
+  }
+
   private static native long nativeOpen(
       SeekableInputStream stream,
       String password,
       String filename,
-      OpenVolumeCallback openVolumeCallback
+      OpenVolumeCallback openVolumeCallback,
+      String preferredFormat,
+      String[] allowedFormats,
+      boolean fallbackEnabled,
+      int maxOpenVolumes,
+      boolean volumePrefetchEnabled
   ) throws ArchiveException;
 
   private static native String nativeGetFormatName(long nativePtr);
@@ -451,5 +1086,48 @@ public class InArchive implements Closeable {
 
   private static native void nativeExtractEntry(long nativePtr, int index, String password, OutputStream os) throws ArchiveException;
 
+  private static native EntryDigest nativeExtractEntryWithDigest(long nativePtr, int index, String password, OutputStream os, int algorithms) throws ArchiveException;
+
+  private static native EntryDigest[] nativeExtractToDirectory(long nativePtr, String path, String password, int[] indices, int algorithms) throws ArchiveException;
+
+  private static native long nativeIterateEntries(long nativePtr, String password, int[] indices) throws ArchiveException;
+
+  private static native EntryLayout[] nativeGetEntryLayouts(long nativePtr) throws ArchiveException;
+
+  private static native EntryDigest[] nativeHashEntries(long nativePtr, String password, int[] indices, int algorithms) throws ArchiveException;
+
+  private static native void nativeSetCacheKey(long nativePtr, String key);
+
+  private static native void nativeSetMemoryBudget(long nativePtr, long budget);
+
+  private static native void nativeSetExtractLimits(
+      long nativePtr,
+      long maxOutputBytes,
+      int maxRatio,
+      long maxMemory,
+      long maxWallTimeMillis,
+      long maxCpuTimeMillis
+  );
+
+  private static native void nativeSetWritePipeline(long nativePtr, int bufferCount, int bufferSize);
+
+  private static native void nativeSetDecodeThreads(long nativePtr, int threadCount);
+
+  private static native long nativeGetParallelChunkCount(long nativePtr);
+
+  private static native void nativeSetHugePagesEnabled(long nativePtr, boolean enabled);
+
+  private static native long nativeGetMemoryUsage(long nativePtr);
+
+  private static native long nativeGetPeakMemoryUsage(long nativePtr);
+
+  private static native void nativeSetBufferPoolCapacity(long nativePtr, long capacity);
+
+  private static native long nativeGetBufferPoolHits(long nativePtr);
+
+  private static native long nativeGetBufferPoolMisses(long nativePtr);
+
+  private static native long nativeGetBufferPoolRetainedBytes(long nativePtr);
+
   private static native void nativeClose(long nativePtr);
 }
@@ -0,0 +1,340 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package com.hippo.a7zip;
+
+import android.os.ParcelFileDescriptor;
+import android.support.annotation.NonNull;
+import android.support.annotation.Nullable;
+import java.io.Closeable;
+import java.io.File;
+import java.io.IOException;
+import java.io.InputStream;
+import java.util.ArrayList;
+import java.util.List;
+
+/**
+ * Creates an archive. Only the builds without {@code EXTRACT} can create archives,
+ * {@link #create(String)} throws {@link ArchiveException} in others.
+ *
+ * <pre>{@code
+ * try (OutArchive archive = OutArchive.create("7z")) {
+ *   archive.addFile("photo.jpg", file);
+ *   archive.addDirectory("empty", -1);
+ *   archive.write(output, new OutArchive.Options().setLevel(9), null);
+ * }
+ * }</pre>
+ *
+ * The entries are read only in {@link #write(SeekableOutputStream, Options, String)}.
+ *
+ * <p>{@link #update(InArchive)} adds entries to an archive or removes them.
+ * The kept entries are copied as they are, only the new ones are compressed.
+ *
+ * <pre>{@code
+ * try (InArchive source = InArchive.open(file);
+ *      OutArchive archive = OutArchive.update(source)) {
+ *   archive.removeEntry(0);
+ *   archive.addFile("photo.jpg", photo);
+ *   archive.write(temp, null, null);
+ * }
+ * temp.renameTo(file);
+ * }</pre>
+ */
+public class OutArchive implements Closeable {
+
+  private long nativePtr;
+  @Nullable
+  private InArchive source;
+  private final List<Entry> entries = new ArrayList<>();
+
+  private OutArchive(long nativePtr, @Nullable InArchive source) {
+    this.nativePtr = nativePtr;
+    this.source = source;
+  }
+
+  private void checkClosed() {
+    if (nativePtr == 0) {
+      throw new IllegalStateException("This OutArchive is closed.");
+    }
+  }
+
+  /**
+   * Removes the entry of the source archive, the one at the index.
+   * Replacing an entry is removing it and adding a new one.
+   *
+   * @return {@code false} if the entry isn't in the archive
+   */
+  public boolean removeEntry(int index) {
+    for (int i = 0, n = entries.size(); i < n; i++) {
+      if (entries.get(i).index == index) {
+        entries.remove(i);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /**
+   * Adds a file. It's opened and read natively while writing.
+   */
+  public OutArchive addFile(String path, File file) {
+    Entry entry = new Entry(path, file.length(), file.lastModified(), false);
+    entry.filePath = file.getPath();
+    entries.add(entry);
+    return this;
+  }
+
+  /**
+   * Adds the file of the descriptor, like a document from {@code ContentResolver}.
+   * The descriptor must stay open until the archive is written, it's read from
+   * the start without changing its offset.
+   */
+  public OutArchive addFileDescriptor(String path, ParcelFileDescriptor fd, long modifiedTime) {
+    Entry entry = new Entry(path, -1, modifiedTime, false);
+    entry.fd = fd.getFd();
+    entries.add(entry);
+    return this;
+  }
+
+  /**
+   * Adds the content of the stream. The stream is closed after it's read.
+   *
+   * @param size the size of the content, the encoders use it to plan the blocks
+   * @param modifiedTime in milliseconds, {@code -1} if unknown
+   */
+  public OutArchive addStream(String path, InputStream stream, long size, long modifiedTime) {
+    Entry entry = new Entry(path, size, modifiedTime, false);
+    entry.stream = stream;
+    entries.add(entry);
+    return this;
+  }
+
+  /**
+   * Adds a directory.
+   *
+   * @param modifiedTime in milliseconds, {@code -1} if unknown
+   */
+  public OutArchive addDirectory(String path, long modifiedTime) {
+    entries.add(new Entry(path, 0, modifiedTime, true));
+    return this;
+  }
+
+  /**
+   * Writes the archive to the file, it's overwritten. It must not be the file
+   * of the source archive, the source is read while writing.
+   *
+   * @see #write(SeekableOutputStream, Options, String)
+   */
+  public void write(File file, @Nullable Options options, @Nullable String password) throws ArchiveException {
+    FileSeekableOutputStream stream;
+    try {
+      stream = new FileSeekableOutputStream(file);
+      stream.truncate(0);
+    } catch (IOException e) {
+      throw new ArchiveException("Can't open the file: " + file.getPath(), e);
+    }
+    write(stream, options, password);
+  }
+
+  /**
+   * Compresses the entries and writes the archive to the stream in the calling thread,
+   * the stream is closed at the end. The entries are cleared after it,
+   * the streams of them can't be read again.
+   *
+   * @param password {@code null} for no encryption. Zip entries are encrypted with AES-256,
+   *                 the paths of 7z archives are encrypted too.
+   */
+  public void write(SeekableOutputStream stream, @Nullable Options options, @Nullable String password)
+      throws ArchiveException {
+    checkClosed();
+    if (options == null) {
+      options = new Options();
+    }
+
+    int size = entries.size();
+    int[] indices = new int[size];
+    String[] paths = new String[size];
+    long[] sizes = new long[size];
+    long[] times = new long[size];
+    boolean[] dirs = new boolean[size];
+    String[] filePaths = new String[size];
+    int[] fds = new int[size];
+    InputStream[] streams = new InputStream[size];
+    for (int i = 0; i < size; i++) {
+      Entry entry = entries.get(i);
+      indices[i] = entry.index;
+      paths[i] = entry.path;
+      sizes[i] = entry.size;
+      times[i] = entry.modifiedTime;
+      dirs[i] = entry.isDir;
+      filePaths[i] = entry.filePath;
+      fds[i] = entry.fd;
+      streams[i] = entry.stream;
+    }
+    entries.clear();
+
+    nativeWrite(nativePtr, indices, paths, sizes, times, dirs, filePaths, fds, streams,
+        options.level, options.threadCount, options.method, password, stream);
+  }
+
+  @Override
+  public void close() {
+    if (nativePtr != 0) {
+      nativeClose(nativePtr);
+      nativePtr = 0;
+    }
+    if (source != null) {
+      source.onUpdateClosed();
+      source = null;
+    }
+  }
+
+  /**
+   * Creates an archive of the format, {@code 7z} or {@code zip}.
+   */
+  @NonNull
+  public static OutArchive create(String format) throws ArchiveException {
+    long nativePtr = nativeCreate(format);
+
+    if (nativePtr == 0) {
+      // It should not be 0
+      throw new ArchiveException("a7zip is buggy");
+    }
+
+    return new OutArchive(nativePtr, null);
+  }
+
+  /**
+   * Updates the archive with its own format, it starts with all entries of it.
+   * The source stays open until this is closed. Zip and 7z can be updated.
+   * The kept entries of zip are copied without decompressing them, so are the
+   * solid blocks of 7z which keep all their entries.
+   */
+  @NonNull
+  public static OutArchive update(@NonNull InArchive source) throws ArchiveException {
+    long nativePtr;
+    try {
+      nativePtr = nativeUpdate(source.retainForUpdate());
+    } catch (ArchiveException e) {
+      source.onUpdateClosed();
+      throw e;
+    }
+
+    if (nativePtr == 0) {
+      // It should not be 0
+      source.onUpdateClosed();
+      throw new ArchiveException("a7zip is buggy");
+    }
+
+    OutArchive archive = new OutArchive(nativePtr, source);
+    for (int i = 0, n = source.getNumberOfEntries(); i < n; i++) {
+      archive.entries.add(new Entry(i));
+    }
+    return archive;
+  }
+
+  private static class Entry {
+
+    // The index in the source archive, -1 for a new entry
+    final int index;
+    @Nullable
+    final String path;
+    final long size;
+    final long modifiedTime;
+    final boolean isDir;
+    @Nullable
+    String filePath;
+    int fd = -1;
+    @Nullable
+    InputStream stream;
+
+    Entry(String path, long size, long modifiedTime, boolean isDir) {
+      this.index = -1;
+      this.path = path;
+      this.size = size;
+      this.modifiedTime = modifiedTime;
+      this.isDir = isDir;
+    }
+
+    Entry(int index) {
+      this.index = index;
+      this.path = null;
+      this.size = -1;
+      this.modifiedTime = -1;
+      this.isDir = false;
+    }
+  }
+
+  public static class Options {
+
+    private int level = 5;
+    private int threadCount = 0;
+    @Nullable
+    private String method;
+
+    /**
+     * The compression level, {@code 0} stores the entries and {@code 9} compresses them best.
+     * It's 5 by default.
+     */
+    public Options setLevel(int level) {
+      this.level = Math.min(Math.max(level, 0), 9);
+      return this;
+    }
+
+    /**
+     * The threads of the encoders, {@code 0} for all cores. It's 0 by default.
+     * 7z archives split the LZMA2 stream into blocks for the threads,
+     * zip archives compress the entries in parallel.
+     */
+    public Options setThreadCount(int count) {
+      this.threadCount = Math.max(count, 0);
+      return this;
+    }
+
+    /**
+     * The compression method, like {@code LZMA2}, {@code LZMA}, {@code PPMd} for 7z,
+     * and {@code Deflate}, {@code Deflate64}, {@code BZip2} for zip.
+     * {@code null} for the default, LZMA2 for 7z and Deflate for zip.
+     */
+    public Options setMethod(@Nullable String method) {
+      this.method = method;
+      return this;
+    }
+  }
+
+  private static native long nativeCreate(String format) throws ArchiveException;
+
+  private static native long nativeUpdate(long inArchivePtr) throws ArchiveException;
+
+  private static native void nativeWrite(
+      long nativePtr,
+      int[] indices,
+      String[] paths,
+      long[] sizes,
+      long[] times,
+      boolean[] dirs,
+      String[] filePaths,
+      int[] fds,
+      InputStream[] streams,
+      int level,
+      int threadCount,
+      String method,
+      String password,
+      SeekableOutputStream stream
+  ) throws ArchiveException;
+
+  private static native void nativeClose(long nativePtr);
+}
@@ -0,0 +1,120 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package com.hippo.a7zip;
+
+import android.support.annotation.NonNull;
+import java.io.File;
+import java.io.IOException;
+
+/**
+ * Counters and spans of the hot paths in native code.
+ * They are only compiled in if the native library is built with {@code -DTRACE=ON}.
+ */
+public final class Trace {
+
+  private Trace() {}
+
+  /**
+   * Keep it in sync with TracePoint in Trace.h.
+   */
+  public enum Stage {
+    OPEN_ARCHIVE,
+    OPEN_FORMAT,
+    IN_ARCHIVE_OPEN,
+    EXTRACT_ENTRY,
+    STREAM_READ,
+    STREAM_SEEK,
+    OUTPUT_WRITE,
+  }
+
+  public static final class Counter {
+
+    @NonNull
+    public final Stage stage;
+    public final long calls;
+    public final long bytes;
+    public final long nanos;
+
+    private Counter(@NonNull Stage stage, long calls, long bytes, long nanos) {
+      this.stage = stage;
+      this.calls = calls;
+      this.bytes = bytes;
+      this.nanos = nanos;
+    }
+
+    @Override
+    public String toString() {
+      return stage + "{calls=" + calls + ", bytes=" + bytes + ", nanos=" + nanos + "}";
+    }
+  }
+
+  /**
+   * Returns {@code true} if the tracing is compiled in.
+   */
+  public static boolean isEnabled() {
+    return nativeIsEnabled();
+  }
+
+  /**
+   * Sets whether each span is recorded as an event for {@link #exportChromeTrace(File)}.
+   * Counters are always updated.
+   */
+  public static void setRecording(boolean recording) {
+    nativeSetRecording(recording);
+  }
+
+  /**
+   * Returns the counters of all stages, in the order of {@link Stage}.
+   */
+  @NonNull
+  public static Counter[] snapshot() {
+    Stage[] stages = Stage.values();
+    Counter[] counters = new Counter[stages.length];
+    long[] values = nativeSnapshot();
+    for (int i = 0; i < stages.length; i++) {
+      counters[i] = new Counter(stages[i], values[i * 3], values[i * 3 + 1], values[i * 3 + 2]);
+    }
+    return counters;
+  }
+
+  /**
+   * Clears the counters and the recorded events.
+   */
+  public static void reset() {
+    nativeReset();
+  }
+
+  /**
+   * Writes the recorded events to the file in Chrome trace JSON format,
+   * which can be opened in chrome://tracing or Perfetto UI.
+   *
+   * @throws IllegalStateException if the tracing is not compiled in
+   */
+  public static void exportChromeTrace(@NonNull File file) throws IOException {
+    nativeExportChromeTrace(file.getPath());
+  }
+
+  private static native boolean nativeIsEnabled();
+
+  private static native void nativeSetRecording(boolean recording);
+
+  private static native long[] nativeSnapshot();
+
+  private static native void nativeReset();
+
+  private static native void nativeExportChromeTrace(String path) throws IOException;
+}
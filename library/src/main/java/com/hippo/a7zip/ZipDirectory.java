@@ -0,0 +1,233 @@
+/*
+ * Copyright 2020 Hippo Seven
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package com.hippo.a7zip;
+
+import android.support.annotation.NonNull;
+import android.support.annotation.Nullable;
+import java.io.Closeable;
+import java.io.File;
+import java.io.FileNotFoundException;
+import java.nio.charset.Charset;
+import java.util.Calendar;
+
+/**
+ * The central directory of a zip archive. Opening it scans the directory once
+ * and keeps only where each record is, a record is read and decoded when it's
+ * looked up, so it's cheap for huge archives of which only a few entries are read.
+ *
+ * <p>It's not an {@link InArchive}: the extraction options, limits, caches and
+ * entry streams of an archive apply only to the single-entry archives it opens.
+ * Each entry can be opened as an {@link InArchive} with the entry only.
+ * The opened archives stay valid after this directory is closed.
+ */
+public class ZipDirectory implements Closeable {
+
+  // Keep it in sync with EntryInfo in JavaZipDirectory.cpp
+  private static final int INFO_SIZE = 0;
+  private static final int INFO_PACKED_SIZE = 1;
+  private static final int INFO_CRC = 2;
+  private static final int INFO_METHOD = 3;
+  private static final int INFO_FLAGS = 4;
+  private static final int INFO_DOS_TIME = 5;
+  private static final int INFO_IS_DIR = 6;
+  private static final int INFO_COUNT = 7;
+
+  // The name is in utf-8
+  private static final int FLAG_UTF8 = 0x800;
+
+  private static final Charset UTF_8 = Charset.forName("UTF-8");
+
+  private long nativePtr;
+  @Nullable
+  private Charset charset;
+
+  private ZipDirectory(long nativePtr, @Nullable Charset charset) {
+    this.nativePtr = nativePtr;
+    this.charset = charset;
+  }
+
+  private void checkClosed() {
+    if (nativePtr == 0) {
+      throw new IllegalStateException("This ZipDirectory is closed.");
+    }
+  }
+
+  private long[] getEntryInfo(int index) throws ArchiveException {
+    checkClosed();
+    long[] info = new long[INFO_COUNT];
+    nativeGetEntryInfo(nativePtr, index, info);
+    return info;
+  }
+
+  /**
+   * Returns the number of entries in the directory.
+   */
+  public int getNumberOfEntries() {
+    checkClosed();
+    return nativeGetNumberOfEntries(nativePtr);
+  }
+
+  /**
+   * Returns the path of the entry. It's decoded in utf-8 if the entry says so,
+   * or in the charset of this directory.
+   */
+  @NonNull
+  public String getEntryPath(int index) throws ArchiveException {
+    checkClosed();
+    byte[] name = nativeGetEntryName(nativePtr, index);
+    long[] info = getEntryInfo(index);
+    Charset nameCharset = (info[INFO_FLAGS] & FLAG_UTF8) != 0 || charset == null ? UTF_8 : charset;
+    return new String(name, nameCharset);
+  }
+
+  /**
+   * Returns the uncompressed size of the entry.
+   */
+  public long getEntrySize(int index) throws ArchiveException {
+    return getEntryInfo(index)[INFO_SIZE];
+  }
+
+  /**
+   * Returns the compressed size of the entry.
+   */
+  public long getEntryPackedSize(int index) throws ArchiveException {
+    return getEntryInfo(index)[INFO_PACKED_SIZE];
+  }
+
+  /**
+   * Returns the CRC32 of the uncompressed entry.
+   */
+  public int getEntryCrc(int index) throws ArchiveException {
+    return (int) getEntryInfo(index)[INFO_CRC];
+  }
+
+  /**
+   * Returns the compression method of the entry, like {@code 0} for stored
+   * and {@code 8} for deflated.
+   */
+  public int getEntryMethod(int index) throws ArchiveException {
+    return (int) getEntryInfo(index)[INFO_METHOD];
+  }
+
+  /**
+   * Returns {@code true} if the entry is a directory.
+   */
+  public boolean isEntryDirectory(int index) throws ArchiveException {
+    return getEntryInfo(index)[INFO_IS_DIR] != 0;
+  }
+
+  /**
+   * Returns {@code true} if the entry is encrypted.
+   */
+  public boolean isEntryEncrypted(int index) throws ArchiveException {
+    return (getEntryInfo(index)[INFO_FLAGS] & 1) != 0;
+  }
+
+  /**
+   * Returns the last modified time of the entry in milliseconds, in the local time zone.
+   */
+  public long getEntryTime(int index) throws ArchiveException {
+    long dosTime = getEntryInfo(index)[INFO_DOS_TIME];
+    Calendar calendar = Calendar.getInstance();
+    calendar.clear();
+    calendar.set(
+        (int) ((dosTime >> 25) & 0x7F) + 1980,
+        (int) ((dosTime >> 21) & 0x0F) - 1,
+        (int) ((dosTime >> 16) & 0x1F),
+        (int) ((dosTime >> 11) & 0x1F),
+        (int) ((dosTime >> 5) & 0x3F),
+        (int) ((dosTime << 1) & 0x3E)
+    );
+    return calendar.getTimeInMillis();
+  }
+
+  /**
+   * Opens the entry as an archive with the entry only, its index is {@code 0}.
+   */
+  @NonNull
+  public InArchive openEntry(int index) throws ArchiveException {
+    return openEntry(index, null);
+  }
+
+  /**
+   * Opens the entry as an archive with the entry only, its index is {@code 0}.
+   * The password is for encrypted entries.
+   */
+  @NonNull
+  public InArchive openEntry(int index, @Nullable String password) throws ArchiveException {
+    checkClosed();
+    password = InArchive.applyCharsetToPassword(password, charset);
+    long ptr = nativeOpenEntry(nativePtr, index, password);
+
+    if (ptr == 0) {
+      // It should not be 0
+      throw new ArchiveException("a7zip is buggy");
+    }
+
+    return new InArchive(ptr, charset, password);
+  }
+
+  /**
+   * Closes the directory. The archives opened from it are still valid.
+   */
+  @Override
+  public void close() {
+    if (nativePtr != 0) {
+      nativeClose(nativePtr);
+      nativePtr = 0;
+    }
+  }
+
+  @NonNull
+  public static ZipDirectory open(File file) throws ArchiveException {
+    try {
+      return open(new FileSeekableInputStream(file), null);
+    } catch (FileNotFoundException e) {
+      throw new ArchiveException("Can't open the archive: " + file.getPath(), e);
+    }
+  }
+
+  /**
+   * Reads the central directory of the zip archive from the stream.
+   *
+   * {@code charset} is for the paths without the utf-8 flag and for passwords,
+   * {@code null} for utf-8.
+   */
+  @NonNull
+  public static ZipDirectory open(SeekableInputStream stream, @Nullable Charset charset) throws ArchiveException {
+    long nativePtr = nativeOpen(stream);
+
+    if (nativePtr == 0) {
+      // It should not be 0
+      throw new ArchiveException("a7zip is buggy");
+    }
+
+    return new ZipDirectory(nativePtr, charset);
+  }
+
+  private static native long nativeOpen(SeekableInputStream stream) throws ArchiveException;
+
+  private static native int nativeGetNumberOfEntries(long nativePtr);
+
+  private static native byte[] nativeGetEntryName(long nativePtr, int index) throws ArchiveException;
+
+  private static native void nativeGetEntryInfo(long nativePtr, int index, long[] info) throws ArchiveException;
+
+  private static native long nativeOpenEntry(long nativePtr, int index, @Nullable String password) throws ArchiveException;
+
+  private static native void nativeClose(long nativePtr);
+}